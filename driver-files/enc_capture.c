@@ -0,0 +1,284 @@
+/*
+ * enc_capture.c
+ *
+ *  Frame capture tap, pcap stream
+ */
+
+#include "enc_capture.h"
+#include "registerlib.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <semaphore.h>
+#include <ti/drivers/dpl/HwiP.h>
+
+#define PCAP_MAGIC              0xa1b2c3d4
+#define PCAP_LINKTYPE_ETHERNET  1
+
+/* pcap headers, in host byte order: readers tell it from the magic */
+typedef struct {
+    uint32_t magic;
+    uint16_t versionMajor;
+    uint16_t versionMinor;
+    int32_t  thisZone;
+    uint32_t sigFigs;
+    uint32_t snapLen;
+    uint32_t linkType;
+} pcapHeader_t;
+
+typedef struct {
+    uint32_t tsSec;
+    uint32_t tsUsec;
+    uint32_t inclLen;
+    uint32_t origLen;
+} pcapRecord_t;
+
+static uint8_t *capRing;
+static uint32_t capSize;
+/* Free running offsets, the ring holds capHead - capTail bytes.
+ * capHead moves with interrupts off in the tap, capTail only in the drain */
+static volatile uint32_t capHead;
+static volatile uint32_t capTail;
+static uint16_t capSnaplen;
+static volatile uint8_t capDirections = 0;
+static encCapture_sinkFxn capSink;
+static void *capSinkArg;
+static bool capHeaderSent;
+static sem_t capReady;
+static bool capSemReady = false;
+static encCaptureStats_t capStats;
+
+
+/*! @brief Copy into the ring at a free running offset, wrapping at the end
+ * @param[in] pos          offset
+ * @param[in] src          bytes
+ * @param[in] len          number of bytes
+ */
+static void encCapture_put(uint32_t pos, const uint8_t *src, uint16_t len){
+    uint32_t at = pos & (capSize - 1);
+    uint32_t first = (len < capSize - at) ? len : capSize - at;
+
+    memcpy(capRing + at, src, first);
+    memcpy(capRing, src + first, len - first);
+}
+
+
+/*! @brief Copy out of the ring at a free running offset, wrapping at the end
+ * @param[in] pos          offset
+ * @param[out] dest        bytes
+ * @param[in] len          number of bytes
+ */
+static void encCapture_get(uint32_t pos, uint8_t *dest, uint16_t len){
+    uint32_t at = pos & (capSize - 1);
+    uint32_t first = (len < capSize - at) ? len : capSize - at;
+
+    memcpy(dest, capRing + at, first);
+    memcpy(dest + first, capRing, len - first);
+}
+
+
+/*! @brief function to start capturing. The pcap global header goes out
+ * with the first drain.
+ * @param[in] ring         record ring
+ * @param[in] size         size of ring, a power of two
+ * @param[in] snaplen      bytes kept per frame, 0 for whole frames
+ * @param[in] directions   ENC_CAPTURE_RX and/or ENC_CAPTURE_TX
+ * @param[in] sink         pcap stream sink
+ * @param[in] arg          sink argument
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t encCapture_init(uint8_t *ring, uint32_t size, uint16_t snaplen, uint8_t directions,
+                         encCapture_sinkFxn sink, void *arg){
+    if (snaplen == 0 || snaplen > MAX_MAC_LENGTH)
+        snaplen = MAX_MAC_LENGTH;
+    if (ring == NULL || sink == NULL || (size & (size - 1)) || size < (uint32_t) (ENC_CAPTURE_RECORD_HEADER + snaplen))
+        return ERR_DRIVER_FAIL;
+
+    capDirections = 0;
+    if (!capSemReady){
+        if (sem_init(&capReady, 0, 0) != 0)
+            return ERR_DRIVER_FAIL;
+        capSemReady = true;
+    }
+    while (sem_trywait(&capReady) == 0)
+        ;
+    capRing = ring;
+    capSize = size;
+    capHead = capTail = 0;
+    capSnaplen = snaplen;
+    capSink = sink;
+    capSinkArg = arg;
+    capHeaderSent = false;
+    memset(&capStats, 0, sizeof(capStats));
+    capDirections = directions & (ENC_CAPTURE_RX | ENC_CAPTURE_TX);
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to stop capturing, records in the ring can still be drained
+ */
+void encCapture_stop(void){
+    capDirections = 0;
+}
+
+
+/*! @brief function to check whether a direction is captured, for callers
+ * keeping frame bytes around only to capture them
+ * @param[in] direction    ENC_CAPTURE_RX or ENC_CAPTURE_TX
+ * @return              true while the direction is captured
+ */
+bool encCapture_active(uint8_t direction){
+    return (capDirections & direction) != 0;
+}
+
+
+/*! @brief function to capture a frame given in two parts, from the receive
+ * and transmit paths. The copy is done with interrupts off, it is at most
+ * the snap length plus the record header.
+ * @param[in] direction    ENC_CAPTURE_RX or ENC_CAPTURE_TX
+ * @param[in] head         first part, from the destination address
+ * @param[in] headLen      length of head
+ * @param[in] body         second part, may be NULL if bodyLen is 0
+ * @param[in] bodyLen      length of body
+ * @param[in] origLen      length of the frame on the wire
+ */
+void encCapture_tap(uint8_t direction, const uint8_t *head, uint16_t headLen,
+                    const uint8_t *body, uint16_t bodyLen, uint16_t origLen){
+    pcapRecord_t record;
+    struct timespec ts;
+    uint16_t capLen = headLen + bodyLen;
+    uint16_t first;
+    uint32_t pos;
+    uintptr_t key;
+
+    if (!(capDirections & direction))
+        return;
+    if (capLen > capSnaplen)
+        capLen = capSnaplen;
+    if (origLen < capLen)
+        origLen = capLen;
+    first = (headLen < capLen) ? headLen : capLen;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    record.tsSec = (uint32_t) ts.tv_sec;
+    record.tsUsec = (uint32_t) (ts.tv_nsec / 1000);
+    record.inclLen = capLen;
+    record.origLen = origLen;
+
+    key = HwiP_disable();
+    pos = capHead;
+    if (capSize - (pos - capTail) < (uint32_t) (ENC_CAPTURE_RECORD_HEADER + capLen)){
+        capStats.dropped++;
+        HwiP_restore(key);
+        return;
+    }
+    encCapture_put(pos, (const uint8_t *) &record, ENC_CAPTURE_RECORD_HEADER);
+    encCapture_put(pos + ENC_CAPTURE_RECORD_HEADER, head, first);
+    if (capLen > first)
+        encCapture_put(pos + ENC_CAPTURE_RECORD_HEADER + first, body, capLen - first);
+    capHead = pos + ENC_CAPTURE_RECORD_HEADER + capLen;
+    capStats.captured++;
+    if (capLen < origLen)
+        capStats.truncated++;
+    HwiP_restore(key);
+    sem_post(&capReady);
+}
+
+
+/*! @brief Hand bytes of the ring to the sink, in at most two parts
+ * @param[in] pos          offset
+ * @param[in] len          number of bytes
+ * @return              true on success
+ */
+static bool encCapture_out(uint32_t pos, uint32_t len){
+    uint32_t at = pos & (capSize - 1);
+    uint32_t first = (len < capSize - at) ? len : capSize - at;
+
+    if (capSink(capSinkArg, capRing + at, first) != (int32_t) first)
+        return false;
+    if (len > first && capSink(capSinkArg, capRing, len - first) != (int32_t) (len - first))
+        return false;
+    return true;
+}
+
+
+/*! @brief function to stream the captured records into the sink, from a
+ * low priority task
+ * @param[in] wait         block until a record is captured
+ * @return              bytes handed to the sink, or ERR_DRIVER_FAIL on a sink failure
+ */
+int32_t encCapture_drain(bool wait){
+    pcapHeader_t global;
+    pcapRecord_t record;
+    uint32_t tail = capTail;
+    uint32_t len;
+    int32_t out = 0;
+    bool failed = false;
+
+    if (capSink == NULL)
+        return ERR_DRIVER_FAIL;
+
+    if (!capHeaderSent){
+        global.magic = PCAP_MAGIC;
+        global.versionMajor = 2;
+        global.versionMinor = 4;
+        global.thisZone = 0;
+        global.sigFigs = 0;
+        global.snapLen = capSnaplen;
+        global.linkType = PCAP_LINKTYPE_ETHERNET;
+        if (capSink(capSinkArg, (const uint8_t *) &global, sizeof(global)) != (int32_t) sizeof(global)){
+            capStats.sinkErrors++;
+            return ERR_DRIVER_FAIL;
+        }
+        capHeaderSent = true;
+        capStats.bytesOut += sizeof(global);
+        out += sizeof(global);
+    }
+
+    if (wait && tail == capHead)
+        sem_wait(&capReady);
+    /* Every record behind one post is drained below */
+    while (sem_trywait(&capReady) == 0)
+        ;
+
+    while (tail != capHead){
+        encCapture_get(tail, (uint8_t *) &record, ENC_CAPTURE_RECORD_HEADER);
+        len = ENC_CAPTURE_RECORD_HEADER + record.inclLen;
+        if (encCapture_out(tail, len)){
+            capStats.bytesOut += len;
+            out += len;
+        }
+        else{
+            capStats.sinkErrors++;
+            failed = true;
+        }
+        tail += len;
+        /* The space goes back to the tap once the sink has the record */
+        capTail = tail;
+    }
+    return failed ? ERR_DRIVER_FAIL : out;
+}
+
+
+/*! @brief function to get the capture counters
+ * @param[out] stats       copy of the counters
+ */
+void encCapture_getStats(encCaptureStats_t *stats){
+    if (stats != NULL)
+        *stats = capStats;
+}
+
+
+/*! @brief Sink writing to a stdio stream, a file on the host
+ *  @param[in] arg         FILE pointer
+ *  @param[in] data        bytes of the pcap stream
+ *  @param[in] len         number of bytes
+ *  @return             len on success, -1 on failure
+ */
+int32_t encCapture_fileSink(void *arg, const uint8_t *data, uint16_t len){
+    if (arg == NULL || fwrite(data, 1, len, (FILE *) arg) != len)
+        return -1;
+    return len;
+}
@@ -0,0 +1,105 @@
+/*
+ * enc_capture.h
+ *
+ *  Frame capture tap: the receive and transmit paths copy frames, cut to
+ *  a snap length and timestamped, into a byte ring of pcap records. A low
+ *  priority task drains the ring as a pcap stream into a sink (UART, file).
+ *  The tap never blocks: a record that does not fit is dropped and counted.
+ */
+
+#ifndef ENC_CAPTURE_H_
+#define ENC_CAPTURE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spimaster.h"
+
+/* Directions captured */
+#define ENC_CAPTURE_RX   0x01
+#define ENC_CAPTURE_TX   0x02
+
+/* pcap record header in front of every frame in the ring */
+#define ENC_CAPTURE_RECORD_HEADER   16
+
+/*! @brief Capture sink, called from encCapture_drain
+ *  @param[in] arg         sink argument from encCapture_init
+ *  @param[in] data        bytes of the pcap stream
+ *  @param[in] len         number of bytes
+ *  @return             len on success, negative on failure
+ */
+typedef int32_t (*encCapture_sinkFxn)(void *arg, const uint8_t *data, uint16_t len);
+
+/*! @brief Capture counters */
+typedef struct {
+    uint32_t captured;      /* records put in the ring */
+    uint32_t dropped;       /* records that did not fit */
+    uint32_t truncated;     /* records cut to the snap length */
+    uint32_t bytesOut;      /* bytes handed to the sink, global header included */
+    uint32_t sinkErrors;    /* sink failures, the record is lost */
+} encCaptureStats_t;
+
+
+/*! @brief function to start capturing. The pcap global header goes out
+ * with the first drain.
+ * @param[in] ring         record ring
+ * @param[in] size         size of ring, a power of two
+ * @param[in] snaplen      bytes kept per frame, 0 for whole frames
+ * @param[in] directions   ENC_CAPTURE_RX and/or ENC_CAPTURE_TX
+ * @param[in] sink         pcap stream sink
+ * @param[in] arg          sink argument
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t encCapture_init(uint8_t *ring, uint32_t size, uint16_t snaplen, uint8_t directions,
+                         encCapture_sinkFxn sink, void *arg);
+
+
+/*! @brief function to stop capturing, records in the ring can still be drained
+ */
+void encCapture_stop(void);
+
+
+/*! @brief function to check whether a direction is captured, for callers
+ * keeping frame bytes around only to capture them
+ * @param[in] direction    ENC_CAPTURE_RX or ENC_CAPTURE_TX
+ * @return              true while the direction is captured
+ */
+bool encCapture_active(uint8_t direction);
+
+
+/*! @brief function to capture a frame given in two parts, from the receive
+ * and transmit paths. Returns at once if the direction is not captured.
+ * @param[in] direction    ENC_CAPTURE_RX or ENC_CAPTURE_TX
+ * @param[in] head         first part, from the destination address
+ * @param[in] headLen      length of head
+ * @param[in] body         second part, may be NULL if bodyLen is 0
+ * @param[in] bodyLen      length of body
+ * @param[in] origLen      length of the frame on the wire, more than
+ *                         headLen + bodyLen if only part of it was read
+ */
+void encCapture_tap(uint8_t direction, const uint8_t *head, uint16_t headLen,
+                    const uint8_t *body, uint16_t bodyLen, uint16_t origLen);
+
+
+/*! @brief function to stream the captured records into the sink, from a
+ * low priority task
+ * @param[in] wait         block until a record is captured
+ * @return              bytes handed to the sink, or ERR_DRIVER_FAIL on a sink failure
+ */
+int32_t encCapture_drain(bool wait);
+
+
+/*! @brief function to get the capture counters
+ * @param[out] stats       copy of the counters
+ */
+void encCapture_getStats(encCaptureStats_t *stats);
+
+
+/*! @brief Sink writing to a stdio stream, a file on the host
+ *  @param[in] arg         FILE pointer
+ *  @param[in] data        bytes of the pcap stream
+ *  @param[in] len         number of bytes
+ *  @return             len on success, -1 on failure
+ */
+int32_t encCapture_fileSink(void *arg, const uint8_t *data, uint16_t len);
+
+#endif /* ENC_CAPTURE_H_ */
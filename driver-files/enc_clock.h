@@ -0,0 +1,90 @@
+/*
+ * enc_clock.h
+ *
+ *  Timestamp clock shared by the latency probes (enc_probe.c) and the
+ *  receive timestamps (enc_rxtime.c): the Cortex-M4 DWT cycle counter on
+ *  target. Host builds count nanoseconds of CLOCK_MONOTONIC, or of the
+ *  function named by ENC_CLOCK_SOURCE (e.g. the virtual time of a replay
+ *  harness).
+ */
+
+#ifndef ENC_CLOCK_H_
+#define ENC_CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/* CPU clock in Hz, the rate of the DWT cycle counter */
+#ifndef ENC_CLOCK_CPU_HZ
+#define ENC_CLOCK_CPU_HZ        48000000UL
+#endif
+
+#if defined(__TI_ARM__) || defined(__arm__)
+#define ENC_CLOCK_DWT
+#endif
+
+/* Cortex-M4 data watchpoint and trace unit */
+#define ENC_CLOCK_DEMCR         (*(volatile uint32_t *) 0xE000EDFC)
+#define ENC_CLOCK_DEMCR_TRCENA  (1UL << 24)
+#define ENC_CLOCK_DWT_CTRL      (*(volatile uint32_t *) 0xE0001000)
+#define ENC_CLOCK_DWT_CYCCNTENA 0x00000001
+#define ENC_CLOCK_DWT_CYCCNT    (*(volatile uint32_t *) 0xE0001004)
+
+#if !defined(ENC_CLOCK_DWT) && defined(ENC_CLOCK_SOURCE)
+uint32_t ENC_CLOCK_SOURCE(void);
+#endif
+
+
+/*! @brief Start the clock, the cycle counter keeps running if it already was
+ */
+static inline void encClock_init(void){
+#ifdef ENC_CLOCK_DWT
+    ENC_CLOCK_DEMCR |= ENC_CLOCK_DEMCR_TRCENA;
+    ENC_CLOCK_DWT_CTRL |= ENC_CLOCK_DWT_CYCCNTENA;
+#endif
+}
+
+
+/*! @brief Current timestamp, safe from interrupt context
+ *  @return     CPU cycles on target, nanoseconds on host builds
+ */
+static inline uint32_t encClock_now(void){
+#if defined(ENC_CLOCK_DWT)
+    return ENC_CLOCK_DWT_CYCCNT;
+#elif defined(ENC_CLOCK_SOURCE)
+    return ENC_CLOCK_SOURCE();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ts.tv_sec * 1000000000UL + ts.tv_nsec;
+#endif
+}
+
+
+/*! @brief Convert a timestamp difference to nanoseconds
+ *  @param[in] ticks       difference of two encClock_now() values
+ *  @return     nanoseconds
+ */
+static inline uint32_t encClock_toNs(uint32_t ticks){
+#ifdef ENC_CLOCK_DWT
+    return (uint32_t) ((uint64_t) ticks * 1000000000UL / ENC_CLOCK_CPU_HZ);
+#else
+    return ticks;
+#endif
+}
+
+
+/*! @brief Convert a timestamp difference to microseconds, for spans
+ * longer than the 4.29 s of encClock_toNs (up to the counter wrap)
+ *  @param[in] ticks       difference of two encClock_now() values
+ *  @return     microseconds
+ */
+static inline uint32_t encClock_toUs(uint32_t ticks){
+#ifdef ENC_CLOCK_DWT
+    return ticks / (ENC_CLOCK_CPU_HZ / 1000000UL);
+#else
+    return ticks / 1000;
+#endif
+}
+
+#endif /* ENC_CLOCK_H_ */
@@ -0,0 +1,711 @@
+/*
+ * enc_engine.c
+ *
+ *  Event-driven core of the ENC28J60 driver, one chain of the SPI queue
+ *  in flight at a time. encEngine_run takes the posted events, finishes
+ *  the completed chain and picks the next one by priority:
+ *  ring resynchronization, status, transmit reset, frame payload, transmit
+ *  load, frame header, PHY read, and last INT armed again.
+ */
+
+#include "enc_engine.h"
+#include "registerlib.h"
+#include "enc_rxtime.h"
+#include "enc_probe.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ti/drivers/dpl/HwiP.h>
+
+#define ENG_MAX(a, b)  ((a) > (b) ? (a) : (b))
+
+/* Largest chain: a frame load, a frame read with its release, or an
+ * resynchronization drain batch (ERXRDPT, PKTDEC commands, RXERIF and RXEN) */
+#define ENC_ENGINE_CHAIN_ITEMS \
+    ENG_MAX(ENG_MAX(ETH_TX_LOAD_ITEMS, ENC_RX_READ_INTO_ITEMS + ENC_RX_RELEASE_ITEMS), \
+            2*SPIQ_REG_ITEMS + ENC_ENGINE_PKTDEC_BATCH + 2)
+
+/* PHY registers to read, engPhyWant */
+#define ENG_PHY_IRQ     0x01    /* PHIR, clears EIR.LINKIF */
+#define ENG_PHY_STATUS  0x02    /* PHSTAT2 */
+
+static encEngineConfig_t engConfig;
+static volatile encEngineState_t engState = ENC_ENGINE_STOPPED;
+static volatile uint8_t engEvents;
+static volatile bool engStopping;
+static encEngineStats_t engStats;
+
+static spiQueueItem_t engChain[ENC_ENGINE_CHAIN_ITEMS];
+static volatile bool engChainOK;
+/* Items of the chain in flight holding register reads */
+static uint8_t engReadAt[4];
+/* Chain failed, wait for the next tick or INT before the bus is used again */
+static bool engHold;
+
+/* Timer ticks, and the limits converted from ms */
+static volatile uint32_t engTicks;
+static uint32_t engTxTimeoutTicks;
+static uint32_t engStatusPollTicks;
+static uint32_t engLinkPollTicks;
+static uint32_t engLastStatus;
+static uint32_t engLastLink;
+
+/* Interrupt: INTIE set, and the EIR flags to clear when it is set again */
+static bool engArmed;
+static uint8_t engAck;
+static bool engStatusDue;
+
+/* Receive */
+static uint8_t engRxLeft;              /* frames of the last EPKTCNT not taken yet */
+static bool engRxParsed;               /* header read, payload and release due */
+static bool engRxBuffered;             /* engRxDesc holds a ring buffer */
+static enc_rx_handle_t engRx;
+static frameDesc_t engRxDesc;
+static enc_rx_dest_t engRxDest;        /* engRxDesc buffer as read destination */
+static uint8_t engRxHead[ENC_RX_PREAMBLE_LENGTH + ENC_ENGINE_PEEK];
+
+/* Transmit queue, indices run freely */
+static const uint8_t *engTxPayload[ENC_ENGINE_TX_DEPTH];
+static uint16_t engTxLength[ENC_ENGINE_TX_DEPTH];
+static volatile uint8_t engTxHead;
+static volatile uint8_t engTxTail;
+static bool engTxBusy;                 /* frame at engTxTail in the transmit logic */
+static bool engTxResetDue;
+static bool engTxResend;
+static uint8_t engTxRetries;
+static uint32_t engTxStart;
+
+/* Receive ring resynchronization after a corrupt next packet pointer */
+static bool engRecoverDue;
+static bool engRecoverWaited;          /* RXBUSY seen once, waited a tick */
+static uint32_t engRecoverTick;
+static uint8_t engRecoverLeft;         /* PKTDEC commands still to issue */
+static uint16_t engRecoverRdPtr;
+static bool engRecoverDraining;
+static bool engRecoverPointer;         /* ERXRDPT written */
+
+/* PHY */
+static uint8_t engPhyWant;
+static uint8_t engPhyReg;
+static encEngineState_t engPhyStep;    /* next chain of the read in progress, IDLE if none */
+static bool engLinkUp;
+
+
+/*! @brief Callback of the last item of every chain
+ * @param[in] item         last item
+ * @param[in] transferOK   false if the chain failed
+ */
+static void encEngine_chainDone(spiQueueItem_t *item, bool transferOK){
+    engChainOK = transferOK;
+    encEngine_post(ENC_ENGINE_EV_SPI_DONE);
+}
+
+
+/*! @brief Link and submit engChain. Frame reads go in the bulk class and
+ * give way to time critical chains, PHY reads in the high class.
+ * @param[in] state        state while the chain is in flight
+ * @param[in] used         number of items
+ */
+static void encEngine_submit(encEngineState_t state, uint8_t used){
+    uint8_t priority = SPIQ_PRIO_NORMAL;
+    uint8_t i;
+
+    for (i = 0; i + 1 < used; i++)
+        engChain[i].next = &engChain[i + 1];
+    engChain[used - 1].next = NULL;
+    engChain[used - 1].callback = encEngine_chainDone;
+    engState = state;
+    engStats.chains++;
+    if (state == ENC_ENGINE_RX_PAYLOAD)
+        priority = SPIQ_PRIO_BULK;
+    else if (state == ENC_ENGINE_PHY_START || state == ENC_ENGINE_PHY_WAIT || state == ENC_ENGINE_PHY_READ)
+        priority = SPIQ_PRIO_HIGH;
+    if (spiQueue_submitTo(engChain, SPIQ_DEV_ENC, priority) != ERR_SUCCESS){
+        engChainOK = false;
+        encEngine_post(ENC_ENGINE_EV_SPI_DONE);
+    }
+}
+
+
+/*! @brief Convert ms to timer ticks, rounded up
+ * @param[in] ms           milliseconds, 0 for never
+ * @return              ticks
+ */
+static uint32_t encEngine_ticks(uint16_t ms){
+    return (ms + engConfig.tickMs - 1) / engConfig.tickMs;
+}
+
+
+/*! @brief Finish the frame at the head of the transmit queue
+ * @param[in] sent         true if it was sent
+ */
+static void encEngine_txFinish(bool sent){
+    const uint8_t *payload = engTxPayload[engTxTail % ENC_ENGINE_TX_DEPTH];
+
+    engTxBusy = false;
+    engTxTail++;
+    if (sent)
+        engStats.txFrames++;
+    else
+        engStats.txFailed++;
+    if (engConfig.txDoneFxn != NULL)
+        engConfig.txDoneFxn(payload, sent);
+}
+
+
+/*! @brief Interrupt flags and counters read, decide what comes next */
+static void encEngine_statusDone(void){
+    uint8_t eir = spiQueue_readValue(&engChain[engReadAt[0]]);
+    uint8_t estat = spiQueue_readValue(&engChain[engReadAt[1]]);
+    uint8_t econ1 = spiQueue_readValue(&engChain[engReadAt[2]]);
+    uint8_t pktcnt = spiQueue_readValue(&engChain[engReadAt[3]]);
+    ethernet_txResult_t result;
+
+    engStatusDue = false;
+    engLastStatus = engTicks;
+    /* Only the incoming frame was lost, the frames in the ring are good */
+    if ((eir & EIR_RXERIF) && !(engAck & EIR_RXERIF)){
+        engAck |= EIR_RXERIF;
+        engStats.rxOverflows++;
+    }
+    if (eir & EIR_LINKIF)
+        engPhyWant |= ENG_PHY_IRQ | ENG_PHY_STATUS;
+    if (engTxBusy && !engTxResetDue){
+        result = ethernet_txCheck(econ1, estat, eir,
+                                  engTicks - engTxStart >= engTxTimeoutTicks);
+        if (result == ETH_TX_DONE){
+            engAck |= EIR_TXIF | EIR_TXERIF;
+            encEngine_txFinish(true);
+        } else if (result == ETH_TX_FAILED){
+            engTxResetDue = true;
+            engTxResend = engTxRetries++ < ENC_ENGINE_TX_RETRIES;
+        }
+    }
+    /* A frame half read is finished first, the count includes it */
+    if (!engRecoverDue){
+        /* Nothing left from the last pass: the frames counted now start a
+         * timestamp pass, which also drops the stamp of an INT without frames */
+        if (engRxLeft == 0 && !engRxParsed)
+            encRxTime_passBegin();
+        engRxLeft = engRxParsed && pktcnt > 0 ? pktcnt - 1 : pktcnt;
+    }
+}
+
+
+/*! @brief Build the RX_PAYLOAD chain: the frame straight into a ring
+ * buffer, or only the release when the frame is dropped
+ * @return              number of items
+ */
+static uint8_t encEngine_buildPayload(void){
+    frameRing_t *ring = engConfig.rxRing;
+    uint8_t used = 0;
+
+    engRxBuffered = false;
+    if (!(engRx.rsv & RSV_RECEIVED_OK) || engRx.length > ring->bufSize
+        || !frameRing_alloc(ring, &engRxDesc)){
+        engStats.rxDropped++;
+    } else {
+        engRxBuffered = true;
+        engRxDest.payload = engRxDesc.data;
+        engRxDest.payloadLen = ring->bufSize;
+        used = enc_rx_buildReadInto(engChain, &engRx, &engRxDest);
+    }
+    return used + enc_rx_buildRelease(&engChain[used], &engRx);
+}
+
+
+/*! @brief Build the RECOVER_DRAIN chain: ERXRDPT on the first batch, up to
+ * ENC_ENGINE_PKTDEC_BATCH decrements, RXERIF cleared and RXEN set on the last
+ * @return              number of items
+ */
+static uint8_t encEngine_buildDrain(void){
+    uint8_t used = 0;
+    uint8_t n = engRecoverLeft < ENC_ENGINE_PKTDEC_BATCH ? engRecoverLeft : ENC_ENGINE_PKTDEC_BATCH;
+    uint8_t i;
+
+    if (!engRecoverPointer){
+        used += spiQueue_buildWrite(&engChain[used], ERXRDPTL, engRecoverRdPtr & 0xff);
+        used += spiQueue_buildWrite(&engChain[used], ERXRDPTH, engRecoverRdPtr >> 8);
+    }
+    for (i = 0; i < n; i++)
+        spiQueue_buildBitField(&engChain[used++], ECON2, ECON2_PKTDEC, true);
+    if (n == engRecoverLeft){
+        spiQueue_buildBitField(&engChain[used++], EIR, EIR_RXERIF, false);
+        spiQueue_buildBitField(&engChain[used++], ECON1, ECON1_RXEN, true);
+    }
+    return used;
+}
+
+
+/*! @brief Finish the chain in flight */
+static void encEngine_complete(void){
+    encEngineState_t state = engState;
+    bool ok = engChainOK;
+    uint8_t n;
+
+    engState = ENC_ENGINE_IDLE;
+    if (!ok){
+        engStats.spiFailures++;
+        engHold = true;
+    }
+
+    switch (state){
+    case ENC_ENGINE_STATUS:
+        if (ok)
+            encEngine_statusDone();
+        break;
+
+    case ENC_ENGINE_RX_HEADER:
+        if (!ok)
+            break;
+        if (engRxLeft > 0)
+            engRxLeft--;
+        if (enc_rx_parse(&engRx, engRxHead, ENC_ENGINE_PEEK) == ERR_SUCCESS){
+            engRxParsed = true;
+        } else {
+            engRecoverDue = true;
+            engRecoverWaited = false;
+            engRecoverDraining = false;
+        }
+        break;
+
+    case ENC_ENGINE_RX_PAYLOAD:
+        /* On a failure the frame goes back with length 0 and is read again */
+        if (engRxBuffered){
+            engRxDesc.length = ok ? engRx.length : 0;
+            engRxDesc.rsv = engRx.rsv;
+            engRxDesc.stamp = engRx.stamp;
+            if (ok && engRx.length != 0)
+                enc_rx_tapInto(&engRx, &engRxDest);
+            frameRing_enqueue(engConfig.rxRing, &engRxDesc, 1);
+            engRxBuffered = false;
+            if (ok)
+                engStats.rxFrames++;
+        }
+        engRxParsed = false;
+        if (ok)
+            enc_rx_released(&engRx);
+        else
+            engStatusDue = true;
+        break;
+
+    case ENC_ENGINE_TX_LOAD:
+        if (ok){
+            /* The load cleared TXIF/TXERIF itself, a later ack could hide its completion */
+            engAck &= ~(EIR_TXIF | EIR_TXERIF);
+            engTxBusy = true;
+            engTxRetries = 0;
+            engTxStart = engTicks;
+        } else {
+            ethernet_txDropped();
+            encEngine_txFinish(false);
+        }
+        break;
+
+    case ENC_ENGINE_TX_RESET:
+        if (!ok)
+            break;
+        engTxResetDue = false;
+        engAck &= ~(EIR_TXIF | EIR_TXERIF);
+        ethernet_txResetDone(engTxResend);
+        if (engTxResend){
+            engTxStart = engTicks;
+        } else {
+            ethernet_txDropped();
+            encEngine_txFinish(false);
+        }
+        break;
+
+    case ENC_ENGINE_RECOVER_STOP:
+        if (!ok)
+            break;
+        /* Let a frame being written finish, once */
+        if ((spiQueue_readValue(&engChain[engReadAt[0]]) & ESTAT_RXBUSY) && !engRecoverWaited){
+            engRecoverWaited = true;
+            engRecoverTick = engTicks;
+            break;
+        }
+        n = spiQueue_readValue(&engChain[engReadAt[1]]);
+        engRecoverRdPtr = ethernet_rxResync(spiQueue_readValue(&engChain[engReadAt[2]])
+                                            | spiQueue_readValue(&engChain[engReadAt[3]]) << 8, n);
+        engRecoverLeft = n;
+        engStats.rxDiscarded += n;
+        engRecoverPointer = false;
+        engRecoverDraining = true;
+        /* The frames counted are gone with the resynchronization */
+        engRxLeft = 0;
+        engRxParsed = false;
+        break;
+
+    case ENC_ENGINE_RECOVER_DRAIN:
+        if (!ok){
+            /* Start over, the pointer and counter are read again */
+            engRecoverDraining = false;
+            engRecoverWaited = false;
+            break;
+        }
+        engRecoverPointer = true;
+        n = engRecoverLeft < ENC_ENGINE_PKTDEC_BATCH ? engRecoverLeft : ENC_ENGINE_PKTDEC_BATCH;
+        engRecoverLeft -= n;
+        if (engRecoverLeft == 0){
+            engRecoverDue = false;
+            engRecoverDraining = false;
+            engStats.recoveries++;
+            engStatusDue = true;
+        }
+        break;
+
+    /* A failed PHY chain starts the read over */
+    case ENC_ENGINE_PHY_START:
+        engPhyStep = ok ? ENC_ENGINE_PHY_WAIT : ENC_ENGINE_IDLE;
+        break;
+
+    case ENC_ENGINE_PHY_WAIT:
+        if (!ok)
+            engPhyStep = ENC_ENGINE_IDLE;
+        else if (!(spiQueue_readValue(&engChain[engReadAt[0]]) & MISTAT_BUSY))
+            engPhyStep = ENC_ENGINE_PHY_READ;
+        break;
+
+    case ENC_ENGINE_PHY_READ:
+        engPhyStep = ENC_ENGINE_IDLE;
+        if (ok){
+            uint16_t value = spiQueue_readValue(&engChain[engReadAt[0]])
+                           | spiQueue_readValue(&engChain[engReadAt[1]]) << 8;
+            bool up;
+
+            if (engPhyReg == PHIR){
+                engPhyWant &= ~ENG_PHY_IRQ;
+            } else {
+                engPhyWant &= ~ENG_PHY_STATUS;
+                engLastLink = engTicks;
+                up = (value & PHSTAT2_LSTAT) != 0;
+                if (up != engLinkUp){
+                    engLinkUp = up;
+                    engStats.linkChanges++;
+                    if (engConfig.linkFxn != NULL)
+                        engConfig.linkFxn(up);
+                }
+            }
+        }
+        break;
+
+    case ENC_ENGINE_ARM:
+        if (ok){
+            engArmed = true;
+            engAck = 0;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+/*! @brief Start the next chain, if there is work and the bus may be used */
+static void encEngine_next(void){
+    uint8_t used = 0;
+
+    if (engHold)
+        return;
+
+    if (engRecoverDue){
+        if (!engRecoverDraining){
+            if (engRecoverWaited && engRecoverTick == engTicks)
+                return;
+            spiQueue_buildBitField(&engChain[used++], ECON1, ECON1_RXEN, false);
+            engReadAt[0] = used;
+            used += spiQueue_buildRead(&engChain[used], ESTAT, false);
+            engReadAt[1] = used;
+            used += spiQueue_buildRead(&engChain[used], EPKTCNT, false);
+            engReadAt[2] = used;
+            used += spiQueue_buildRead(&engChain[used], ERXWRPTL, false);
+            engReadAt[3] = used;
+            used += spiQueue_buildRead(&engChain[used], ERXWRPTH, false);
+            encEngine_submit(ENC_ENGINE_RECOVER_STOP, used);
+        } else {
+            encEngine_submit(ENC_ENGINE_RECOVER_DRAIN, encEngine_buildDrain());
+        }
+        return;
+    }
+
+    /* A PHY read in progress is finished before the MII registers are used again */
+    if (engPhyStep != ENC_ENGINE_IDLE){
+        engReadAt[0] = used;
+        if (engPhyStep == ENC_ENGINE_PHY_WAIT){
+            used += spiQueue_buildRead(&engChain[used], MISTAT, true);
+        } else {
+            used += spiQueue_buildWrite(&engChain[used], MICMD, 0);
+            engReadAt[0] = used;
+            used += spiQueue_buildRead(&engChain[used], MIRDL, true);
+            engReadAt[1] = used;
+            used += spiQueue_buildRead(&engChain[used], MIRDH, true);
+        }
+        encEngine_submit(engPhyStep, used);
+        return;
+    }
+
+    if (engStatusDue){
+        /* INT off while the flags are worked off, the ARM chain sets it again */
+        if (engArmed){
+            spiQueue_buildBitField(&engChain[used++], EIE, EIE_INTIE, false);
+            engArmed = false;
+        }
+        engReadAt[0] = used;
+        used += spiQueue_buildRead(&engChain[used], EIR, false);
+        engReadAt[1] = used;
+        used += spiQueue_buildRead(&engChain[used], ESTAT, false);
+        engReadAt[2] = used;
+        used += spiQueue_buildRead(&engChain[used], ECON1, false);
+        engReadAt[3] = used;
+        used += spiQueue_buildRead(&engChain[used], EPKTCNT, false);
+        encEngine_submit(ENC_ENGINE_STATUS, used);
+        return;
+    }
+
+    if (engTxResetDue){
+        encEngine_submit(ENC_ENGINE_TX_RESET, ethernet_txBuildReset(engChain, engTxResend));
+        return;
+    }
+
+    if (engRxParsed){
+        encEngine_submit(ENC_ENGINE_RX_PAYLOAD, encEngine_buildPayload());
+        return;
+    }
+
+    /* One transmit load between two received frames */
+    if (!engTxBusy && engTxHead != engTxTail && !engStopping){
+        uint8_t at = engTxTail % ENC_ENGINE_TX_DEPTH;
+
+        encEngine_submit(ENC_ENGINE_TX_LOAD,
+                         ethernet_txBuildLoad(engChain, engTxPayload[at], engTxLength[at]));
+        return;
+    }
+
+    if (engRxLeft > 0){
+        encEngine_submit(ENC_ENGINE_RX_HEADER,
+                         enc_rx_buildPeek(engChain, &engRx, engRxHead, ENC_ENGINE_PEEK));
+        return;
+    }
+
+    if (engPhyWant){
+        engPhyReg = (engPhyWant & ENG_PHY_IRQ) ? PHIR : PHSTAT2;
+        used += spiQueue_buildWrite(&engChain[used], MIREGADR, engPhyReg);
+        used += spiQueue_buildWrite(&engChain[used], MICMD, MICMD_MIIRD);
+        encEngine_submit(ENC_ENGINE_PHY_START, used);
+        return;
+    }
+
+    /* Nothing left: acknowledge and enable INT, a flag still set makes a new edge */
+    if (!engArmed){
+        if (engAck)
+            spiQueue_buildBitField(&engChain[used++], EIR, engAck, false);
+        spiQueue_buildBitField(&engChain[used++], EIE, EIE_INTIE, true);
+        encEngine_submit(ENC_ENGINE_ARM, used);
+    }
+}
+
+
+/*! @brief function to start the engine, after ethernet_Init and
+ * spiQueue_init. The interrupt sources of the chip (PKTIE, TXIE, TXERIE,
+ * RXERIE, LINKIE and the PHY link interrupt) are enabled with blocking
+ * calls, everything afterwards happens in encEngine_run.
+ * @param[in] config       configuration, copied
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t encEngine_start(const encEngineConfig_t *config){
+    if (config == NULL || config->rxRing == NULL || config->tickMs == 0 || config->txTimeoutMs == 0
+        || engState != ENC_ENGINE_STOPPED)
+        return ERR_DRIVER_FAIL;
+
+    engConfig = *config;
+    memset(&engStats, 0, sizeof(engStats));
+    engTicks = 0;
+    engTxTimeoutTicks = encEngine_ticks(engConfig.txTimeoutMs);
+    engStatusPollTicks = encEngine_ticks(engConfig.statusPollMs);
+    engLinkPollTicks = encEngine_ticks(engConfig.linkPollMs);
+    engLastStatus = engLastLink = 0;
+    engEvents = 0;
+    engStopping = false;
+    engHold = false;
+    engAck = 0;
+    engRxLeft = 0;
+    engRxParsed = engRxBuffered = false;
+    engTxHead = engTxTail = 0;
+    engTxBusy = engTxResetDue = false;
+    engRecoverDue = engRecoverDraining = false;
+    engPhyStep = ENC_ENGINE_IDLE;
+    engLinkUp = false;
+
+    /* PHY link interrupt, PHIR read to clear a pending one */
+    if (spi_writePHYReg(PHIE, 0, PHIE_PGEIE | PHIE_PLNKIE) != ERR_SUCCESS)
+        return ERR_DRIVER_FAIL;
+    spi_readPHYReg(PHIR);
+    /* INT stays off until the first ARM chain, after the first status read */
+    if (ENC_BFC(EIE, EIE_INTIE) != ERR_SUCCESS)
+        return ERR_DRIVER_FAIL;
+    if (ENC_BFS(EIE, EIE_PKTIE | EIE_LINKIE | EIE_TXIE | EIE_TXERIE | EIE_RXERIE) != ERR_SUCCESS)
+        return ERR_DRIVER_FAIL;
+    engArmed = false;
+    engStatusDue = true;
+    engPhyWant = ENG_PHY_STATUS;
+
+    engState = ENC_ENGINE_IDLE;
+    encEngine_post(ENC_ENGINE_EV_REQUEST);
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to stop the engine once the chain in flight completed,
+ * frames still queued are finished as not sent
+ */
+void encEngine_stop(void){
+    engStopping = true;
+    encEngine_post(ENC_ENGINE_EV_REQUEST);
+}
+
+
+/*! @brief function to post events, ISR safe
+ * @param[in] events       ENC_ENGINE_EV_* bits
+ */
+void encEngine_post(uint8_t events){
+    uintptr_t key;
+
+    key = HwiP_disable();
+    engEvents |= events;
+    HwiP_restore(key);
+    if (engConfig.notifyFxn != NULL)
+        engConfig.notifyFxn(engConfig.notifyArg);
+}
+
+
+/*! @brief GPIO callback of the INT line, marks the ISR entry probe,
+ * latches the receive timestamp and posts ENC_ENGINE_EV_INT
+ * @param[in] index        GPIO index
+ */
+void encEngine_intIsr(uint_least8_t index){
+    ENC_PROBE(ENC_PROBE_ISR_ENTRY);
+    encRxTime_intMark();
+    encEngine_post(ENC_ENGINE_EV_INT);
+}
+
+
+/*! @brief function to call every tickMs, ISR safe, posts ENC_ENGINE_EV_TIMER */
+void encEngine_timer(void){
+    encEngine_post(ENC_ENGINE_EV_TIMER);
+}
+
+
+/*! @brief function to queue a frame for transmission, any context.
+ * The payload stays owned by the engine until txDoneFxn reports it.
+ * @param[in] payload      frame from the destination address, without CRC
+ * @param[in] len          frame length
+ *  @return     ERR_SUCCESS if queued, ERR_DRIVER_FAIL if the queue is full or stopped
+ */
+spierr_t encEngine_send(const uint8_t *payload, uint16_t len){
+    uintptr_t key;
+    uint8_t at;
+
+    if (payload == NULL || len == 0 || len > MAX_MAC_LENGTH)
+        return ERR_DRIVER_FAIL;
+
+    key = HwiP_disable();
+    if (engState == ENC_ENGINE_STOPPED || engStopping
+        || (uint8_t) (engTxHead - engTxTail) == ENC_ENGINE_TX_DEPTH){
+        if (engState != ENC_ENGINE_STOPPED)
+            engStats.txQueueFull++;
+        HwiP_restore(key);
+        return ERR_DRIVER_FAIL;
+    }
+    at = engTxHead % ENC_ENGINE_TX_DEPTH;
+    engTxPayload[at] = payload;
+    engTxLength[at] = len;
+    engTxHead++;
+    HwiP_restore(key);
+
+    encEngine_post(ENC_ENGINE_EV_REQUEST);
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to process the posted events and start the next chain,
+ * from the single context driving the engine. Never blocks.
+ * @return              true if events are pending, call again
+ */
+bool encEngine_run(void){
+    uintptr_t key;
+    uint8_t events;
+
+    key = HwiP_disable();
+    events = engEvents;
+    engEvents = 0;
+    HwiP_restore(key);
+
+    if (engState == ENC_ENGINE_STOPPED || events == 0)
+        return false;
+    engStats.runs++;
+
+    if (events & ENC_ENGINE_EV_TIMER){
+        engTicks++;
+        engHold = false;
+        if (engTxBusy && engTicks - engTxStart >= engTxTimeoutTicks)
+            engStatusDue = true;
+        if (engStatusPollTicks && engTicks - engLastStatus >= engStatusPollTicks)
+            engStatusDue = true;
+        if (engLinkPollTicks && engTicks - engLastLink >= engLinkPollTicks){
+            engPhyWant |= ENG_PHY_STATUS;
+            engLastLink = engTicks;
+        }
+    }
+    if (events & ENC_ENGINE_EV_INT){
+        engStats.interrupts++;
+        engHold = false;
+        engStatusDue = true;
+    }
+    if ((events & ENC_ENGINE_EV_SPI_DONE) && engState != ENC_ENGINE_IDLE)
+        encEngine_complete();
+
+    if (engState == ENC_ENGINE_IDLE){
+        if (engStopping){
+            while (engTxHead != engTxTail)
+                encEngine_txFinish(false);
+            engState = ENC_ENGINE_STOPPED;
+            return false;
+        }
+        encEngine_next();
+    }
+    return engEvents != 0;
+}
+
+
+/*! @brief function to check for posted events, e.g. before sleeping in a superloop
+ * @return              true if encEngine_run has work
+ */
+bool encEngine_pending(void){
+    return engEvents != 0;
+}
+
+
+/*! @brief function to get the state of the engine
+ * @return              chain in flight, ENC_ENGINE_IDLE or ENC_ENGINE_STOPPED
+ */
+encEngineState_t encEngine_getState(void){
+    return engState;
+}
+
+
+/*! @brief function to get the link state last read from PHSTAT2
+ * @return              true if the link is up
+ */
+bool encEngine_linkUp(void){
+    return engLinkUp;
+}
+
+
+/*! @brief function to get the engine counters
+ * @param[out] stats       copy of the counters
+ */
+void encEngine_getStats(encEngineStats_t *stats){
+    *stats = engStats;
+}
@@ -0,0 +1,171 @@
+/*
+ * enc_engine.h
+ *
+ *  Event-driven core of the ENC28J60 driver: receive, transmit, link and
+ *  receive ring resynchronization as one state machine that never blocks.
+ *  Work is started by events (INT edge, SPI chain completed, timer tick,
+ *  application request) and carried out as chains of the SPI queue, so
+ *  the whole driver runs from a single task or a bare-metal superloop:
+ *
+ *      GPIO callback        -> encEngine_intIsr
+ *      periodic timer       -> encEngine_timer
+ *      task / superloop     -> while (encEngine_run()) ;  then sleep
+ *
+ *  The engine owns the receive ring, the transmit buffer and the
+ *  interrupt enables of the chip while it runs: the blocking receive and
+ *  transmit calls of enc_ethernet.h, the ARP responder and power save
+ *  must not be used between encEngine_start and encEngine_stop.
+ */
+
+#ifndef ENC_ENGINE_H_
+#define ENC_ENGINE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "enc_ethernet.h"
+#include "enc_framering.h"
+
+/* Events, posted from any context */
+#define ENC_ENGINE_EV_INT       0x01    /* falling edge of INT */
+#define ENC_ENGINE_EV_SPI_DONE  0x02    /* chain of the engine completed */
+#define ENC_ENGINE_EV_TIMER     0x04    /* tick of encEngine_timer */
+#define ENC_ENGINE_EV_REQUEST   0x08    /* frame queued, start or stop */
+
+/* Frames of encEngine_send waiting or in the transmit logic, a power of two */
+#define ENC_ENGINE_TX_DEPTH     4
+/* Retries of a frame after an abort, late collision or stall */
+#define ENC_ENGINE_TX_RETRIES   3
+/* Frame bytes read with the receive status vector, 0 reads frames
+ * straight into the ring buffers */
+#define ENC_ENGINE_PEEK         0
+/* ECON2.PKTDEC commands per chain when resynchronizing the receive ring */
+#define ENC_ENGINE_PKTDEC_BATCH 8
+
+/*! @brief States, the chain in flight or ENC_ENGINE_IDLE */
+typedef enum {
+    ENC_ENGINE_STOPPED = 0,
+    ENC_ENGINE_IDLE,            /* no chain in flight */
+    ENC_ENGINE_STATUS,          /* EIR, ESTAT, ECON1, EPKTCNT */
+    ENC_ENGINE_RX_HEADER,       /* next packet pointer, status vector, header */
+    ENC_ENGINE_RX_PAYLOAD,      /* rest of the frame and release */
+    ENC_ENGINE_TX_LOAD,         /* frame written, TXRTS set */
+    ENC_ENGINE_TX_RESET,        /* TXRST after an error, optional resend */
+    ENC_ENGINE_RECOVER_STOP,    /* RXEN cleared, write pointer read */
+    ENC_ENGINE_RECOVER_DRAIN,   /* ERXRDPT moved, EPKTCNT decremented to 0 */
+    ENC_ENGINE_PHY_START,       /* MIREGADR and MICMD.MIIRD written */
+    ENC_ENGINE_PHY_WAIT,        /* MISTAT.BUSY polled */
+    ENC_ENGINE_PHY_READ,        /* MIRDL/MIRDH read */
+    ENC_ENGINE_ARM              /* EIR acknowledged, EIE.INTIE set */
+} encEngineState_t;
+
+/*! @brief Called when events were posted, wakes the context running encEngine_run */
+typedef void (*encEngine_notifyFxn)(void *arg);
+/*! @brief Called from encEngine_run when a frame of encEngine_send is finished */
+typedef void (*encEngine_txDoneFxn)(const uint8_t *payload, bool sent);
+/*! @brief Called from encEngine_run when the link changed */
+typedef void (*encEngine_linkFxn)(bool up);
+
+/*! @brief Configuration of encEngine_start */
+typedef struct {
+    frameRing_t          *rxRing;       /* received frames, filled by the engine */
+    uint16_t              tickMs;       /* period of encEngine_timer, not 0 */
+    uint16_t              txTimeoutMs;  /* TXRTS still set after this is a stall, not 0 */
+    uint16_t              statusPollMs; /* status read without an INT edge, 0 for INT only */
+    uint16_t              linkPollMs;   /* PHSTAT2 read without an INT edge, 0 for INT only */
+    encEngine_notifyFxn   notifyFxn;    /* may be NULL, e.g. in a superloop */
+    void                 *notifyArg;
+    encEngine_txDoneFxn   txDoneFxn;    /* may be NULL */
+    encEngine_linkFxn     linkFxn;      /* may be NULL */
+} encEngineConfig_t;
+
+/*! @brief Engine counters */
+typedef struct {
+    uint32_t runs;          /* encEngine_run calls with events */
+    uint32_t interrupts;    /* INT edges */
+    uint32_t chains;        /* chains submitted */
+    uint32_t spiFailures;   /* chains failed or refused by the queue */
+    uint32_t rxFrames;      /* frames queued to the ring */
+    uint32_t rxDropped;     /* frames released without a buffer, too long or with errors */
+    uint32_t txFrames;      /* frames of encEngine_send sent */
+    uint32_t txFailed;      /* frames given up */
+    uint32_t txQueueFull;   /* encEngine_send refused */
+    uint32_t rxOverflows;   /* EIR.RXERIF seen, the incoming frame was lost, the ring kept */
+    uint32_t recoveries;    /* ring resynchronizations after a corrupt next packet pointer */
+    uint32_t rxDiscarded;   /* frames flushed from the ring by the resynchronizations */
+    uint32_t linkChanges;   /* PHSTAT2.LSTAT changes */
+} encEngineStats_t;
+
+
+/*! @brief function to start the engine, after ethernet_Init and
+ * spiQueue_init. The interrupt sources of the chip (PKTIE, TXIE, TXERIE,
+ * RXERIE, LINKIE and the PHY link interrupt) are enabled with blocking
+ * calls, everything afterwards happens in encEngine_run.
+ * @param[in] config       configuration, copied
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t encEngine_start(const encEngineConfig_t *config);
+
+
+/*! @brief function to stop the engine once the chain in flight completed,
+ * frames still queued are finished as not sent
+ */
+void encEngine_stop(void);
+
+
+/*! @brief function to post events, ISR safe
+ * @param[in] events       ENC_ENGINE_EV_* bits
+ */
+void encEngine_post(uint8_t events);
+
+
+/*! @brief GPIO callback of the INT line, marks the ISR entry probe,
+ * latches the receive timestamp and posts ENC_ENGINE_EV_INT
+ * @param[in] index        GPIO index
+ */
+void encEngine_intIsr(uint_least8_t index);
+
+
+/*! @brief function to call every tickMs, ISR safe, posts ENC_ENGINE_EV_TIMER */
+void encEngine_timer(void);
+
+
+/*! @brief function to queue a frame for transmission, any context.
+ * The payload stays owned by the engine until txDoneFxn reports it.
+ * @param[in] payload      frame from the destination address, without CRC
+ * @param[in] len          frame length
+ *  @return     ERR_SUCCESS if queued, ERR_DRIVER_FAIL if the queue is full or stopped
+ */
+spierr_t encEngine_send(const uint8_t *payload, uint16_t len);
+
+
+/*! @brief function to process the posted events and start the next chain,
+ * from the single context driving the engine. Never blocks.
+ * @return              true if events are pending, call again
+ */
+bool encEngine_run(void);
+
+
+/*! @brief function to check for posted events, e.g. before sleeping in a superloop
+ * @return              true if encEngine_run has work
+ */
+bool encEngine_pending(void);
+
+
+/*! @brief function to get the state of the engine
+ * @return              chain in flight, ENC_ENGINE_IDLE or ENC_ENGINE_STOPPED
+ */
+encEngineState_t encEngine_getState(void);
+
+
+/*! @brief function to get the link state last read from PHSTAT2
+ * @return              true if the link is up
+ */
+bool encEngine_linkUp(void);
+
+
+/*! @brief function to get the engine counters
+ * @param[out] stats       copy of the counters
+ */
+void encEngine_getStats(encEngineStats_t *stats);
+
+#endif /* ENC_ENGINE_H_ */
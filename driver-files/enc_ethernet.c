@@ -9,10 +9,16 @@
 #include "enc_ethernet.h"
 #include "registerlib.h"
 #include "spimaster.h"
+#include "enc_regprog.h"
+#include "enc_probe.h"
+#include "enc_capture.h"
+#include "enc_rxtime.h"
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
 #include <ti/display/Display.h>
 
 extern Display_Handle display;
@@ -27,8 +33,50 @@ static uint8_t mymac[] = { 0x74,0x69,0x69,0x2D,0x30,0x31};
 
 static uint16_t numPackets = 0;
 static uint16_t gnextPacketPtr;
+/* Last value written to ERXRDPT, the host moves it */
+static uint16_t rxRdPtShadow;
 uint16_t nextpktptr;
 uint32_t status;
+
+/* Bring-up timing, microseconds since ethernet_Init() was entered */
+static uint32_t bringupStartUs;
+static uint32_t bringupInitUs;
+static uint32_t bringupLinkUpUs;
+
+/* Frame handed to the transmit logic and not checked yet */
+static volatile bool txPending = false;
+static uint16_t txEndAddr;
+static uint16_t txLength;
+static ethernet_txStats_t txStats;
+/* ETXST/ETXND as last programmed, the stream skips rewriting them */
+static uint16_t txProgStart = 0xffff;
+static uint16_t txProgEnd = 0xffff;
+static ethernet_rxStats_t rxStats;
+/* Peeked bytes of the frame at rxCapStart, captured when it is released
+ * unless the whole frame was read meanwhile */
+static uint8_t rxCapPeek[ENC_RX_PEEK_MAX];
+static uint16_t rxCapPeekLen;
+static uint16_t rxCapStart;
+static bool rxCapPending = false;
+
+/* Power-save idle manager, times in microseconds of ethernet_nowUs() */
+static bool pwrAsleep = false;
+static bool pwrRxWasOn;
+static uint32_t pwrQuietMs = 0;
+static uint32_t pwrPollMs = 0;
+static uint32_t pwrLastActivityUs;
+static uint32_t pwrSleepStartUs;
+static ethernet_pwrStats_t pwrStats;
+
+/* Receive filters used while the host is awake, ERXFCON is replaced by the sleep profile */
+static uint8_t rxFilter;
+static bool rxSleepFilter = false;
+
+/* ARP responder */
+static uint32_t arpAddresses[ETH_ARP_MAX_ADDRESSES];
+static uint8_t arpAddressCount = 0;
+static ethernet_arpStats_t arpStats;
+
 /* ======== Ethernet Defines =======
  *
  * ===================================
@@ -38,6 +86,94 @@ uint32_t status;
 #define RXSTOP_INIT  0x0BFF
 #define TXSTART_INIT 0x0C00
 #define TXSTOP_INIT  0x11FF
+/* Isochronous stream frame, header template written once */
+#define STREAM_TXSTART 0x1200
+#define STREAM_TXSTOP  0x17FF
+/* ARP reply template of the ARP responder */
+#define ARP_TXSTART    0x1800
+#define SRAM_END       0x1FFF
+
+/* Errata: CLKRDY is not cleared by the SPI reset, wait at least 1 ms before trusting it */
+#define RESET_DELAY_US      1000
+#define CLKRDY_TIMEOUT_US   10000
+#define LINK_POLL_US        1000
+
+/* Transmit completion: longest wait for TXRTS to clear and resend budget */
+#define TX_TIMEOUT_US       20000
+#define TX_MAX_RETRIES      3
+/* Transmit status vector, written behind ETXND */
+#define TSV_LENGTH          7
+#define TSV3_LATECOL        0x20
+
+/* Receive overflow recovery: PKTDEC items per chain, RXBUSY wait */
+#define RX_PKTDEC_BATCH     16
+#define RX_IDLE_TIMEOUT_US  2000
+
+/* Receive filters after ethernet_Init: unicast to us and broadcast */
+#define RX_FILTER_DEFAULT   (ERXFCON_UCEN | ERXFCON_BCEN)
+/* Pattern match window */
+#define PATTERN_WINDOW      64
+
+/* Next packet pointer and receive status vector in front of each frame */
+#define RX_PREAMBLE_LENGTH  ENC_RX_PREAMBLE_LENGTH
+#define RX_CRC_LENGTH       4
+/* Frames handed to a frame ring per enqueue */
+#define RX_RING_BATCH       8
+/* Frame bytes peeked for the ARP responder before a frame is read whole,
+ * up to the EtherType; nothing is peeked without responder addresses */
+#define RX_ARP_PEEK         14
+/* Snapshots of ERXWRPT and EPKTCNT tried before giving up */
+#define RX_OCCUPANCY_TRIES  4
+
+/* Buffer memory fill: a WBM per chain with the block repeated by the
+ * data items, MEMFILL_DATA_ITEMS * MEMFILL_BLOCK bytes per chip select */
+#define MEMFILL_BLOCK       256
+#define MEMFILL_DATA_ITEMS  8
+#define MEMFILL_CHAIN_ITEMS (SPIQ_BUFFER_ITEMS + MEMFILL_DATA_ITEMS - 1)
+
+
+/* ======== Register programs =======
+ *
+ * ===================================
+ */
+
+/* Receive buffer, transmit buffer and receive filters */
+static const regOp_t ethConfigProgram[] = {
+    /* All memory between and including ERXST and ERXND is dedicated to the receive hardware.
+     * ERXST should be even, 0x0000 */
+    REGOP_WRITE16(ERXSTL, ERXSTH, RXSTART_INIT),
+    REGOP_WRITE16(ERXNDL, ERXNDH, RXSTOP_INIT),
+    /* ERXRDPT must be odd (errata), RXSTOP_INIT frees the whole ring */
+    REGOP_WRITE16(ERXRDPTL, ERXRDPTH, RXSTOP_INIT),
+    REGOP_WRITE16(ETXSTL, ETXSTH, TXSTART_INIT),
+    REGOP_WRITE16(ETXNDL, ETXNDH, TXSTOP_INIT),
+    REGOP_WRITE16(EWRPTL, EWRPTH, TXSTART_INIT),
+    /* Receive filters - bank 1, 0x18
+     * UCEN : 1 (UNICAST) , ANDOR: 0 (OR), CRCEN: 0, PMEN: 0, MPEN: 0, HTEN: 0, MCEN: 0, BCEN: 1
+     * 0b1000 0001: 0x81 */
+    REGOP_WRITE(ERXFCON, RX_FILTER_DEFAULT),
+};
+
+/* MAC registers, the MAC/MII registers partially written are read-modify-write */
+static const regOp_t macConfigProgram[] = {
+    /* 1. Set MARXEN to enable MAC to receive frames, also set RXPAUS and TXPAUS. Keep PASSALL and LOOPBK */
+    REGOP_FIELD(MACON1, MACON1_TXPAUS | MACON1_RXPAUS | MACON1_MARXEN, 0xed),
+    /* 2. Pad atleast 60 bytes and add a CRC, regardless of the PDCFG bits, and full-duplex.
+     * Keep PHDREN, HFRMEN and FRMLNEN */
+    REGOP_FIELD(MACON3, 0x31, 0xf1),
+    /* 3. Set the DEFER bit to conform to IEEE 802.3 standard */
+    REGOP_SET(MACON4, 0x40),
+    /* 4. Maximum frame length permitted to be received or transmitted */
+    REGOP_WRITE16(MAMXFLL, MAMXFLH, MAX_MAC_LENGTH),
+    /* 5. Back-To-Back Inter-Packet Gap, 0x15 for Full-Duplex mode */
+    REGOP_WRITE(MABBIPG, 0x15),
+    /* 6. Non-Back-To-Back Inter-Packet Gap low byte, most apps will configure as 0x12.
+     * MAIPGH is only needed for half-duplex */
+    REGOP_WRITE(MAIPGL, 0x12),
+};
+
+/* Local MAC address registers, in the order of mymac */
+static const uint8_t maadrRegs[6] = { MAADR1, MAADR2, MAADR3, MAADR4, MAADR5, MAADR6 };
 
 
 /* ======== Ethernet Functions =======
@@ -47,79 +183,44 @@ uint32_t status;
 
 
 
+/*! @brief Monotonic time for the bring-up measurements
+ *  @return     microseconds, wraps after ~71 minutes
+ */
+static uint32_t ethernet_nowUs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
 /*! @brief function to configure Ethernet on the ENC28J60
  *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
  */
 spierr_t ethernetConfig(void){
+    uint32_t start;
+
     /* Soft Reset before starting anything */
     if (systemSoftReset() != ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
-    sleep(2);
-    while(!(spi_read(ESTAT) & 0x01));
-
-    /* Initialize the receive buffer by programming ERXST and ERXND pointers */
-    /* All memory between and including the two addresses will be dedicated to receive hardware */
-    /* Let's configure it for now to allocate half the memory to the transmit buffer and half to the receive buffer */
-    /* Recommended to program ERXST pointer with an even address so I'll give it 0x1002*/
-
-    /* 0x1FFF is the address space available : 0 - 0x1000 for Transmit buffer, and 0x1001 - 0x1fff for receive buffer */
-    /* Write to ERXSTH (bank 0, 0x9 :   and to ERXSTL bank0, 0x8:     - lower bound i.e. 0x1001 */
-    if(spi_write(ERXSTL,(RXSTART_INIT+1) & 0x00ff) != ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-    if(spi_write(ERXSTH,((RXSTART_INIT+1) & 0xff00)>>8) != ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
 
-    /* Write to ERXNDH bank 0 0x0b    and ERXNDL bank0 0x0a   registers the value 0x1fff */
-    if(spi_write(ERXNDL,RXSTOP_INIT & 0x00ff)!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-    if(spi_write(ERXNDH,(RXSTOP_INIT & 0xff00)>>8)!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-
-    /* Program the ERXRDPT to the same value as ERXST. */
-    /* First write to ERXRDPTL bank 0 0xc, then ERXRDPTH bank 0 0xd*/
-    /* ERXRDPTL */
-    if(spi_write(ERXRDPTL, (RXSTART_INIT+1) & 0x00ff)!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
+    /* Minimum post-reset delay, then poll CLKRDY for a bounded time */
+    usleep(RESET_DELAY_US);
+    start = ethernet_nowUs();
+    while(!(ENC_READ(ESTAT) & ESTAT_CLKRDY)){
+	if (ethernet_nowUs() - start > CLKRDY_TIMEOUT_US){
+	    Display_printf(display, 0, 0, "ENC28J60 clock not ready after reset\n");
+	    return ERR_DRIVER_FAIL;
+	}
+    }
 
-    /* ERXRDPTH */
-    if(spi_write(ERXRDPTH, ((RXSTART_INIT+1) & 0xff00)>>8)!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-
-    /* ETXST */
-    if(spi_write(ETXSTL,TXSTART_INIT & 0x00ff) != ERR_SUCCESS)
-        return ERR_DRIVER_FAIL;
-    if(spi_write(ETXSTH,(TXSTART_INIT & 0xff00)>>8) != ERR_SUCCESS)
-        return ERR_DRIVER_FAIL;
-
-    /* ETXND */
-    if(spi_write(ETXNDL,TXSTOP_INIT & 0x00ff) != ERR_SUCCESS)
-        return ERR_DRIVER_FAIL;
-    if(spi_write(ETXNDH,(TXSTOP_INIT & 0xff00)>>8) != ERR_SUCCESS)
-        return ERR_DRIVER_FAIL;
-
-
-    /* EWRPT */
-    if(spi_write(EWRPTL,TXSTART_INIT & 0x00ff) != ERR_SUCCESS)
-        return ERR_DRIVER_FAIL;
-    if(spi_write(EWRPTH,(TXSTART_INIT & 0xff00)>>8) != ERR_SUCCESS)
-        return ERR_DRIVER_FAIL;
- 	
-    /* Memory not used by the receive buffer is part of the transmission buffer, so in this case 0x0 to 0x1002 */
-    /* No need to initialize the transmission buffer */
-
-    /* Enable the appropriate receive filters by writing to ERXFCON register  */
-    /*  • Unicast
-        • Pattern Match
-        • Magic Packet™
-        • Hash Table
-        • Multicast
-        • Broadcast
-     */
-    /* Promiscuous mode - clear the ERXFCON - bank 1, 0x18 */
-    /* UCEN : 1 (UNICAST) , ANDOR: 0 (OR), CRCEN: 0, PMEN: 0, MPEN: 0, HTEN: 0, MCEN: 0, BCEN: 1  */	
-    /* 0b1000 0001: 0x81 */
-    if(spi_write(ERXFCON,0x81)!=ERR_SUCCESS)
+    /* Buffer pointers and receive filters in a single register program */
+    if(regProgram_run(ethConfigProgram, sizeof(ethConfigProgram)/sizeof(ethConfigProgram[0])) != ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
+    rxFilter = RX_FILTER_DEFAULT;
+    rxSleepFilter = false;
+    txProgStart = TXSTART_INIT;
+    txProgEnd = TXSTOP_INIT;
+    rxRdPtShadow = RXSTOP_INIT;
 
     return ERR_SUCCESS;
 }
@@ -128,94 +229,24 @@ spierr_t ethernetConfig(void){
  *  @return 	ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
  */
 spierr_t ethernet_initializeMAC(void){
-    /* Configure the MAC registers */
-    /* 1. Set the MARXEN bit in MACON1 to enable MAC to receive frames. Also set RxPAUS and TxPAUS*/
-    /* MACON1 : bank 2 0x0 */
-    selectMemBank(2);
-    uint8_t macon1val = spi_readMACReg(MACON1);
-    if(spi_write(MACON1, (macon1val & 0x12) | 0xD)!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-
-    /* 2. Configure the PADCFG, TXCRCEN and FULDPX bits of MACON3
-     * MACON3 : bank 2, 0x2
-     * */
-    uint8_t macon3val = spi_readMACReg(MACON3);
-    /* 0b 0000 1110 */
-    /* 0b 001 1 000 1  */
-    /*
-     * Configuration : pad atleast 60 bits and add a CRC, regardless of the PDCFG bits, and full-duplex
-     */
-    if(spi_write(MACON3, (macon3val & 0xe) | 0x31)!=ERR_SUCCESS)
+    /* MAC registers, then the local MAC address, in one register program
+     * since the address is not known at compile time */
+    regOp_t program[sizeof(macConfigProgram)/sizeof(macConfigProgram[0]) + 6];
+    uint8_t count = sizeof(macConfigProgram)/sizeof(macConfigProgram[0]);
+    memcpy(program, macConfigProgram, sizeof(macConfigProgram));
+    for (uint8_t i = 0; i < 6; i++){
+	program[count].reg = maadrRegs[i];
+	program[count].value = mymac[i];
+	program[count].mask = 0xff;
+	program[count++].attr = ENC_REG_MAC | ENC_REG_RW;
+    }
+    if(regProgram_run(program, count)!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
 
     /* If in Full-Duplex mode, PDPXMD in PHCON1 must also be set */
     uint16_t phcon1val = spi_readPHYReg(PHCON1);
-    uint16_t relevant_phcon1 = phcon1val & 0xfeff | (~0xfeff);
-    if(spi_writePHYReg(PHCON1, relevant_phcon1 & 0xff00 >> 8 , relevant_phcon1 & 0x00ff) != ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-
-    /* 3. Configure the bits in MACON4 - set the DEFER bit to conform to IEEE 802.3 standard
-     * MACON4 : bank2 , 0x3
-     * set DEFER bit, leave the rest as before. then, read mask = 0b01000000
-     */
-    uint8_t macon4val = spi_readMACReg(MACON4);
-    if(spi_write(MACON4, macon4val & ~(0x40) | (0x40))!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-
-    /* 4. Program the MAMXFL registrs with max frame length to be permitted to be received or transmitted.
-     * Normally - network nodes are designed to handle packets that are 1518 packets or less
-     * MAMXFLL: bank 2, 0x0a, MAMXFLH bank2 , 0x0b
-     * MAMXFLL : 0xee
-     * MAMXFLH : 0x05
-     */
-    if(spi_write(MAMXFLL, 0xee)!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-    if(spi_write(MAMXFLH, 0x05)!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-
-    /* 5. Configure the Back-To-Back Inter-Packet Gap register, MABBIPG. most apps will program
-     * this register with 0x15 when Full-Duplex mode is used and 0x12 when half-duplex mode is used.
-     * MABBIPG: bank 2, 0x4
-     * write the value 0x15
-     *
-     */
-    if(spi_write(MABBIPG,0x15)!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-
-    /* 6. Configure the Non-Bank-To-Bank Inter-Packet Gapregister low byte, MAIPGL.
-     * Most apps will configure as 0x12
-     * MAIPGH : bank2, 0x6
-     */
-    if(spi_write(MAIPGL,0x12)!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-
-    /* 7. If half-duplex mode is used, non-back-to-back inter-packet gap register high byte, MAIPGH,
-     * should be programmed, and most applications will program the register to 0xc. Leave it unprogrammed
-     * since you have programmed this application as full-duplex.
-     */
-
-    /* 8. If half-duplex mode is used, program retransmission and collision window registers. MACLCON1 and MACLCON2.
-     * most apps will not change default reset values. Leave this alone.
-     */
-
-    /* 9. Program the local MAC address into the MAADR1:MAADR6 registers.
-     * local MAC address :
-     * Bank3
-     * MAADR1 : 0x4, MAADR2 : 0x5, MAADR3: 0x2, MAADR4 0x3, MAADR5 0x0, MAADR6 0x1
-     * set the MAC to whatever you choose : I've set it to mymac.
-     */
-    selectMemBank(3);
-    if (spi_write(MAADR1,mymac[0])!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-    if(spi_write(MAADR2,mymac[1])!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-    if(spi_write(MAADR3,mymac[2])!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-    if(spi_write(MAADR4,mymac[3])!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-    if(spi_write(MAADR5,mymac[4])!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-    if(spi_write(MAADR6,mymac[5])!=ERR_SUCCESS)
+    uint16_t relevant_phcon1 = phcon1val | 0x0100;
+    if(spi_writePHYReg(PHCON1, (relevant_phcon1 & 0xff00) >> 8 , relevant_phcon1 & 0x00ff) != ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
 
     /* set the next packet pointer to position zero in the receive buffer */
@@ -240,6 +271,7 @@ spierr_t ethernet_initializePHY(void){
      */
      if(LED_Default()!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
+     return ERR_SUCCESS;
 }
 
 
@@ -248,7 +280,12 @@ spierr_t ethernet_initializePHY(void){
  *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
  */
 spierr_t ethernet_Init(void){
-    
+    bringupStartUs = ethernet_nowUs();
+    bringupInitUs = 0;
+    bringupLinkUpUs = 0;
+
+    if(regProgram_init()!=ERR_SUCCESS)
+	return ERR_DRIVER_FAIL;
     if(ethernetConfig()!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
     if(ethernet_initializeMAC()!=ERR_SUCCESS)
@@ -257,10 +294,51 @@ spierr_t ethernet_Init(void){
 	return ERR_DRIVER_FAIL;
     if(ethernet_receiveEnable()!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
+
+    bringupInitUs = ethernet_nowUs() - bringupStartUs;
     return ERR_SUCCESS;
 }
 
 
+/*! @brief function to wait for the link to come up after ethernet_Init,
+ * polls PHSTAT2.LSTAT
+ * @param[in] timeoutMs    maximum time to wait, 0 checks once
+ *  @return     ERR_SUCCESS if the link is up, ERR_DRIVER_FAIL on timeout
+ */
+spierr_t ethernet_waitLinkUp(uint32_t timeoutMs){
+    uint32_t start = ethernet_nowUs();
+
+    while(!(spi_readPHYReg(PHSTAT2) & PHSTAT2_LSTAT)){
+	if (ethernet_nowUs() - start >= timeoutMs * 1000)
+	    return ERR_DRIVER_FAIL;
+	usleep(LINK_POLL_US);
+    }
+    if (bringupLinkUpUs == 0)
+	bringupLinkUpUs = ethernet_nowUs() - bringupStartUs;
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to get the measured bring-up times
+ * @param[out] initUs      time spent in ethernet_Init, 0 if it did not complete
+ * @param[out] linkUpUs    time from ethernet_Init to link up, 0 if not seen yet
+ */
+void ethernet_getBringupTime(uint32_t *initUs, uint32_t *linkUpUs){
+    if (initUs != NULL)
+	*initUs = bringupInitUs;
+    if (linkUpUs != NULL)
+	*linkUpUs = bringupLinkUpUs;
+}
+
+
+/*! @brief function to get the local MAC address
+ * @param[out] mac         6 bytes, as programmed in MAADR
+ */
+void ethernet_getMacAddress(uint8_t *mac){
+    memcpy(mac, mymac, sizeof(mymac));
+}
+
+
 /*! @brief function to transmit packets to the dest MAC address 
  * @param[in] char* payload    message payload
  * @param[in] uint16_t msglen   length of message payload
@@ -281,22 +359,31 @@ spierr_t ethernet_transmitPackets(uint8_t* payload, uint16_t msglen){
      * for example, 0x0120. Recommended to use an even address.
      * ETXSTL :0x20    ETXSTH : 0x01
      */
+    /* The previous frame must have left the transmit buffer */
+    ethernet_txPoll();
+    if(ethernet_powerSaveActivity(true)!=ERR_SUCCESS)
+	return ERR_DRIVER_FAIL;
+    ENC_PROBE(ENC_PROBE_TX_REQUEST);
+
     uint16_t start_addr = TXSTART_INIT ;
     uint8_t start_addr_l = (start_addr) & 0x00ff;
     uint8_t start_addr_h = ((start_addr) & 0xff00) >> 8;
-    if(spi_write(ETXSTL, start_addr_l)!=ERR_SUCCESS)
+    if(ENC_WRITE(ETXSTL, start_addr_l)!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
-    if(spi_write(ETXSTH, start_addr_h)!=ERR_SUCCESS)
+    if(ENC_WRITE(ETXSTH, start_addr_h)!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
 
 
     /* 2. Use the WBM SPI command to write the per packet control byte, the destination address,
      * the source MAC address, the type/length and the data payload
      */
-
-     	
-    if(writeBufferMemory(payload,start_addr,msglen)!=ERR_SUCCESS)
+    uint8_t controlByte = 0x00;
+    if(writeBufferMemory(&controlByte,start_addr,1)!=ERR_SUCCESS)
+	return ERR_DRIVER_FAIL;
+    if(writeBufferMemory(payload,start_addr+1,msglen)!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
+    ENC_PROBE(ENC_PROBE_WBM_DONE);
+    encCapture_tap(ENC_CAPTURE_TX, payload, msglen, NULL, 0, msglen);
 
 
     /* 3. Appropriately program the ETXND pointer, points to the last byte
@@ -306,31 +393,466 @@ spierr_t ethernet_transmitPackets(uint8_t* payload, uint16_t msglen){
     uint8_t end_addr_l = (end_addr) & 0x00ff;
     uint8_t end_addr_h = ((end_addr) & 0xff00) >> 8;
 
-    if(spi_write(ETXNDL, end_addr_l)!=ERR_SUCCESS)
+    if(ENC_WRITE(ETXNDL, end_addr_l)!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
-    if(spi_write(ETXNDH, end_addr_h)!=ERR_SUCCESS)	
+    if(ENC_WRITE(ETXNDH, end_addr_h)!=ERR_SUCCESS)	
 	return ERR_DRIVER_FAIL;
+    txProgStart = start_addr;
+    txProgEnd = end_addr;
 
     /* 4. Clear EIR.TXIF, set EIE.TXIE, set EIE.INTIE to enable an interrupt
      * when done (if desired)
      */
     if(selectMemBank(0)!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
-    if(bitFieldClear(0x1c, 0x08)!=ERR_SUCCESS)
+    if(ENC_BFC(EIR, EIR_TXIF | EIR_TXERIF)!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
-    if(bitFieldSet(0x1b,0x88)!=ERR_SUCCESS)
+    if(ENC_BFS(EIE, 0x88)!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
 
     /* 5. Start the transmission process by setting ECON1.TXRTS
      *
      */
-    /* Start transmission */
-    if(bitFieldSet(0x1f,0x8)!=ERR_SUCCESS)
+    /* Start transmission, completion is checked by ethernet_txPoll */
+    if(ENC_BFS(ECON1, 0x8)!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
+    ENC_PROBE(ENC_PROBE_TXRTS_SET);
+    txEndAddr = end_addr;
+    txLength = msglen;
+    txPending = true;
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to build the chain resetting the transmit logic after
+ * ETH_TX_FAILED (errata: TXRTS may stay set after an error), optionally
+ * starting the frame still in the transmit buffer again
+ * @param[out] items       at least ETH_TX_RESET_ITEMS items
+ * @param[in] resend       set TXRTS again
+ * @return              number of items used, chained through next
+ */
+uint8_t ethernet_txBuildReset(spiQueueItem_t *items, bool resend){
+    uint8_t used = 0;
+    uint8_t i;
+
+    spiQueue_buildBitField(&items[used++], ECON1, ECON1_TXRST, true);
+    spiQueue_buildBitField(&items[used++], ECON1, ECON1_TXRST | ECON1_TXRTS, false);
+    spiQueue_buildBitField(&items[used++], EIR, EIR_TXERIF | EIR_TXIF, false);
+    spiQueue_buildBitField(&items[used++], ESTAT, ESTAT_TXABRT | ESTAT_LATECOL, false);
+    if (resend)
+	spiQueue_buildBitField(&items[used++], ECON1, ECON1_TXRTS, true);
+    for (i = 0; i + 1 < used; i++)
+	items[i].next = &items[i + 1];
+    return used;
+}
+
+
+/*! @brief function to count a chain of ethernet_txBuildReset once it
+ * completed: a reset, and a retry if it started the frame again
+ * @param[in] resend       resend given to ethernet_txBuildReset
+ */
+void ethernet_txResetDone(bool resend){
+    txStats.txResets++;
+    if (resend)
+	txStats.txRetries++;
+}
+
+
+/*! @brief function to account the frame in the transmit logic from
+ * ECON1, ESTAT and EIR read by the caller
+ * @param[in] econ1        ECON1
+ * @param[in] estat        ESTAT
+ * @param[in] eir          EIR
+ * @param[in] timedOut     the frame was started longer than the transmit timeout ago
+ * @return              ETH_TX_BUSY, ETH_TX_DONE or ETH_TX_FAILED
+ */
+ethernet_txResult_t ethernet_txCheck(uint8_t econ1, uint8_t estat, uint8_t eir, bool timedOut){
+    if (econ1 & ECON1_TXRTS){
+	if (!timedOut)
+	    return ETH_TX_BUSY;
+	txStats.txStalls++;
+	return ETH_TX_FAILED;
+    }
+    if ((estat & ESTAT_TXABRT) || (eir & EIR_TXERIF)){
+	txStats.txAborts++;
+	return ETH_TX_FAILED;
+    }
+    ENC_PROBE(ENC_PROBE_TXIF);
+    txStats.txPackets++;
+    txStats.txBytes += txLength;
+    txPending = false;
+    return ETH_TX_DONE;
+}
+
+
+/*! @brief function to give up the frame in the transmit logic, counted as dropped
+ */
+void ethernet_txDropped(void){
+    txStats.txDropped++;
+    txPending = false;
+}
+
+
+/*! @brief function to finish the frame handed to the transmit logic: wait
+ * (bounded) for TXRTS to clear, and on an abort, late collision or stall
+ * reset the transmit logic and send the frame again, at most TX_MAX_RETRIES times
+ *  @return 	ERR_SUCCESS if the frame went out or none was pending, ERR_DRIVER_FAIL if it was dropped
+ */
+spierr_t ethernet_txPoll(void){
+    spiQueueItem_t items[ETH_TX_RESET_ITEMS];
+    uint8_t retries = 0;
+    uint8_t tsv[TSV_LENGTH];
+    uint8_t econ1;
+    bool resend;
+    uint32_t start;
+
+    if (!txPending)
+	return ERR_SUCCESS;
+
+    while (1){
+	start = ethernet_nowUs();
+	while (((econ1 = ENC_READ(ECON1)) & ECON1_TXRTS) && ethernet_nowUs() - start < TX_TIMEOUT_US);
+
+	if (ethernet_txCheck(econ1, ENC_READ(ESTAT), ENC_READ(EIR), true) == ETH_TX_DONE)
+	    return ERR_SUCCESS;
+	if (!(econ1 & ECON1_TXRTS) && readBufferMemory(tsv, txEndAddr + 1, TSV_LENGTH) == ERR_SUCCESS
+		&& (tsv[3] & TSV3_LATECOL))
+	    txStats.txLateCollisions++;
+
+	/* The frame is still in the transmit buffer, reset and start it again */
+	resend = retries++ < TX_MAX_RETRIES;
+	if (spi_transferItems(items, ethernet_txBuildReset(items, resend)) != ERR_SUCCESS){
+	    ethernet_txDropped();
+	    return ERR_DRIVER_FAIL;
+	}
+	ethernet_txResetDone(resend);
+	if (!resend){
+	    ethernet_txDropped();
+	    return ERR_DRIVER_FAIL;
+	}
+    }
+}
+
+
+/*! @brief function to get the transmit counters
+ * @param[out] stats      copy of the counters
+ */
+void ethernet_getTxStats(ethernet_txStats_t *stats){
+    if (stats != NULL)
+	*stats = txStats;
+}
+
+
+
+static spiQueueItem_t txChain[ETH_TX_LOAD_ITEMS];
+static uint8_t txControlByte = 0x00;
+static volatile bool txChainBusy = false;
+static ethernet_txDoneFxn txChainDone;
+
+
+#ifdef ENC28J60_PROBES
+/*! @brief completion of the payload item of the queued transmit chain
+ */
+static void ethernet_txWbmCallback(spiQueueItem_t *item, bool transferOK){
+    if (transferOK)
+        ENC_PROBE(ENC_PROBE_WBM_DONE);
+}
+#endif
+
+
+/*! @brief completion of the last item of the queued transmit chain
+ */
+static void ethernet_txChainCallback(spiQueueItem_t *item, bool transferOK){
+    ethernet_txDoneFxn doneFxn = txChainDone;
+    if (transferOK)
+        ENC_PROBE(ENC_PROBE_TXRTS_SET);
+    if (transferOK)
+        txPending = true;
+    txChainBusy = false;
+    if (doneFxn != NULL)
+        doneFxn(transferOK);
+}
+
+
+/*! @brief function to build the chain loading a frame into the transmit
+ * buffer and starting it: control byte and payload WBM, ETXST/ETXND,
+ * EIR.TXIF clear and ECON1.TXRTS set. The split-phase form of the
+ * transmit, for callers running their own SPI chains (enc_engine).
+ * @param[out] items       at least ETH_TX_LOAD_ITEMS items
+ * @param[in] payload      message payload, must stay valid until the chain completed
+ * @param[in] msglen       length of message payload
+ * @return              number of items used, chained through next
+ */
+uint8_t ethernet_txBuildLoad(spiQueueItem_t *items, const uint8_t *payload, uint16_t msglen){
+    uint16_t start_addr = TXSTART_INIT;
+    uint16_t end_addr = start_addr + msglen;
+    uint8_t used;
+    uint8_t i;
+
+    txEndAddr = end_addr;
+    txLength = msglen;
+
+    /* EWRPT, WBM opcode, control byte and payload under one chip select */
+    used = spiQueue_buildWriteBuffer(items, start_addr, &txControlByte, 1);
+    items[used - 1].flags = 0;
+    items[used] = items[used - 1];
+    items[used].txBuf = (void *) payload;
+    items[used].count = msglen;
+    items[used].flags = SPIQ_CS_RELEASE;
+    used++;
+
+    /* ETXST is only moved by the stream, ETXND points to the last byte of the payload */
+    if (txProgStart != start_addr){
+        used += spiQueue_buildWrite(&items[used], ETXSTL, start_addr & 0x00ff);
+        used += spiQueue_buildWrite(&items[used], ETXSTH, (start_addr & 0xff00) >> 8);
+    }
+    used += spiQueue_buildWrite(&items[used], ETXNDL, end_addr & 0x00ff);
+    used += spiQueue_buildWrite(&items[used], ETXNDH, (end_addr & 0xff00) >> 8);
+    txProgStart = start_addr;
+    txProgEnd = end_addr;
+
+    /* Clear EIR.TXIF/TXERIF and start transmission with ECON1.TXRTS */
+    spiQueue_buildBitField(&items[used++], EIR, EIR_TXIF | EIR_TXERIF, false);
+    spiQueue_buildBitField(&items[used++], ECON1, ECON1_TXRTS, true);
+
+    /* The builders terminate their own chains, link them into one */
+    for (i = 0; i + 1 < used; i++)
+        items[i].next = &items[i + 1];
+    items[used - 1].next = NULL;
+    encCapture_tap(ENC_CAPTURE_TX, payload, msglen, NULL, 0, msglen);
+    return used;
+}
+
+
+/*! @brief function to queue the transmission of a packet without waiting
+ * for the SPI transfers. The payload is written behind the control byte,
+ * ETXND is programmed and TXRTS set as one chain on the SPI queue.
+ * The previous frame is finished with ethernet_txPoll first.
+ * @param[in] payload    message payload, must stay valid until doneFxn
+ * @param[in] msglen     length of message payload
+ * @param[in] doneFxn    called from SPI callback context once TXRTS is set, may be NULL
+ *  @return 	ERR_SUCCESS if queued, ERR_DRIVER_FAIL on failure or if a transmit is still queued
+ */
+spierr_t ethernet_transmitPacketsAsync(uint8_t* payload, uint16_t msglen, ethernet_txDoneFxn doneFxn){
+    uint8_t used;
+
+    if (txChainBusy || msglen == 0)
+        return ERR_DRIVER_FAIL;
+
+    /* The previous frame must have left the transmit buffer */
+    ethernet_txPoll();
+    if (ethernet_powerSaveActivity(true) != ERR_SUCCESS)
+        return ERR_DRIVER_FAIL;
+    txChainBusy = true;
+    txChainDone = doneFxn;
+    ENC_PROBE(ENC_PROBE_TX_REQUEST);
+
+    used = ethernet_txBuildLoad(txChain, payload, msglen);
+#ifdef ENC28J60_PROBES
+    txChain[SPIQ_BUFFER_ITEMS].callback = ethernet_txWbmCallback;
+#endif
+    txChain[used - 1].callback = ethernet_txChainCallback;
+
+    if (spiQueue_submit(txChain) != ERR_SUCCESS){
+        txChainBusy = false;
+        txProgStart = txProgEnd = 0xffff;
+        return ERR_DRIVER_FAIL;
+    }
     return ERR_SUCCESS;
 }
 
 
+/* ======== Isochronous stream =======
+ *
+ * ===================================
+ */
+
+/* Stream frame layout behind the per packet control byte */
+#define STREAM_IP_OFF     15
+#define STREAM_UDP_OFF    35
+#define STREAM_RTP_OFF    43
+#define STREAM_HDR_LEN    55
+/* The largest frame plus its status vector fits the stream area */
+#if STREAM_HDR_LEN - 1 + ETH_STREAM_MAX_PAYLOAD + 4 > MAX_MAC_LENGTH || \
+    STREAM_HDR_LEN + ETH_STREAM_MAX_PAYLOAD + TSV_LENGTH > STREAM_TXSTOP - STREAM_TXSTART + 1
+#error "stream frame does not fit"
+#endif
+
+/* Items of a stream frame: IP fields WBM, UDP/RTP fields + payload WBM,
+ * ETXST/ETXND L/H, EIR.TXIF clear and ECON1.TXRTS set */
+#define STREAM_CHAIN_ITEMS (2*SPIQ_BUFFER_ITEMS + 1 + 4*SPIQ_REG_ITEMS + 2)
+
+/* Header template as written in SRAM, patched here and copied over in spans */
+static uint8_t streamHdr[STREAM_HDR_LEN];
+static uint16_t streamPayloadLen;
+static bool streamActive = false;
+static spiQueueItem_t streamChain[STREAM_CHAIN_ITEMS];
+
+
+/*! @brief Store a 16 bit big endian field of the template
+ * @param[in] offset       offset in the template
+ * @param[in] value        field value
+ */
+static void ethernet_streamPut16(uint8_t offset, uint16_t value){
+    streamHdr[offset] = (value & 0xff00) >> 8;
+    streamHdr[offset + 1] = value & 0x00ff;
+}
+
+
+/*! @brief Set the IPv4 total length and UDP length of the template
+ * @param[in] payloadLen   RTP payload length
+ */
+static void ethernet_streamSetLength(uint16_t payloadLen){
+    ethernet_streamPut16(STREAM_IP_OFF + 2, 20 + 8 + 12 + payloadLen);
+    ethernet_streamPut16(STREAM_UDP_OFF + 4, 8 + 12 + payloadLen);
+    streamPayloadLen = payloadLen;
+}
+
+
+/*! @brief Recompute the IPv4 header checksum of the template
+ */
+static void ethernet_streamChecksum(void){
+    uint32_t sum = 0;
+    uint8_t i;
+
+    ethernet_streamPut16(STREAM_IP_OFF + 10, 0);
+    for (i = 0; i < 20; i += 2)
+        sum += streamHdr[STREAM_IP_OFF + i] << 8 | streamHdr[STREAM_IP_OFF + i + 1];
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    ethernet_streamPut16(STREAM_IP_OFF + 10, ~sum & 0xffff);
+}
+
+
+/*! @brief function to start the isochronous stream: the Ethernet, IPv4,
+ * UDP and RTP headers are built once and written to the stream area of
+ * the transmit SRAM (STREAM_TXSTART)
+ * @param[in] config       stream addresses and payload length
+ *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t ethernet_streamStart(const ethernet_streamConfig_t *config){
+    if (config == NULL || config->payloadLen == 0 || config->payloadLen > ETH_STREAM_MAX_PAYLOAD)
+        return ERR_DRIVER_FAIL;
+
+    memset(streamHdr, 0, sizeof(streamHdr));
+    /* Per packet control byte: MACON3 pads and appends the CRC */
+    streamHdr[0] = 0x00;
+    memcpy(&streamHdr[1], config->dstMac, 6);
+    memcpy(&streamHdr[7], mymac, 6);
+    ethernet_streamPut16(13, 0x0800);
+
+    streamHdr[STREAM_IP_OFF] = 0x45;
+    ethernet_streamPut16(STREAM_IP_OFF + 6, 0x4000);        /* don't fragment */
+    streamHdr[STREAM_IP_OFF + 8] = 64;
+    streamHdr[STREAM_IP_OFF + 9] = 17;                      /* UDP */
+    ethernet_streamPut16(STREAM_IP_OFF + 12, config->srcIp >> 16);
+    ethernet_streamPut16(STREAM_IP_OFF + 14, config->srcIp & 0xffff);
+    ethernet_streamPut16(STREAM_IP_OFF + 16, config->dstIp >> 16);
+    ethernet_streamPut16(STREAM_IP_OFF + 18, config->dstIp & 0xffff);
+
+    /* UDP checksum 0: not computed, allowed over IPv4, saves reading the payload */
+    ethernet_streamPut16(STREAM_UDP_OFF, config->srcPort);
+    ethernet_streamPut16(STREAM_UDP_OFF + 2, config->dstPort);
+
+    streamHdr[STREAM_RTP_OFF] = 0x80;                       /* version 2 */
+    streamHdr[STREAM_RTP_OFF + 1] = config->payloadType & 0x7f;
+    ethernet_streamPut16(STREAM_RTP_OFF + 8, config->ssrc >> 16);
+    ethernet_streamPut16(STREAM_RTP_OFF + 10, config->ssrc & 0xffff);
+
+    ethernet_streamSetLength(config->payloadLen);
+    ethernet_streamChecksum();
+
+    /* The frame in flight may be the stream one, the template is rewritten */
+    ethernet_txPoll();
+    if (writeBufferMemory(streamHdr, STREAM_TXSTART, STREAM_HDR_LEN) != ERR_SUCCESS)
+        return ERR_DRIVER_FAIL;
+    streamActive = true;
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to send one stream packet: only the IP identification
+ * and checksum, the RTP sequence number and timestamp (plus the lengths
+ * if len changed) and the payload are written, then TXRTS is set.
+ * The IP identification and RTP sequence number advance by one per packet.
+ * @param[in] payload      RTP payload
+ * @param[in] len          payload length, at most ETH_STREAM_MAX_PAYLOAD bytes
+ * @param[in] rtpTimestamp RTP timestamp of the packet
+ *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t ethernet_streamSend(const uint8_t *payload, uint16_t len, uint32_t rtpTimestamp){
+    uint16_t end_addr = STREAM_TXSTART + STREAM_HDR_LEN - 1 + len;
+    bool resized = (len != streamPayloadLen);
+    uint8_t ipFrom, rtpFrom;
+    uint8_t used = 0;
+
+    if (!streamActive || payload == NULL || len == 0 || len > ETH_STREAM_MAX_PAYLOAD)
+        return ERR_DRIVER_FAIL;
+
+    /* The previous frame must have left the transmit buffer */
+    ethernet_txPoll();
+    if (ethernet_powerSaveActivity(true) != ERR_SUCCESS)
+        return ERR_DRIVER_FAIL;
+    ENC_PROBE(ENC_PROBE_TX_REQUEST);
+
+    ethernet_streamPut16(STREAM_IP_OFF + 4, (streamHdr[STREAM_IP_OFF + 4] << 8 | streamHdr[STREAM_IP_OFF + 5]) + 1);
+    ethernet_streamPut16(STREAM_RTP_OFF + 2, (streamHdr[STREAM_RTP_OFF + 2] << 8 | streamHdr[STREAM_RTP_OFF + 3]) + 1);
+    ethernet_streamPut16(STREAM_RTP_OFF + 4, rtpTimestamp >> 16);
+    ethernet_streamPut16(STREAM_RTP_OFF + 6, rtpTimestamp & 0xffff);
+    if (resized)
+        ethernet_streamSetLength(len);
+    ethernet_streamChecksum();
+
+    /* IP: identification .. checksum, from the total length if resized.
+     * UDP/RTP: RTP sequence .. SSRC, from the UDP length if resized, then the payload */
+    ipFrom = STREAM_IP_OFF + (resized ? 2 : 4);
+    rtpFrom = resized ? STREAM_UDP_OFF + 4 : STREAM_RTP_OFF + 2;
+    used += spiQueue_buildWriteBuffer(&streamChain[used], STREAM_TXSTART + ipFrom,
+                                      &streamHdr[ipFrom], STREAM_IP_OFF + 12 - ipFrom);
+    used += spiQueue_buildWriteBuffer(&streamChain[used], STREAM_TXSTART + rtpFrom,
+                                      &streamHdr[rtpFrom], STREAM_HDR_LEN - rtpFrom);
+    /* The payload follows under the same chip select */
+    streamChain[used - 1].flags &= ~SPIQ_CS_RELEASE;
+    streamChain[used] = streamChain[used - 1];
+    streamChain[used].flags = SPIQ_CS_RELEASE;
+    streamChain[used].txBuf = (void *) payload;
+    streamChain[used].count = len;
+    used++;
+
+    if (txProgStart != STREAM_TXSTART){
+        used += spiQueue_buildWrite(&streamChain[used], ETXSTL, STREAM_TXSTART & 0x00ff);
+        used += spiQueue_buildWrite(&streamChain[used], ETXSTH, (STREAM_TXSTART & 0xff00) >> 8);
+    }
+    if (txProgEnd != end_addr){
+        used += spiQueue_buildWrite(&streamChain[used], ETXNDL, end_addr & 0x00ff);
+        used += spiQueue_buildWrite(&streamChain[used], ETXNDH, (end_addr & 0xff00) >> 8);
+    }
+    spiQueue_buildBitField(&streamChain[used++], EIR, EIR_TXIF | EIR_TXERIF, false);
+    spiQueue_buildBitField(&streamChain[used++], ECON1, ECON1_TXRTS, true);
+
+    if (spi_transferItemsPrio(streamChain, used, SPIQ_PRIO_HIGH) != ERR_SUCCESS){
+        txProgStart = txProgEnd = 0xffff;
+        return ERR_DRIVER_FAIL;
+    }
+    ENC_PROBE(ENC_PROBE_TXRTS_SET);
+    txProgStart = STREAM_TXSTART;
+    txProgEnd = end_addr;
+    txEndAddr = end_addr;
+    txLength = STREAM_HDR_LEN - 1 + len;
+    txPending = true;
+    encCapture_tap(ENC_CAPTURE_TX, &streamHdr[1], STREAM_HDR_LEN - 1, payload, len, STREAM_HDR_LEN - 1 + len);
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to stop the isochronous stream, the last frame is finished
+ *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL if it was dropped
+ */
+spierr_t ethernet_streamStop(void){
+    streamActive = false;
+    return ethernet_txPoll();
+}
+
 
 /*! @brief function to enable the ENC28J60 to receive packets 
  *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
@@ -341,7 +863,7 @@ spierr_t ethernet_receiveEnable(void){
      */
     if(selectMemBank(0)!=ERR_SUCCESS)	
 	return ERR_DRIVER_FAIL;
-    if(bitFieldSet(0x1b, 0xC0)!=ERR_SUCCESS)
+    if(ENC_BFS(EIE, 0xC0)!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
 
     /* 2. If an interrupt is desired whenever a packet is dropped due to
@@ -349,18 +871,18 @@ spierr_t ethernet_receiveEnable(void){
      * EIE.RXERIE and EIE.INTIE.
      */
 
-    if(bitFieldClear(0x1c, 0x1)!=ERR_SUCCESS)
+    if(ENC_BFC(EIR, 0x1)!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
-    if(bitFieldSet(0x1b, 0x81)!=ERR_SUCCESS)
+    if(ENC_BFS(EIE, 0x81)!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
 
     /* 3. Set ECON2.AUTOINC */
-    if(bitFieldSet(0x1e, 0x80)!=ERR_SUCCESS)
+    if(ENC_BFS(ECON2, 0x80)!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
 
     /* 3. Enable reception by setting ECON1.RXEN
      */
-    if(bitFieldSet(0x1f,0x04)!=ERR_SUCCESS)
+    if(ENC_BFS(ECON1, 0x04)!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
 
     return ERR_SUCCESS;
@@ -373,12 +895,395 @@ spierr_t ethernet_receiveEnable(void){
 spierr_t ethernet_receiveDisable(void){
     /* 3. Disable reception by clearing ECON1.RXEN
      */
-    if(bitFieldClear(0x1f,0x04)!=ERR_SUCCESS)
+    if(ENC_BFC(ECON1, 0x04)!=ERR_SUCCESS)
 	return ERR_DRIVER_FAIL;
     return ERR_SUCCESS;
 }
 
 
+/*! @brief function to change the receive filters at runtime. While a sleep
+ * profile is active they are applied by ethernet_sleepFilterExit
+ * @param[in] erxfcon    new ERXFCON value, ERXFCON_* bits
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t ethernet_setRxFilter(uint8_t erxfcon){
+    const regOp_t program[] = {
+        REGOP_WRITE(ERXFCON, erxfcon),
+    };
+    rxFilter = erxfcon;
+    /* Applied by ethernet_sleepFilterExit */
+    if (rxSleepFilter)
+        return ERR_SUCCESS;
+    return regProgram_run(program, sizeof(program)/sizeof(program[0]));
+}
+
+
+/*! @brief Checksum the pattern match filter compares with EPMCS: the
+ * masked bytes of the window taken as one stream of big endian 16 bit
+ * words, ones' complement of the ones' complement sum
+ * @param[in] pattern      window content
+ * @param[in] mask         EPMM0-7, bit n selects byte n
+ * @return              EPMCS value
+ */
+static uint16_t ethernet_patternChecksum(const uint8_t *pattern, const uint8_t *mask){
+    uint32_t sum = 0;
+    bool high = true;
+    uint8_t i;
+
+    for (i = 0; i < PATTERN_WINDOW; i++){
+        if (!(mask[i / 8] & (1 << (i % 8))))
+            continue;
+        sum += high ? (uint32_t) pattern[i] << 8 : pattern[i];
+        high = !high;
+    }
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t) ~sum;
+}
+
+
+/*! @brief function to switch the receive filters to a sleep profile before
+ * the host enters low power: only frames of the profile reach the ring and
+ * raise the INT line (EIE.PKTIE), everything else is dropped by the ENC28J60.
+ * The ENC28J60 must stay out of power-save. Frames already in the ring keep
+ * INT asserted, they must be read first.
+ * @param[in] profile      ETH_SLEEP_FILTER_* profile
+ * @param[in] pattern      pattern of ETH_SLEEP_FILTER_PATTERN, NULL otherwise
+ *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure or if frames are pending
+ */
+spierr_t ethernet_sleepFilterEnter(ethernet_sleepFilter_t profile, const ethernet_pattern_t *pattern){
+    regOp_t program[] = {
+        REGOP_WRITE(EPMM0, 0),
+        REGOP_WRITE(EPMM1, 0),
+        REGOP_WRITE(EPMM2, 0),
+        REGOP_WRITE(EPMM3, 0),
+        REGOP_WRITE(EPMM4, 0),
+        REGOP_WRITE(EPMM5, 0),
+        REGOP_WRITE(EPMM6, 0),
+        REGOP_WRITE(EPMM7, 0),
+        REGOP_WRITE16(EPMCSL, EPMCSH, 0),
+        REGOP_WRITE16(EPMOL, EPMOH, 0),
+        /* Written last so the filter is complete once it is enabled */
+        REGOP_WRITE(ERXFCON, ERXFCON_CRCEN | ERXFCON_MPEN),
+    };
+    uint8_t count = sizeof(program)/sizeof(program[0]);
+    uint16_t checksum;
+    uint8_t i;
+
+    if (ENC_READ(EPKTCNT) != 0)
+        return ERR_DRIVER_FAIL;
+
+    if (profile == ETH_SLEEP_FILTER_MAGIC){
+        /* Only ERXFCON, the magic packet filter uses MAADR */
+        program[0] = program[count - 1];
+        count = 1;
+    }
+    else if (profile == ETH_SLEEP_FILTER_PATTERN && pattern != NULL && pattern->pattern != NULL){
+        for (i = 0; i < 8; i++)
+            program[i].value = pattern->mask[i];
+        checksum = ethernet_patternChecksum(pattern->pattern, pattern->mask);
+        program[8].value = checksum & 0x00ff;
+        program[9].value = (checksum & 0xff00) >> 8;
+        program[10].value = pattern->offset & 0x00ff;
+        program[11].value = (pattern->offset & 0xff00) >> 8;
+        program[12].value = ERXFCON_CRCEN | ERXFCON_PMEN;
+    }
+    else{
+        return ERR_DRIVER_FAIL;
+    }
+
+    if (regProgram_run(program, count) != ERR_SUCCESS)
+        return ERR_DRIVER_FAIL;
+    rxSleepFilter = true;
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to restore the receive filters used before
+ * ethernet_sleepFilterEnter, call it when the host wakes. The frame which
+ * woke the host stays in the ring.
+ *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t ethernet_sleepFilterExit(void){
+    const regOp_t program[] = {
+        REGOP_WRITE(ERXFCON, rxFilter),
+    };
+
+    if (!rxSleepFilter)
+        return ERR_SUCCESS;
+    if (regProgram_run(program, sizeof(program)/sizeof(program[0])) != ERR_SUCCESS)
+        return ERR_DRIVER_FAIL;
+    rxSleepFilter = false;
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to change the flow control at runtime
+ * @param[in] fcen         EFLOCON.FCEN - EFLOCON_FC_* value
+ * @param[in] pauseTimer   pause timer value sent in pause frames (EPAUS), in units of 512 bit times
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t ethernet_setFlowControl(uint8_t fcen, uint16_t pauseTimer){
+    /* EPAUS must be programmed before flow control is enabled */
+    const regOp_t program[] = {
+        REGOP_WRITE16(EPAUSL, EPAUSH, pauseTimer),
+        REGOP_FIELD(EFLOCON, fcen, EFLOCON_FCEN_MASK),
+    };
+    return regProgram_run(program, sizeof(program)/sizeof(program[0]));
+}
+
+
+/*! @brief function to move the host side of the receive ring to the
+ * hardware write pointer, read with reception off, after an overflow or a
+ * corrupt next packet pointer. The frames left are counted as dropped.
+ * The caller writes the result to ERXRDPT and decrements EPKTCNT to 0.
+ * @param[in] wrPtr        ERXWRPT
+ * @param[in] dropped      EPKTCNT, frames discarded
+ * @return              value for ERXRDPT
+ */
+uint16_t ethernet_rxResync(uint16_t wrPtr, uint8_t dropped){
+    /* The next frame will be written at ERXWRPT. ERXRDPT must be odd (errata),
+     * it stays one byte behind */
+    gnextPacketPtr = wrPtr;
+    rxRdPtShadow = (wrPtr == RXSTART_INIT) ? RXSTOP_INIT : wrPtr - 1;
+    rxStats.rxOverflows++;
+    rxStats.rxDropped += dropped;
+    return rxRdPtShadow;
+}
+
+
+/*! @brief function to recover from a receive buffer overflow (EIR.RXERIF)
+ * without reinitializing: reception is disabled, the frames left in the
+ * ring are discarded by moving the read pointer to the hardware write
+ * pointer and decrementing EPKTCNT to 0, then RXERIF is cleared and
+ * reception enabled again
+ *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t ethernet_rxOverflowRecover(void){
+    spiQueueItem_t items[RX_PKTDEC_BATCH + 2];
+    uint8_t used = 0;
+    uint8_t pending;
+    uint16_t wrPtr;
+    uint16_t rdPtr;
+    uint32_t start;
+
+    /* Stop reception and let a frame being written finish */
+    if(ENC_BFC(ECON1, ECON1_RXEN)!=ERR_SUCCESS)
+	return ERR_DRIVER_FAIL;
+    start = ethernet_nowUs();
+    while((ENC_READ(ESTAT) & ESTAT_RXBUSY) && ethernet_nowUs() - start < RX_IDLE_TIMEOUT_US);
+
+    /* With reception off the write pointer and the packet count are stable */
+    pending = ENC_READ(EPKTCNT);
+    wrPtr = ENC_READ(ERXWRPTL);
+    wrPtr |= ENC_READ(ERXWRPTH) << 8;
+
+    rdPtr = ethernet_rxResync(wrPtr, pending);
+    used += spiQueue_buildWrite(&items[used], ERXRDPTL, rdPtr & 0x00ff);
+    used += spiQueue_buildWrite(&items[used], ERXRDPTH, (rdPtr & 0xff00) >> 8);
+
+    /* EPKTCNT only goes down through PKTDEC, one per discarded frame */
+    while (pending > 0){
+	if (used == RX_PKTDEC_BATCH + 2){
+	    if (spi_transferItems(items, used) != ERR_SUCCESS)
+		return ERR_DRIVER_FAIL;
+	    used = 0;
+	}
+	spiQueue_buildBitField(&items[used++], ECON2, ECON2_PKTDEC, true);
+	pending--;
+    }
+    if (spi_transferItems(items, used) != ERR_SUCCESS)
+	return ERR_DRIVER_FAIL;
+
+    /* Clear the overflow and receive again */
+    spiQueue_buildBitField(&items[0], EIR, EIR_RXERIF, false);
+    spiQueue_buildBitField(&items[1], ECON1, ECON1_RXEN, true);
+    return spi_transferItems(items, 2);
+}
+
+
+/*! @brief function to check EIR.RXERIF and recover from a receive buffer
+ * overflow if it is set
+ *  @return 	ERR_SUCCESS if there was no overflow or it was recovered, ERR_DRIVER_FAIL on failure
+ */
+spierr_t ethernet_rxCheckOverflow(void){
+    if (!(ENC_READ(EIR) & EIR_RXERIF))
+	return ERR_SUCCESS;
+    return ethernet_rxOverflowRecover();
+}
+
+
+/*! @brief function to get the receive counters
+ * @param[out] stats      copy of the counters
+ */
+void ethernet_getRxStats(ethernet_rxStats_t *stats){
+    if (stats != NULL)
+	*stats = rxStats;
+}
+
+
+/*! @brief function to get a snapshot of all driver counters, receive,
+ * transmit and SPI cost, with the derived SPI efficiency
+ * @param[out] stats      copy of the counters
+ */
+void ethernet_getStats(ethernet_stats_t *stats){
+    uint64_t payload;
+
+    if (stats == NULL)
+	return;
+    stats->rx = rxStats;
+    stats->tx = txStats;
+    ethernet_getPowerStats(&stats->pwr);
+    spi_getStats(&stats->spi);
+
+    payload = (uint64_t) rxStats.rxBytes + txStats.txBytes;
+    stats->efficiencyPermille = stats->spi.bytes ? (uint32_t) (payload * 1000 / stats->spi.bytes) : 0;
+}
+
+
+/*! @brief function to reset all driver counters, including the SPI ones
+ */
+void ethernet_resetStats(void){
+    memset(&rxStats, 0, sizeof(rxStats));
+    memset(&txStats, 0, sizeof(txStats));
+    memset(&pwrStats, 0, sizeof(pwrStats));
+    memset(&arpStats, 0, sizeof(arpStats));
+    if (pwrAsleep)
+	pwrSleepStartUs = ethernet_nowUs();
+    spi_resetStats();
+}
+
+
+/*! @brief function to put the ENC28J60 in power-save mode: reception is
+ * turned off, a frame being received or transmitted is let finish, then
+ * ECON2.VRPS and ECON2.PWRSV are set
+ *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t ethernet_powerSaveEnter(void){
+    spiQueueItem_t items[2];
+    uint32_t start;
+
+    if (pwrAsleep)
+	return ERR_SUCCESS;
+
+    pwrRxWasOn = (ENC_READ(ECON1) & ECON1_RXEN) != 0;
+    if(ENC_BFC(ECON1, ECON1_RXEN)!=ERR_SUCCESS)
+	return ERR_DRIVER_FAIL;
+    start = ethernet_nowUs();
+    while((ENC_READ(ESTAT) & ESTAT_RXBUSY) && ethernet_nowUs() - start < RX_IDLE_TIMEOUT_US);
+    ethernet_txPoll();
+
+    /* Low current regulator mode first, then the main power down */
+    spiQueue_buildBitField(&items[0], ECON2, ECON2_VRPS, true);
+    spiQueue_buildBitField(&items[1], ECON2, ECON2_PWRSV, true);
+    if (spi_transferItems(items, 2) != ERR_SUCCESS)
+	return ERR_DRIVER_FAIL;
+
+    pwrAsleep = true;
+    pwrSleepStartUs = ethernet_nowUs();
+    pwrStats.sleeps++;
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to leave power-save mode: ECON2.PWRSV is cleared,
+ * ESTAT.CLKRDY is polled (bounded) and reception restored if it was on
+ *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t ethernet_powerSaveExit(void){
+    uint32_t start, latency;
+
+    if (!pwrAsleep)
+	return ERR_SUCCESS;
+
+    start = ethernet_nowUs();
+    pwrStats.asleepMs += (start - pwrSleepStartUs) / 1000;
+    pwrSleepStartUs = start;
+    if(ENC_BFC(ECON2, ECON2_PWRSV)!=ERR_SUCCESS)
+	return ERR_DRIVER_FAIL;
+    /* The oscillator and PHY need about 300 us, CLKRDY tells when they are back */
+    while(!(ENC_READ(ESTAT) & ESTAT_CLKRDY)){
+	if (ethernet_nowUs() - start > CLKRDY_TIMEOUT_US)
+	    return ERR_DRIVER_FAIL;
+    }
+    pwrAsleep = false;
+    if (pwrRxWasOn && ENC_BFS(ECON1, ECON1_RXEN) != ERR_SUCCESS)
+	return ERR_DRIVER_FAIL;
+
+    latency = ethernet_nowUs() - start;
+    pwrStats.wakes++;
+    pwrStats.lastWakeUs = latency;
+    pwrStats.totalWakeUs += latency;
+    if (latency > pwrStats.maxWakeUs)
+	pwrStats.maxWakeUs = latency;
+    pwrLastActivityUs = ethernet_nowUs();
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to configure the power-save idle manager
+ * @param[in] quietMs      time without traffic before entering power-save, 0 disables the manager
+ * @param[in] pollMs       time asleep before waking for a scheduled poll, 0 only wakes on transmit
+ */
+void ethernet_setPowerSave(uint32_t quietMs, uint32_t pollMs){
+    pwrQuietMs = quietMs;
+    pwrPollMs = pollMs;
+    pwrLastActivityUs = ethernet_nowUs();
+}
+
+
+/*! @brief function to note traffic for the idle manager
+ * @param[in] wake         wake the ENC28J60 if it is in power-save (transmit)
+ *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL if the wake failed
+ */
+spierr_t ethernet_powerSaveActivity(bool wake){
+    pwrLastActivityUs = ethernet_nowUs();
+    if (wake && pwrAsleep)
+	return ethernet_powerSaveExit();
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to run the idle manager, call it periodically: enters
+ * power-save after the quiet period without traffic or pending frames,
+ * wakes for the scheduled poll, the link then stays up for a quiet period
+ *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t ethernet_powerSavePoll(void){
+    uint32_t now = ethernet_nowUs();
+
+    if (pwrQuietMs == 0)
+	return ERR_SUCCESS;
+
+    if (pwrAsleep){
+	if (pwrPollMs != 0 && now - pwrSleepStartUs >= pwrPollMs * 1000)
+	    return ethernet_powerSaveExit();
+	return ERR_SUCCESS;
+    }
+
+    if (now - pwrLastActivityUs < pwrQuietMs * 1000)
+	return ERR_SUCCESS;
+    /* Frames still in the ring are traffic */
+    if (ENC_READ(EPKTCNT) != 0 || txPending){
+	pwrLastActivityUs = now;
+	return ERR_SUCCESS;
+    }
+    return ethernet_powerSaveEnter();
+}
+
+
+/*! @brief function to get the power-save counters
+ * @param[out] stats      copy of the counters, asleepMs includes the current sleep
+ */
+void ethernet_getPowerStats(ethernet_pwrStats_t *stats){
+    if (stats == NULL)
+	return;
+    *stats = pwrStats;
+    if (pwrAsleep)
+	stats->asleepMs += (ethernet_nowUs() - pwrSleepStartUs) / 1000;
+}
+
+
 /*! @brief function to read a slice of the incoming packet
  * @param[in] dest		Destination buffer
  * @param[in] maxLength	Maximum number of bytes to read from packet
@@ -386,8 +1291,8 @@ spierr_t ethernet_receiveDisable(void){
  * @return number of bytes to copy
  */
 uint16_t readPacketSlice(char* dest, int16_t maxlength, int16_t packetOffset){
-    uint8_t erxrdptL = spi_read(ERXRDPTL);
-    uint8_t erxrdptH = spi_read(ERXRDPTH);
+    uint8_t erxrdptL = ENC_READ(ERXRDPTL);
+    uint8_t erxrdptH = ENC_READ(ERXRDPTH);
     uint16_t erxrdpt = erxrdptH << 8 | erxrdptL;
     int16_t packetLength;
 
@@ -444,9 +1349,14 @@ uint16_t ethernet_getRecvLength(uint8_t pkthdr[24]){
     if(nextpktptr == ERR_DRIVER_FAIL){
         return (uint16_t) ERR_DRIVER_FAIL;
     }
+    ENC_PROBE(ENC_PROBE_RSV_READ);
 
     uint16_t len, type;
     status =  pkthdr[5] << 24 | pkthdr[4] << 16 | pkthdr[3]<< 8 | pkthdr[2];
+    if (status & RSV_CRC_ERROR)
+	rxStats.rxCrcErrors++;
+    if (status & (RSV_LENGTH_CHECK_ERROR | RSV_LENGTH_OUT_OF_RANGE))
+	rxStats.rxLengthErrors++;
 
     uint8_t dest_mac[6];
     uint8_t src_mac[6];
@@ -454,37 +1364,36 @@ uint16_t ethernet_getRecvLength(uint8_t pkthdr[24]){
     memcpy(dest_mac, pkthdr+6, 6);
     memcpy(src_mac, pkthdr+12, 6);
 
-    type =  pkthdr[22] << 8 | pkthdr[23];
+    /* next packet pointer (2), receive status vector (4), dest (6), src (6), type */
+    type =  pkthdr[18] << 8 | pkthdr[19];
     if (type == 0x0800){
         len = 64;
     } else {
         len = type;
     }
-        
-    uint8_t lastVal;
-    memcpy_from_enc(&lastVal, 3071, 1);
-    Display_printf(display,0,0,"LastVal : %d", lastVal);		 
+
     /* Add the length of the ethernet header (14 bytes) to the computed length */
     return len+14;
 }
 
 
 /*! @brief function to receive packets from dest MAC
- * @param[in] char* receiveBuffer  Buffer in which to receieve message
+ * @param[in] char* receiveBuffer  Buffer in which to receieve message, len bytes
  * @return length, ERR_DRIVER_FAIL if failure
  */
 spierr_t ethernet_packetReceive(uint8_t* receiveBuffer, uint16_t len){
     /* If the number of packets to be read is >0 */
-    uint8_t RxRdPtrL = spi_read(ERXRDPTL);
-    uint8_t RxRdPtrH = spi_read(ERXRDPTH);
+    uint8_t RxRdPtrL = ENC_READ(ERXRDPTL);
+    uint8_t RxRdPtrH = ENC_READ(ERXRDPTH);
     uint16_t RxRdPt = RxRdPtrH<<8 | RxRdPtrL;
     if (numPackets ==0){
-	    if(spi_write(ERXRDPTL,(gnextPacketPtr) & 0x00ff)!=ERR_SUCCESS){
+	    if(ENC_WRITE(ERXRDPTL,(gnextPacketPtr) & 0x00ff)!=ERR_SUCCESS){
             return ERR_DRIVER_FAIL;
         }
-        if(spi_write(ERXRDPTH,((gnextPacketPtr) & 0xff00 )>>8)!=ERR_SUCCESS){
+        if(ENC_WRITE(ERXRDPTH,((gnextPacketPtr) & 0xff00 )>>8)!=ERR_SUCCESS){
             return ERR_DRIVER_FAIL;
         }
+        rxRdPtShadow = gnextPacketPtr;
     }
 	gnextPacketPtr+=6;	
         
@@ -493,26 +1402,32 @@ spierr_t ethernet_packetReceive(uint8_t* receiveBuffer, uint16_t len){
     } else {
         if(readBufferMemory(receiveBuffer, gnextPacketPtr, len)!=0)
     return  ERR_DRIVER_FAIL;
-        receiveBuffer[len] = 0;
+        ENC_PROBE(ENC_PROBE_PAYLOAD_DONE);
+        encCapture_tap(ENC_CAPTURE_RX, receiveBuffer, len, NULL, 0, len);
+        rxStats.rxPackets++;
+        rxStats.rxBytes += len;
+        ethernet_powerSaveActivity(false);
     }
     gnextPacketPtr = nextpktptr-1;
 
     if(gnextPacketPtr > RXSTOP_INIT){
-        if(spi_write(ERXRDPTL,RXSTOP_INIT & 0x00ff)!=ERR_SUCCESS){
+        if(ENC_WRITE(ERXRDPTL,RXSTOP_INIT & 0x00ff)!=ERR_SUCCESS){
             return ERR_DRIVER_FAIL;
         }
 
-        if(spi_write(ERXRDPTH,(RXSTOP_INIT & 0xff00 )>>8)!=ERR_SUCCESS){
+        if(ENC_WRITE(ERXRDPTH,(RXSTOP_INIT & 0xff00 )>>8)!=ERR_SUCCESS){
             return ERR_DRIVER_FAIL;
         }
+        rxRdPtShadow = RXSTOP_INIT;
     } else {
-        if(spi_write(ERXRDPTL,(gnextPacketPtr ) & 0x00ff)!=ERR_SUCCESS){
+        if(ENC_WRITE(ERXRDPTL,(gnextPacketPtr ) & 0x00ff)!=ERR_SUCCESS){
             return ERR_DRIVER_FAIL;
         }
 
-        if(spi_write(ERXRDPTH,((gnextPacketPtr ) & 0xff00) >> 8 )!=ERR_SUCCESS){
+        if(ENC_WRITE(ERXRDPTH,((gnextPacketPtr ) & 0xff00) >> 8 )!=ERR_SUCCESS){
             return ERR_DRIVER_FAIL;
         }
+        rxRdPtShadow = gnextPacketPtr;
     }
 
     /* set ECON2.PKTDEC */
@@ -520,113 +1435,768 @@ spierr_t ethernet_packetReceive(uint8_t* receiveBuffer, uint16_t len){
         return ERR_DRIVER_FAIL;
     }
 
-    if(bitFieldSet(0x1e, 0x40)!=ERR_SUCCESS){
+    if(ENC_BFS(ECON2, 0x40)!=ERR_SUCCESS){
         return ERR_DRIVER_FAIL;
     }
+    ENC_PROBE(ENC_PROBE_PKTDEC);
 
     numPackets++;
     return ERR_SUCCESS;
 }
 
 
+/*! @brief Receive ring address of a frame byte
+ * @param[in] rx           frame handle
+ * @param[in] offset       offset from the destination address
+ * @return              address, wrapped at the end of the ring
+ */
+static uint16_t enc_rx_address(const enc_rx_handle_t *rx, uint16_t offset){
+    uint16_t addr = rx->start + RX_PREAMBLE_LENGTH + offset;
+    if (addr > RXSTOP_INIT)
+        addr -= RXSTOP_INIT - RXSTART_INIT + 1;
+    return addr;
+}
+
+
+/*! @brief function to build the chain of enc_rx_peek, for callers running
+ * their own SPI chains (enc_engine): the next packet pointer, the receive
+ * status vector and the first len bytes of the frame at the head of the
+ * ring are read into buf. Check EPKTCNT first, then enc_rx_parse the result.
+ * @param[out] items       at least ENC_RX_PEEK_ITEMS items
+ * @param[out] rx          frame handle, invalid until enc_rx_parse
+ * @param[out] buf         ENC_RX_PREAMBLE_LENGTH + len bytes, valid until the chain completed
+ * @param[in] len          number of frame bytes wanted, at most ENC_RX_PEEK_MAX
+ * @return              number of items used, chained through next
+ */
+uint8_t enc_rx_buildPeek(spiQueueItem_t *items, enc_rx_handle_t *rx, uint8_t *buf, uint16_t len){
+    rx->valid = false;
+    rx->start = gnextPacketPtr;
+    return spiQueue_buildReadBuffer(items, rx->start, buf, RX_PREAMBLE_LENGTH + len);
+}
+
+
+/*! @brief function to fill a frame handle from the bytes read by the chain
+ * of enc_rx_buildPeek
+ * @param[in,out] rx       frame handle from enc_rx_buildPeek
+ * @param[in] buf          bytes read, the frame bytes start at ENC_RX_PREAMBLE_LENGTH
+ * @param[in] len          number of frame bytes read
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL if the next packet pointer or
+ *                      the length is corrupt (the ring must be resynchronized)
+ */
+spierr_t enc_rx_parse(enc_rx_handle_t *rx, const uint8_t *buf, uint16_t len){
+    uint16_t byteCount;
+
+    ENC_PROBE(ENC_PROBE_RSV_READ);
+    rx->next = buf[1] << 8 | buf[0];
+    byteCount = buf[3] << 8 | buf[2];
+    rx->rsv = (uint32_t) buf[5] << 24 | (uint32_t) buf[4] << 16 | byteCount;
+    rx->length = (byteCount > RX_CRC_LENGTH) ? byteCount - RX_CRC_LENGTH : 0;
+    if (rx->next > RXSTOP_INIT || (rx->next & 1) || rx->length > MAX_MAC_LENGTH)
+        return ERR_DRIVER_FAIL;
+    if (rx->rsv & RSV_CRC_ERROR)
+        rxStats.rxCrcErrors++;
+    if (rx->rsv & (RSV_LENGTH_CHECK_ERROR | RSV_LENGTH_OUT_OF_RANGE))
+        rxStats.rxLengthErrors++;
+
+    rx->headerLen = (len < rx->length) ? len : rx->length;
+    rx->stamp = encRxTime_passStamp();
+    /* A frame peeked whole is captured at once. Otherwise it is captured
+     * once it is read whole (enc_rx_tapInto, or an enc_rx_read of the rest),
+     * or with the peeked bytes when it is released; the capture costs no
+     * SPI reads either way. Nothing read, nothing captured. */
+    rxCapPending = false;
+    if (rx->headerLen == 0){
+        /* Nothing to keep */
+    }
+    else if (rx->headerLen == rx->length){
+        encCapture_tap(ENC_CAPTURE_RX, buf + RX_PREAMBLE_LENGTH, rx->headerLen, NULL, 0, rx->length);
+    }
+    else if (encCapture_active(ENC_CAPTURE_RX)){
+        memcpy(rxCapPeek, buf + RX_PREAMBLE_LENGTH, rx->headerLen);
+        rxCapPeekLen = rx->headerLen;
+        rxCapStart = rx->start;
+        rxCapPending = true;
+    }
+    rx->valid = true;
+    ethernet_powerSaveActivity(false);
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to look at the next frame in the receive ring without
+ * copying it: the next packet pointer, the receive status vector and the
+ * first bytes of the frame are read in a single SPI transaction
+ * @param[out] rx          frame handle
+ * @param[out] header      first bytes of the frame, may be NULL if len is 0
+ * @param[in] len          number of bytes wanted, at most ENC_RX_PEEK_MAX
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure or if the ring is empty
+ */
+spierr_t enc_rx_peek(enc_rx_handle_t *rx, uint8_t *header, uint16_t len){
+    spiQueueItem_t items[ENC_RX_PEEK_ITEMS];
+    uint8_t buf[RX_PREAMBLE_LENGTH + ENC_RX_PEEK_MAX];
+
+    if (rx == NULL || len > ENC_RX_PEEK_MAX || (len != 0 && header == NULL))
+        return ERR_DRIVER_FAIL;
+    rx->valid = false;
+    if (ENC_READ(EPKTCNT) == 0)
+        return ERR_DRIVER_FAIL;
+
+    if (spi_transferItems(items, enc_rx_buildPeek(items, rx, buf, len)) != ERR_SUCCESS)
+        return ERR_DRIVER_FAIL;
+    if (enc_rx_parse(rx, buf, len) != ERR_SUCCESS)
+        return ERR_DRIVER_FAIL;
+    if (rx->headerLen != 0)
+        memcpy(header, buf + RX_PREAMBLE_LENGTH, rx->headerLen);
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to build the chain of enc_rx_read
+ * @param[out] items       at least ENC_RX_READ_ITEMS items
+ * @param[in] rx           frame handle
+ * @param[in] offset       offset from the destination address
+ * @param[in] len          number of bytes, within the frame
+ * @param[out] dest        destination, valid until the chain completed
+ * @return              number of items used, chained through next, 0 if the slice is not in the frame
+ */
+uint8_t enc_rx_buildRead(spiQueueItem_t *items, const enc_rx_handle_t *rx, uint16_t offset, uint16_t len, uint8_t *dest){
+    if (rx == NULL || !rx->valid || dest == NULL || len == 0 || offset >= rx->length || len > rx->length - offset)
+        return 0;
+    /* The read pointer wraps from ERXND to ERXST by itself */
+    return spiQueue_buildReadBuffer(items, enc_rx_address(rx, offset), dest, len);
+}
+
+
+/*! @brief function to copy a slice of the frame of a handle.
+ * Reading the rest of a peeked frame in one slice completes its capture
+ * @param[in] rx           frame handle from enc_rx_peek
+ * @param[in] offset       offset from the destination address
+ * @param[in] len          number of bytes wanted
+ * @param[out] dest        destination buffer, len bytes
+ * @return              number of bytes copied, less than len at the end of the frame,
+ *                      or ERR_DRIVER_FAIL on failure
+ */
+uint16_t enc_rx_read(const enc_rx_handle_t *rx, uint16_t offset, uint16_t len, uint8_t *dest){
+    spiQueueItem_t items[ENC_RX_READ_ITEMS];
+
+    if (rx == NULL || !rx->valid || dest == NULL)
+        return (uint16_t) ERR_DRIVER_FAIL;
+    if (offset >= rx->length)
+        return 0;
+    if (len > rx->length - offset)
+        len = rx->length - offset;
+    if (len == 0)
+        return 0;
+    /* Bulk class: a long read gives way to time critical chains between chunks */
+    if (spi_transferItemsPrio(items, enc_rx_buildRead(items, rx, offset, len, dest), SPIQ_PRIO_BULK) != ERR_SUCCESS)
+        return (uint16_t) ERR_DRIVER_FAIL;
+    /* The rest of a peeked frame completes it for the capture */
+    if (rxCapPending && rxCapStart == rx->start && offset == rxCapPeekLen && offset + len == rx->length){
+        rxCapPending = false;
+        encCapture_tap(ENC_CAPTURE_RX, rxCapPeek, rxCapPeekLen, dest, len, rx->length);
+    }
+    return len;
+}
+
+
+/*! @brief Bytes of a frame going to the header part of a destination
+ * @param[in] rx           frame handle
+ * @param[in] dest         destination
+ * @return              bytes for dest->header
+ */
+static uint16_t enc_rx_headPart(const enc_rx_handle_t *rx, const enc_rx_dest_t *dest){
+    return (rx->length < dest->headerLen) ? rx->length : dest->headerLen;
+}
+
+
+/*! @brief function to build the chain of enc_rx_readInto
+ * @param[out] items       at least ENC_RX_READ_INTO_ITEMS items
+ * @param[in] rx           frame handle
+ * @param[in] dest         destination, valid until the chain completed
+ * @return              number of items used, chained through next, 0 if the frame does not fit
+ *                      or was peeked whole
+ */
+uint8_t enc_rx_buildReadInto(spiQueueItem_t *items, const enc_rx_handle_t *rx, const enc_rx_dest_t *dest){
+    uint16_t head, skip = (rx != NULL) ? rx->headerLen : 0;
+
+    if (rx == NULL || !rx->valid || dest == NULL || rx->length <= skip
+            || rx->length > (uint32_t) dest->headerLen + dest->payloadLen)
+        return 0;
+    head = enc_rx_headPart(rx, dest);
+    if ((head > skip && dest->header == NULL) || (rx->length > head && dest->payload == NULL))
+        return 0;
+    /* The read pointer wraps from ERXND to ERXST by itself, the peeked bytes are skipped */
+    if (skip < head)
+        return spiQueue_buildReadScatter(items, enc_rx_address(rx, skip), dest->header + skip, head - skip,
+                                         dest->payload, rx->length - head);
+    return spiQueue_buildReadScatter(items, enc_rx_address(rx, skip), NULL, 0,
+                                     dest->payload + (skip - head), rx->length - skip);
+}
+
+
+/*! @brief function to capture a frame read whole into a destination, e.g.
+ * with enc_rx_buildReadInto once its chain completed. A frame peeked whole
+ * was already captured by enc_rx_parse and is not captured again, nor is
+ * the frame captured at its release.
+ * @param[in] rx           frame handle
+ * @param[in] dest         destination holding the frame
+ */
+void enc_rx_tapInto(const enc_rx_handle_t *rx, const enc_rx_dest_t *dest){
+    uint16_t head = enc_rx_headPart(rx, dest);
+
+    if (rx->headerLen >= rx->length)
+        return;
+    if (rxCapStart == rx->start)
+        rxCapPending = false;
+    encCapture_tap(ENC_CAPTURE_RX, dest->header, head, dest->payload, rx->length - head, rx->length);
+}
+
+
+/*! @brief function to read the whole frame of a handle into its final
+ * destination in a single SPI transaction, header and payload parts
+ * without an intermediate buffer. The bytes peeked with the handle are not
+ * read again, the caller puts them in dest with enc_rx_putPeeked.
+ * @param[in] rx           frame handle from enc_rx_peek, len 0 is enough
+ * @param[in] dest         destination, headerLen + payloadLen at least the frame length
+ * @return              frame length, or ERR_DRIVER_FAIL on failure or if the frame does not fit
+ */
+uint16_t enc_rx_readInto(const enc_rx_handle_t *rx, const enc_rx_dest_t *dest){
+    spiQueueItem_t items[ENC_RX_READ_INTO_ITEMS];
+    uint8_t used = enc_rx_buildReadInto(items, rx, dest);
+
+    /* Peeked whole, nothing left to read */
+    if (used == 0 && rx != NULL && rx->valid && dest != NULL && rx->length != 0 && rx->headerLen >= rx->length
+            && rx->length <= (uint32_t) dest->headerLen + dest->payloadLen)
+        return rx->length;
+    if (used == 0)
+        return (uint16_t) ERR_DRIVER_FAIL;
+    /* Bulk class: a long read gives way to time critical chains between chunks */
+    if (spi_transferItemsPrio(items, used, SPIQ_PRIO_BULK) != ERR_SUCCESS)
+        return (uint16_t) ERR_DRIVER_FAIL;
+    enc_rx_tapInto(rx, dest);
+    return rx->length;
+}
+
+
+/*! @brief function to put the bytes peeked with a handle at the start of
+ * a destination, where enc_rx_readInto does not read them again
+ * @param[in] rx           frame handle
+ * @param[in] dest         destination, as given to enc_rx_readInto
+ * @param[in] header       bytes returned by enc_rx_peek, rx->headerLen of them
+ */
+void enc_rx_putPeeked(const enc_rx_handle_t *rx, const enc_rx_dest_t *dest, const uint8_t *header){
+    uint16_t head = enc_rx_headPart(rx, dest);
+    uint16_t first = (rx->headerLen < head) ? rx->headerLen : head;
+
+    /* A destination enc_rx_readInto refuses is left alone */
+    if (rx->length > (uint32_t) dest->headerLen + dest->payloadLen
+            || (first != 0 && dest->header == NULL) || (rx->headerLen > first && dest->payload == NULL))
+        return;
+    if (first != 0)
+        memcpy(dest->header, header, first);
+    if (rx->headerLen > first)
+        memcpy(dest->payload, header + first, rx->headerLen - first);
+}
+
+
+/*! @brief function to build the chain of enc_rx_release: ERXRDPT behind
+ * the frame and EPKTCNT decremented. Call enc_rx_released once it completed.
+ * @param[out] items       at least ENC_RX_RELEASE_ITEMS items
+ * @param[in] rx           frame handle
+ * @return              number of items used, chained through next, 0 if the handle
+ *                      is not the head of the ring
+ */
+uint8_t enc_rx_buildRelease(spiQueueItem_t *items, const enc_rx_handle_t *rx){
+    uint8_t used = 0;
+    uint16_t rdPtr;
+
+    if (rx == NULL || !rx->valid || rx->start != gnextPacketPtr)
+        return 0;
+
+    /* ERXRDPT must be odd (errata), one byte before the next frame */
+    rdPtr = (rx->next == RXSTART_INIT) ? RXSTOP_INIT : rx->next - 1;
+    used += spiQueue_buildWrite(&items[used], ERXRDPTL, rdPtr & 0x00ff);
+    used += spiQueue_buildWrite(&items[used], ERXRDPTH, (rdPtr & 0xff00) >> 8);
+    spiQueue_buildBitField(&items[used++], ECON2, ECON2_PKTDEC, true);
+    items[0].next = &items[1];
+    items[1].next = &items[2];
+    return used;
+}
+
+
+/*! @brief function to move the host side of the ring behind a frame once
+ * the chain of enc_rx_buildRelease completed
+ * @param[in,out] rx       frame handle, invalid afterwards
+ */
+void enc_rx_released(enc_rx_handle_t *rx){
+    ENC_PROBE(ENC_PROBE_PKTDEC);
+    /* Never read whole, the capture keeps what was peeked */
+    if (rxCapPending && rxCapStart == rx->start){
+        rxCapPending = false;
+        encCapture_tap(ENC_CAPTURE_RX, rxCapPeek, rxCapPeekLen, NULL, 0, rx->length);
+    }
+    rx->valid = false;
+    gnextPacketPtr = rx->next;
+    rxRdPtShadow = (rx->next == RXSTART_INIT) ? RXSTOP_INIT : rx->next - 1;
+    rxStats.rxPackets++;
+    rxStats.rxBytes += rx->length;
+}
+
+
+/*! @brief function to give the frame of a handle back to the receive ring:
+ * ERXRDPT is moved behind it and EPKTCNT decremented
+ * @param[in,out] rx       frame handle from enc_rx_peek, invalid afterwards
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t enc_rx_release(enc_rx_handle_t *rx){
+    spiQueueItem_t items[ENC_RX_RELEASE_ITEMS];
+    uint8_t used = enc_rx_buildRelease(items, rx);
+
+    if (used == 0)
+        return ERR_DRIVER_FAIL;
+    rx->valid = false;
+    if (spi_transferItems(items, used) != ERR_SUCCESS)
+        return ERR_DRIVER_FAIL;
+    enc_rx_released(rx);
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to move the frames waiting in the receive ring into a
+ * frame ring, from the thread draining the ENC28J60 (producer side).
+ * Frames are read straight into the pool buffers and queued in batches,
+ * ARP requests for the responder addresses are answered before a buffer
+ * is taken. A frame without a free pool buffer, or
+ * larger than one, is released and counted as an overflow of the frame
+ * ring, so a slow consumer never makes the on-chip ring overflow.
+ * A frame whose payload read fails is queued with length 0. Starts a
+ * receive timestamp pass, see encRxTime_passBegin.
+ * @param[in] ring         frame ring from frameRing_init
+ * @param[in] budget       most frames to move, 0 for all
+ * @return              number of frames queued, or ERR_DRIVER_FAIL on failure
+ */
+int16_t ethernet_rxToRing(frameRing_t *ring, uint8_t budget){
+    uint8_t header[RX_ARP_PEEK];
+    frameDesc_t batch[RX_RING_BATCH];
+    enc_rx_handle_t rx;
+    enc_rx_dest_t dest;
+    uint16_t peek = (arpAddressCount != 0) ? RX_ARP_PEEK : 0;
+    uint8_t used = 0;
+    uint16_t seen = 0;
+    int16_t queued = 0;
+
+    if (ring == NULL)
+        return ERR_DRIVER_FAIL;
+
+    memset(&dest, 0, sizeof(dest));
+    dest.payloadLen = ring->bufSize;
+    encRxTime_passBegin();
+    while (budget == 0 || seen < budget){
+        /* The next packet pointer, the status vector and, for the ARP
+         * responder, the EtherType; the rest of the frame goes from the ring
+         * straight into its pool buffer */
+        if (enc_rx_peek(&rx, header, peek) != ERR_SUCCESS)
+            break;
+        seen++;
+
+        if (ethernet_arpRespond(&rx, header)){
+            /* Answered, nothing for the consumer */
+        }
+        else if (rx.length <= ring->bufSize && frameRing_alloc(ring, &batch[used])){
+            dest.payload = batch[used].data;
+            enc_rx_putPeeked(&rx, &dest, header);
+            if (rx.length == 0 || enc_rx_readInto(&rx, &dest) == rx.length){
+                ENC_PROBE(ENC_PROBE_PAYLOAD_DONE);
+                batch[used].length = rx.length;
+                batch[used].rsv = rx.rsv;
+                batch[used].stamp = rx.stamp;
+                used++;
+            }
+            else{
+                /* Not queued, the buffer goes back with the next batch as an empty frame */
+                batch[used].length = 0;
+                batch[used++].rsv = 0;
+            }
+        }
+        else if (rx.length > ring->bufSize){
+            ring->stats.overflows++;
+        }
+
+        if (enc_rx_release(&rx) != ERR_SUCCESS){
+            frameRing_enqueue(ring, batch, used);
+            return ERR_DRIVER_FAIL;
+        }
+        if (used == RX_RING_BATCH){
+            frameRing_enqueue(ring, batch, used);
+            queued += used;
+            used = 0;
+        }
+    }
+    frameRing_enqueue(ring, batch, used);
+    queued += used;
+    return queued;
+}
+
+
+/*! @brief function to receive the frames waiting in the receive ring
+ * straight into memory lent by the consumer: only the next packet pointer,
+ * the receive status vector and, with ARP responder addresses set, the
+ * EtherType are read first, then destFxn is asked for the destination and
+ * the frame crosses the SPI once into it. Starts a
+ * receive timestamp pass, see encRxTime_passBegin.
+ * @param[in] destFxn      lends the destination of each frame
+ * @param[in] deliverFxn   gets every lent destination back
+ * @param[in] arg          argument of both
+ * @param[in] budget       most frames to receive, 0 for all
+ * @return              number of frames delivered, or ERR_DRIVER_FAIL on failure
+ */
+int16_t ethernet_rxZeroCopy(ethernet_rxDestFxn destFxn, ethernet_rxDeliverFxn deliverFxn, void *arg, uint8_t budget){
+    uint8_t header[RX_ARP_PEEK];
+    enc_rx_handle_t rx;
+    enc_rx_dest_t dest;
+    uint16_t peek = (arpAddressCount != 0) ? RX_ARP_PEEK : 0;
+    uint16_t seen = 0;
+    int16_t delivered = 0;
+    spierr_t released;
+    bool ok;
+
+    if (destFxn == NULL || deliverFxn == NULL)
+        return ERR_DRIVER_FAIL;
+
+    encRxTime_passBegin();
+    while (budget == 0 || seen < budget){
+        if (enc_rx_peek(&rx, header, peek) != ERR_SUCCESS)
+            break;
+        seen++;
+
+        memset(&dest, 0, sizeof(dest));
+        /* ARP requests for the responder addresses are answered before a destination is asked for */
+        if (ethernet_arpRespond(&rx, header) || rx.length == 0 || !destFxn(arg, &rx, &dest)){
+            /* Answered or dropped, nothing lent */
+            if (enc_rx_release(&rx) != ERR_SUCCESS)
+                return ERR_DRIVER_FAIL;
+            continue;
+        }
+
+        /* The peeked EtherType is not read again */
+        enc_rx_putPeeked(&rx, &dest, header);
+        ok = enc_rx_readInto(&rx, &dest) == rx.length;
+        if (ok)
+            ENC_PROBE(ENC_PROBE_PAYLOAD_DONE);
+        /* The ring space is freed before the consumer runs */
+        released = enc_rx_release(&rx);
+        deliverFxn(arg, &rx, &dest, ok);
+        if (released != ERR_SUCCESS)
+            return ERR_DRIVER_FAIL;
+        if (ok)
+            delivered++;
+    }
+    return delivered;
+}
+
+
+/* ======== ARP responder ===========
+ *
+ * ===================================
+ */
+
+/* Reply layout behind the per packet control byte */
+#define ARP_FRAME_LEN     42
+#define ARP_SPA_OFF       29
+#define ARP_REPLY_LEN     (1 + ARP_FRAME_LEN)
+#if ARP_TXSTART + ARP_REPLY_LEN + TSV_LENGTH > 0x1FFF
+#error "ARP reply does not fit"
+#endif
+
+/* Items of a reply: destination WBM, SPA/THA/TPA WBM, ETXST/ETXND L/H,
+ * EIR.TXIF clear and ECON1.TXRTS set */
+#define ARP_CHAIN_ITEMS (2*SPIQ_BUFFER_ITEMS + 4*SPIQ_REG_ITEMS + 2)
+
+static spiQueueItem_t arpChain[ARP_CHAIN_ITEMS];
+/* Target fields of the reply: our address, then the sender of the request */
+static uint8_t arpTarget[14];
+
+
+/*! @brief function to let the driver answer ARP requests for the given
+ * IPv4 addresses from the receive path. The reply is written once to
+ * ARP_TXSTART, per request only the destination and the target fields
+ * are patched.
+ * @param[in] addresses    host order, 192.168.0.1 is 0xc0a80001
+ * @param[in] count        number of addresses, at most ETH_ARP_MAX_ADDRESSES, 0 to turn it off
+ *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t ethernet_arpResponderEnable(const uint32_t *addresses, uint8_t count){
+    uint8_t reply[ARP_REPLY_LEN];
+
+    arpAddressCount = 0;
+    if (count == 0)
+        return ERR_SUCCESS;
+    if (addresses == NULL || count > ETH_ARP_MAX_ADDRESSES)
+        return ERR_DRIVER_FAIL;
+
+    memset(reply, 0, sizeof(reply));
+    /* Per packet control byte: MACON3 pads and appends the CRC */
+    reply[0] = 0x00;
+    memcpy(&reply[7], mymac, 6);
+    reply[13] = 0x08;
+    reply[14] = 0x06;
+    reply[16] = 0x01;                   /* Ethernet */
+    reply[17] = 0x08;                   /* IPv4 */
+    reply[19] = 6;
+    reply[20] = 4;
+    reply[22] = 0x02;                   /* reply */
+    memcpy(&reply[23], mymac, 6);
+
+    /* The frame in flight may be an earlier reply */
+    ethernet_txPoll();
+    if (writeBufferMemory(reply, ARP_TXSTART, ARP_REPLY_LEN) != ERR_SUCCESS)
+        return ERR_DRIVER_FAIL;
+    memcpy(arpAddresses, addresses, count * sizeof(uint32_t));
+    arpAddressCount = count;
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to answer the frame of a handle if it is an ARP request
+ * for one of the responder addresses. The ARP body comes from the peeked
+ * bytes, or is the only part read from the ring. The frame is still
+ * released by the caller. The previous frame is not waited for: while it
+ * is still being sent the request goes unanswered and is counted as
+ * skipped, the requester asks again.
+ * @param[in] rx           frame handle from enc_rx_peek
+ * @param[in] header       peeked bytes
+ * @return              true if the frame was an ARP request for us and is consumed
+ */
+bool ethernet_arpRespond(const enc_rx_handle_t *rx, const uint8_t *header){
+    spiQueueItem_t items[ETH_TX_RESET_ITEMS];
+    ethernet_txResult_t result;
+    uint8_t body[28];
+    const uint8_t *arp = body;
+    uint32_t target;
+    uint8_t used = 0;
+    uint8_t i;
+
+    if (arpAddressCount == 0 || rx->headerLen < 14 || header[12] != 0x08 || header[13] != 0x06
+            || rx->length < ARP_FRAME_LEN || !(rx->rsv & RSV_RECEIVED_OK))
+        return false;
+    if (rx->headerLen >= ARP_FRAME_LEN)
+        arp = header + 14;
+    else if (enc_rx_read(rx, 14, sizeof(body), body) != sizeof(body))
+        return false;
+
+    /* Ethernet/IPv4 request */
+    if (arp[0] != 0 || arp[1] != 1 || arp[2] != 0x08 || arp[3] != 0x00 || arp[4] != 6 || arp[5] != 4
+            || arp[6] != 0 || arp[7] != 1)
+        return false;
+    target = (uint32_t) arp[24] << 24 | (uint32_t) arp[25] << 16 | (uint32_t) arp[26] << 8 | arp[27];
+    for (i = 0; i < arpAddressCount && arpAddresses[i] != target; i++)
+        ;
+    if (i == arpAddressCount)
+        return false;
+    arpStats.requests++;
+
+    /* The previous frame must have left the transmit logic, the receive
+     * path does not wait for it */
+    if (txPending){
+        result = ethernet_txCheck(ENC_READ(ECON1), ENC_READ(ESTAT), ENC_READ(EIR), false);
+        if (result != ETH_TX_DONE){
+            /* An aborted frame is started again, its sender finishes it */
+            if (result == ETH_TX_FAILED){
+                if (spi_transferItems(items, ethernet_txBuildReset(items, true)) == ERR_SUCCESS)
+                    ethernet_txResetDone(true);
+                else
+                    ethernet_txDropped();
+            }
+            arpStats.skipped++;
+            return true;
+        }
+    }
+    if (ethernet_powerSaveActivity(true) != ERR_SUCCESS){
+        arpStats.failures++;
+        return true;
+    }
+
+    /* SPA is the address asked for, THA/TPA the sender of the request */
+    memcpy(arpTarget, &arp[24], 4);
+    memcpy(&arpTarget[4], &arp[8], 10);
+    used += spiQueue_buildWriteBuffer(&arpChain[used], ARP_TXSTART + 1, (uint8_t *) &arp[8], 6);
+    used += spiQueue_buildWriteBuffer(&arpChain[used], ARP_TXSTART + ARP_SPA_OFF, arpTarget, sizeof(arpTarget));
+    if (txProgStart != ARP_TXSTART){
+        used += spiQueue_buildWrite(&arpChain[used], ETXSTL, ARP_TXSTART & 0x00ff);
+        used += spiQueue_buildWrite(&arpChain[used], ETXSTH, (ARP_TXSTART & 0xff00) >> 8);
+    }
+    if (txProgEnd != ARP_TXSTART + ARP_FRAME_LEN){
+        used += spiQueue_buildWrite(&arpChain[used], ETXNDL, (ARP_TXSTART + ARP_FRAME_LEN) & 0x00ff);
+        used += spiQueue_buildWrite(&arpChain[used], ETXNDH, ((ARP_TXSTART + ARP_FRAME_LEN) & 0xff00) >> 8);
+    }
+    spiQueue_buildBitField(&arpChain[used++], EIR, EIR_TXIF | EIR_TXERIF, false);
+    spiQueue_buildBitField(&arpChain[used++], ECON1, ECON1_TXRTS, true);
+
+    if (spi_transferItems(arpChain, used) != ERR_SUCCESS){
+        txProgStart = txProgEnd = 0xffff;
+        arpStats.failures++;
+        return true;
+    }
+    txProgStart = ARP_TXSTART;
+    txProgEnd = ARP_TXSTART + ARP_FRAME_LEN;
+    txEndAddr = txProgEnd;
+    txLength = ARP_FRAME_LEN;
+    txPending = true;
+    arpStats.replies++;
+    return true;
+}
+
+
+/*! @brief function to get the ARP responder counters
+ * @param[out] stats       copy of the counters
+ */
+void ethernet_getArpStats(ethernet_arpStats_t *stats){
+    if (stats != NULL)
+        *stats = arpStats;
+}
+
+
 /* ============= Helper functions to clear buffer, peek at buffer,   
  * 		 calculate free space ============================
  */
 
-/*! @brief function to clear the receive buffer on ENC28J60
+static uint8_t memFillBlock[MEMFILL_BLOCK];
+static spiQueueItem_t memFillChain[MEMFILL_CHAIN_ITEMS];
+
+
+/*! @brief function to fill a range of the buffer memory with one value.
+ * Each chain is one WBM streaming the same block up to MEMFILL_DATA_ITEMS
+ * times under a single chip select, 8 KB take four chains.
+ * @param[in] start        first address
+ * @param[in] end          last address, at most SRAM_END (0x1FFF)
+ * @param[in] value        fill byte
  *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
  */
-spierr_t clearRxBuf(void){
-    uint16_t num_units = (RXSTOP_INIT-RXSTART_INIT)/10;
-    uint16_t unit_len = (RXSTOP_INIT-RXSTART_INIT)/num_units;
-    Display_printf(display,0,0,"Length is : %d, num_units: %d, unit_len : %d", RXSTOP_INIT-RXSTART_INIT, num_units, unit_len);
-    uint8_t test_TxBuf[10];
-    int i;
-    memset(test_TxBuf, 0, unit_len);
-    for(i=0;i<num_units;i++){
-	if(writeBufferMemory(test_TxBuf, unit_len*i, unit_len)!=ERR_SUCCESS)
-		return ERR_DRIVER_FAIL;
+spierr_t ethernet_memFill(uint16_t start, uint16_t end, uint8_t value){
+    uint32_t addr = start;
+    uint16_t chunk;
+    uint8_t used, n;
+
+    if (start > end || end > SRAM_END)
+        return ERR_DRIVER_FAIL;
+    memset(memFillBlock, value, sizeof(memFillBlock));
+
+    while (addr <= end){
+        chunk = (end - addr + 1 < MEMFILL_BLOCK) ? end - addr + 1 : MEMFILL_BLOCK;
+        used = spiQueue_buildWriteBuffer(memFillChain, addr, memFillBlock, chunk);
+        addr += chunk;
+        /* The write pointer increments by itself, more data under the same chip select */
+        for (n = 1; n < MEMFILL_DATA_ITEMS && addr <= end; n++){
+            chunk = (end - addr + 1 < MEMFILL_BLOCK) ? end - addr + 1 : MEMFILL_BLOCK;
+            memFillChain[used - 1].flags &= ~SPIQ_CS_RELEASE;
+            memFillChain[used] = memFillChain[used - 1];
+            memFillChain[used].flags = SPIQ_CS_RELEASE;
+            memFillChain[used].count = chunk;
+            used++;
+            addr += chunk;
+        }
+        if (spi_transferItems(memFillChain, used) != ERR_SUCCESS)
+            return ERR_DRIVER_FAIL;
     }
-    /* And the last one */
-    
-    /* Restore parameters to initial states */
     return ERR_SUCCESS;
 }
 
 
+/*! @brief function to clear the receive buffer on ENC28J60
+ *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t clearRxBuf(void){
+    return ethernet_memFill(RXSTART_INIT, RXSTOP_INIT, 0);
+}
+
+
 /*! @brief function to clear the transmit buffer on ENC28J60
  *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
  */
 spierr_t clearTxBuf(void){
-    uint16_t num_units = (TXSTOP_INIT-TXSTART_INIT)/10;
-    uint16_t unit_len = (TXSTOP_INIT-TXSTART_INIT)/num_units;
-    Display_printf(display,0,0,"Length is : %d, num_units: %d, unit_len : %d", TXSTOP_INIT-TXSTART_INIT, num_units, unit_len);
-    uint8_t test_TxBuf[10];
-    int i;
-    memset(test_TxBuf, 0, unit_len);
-    for(i=0;i<num_units;i++){
-        if(writeBufferMemory(test_TxBuf, unit_len*i, unit_len)!=ERR_SUCCESS)
-		return ERR_DRIVER_FAIL;
-    }	
-    return ERR_SUCCESS;
+    /* Finish a frame in flight before its bytes are overwritten, a dropped one is counted */
+    ethernet_txPoll();
+    return ethernet_memFill(TXSTART_INIT, TXSTOP_INIT, 0);
 }
 
 
-/*! @brief function to clear the entire buffer
+/*! @brief function to clear the entire buffer. The stream and ARP reply
+ * templates are lost as well, so the stream is stopped and the ARP
+ * responder turned off; start them again afterwards.
  *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
  */
 spierr_t clearWholeBuf(void){
-    uint16_t num_units = (TXSTOP_INIT-RXSTART_INIT)/10;
-    uint16_t unit_len = (TXSTOP_INIT-RXSTART_INIT)/num_units;
-    Display_printf(display,0,0,"Length is : %d, num_units: %d, unit_len : %d", TXSTOP_INIT-RXSTART_INIT, num_units, unit_len);
-    uint8_t test_Buf[10];
-    int i;
-    memset(test_Buf, 0, unit_len);
-    for(i=0;i<num_units;i++){
-        if(writeBufferMemory(test_Buf, unit_len*i, unit_len)!=ERR_SUCCESS)
-		return ERR_DRIVER_FAIL;
-    }
-    return ERR_SUCCESS;
+    /* Finish a frame in flight before its bytes are overwritten, a dropped one is counted */
+    ethernet_txPoll();
+    streamActive = false;
+    arpAddressCount = 0;
+    return ethernet_memFill(0x0000, SRAM_END, 0);
 }
 
 
-/*! @brief function to calculate free space
+/*! @brief function to get the receive ring occupancy from the shadowed
+ * read pointer and one snapshot of ERXWRPT and EPKTCNT. The ring bounds
+ * are the driver constants, ERXST/ERXND/ERXRDPT are not read.
+ * The snapshot is one SPI chain: EPKTCNT, ERXWRPTL, ERXWRPTH, EPKTCNT.
+ * ERXWRPT moves when EPKTCNT goes up, so equal counts mean L and H match;
+ * otherwise the chain is run again.
+ * @param[out] occ         free bytes, used bytes and pending frames
  *  @return 	ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
  */
-uint16_t ethernet_calcfreeSpaceBuffer(void){
-    uint8_t num_packets = spi_read(EPKTCNT);
-    uint8_t ReadWrtPtrL = spi_read(ERXWRPTL);
-    uint8_t ReadWrtPtrH = spi_read(ERXWRPTH);
-    /* Assure that you get a matching set of RdWrPTL and H bytes */
-    while (spi_read(EPKTCNT)!= num_packets){
-        num_packets = spi_read(EPKTCNT);
-        ReadWrtPtrL = spi_read(ERXWRPTL);
-        ReadWrtPtrH = spi_read(ERXWRPTH);
-    }
-
-    uint8_t RxRdPtrL = spi_read(ERXRDPTL);
-    uint8_t RxRdPtrH = spi_read(ERXRDPTH);
-    uint16_t RxRdPt = RxRdPtrH<<8 | RxRdPtrL;
-    uint16_t ReadWrPtr = ReadWrtPtrH << 8 | ReadWrtPtrL;
-    uint16_t FreeSpace;
+spierr_t ethernet_rxOccupancy(ethernet_rxOccupancy_t *occ){
+    spiQueueItem_t items[4 * SPIQ_REG_ITEMS];
+    uint8_t used, tries;
+    uint8_t pending = 0;
+    uint16_t wrPtr = 0;
+    uint16_t size = RXSTOP_INIT - RXSTART_INIT + 1;
+
+    if (occ == NULL)
+        return ERR_DRIVER_FAIL;
 
-    uint8_t RxNdL = spi_read(ERXNDL);
-    uint8_t RxNdH = spi_read(ERXNDH);
-    uint16_t RxNd = RxNdH << 8 | RxNdL;
+    for (tries = 0; ; tries++){
+        if (tries == RX_OCCUPANCY_TRIES)
+            return ERR_DRIVER_FAIL;
+        used = 0;
+        used += spiQueue_buildRead(&items[used], EPKTCNT, false);
+        used += spiQueue_buildRead(&items[used], ERXWRPTL, false);
+        used += spiQueue_buildRead(&items[used], ERXWRPTH, false);
+        used += spiQueue_buildRead(&items[used], EPKTCNT, false);
+        if (spi_transferItems(items, used) != ERR_SUCCESS)
+            return ERR_DRIVER_FAIL;
+        pending = spiQueue_readValue(&items[0]);
+        if (spiQueue_readValue(&items[3]) != pending)
+            continue;
+        wrPtr = spiQueue_readValue(&items[2]) << 8 | spiQueue_readValue(&items[1]);
+        break;
+    }
+    /* RXSTART_INIT is 0, only the upper bound can be crossed */
+    if (wrPtr > RXSTOP_INIT)
+        return ERR_DRIVER_FAIL;
 
-    uint8_t RxStL = spi_read(ERXSTL);
-    uint8_t RxStH = spi_read(ERXSTH);
-    uint16_t RxSt = RxStH << 8 | RxStL;
+    /* Unread bytes run from the byte after ERXRDPT up to ERXWRPT */
+    occ->usedBytes = (uint16_t) (wrPtr + size - rxRdPtShadow - 1) % size;
+    /* Datasheet formula, the byte at ERXRDPT is never written */
+    if (wrPtr > rxRdPtShadow)
+        occ->freeBytes = (RXSTOP_INIT - RXSTART_INIT) - (wrPtr - rxRdPtShadow);
+    else if (wrPtr == rxRdPtShadow)
+        occ->freeBytes = RXSTOP_INIT - RXSTART_INIT;
+    else
+        occ->freeBytes = rxRdPtShadow - wrPtr - 1;
+    occ->pendingFrames = pending;
+    return ERR_SUCCESS;
+}
 
-    if (ReadWrPtr > RxRdPt){
-        FreeSpace = (RxNd - RxSt) - (ReadWrPtr - RxRdPt);
-    }
-    else{
-        FreeSpace = RxRdPt - ReadWrPtr -1;
-    }
-    return FreeSpace;
 
+/*! @brief function to calculate free space in the receive ring, see
+ * ethernet_rxOccupancy
+ * @return              free bytes, 0 on failure
+ */
+uint16_t ethernet_calcfreeSpaceBuffer(void){
+    ethernet_rxOccupancy_t occ;
 
+    if (ethernet_rxOccupancy(&occ) != ERR_SUCCESS)
+        return 0;
+    return occ.freeBytes;
 }
 
 /*! @brief function to dump contents of the receive buffer onto display
@@ -10,6 +10,7 @@
 
 #include <stdint.h>
 #include "spimaster.h"
+#include "enc_framering.h"
 
 /*! @brief function to configure Ethernet on the ENC28J60
  *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
@@ -35,6 +36,27 @@ spierr_t ethernet_initializePHY(void);
 spierr_t ethernet_Init(void);
 
 
+/*! @brief function to wait for the link to come up after ethernet_Init,
+ * polls PHSTAT2.LSTAT
+ * @param[in] timeoutMs    maximum time to wait, 0 checks once
+ *  @return     ERR_SUCCESS if the link is up, ERR_DRIVER_FAIL on timeout
+ */
+spierr_t ethernet_waitLinkUp(uint32_t timeoutMs);
+
+
+/*! @brief function to get the measured bring-up times
+ * @param[out] initUs      time spent in ethernet_Init, 0 if it did not complete
+ * @param[out] linkUpUs    time from ethernet_Init to link up, 0 if not seen yet
+ */
+void ethernet_getBringupTime(uint32_t *initUs, uint32_t *linkUpUs);
+
+
+/*! @brief function to get the local MAC address
+ * @param[out] mac         6 bytes, as programmed in MAADR
+ */
+void ethernet_getMacAddress(uint8_t *mac);
+
+
 /*! @brief function to transmit packets to the dest MAC address
  * @param[in] payload    message payload
  * @param[in] msglen   length of message payload
@@ -43,6 +65,152 @@ spierr_t ethernet_Init(void);
 spierr_t ethernet_transmitPackets(uint8_t* payload, uint16_t msglen);
 
 
+/*! @brief Transmit counters */
+typedef struct {
+    uint32_t txPackets;         /* frames sent without error */
+    uint32_t txBytes;           /* bytes of those frames, headers included */
+    uint32_t txAborts;          /* ESTAT.TXABRT or EIR.TXERIF after a frame */
+    uint32_t txLateCollisions;  /* aborts with the late collision bit in the status vector */
+    uint32_t txStalls;          /* TXRTS still set after TX_TIMEOUT_US */
+    uint32_t txResets;          /* transmit logic resets with ECON1.TXRST */
+    uint32_t txRetries;         /* frames started again after a reset */
+    uint32_t txDropped;         /* frames given up after TX_MAX_RETRIES */
+} ethernet_txStats_t;
+
+
+/*! @brief function to finish the frame handed to the transmit logic: wait
+ * (bounded) for TXRTS to clear, and on an abort, late collision or stall
+ * reset the transmit logic and send the frame again, at most TX_MAX_RETRIES times.
+ * Called by the transmit functions before a new frame is written.
+ *  @return     ERR_SUCCESS if the frame went out or none was pending, ERR_DRIVER_FAIL if it was dropped
+ */
+spierr_t ethernet_txPoll(void);
+
+
+/*! @brief function to get the transmit counters
+ * @param[out] stats      copy of the counters
+ */
+void ethernet_getTxStats(ethernet_txStats_t *stats);
+
+
+/*! @brief Completion of a queued transmit
+ * @param[in] transferOK   false if the SPI chain failed
+ */
+typedef void (*ethernet_txDoneFxn)(bool transferOK);
+
+
+/*! @brief function to queue the transmission of a packet without waiting
+ * for the SPI transfers. Needs the SPI queue (spiQueue_init)
+ * @param[in] payload    message payload, must stay valid until doneFxn
+ * @param[in] msglen     length of message payload
+ * The previous frame is finished with ethernet_txPoll first.
+ * @param[in] doneFxn    called from SPI callback context once TXRTS is set, may be NULL
+ *  @return     ERR_SUCCESS if queued, ERR_DRIVER_FAIL if failure or a transmit is still queued
+ */
+spierr_t ethernet_transmitPacketsAsync(uint8_t* payload, uint16_t msglen, ethernet_txDoneFxn doneFxn);
+
+
+/* Items of ethernet_txBuildLoad and ethernet_txBuildReset */
+#define ETH_TX_LOAD_ITEMS   (SPIQ_BUFFER_ITEMS + 1 + 4*SPIQ_REG_ITEMS + 2)
+#define ETH_TX_RESET_ITEMS  5
+
+/*! @brief State of the frame in the transmit logic, from ethernet_txCheck */
+typedef enum {
+    ETH_TX_BUSY = 0,    /* TXRTS still set */
+    ETH_TX_DONE,        /* sent without error */
+    ETH_TX_FAILED       /* aborted, or stalled past the timeout */
+} ethernet_txResult_t;
+
+
+/*! @brief function to build the chain loading a frame into the transmit
+ * buffer and starting it: control byte and payload WBM, ETXST/ETXND,
+ * EIR.TXIF clear and ECON1.TXRTS set. The split-phase form of the
+ * transmit, for callers running their own SPI chains (enc_engine).
+ * @param[out] items       at least ETH_TX_LOAD_ITEMS items
+ * @param[in] payload      message payload, must stay valid until the chain completed
+ * @param[in] msglen       length of message payload
+ * @return              number of items used, chained through next
+ */
+uint8_t ethernet_txBuildLoad(spiQueueItem_t *items, const uint8_t *payload, uint16_t msglen);
+
+
+/*! @brief function to account the frame in the transmit logic from
+ * ECON1, ESTAT and EIR read by the caller
+ * @param[in] econ1        ECON1
+ * @param[in] estat        ESTAT
+ * @param[in] eir          EIR
+ * @param[in] timedOut     the frame was started longer than the transmit timeout ago
+ * @return              ETH_TX_BUSY, ETH_TX_DONE or ETH_TX_FAILED
+ */
+ethernet_txResult_t ethernet_txCheck(uint8_t econ1, uint8_t estat, uint8_t eir, bool timedOut);
+
+
+/*! @brief function to build the chain resetting the transmit logic after
+ * ETH_TX_FAILED (errata: TXRTS may stay set after an error), optionally
+ * starting the frame still in the transmit buffer again
+ * @param[out] items       at least ETH_TX_RESET_ITEMS items
+ * @param[in] resend       set TXRTS again
+ * @return              number of items used, chained through next
+ */
+uint8_t ethernet_txBuildReset(spiQueueItem_t *items, bool resend);
+
+
+/*! @brief function to count a chain of ethernet_txBuildReset once it
+ * completed: a reset, and a retry if it started the frame again
+ * @param[in] resend       resend given to ethernet_txBuildReset
+ */
+void ethernet_txResetDone(bool resend);
+
+
+/*! @brief function to give up the frame in the transmit logic, counted as dropped
+ */
+void ethernet_txDropped(void);
+
+
+/* Largest RTP payload of a stream packet, a full size Ethernet frame */
+#define ETH_STREAM_MAX_PAYLOAD  1460
+
+/*! @brief Isochronous stream: UDP/RTP over IPv4 to one destination */
+typedef struct {
+    uint8_t  dstMac[6];     /* next hop MAC address */
+    uint32_t srcIp;         /* host order, 192.168.0.1 is 0xc0a80001 */
+    uint32_t dstIp;
+    uint16_t srcPort;
+    uint16_t dstPort;
+    uint8_t  payloadType;   /* RTP payload type */
+    uint32_t ssrc;          /* RTP synchronization source */
+    uint16_t payloadLen;    /* RTP payload bytes per packet */
+} ethernet_streamConfig_t;
+
+
+/*! @brief function to start the isochronous stream: the Ethernet, IPv4,
+ * UDP and RTP headers are built once and written to the stream area of
+ * the transmit SRAM (STREAM_TXSTART)
+ * @param[in] config       stream addresses and payload length
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t ethernet_streamStart(const ethernet_streamConfig_t *config);
+
+
+/*! @brief function to send one stream packet: only the IP identification
+ * and checksum, the RTP sequence number and timestamp (plus the lengths
+ * if len changed) and the payload are written, then TXRTS is set.
+ * The IP identification and RTP sequence number advance by one per packet.
+ * About 20 header bytes go over SPI besides the payload.
+ * @param[in] payload      RTP payload
+ * @param[in] len          payload length, at most ETH_STREAM_MAX_PAYLOAD bytes
+ * @param[in] rtpTimestamp RTP timestamp of the packet
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t ethernet_streamSend(const uint8_t *payload, uint16_t len, uint32_t rtpTimestamp);
+
+
+/*! @brief function to stop the isochronous stream, the last frame is finished
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if it was dropped
+ */
+spierr_t ethernet_streamStop(void);
+
+
 /*! @brief function to enable the ENC28J60 to receive packets
  *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
  */
@@ -55,6 +223,178 @@ spierr_t ethernet_receiveEnable(void);
 spierr_t ethernet_receiveDisable(void);
 
 
+/*! @brief function to change the receive filters at runtime. While a sleep
+ * profile is active they are applied by ethernet_sleepFilterExit
+ * @param[in] erxfcon    new ERXFCON value, ERXFCON_* bits
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t ethernet_setRxFilter(uint8_t erxfcon);
+
+
+/*! @brief Receive filter profiles for a sleeping host */
+typedef enum {
+    ETH_SLEEP_FILTER_MAGIC = 0,     /* Magic Packets for our MAC address (ERXFCON.MPEN) */
+    ETH_SLEEP_FILTER_PATTERN        /* pattern match filter (ERXFCON.PMEN) */
+} ethernet_sleepFilter_t;
+
+/*! @brief Pattern match filter: a 64 byte window of the frame, masked bytes must match */
+typedef struct {
+    uint16_t       offset;      /* EPMO, start of the window from the destination address, even */
+    uint8_t        mask[8];     /* EPMM0-7, bit n of mask[n/8] selects byte n of the window */
+    const uint8_t *pattern;     /* 64 bytes expected in the window, only masked bytes are used */
+} ethernet_pattern_t;
+
+
+/*! @brief function to switch the receive filters to a sleep profile before
+ * the host enters low power: only frames of the profile reach the ring and
+ * raise the INT line (EIE.PKTIE), everything else is dropped by the ENC28J60.
+ * The ENC28J60 must stay out of power-save. Frames already in the ring keep
+ * INT asserted, they must be read first.
+ * @param[in] profile      ETH_SLEEP_FILTER_* profile
+ * @param[in] pattern      pattern of ETH_SLEEP_FILTER_PATTERN, NULL otherwise
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure or frames are pending
+ */
+spierr_t ethernet_sleepFilterEnter(ethernet_sleepFilter_t profile, const ethernet_pattern_t *pattern);
+
+
+/*! @brief function to restore the receive filters used before
+ * ethernet_sleepFilterEnter, call it when the host wakes. The frame which
+ * woke the host stays in the ring.
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t ethernet_sleepFilterExit(void);
+
+
+/*! @brief function to change the flow control at runtime
+ * @param[in] fcen         EFLOCON.FCEN - EFLOCON_FC_* value
+ * @param[in] pauseTimer   pause timer value sent in pause frames (EPAUS), in units of 512 bit times
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t ethernet_setFlowControl(uint8_t fcen, uint16_t pauseTimer);
+
+
+/*! @brief Receive counters */
+typedef struct {
+    uint32_t rxPackets;         /* frames copied out of the ring */
+    uint32_t rxBytes;           /* bytes of those frames */
+    uint32_t rxCrcErrors;       /* receive status vector CRC error bit */
+    uint32_t rxLengthErrors;    /* receive status vector length check or out of range bits */
+    uint32_t rxOverflows;       /* EIR.RXERIF recoveries */
+    uint32_t rxDropped;         /* frames discarded from the ring by the recoveries */
+} ethernet_rxStats_t;
+
+
+/*! @brief function to recover from a receive buffer overflow (EIR.RXERIF)
+ * without reinitializing: reception is disabled, the frames left in the
+ * ring are discarded by moving the read pointer to the hardware write
+ * pointer and decrementing EPKTCNT to 0, then RXERIF is cleared and
+ * reception enabled again
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t ethernet_rxOverflowRecover(void);
+
+
+/*! @brief function to check EIR.RXERIF and recover from a receive buffer
+ * overflow if it is set
+ *  @return     ERR_SUCCESS if there was no overflow or it was recovered, ERR_DRIVER_FAIL if failure
+ */
+spierr_t ethernet_rxCheckOverflow(void);
+
+
+/*! @brief function to move the host side of the receive ring to the
+ * hardware write pointer, read with reception off, after an overflow or a
+ * corrupt next packet pointer. The frames left are counted as dropped.
+ * The caller writes the result to ERXRDPT and decrements EPKTCNT to 0.
+ * @param[in] wrPtr        ERXWRPT
+ * @param[in] dropped      EPKTCNT, frames discarded
+ * @return              value for ERXRDPT
+ */
+uint16_t ethernet_rxResync(uint16_t wrPtr, uint8_t dropped);
+
+
+/*! @brief function to get the receive counters
+ * @param[out] stats      copy of the counters
+ */
+void ethernet_getRxStats(ethernet_rxStats_t *stats);
+
+
+/*! @brief Power-save counters */
+typedef struct {
+    uint32_t sleeps;            /* power-save entries */
+    uint32_t wakes;             /* power-save exits */
+    uint32_t asleepMs;          /* time spent in power-save */
+    uint32_t lastWakeUs;        /* PWRSV cleared to CLKRDY and RXEN, last wake */
+    uint32_t maxWakeUs;
+    uint32_t totalWakeUs;       /* divide by wakes for the average */
+} ethernet_pwrStats_t;
+
+
+/*! @brief Driver statistics snapshot */
+typedef struct {
+    ethernet_rxStats_t rx;
+    ethernet_txStats_t tx;
+    ethernet_pwrStats_t pwr;
+    spiStats_t         spi;
+    uint32_t           efficiencyPermille;   /* (rx + tx payload bytes) * 1000 / SPI bytes */
+} ethernet_stats_t;
+
+
+/*! @brief function to get a snapshot of all driver counters, receive,
+ * transmit and SPI cost, with the derived SPI efficiency
+ * @param[out] stats      copy of the counters
+ */
+void ethernet_getStats(ethernet_stats_t *stats);
+
+
+/*! @brief function to reset all driver counters, including the SPI ones
+ */
+void ethernet_resetStats(void);
+
+
+/*! @brief function to put the ENC28J60 in power-save mode: reception is
+ * turned off, a frame being received or transmitted is let finish, then
+ * ECON2.VRPS and ECON2.PWRSV are set
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t ethernet_powerSaveEnter(void);
+
+
+/*! @brief function to leave power-save mode: ECON2.PWRSV is cleared,
+ * ESTAT.CLKRDY is polled (bounded) and reception restored if it was on
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t ethernet_powerSaveExit(void);
+
+
+/*! @brief function to configure the power-save idle manager
+ * @param[in] quietMs      time without traffic before entering power-save, 0 disables the manager
+ * @param[in] pollMs       time asleep before waking for a scheduled poll, 0 only wakes on transmit
+ */
+void ethernet_setPowerSave(uint32_t quietMs, uint32_t pollMs);
+
+
+/*! @brief function to note traffic for the idle manager. The transmit
+ * and receive functions call it.
+ * @param[in] wake         wake the ENC28J60 if it is in power-save (transmit)
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if the wake failed
+ */
+spierr_t ethernet_powerSaveActivity(bool wake);
+
+
+/*! @brief function to run the idle manager, call it periodically: enters
+ * power-save after the quiet period without traffic or pending frames,
+ * wakes for the scheduled poll, the link then stays up for a quiet period
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t ethernet_powerSavePoll(void);
+
+
+/*! @brief function to get the power-save counters
+ * @param[out] stats      copy of the counters, asleepMs includes the current sleep
+ */
+void ethernet_getPowerStats(ethernet_pwrStats_t *stats);
+
+
 /*! @brief function to read a slice of the incoming packet
  * @param[in] dest         Destination buffer
  * @param[in] maxlength    Maximum number of bytes to read from packet
@@ -89,7 +429,7 @@ uint16_t ethernet_getRecvLength(uint8_t* header);
 
 
 /*! @brief function to receive packets from dest MAC
- * @param[in] receiveBuffer  	Buffer in which to receieve message
+ * @param[in] receiveBuffer  	Buffer in which to receieve message, len bytes
  * @param[in] len	    	length of packet to read
  * @return 			ERR_SUCCESS for success or ERR_DRIVER_FAIL for failure
  */
@@ -97,16 +437,306 @@ spierr_t ethernet_packetReceive(uint8_t* receiveBuffer, uint16_t len);
 
 
 
+/* ============= Receive handles: header first, payload on demand ====
+ *
+ * ====================================================================
+ */
+
+/* Receive status vector bits */
+#define RSV_CRC_ERROR            (1UL << 20)
+#define RSV_LENGTH_CHECK_ERROR   (1UL << 21)
+#define RSV_LENGTH_OUT_OF_RANGE  (1UL << 22)
+#define RSV_RECEIVED_OK          (1UL << 23)
+
+/* Most frame bytes enc_rx_peek returns */
+#define ENC_RX_PEEK_MAX  64
+/* Next packet pointer and receive status vector in front of each frame */
+#define ENC_RX_PREAMBLE_LENGTH  6
+/* Items of enc_rx_buildPeek, enc_rx_buildRead and enc_rx_buildRelease */
+#define ENC_RX_PEEK_ITEMS     SPIQ_BUFFER_ITEMS
+#define ENC_RX_READ_ITEMS     SPIQ_BUFFER_ITEMS
+#define ENC_RX_READ_INTO_ITEMS  SPIQ_SCATTER_ITEMS
+#define ENC_RX_RELEASE_ITEMS  (2*SPIQ_REG_ITEMS + 1)
+
+/*! @brief Frame at the head of the receive ring */
+typedef struct {
+    uint16_t start;       /* ring address of the next packet pointer */
+    uint16_t next;        /* ring address of the following frame */
+    uint32_t rsv;         /* receive status vector, bits 0-15 are the byte count with CRC */
+    uint16_t length;      /* frame length from the destination address, without CRC */
+    uint16_t headerLen;   /* bytes returned by enc_rx_peek */
+    bool     valid;       /* cleared by enc_rx_release */
+    uint32_t stamp;       /* encRxTime_now() of the INT edge of the service pass */
+} enc_rx_handle_t;
+
+/*! @brief Final destination of a frame, memory of the consumer (a pbuf, a
+ * ring slot, a socket buffer) the SPI reads straight into. The first
+ * headerLen bytes go to header, the rest of the frame to payload.
+ */
+typedef struct {
+    uint8_t  *header;     /* separate buffer for the first bytes, may be NULL if headerLen is 0 */
+    uint16_t  headerLen;  /* size of header, 0 puts the whole frame in payload */
+    uint8_t  *payload;    /* rest of the frame */
+    uint16_t  payloadLen; /* size of payload */
+    void     *cookie;     /* for the consumer, e.g. the pbuf owning payload */
+} enc_rx_dest_t;
+
+
+/*! @brief function to look at the next frame in the receive ring without
+ * copying it: the next packet pointer, the receive status vector and the
+ * first bytes of the frame are read in a single SPI transaction.
+ * Frames are released in order, don't mix with ethernet_packetReceive.
+ * @param[out] rx          frame handle
+ * @param[out] header      first bytes of the frame, may be NULL if len is 0
+ * @param[in] len          number of bytes wanted, at most ENC_RX_PEEK_MAX
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure or if the ring is empty
+ */
+spierr_t enc_rx_peek(enc_rx_handle_t *rx, uint8_t *header, uint16_t len);
+
+
+/*! @brief function to copy a slice of the frame of a handle.
+ * Reading the rest of a peeked frame in one slice completes its capture
+ * @param[in] rx           frame handle from enc_rx_peek
+ * @param[in] offset       offset from the destination address
+ * @param[in] len          number of bytes wanted
+ * @param[out] dest        destination buffer, len bytes
+ * @return              number of bytes copied, less than len at the end of the frame,
+ *                      or ERR_DRIVER_FAIL on failure
+ */
+uint16_t enc_rx_read(const enc_rx_handle_t *rx, uint16_t offset, uint16_t len, uint8_t *dest);
+
+
+/*! @brief function to read the whole frame of a handle into its final
+ * destination in a single SPI transaction, header and payload parts
+ * without an intermediate buffer. The bytes peeked with the handle are not
+ * read again, the caller puts them in dest with enc_rx_putPeeked.
+ * @param[in] rx           frame handle from enc_rx_peek, len 0 is enough
+ * @param[in] dest         destination, headerLen + payloadLen at least the frame length
+ * @return              frame length, or ERR_DRIVER_FAIL on failure or if the frame does not fit
+ */
+uint16_t enc_rx_readInto(const enc_rx_handle_t *rx, const enc_rx_dest_t *dest);
+
+
+/*! @brief function to put the bytes peeked with a handle at the start of
+ * a destination, where enc_rx_readInto does not read them again
+ * @param[in] rx           frame handle
+ * @param[in] dest         destination, as given to enc_rx_readInto
+ * @param[in] header       bytes returned by enc_rx_peek, rx->headerLen of them
+ */
+void enc_rx_putPeeked(const enc_rx_handle_t *rx, const enc_rx_dest_t *dest, const uint8_t *header);
+
+
+/*! @brief function to give the frame of a handle back to the receive ring:
+ * ERXRDPT is moved behind it and EPKTCNT decremented
+ * @param[in,out] rx       frame handle from enc_rx_peek, invalid afterwards
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t enc_rx_release(enc_rx_handle_t *rx);
+
+
+/*! @brief function to build the chain of enc_rx_peek, for callers running
+ * their own SPI chains (enc_engine): the next packet pointer, the receive
+ * status vector and the first len bytes of the frame at the head of the
+ * ring are read into buf. Check EPKTCNT first, then enc_rx_parse the result.
+ * @param[out] items       at least ENC_RX_PEEK_ITEMS items
+ * @param[out] rx          frame handle, invalid until enc_rx_parse
+ * @param[out] buf         ENC_RX_PREAMBLE_LENGTH + len bytes, valid until the chain completed
+ * @param[in] len          number of frame bytes wanted, at most ENC_RX_PEEK_MAX
+ * @return              number of items used, chained through next
+ */
+uint8_t enc_rx_buildPeek(spiQueueItem_t *items, enc_rx_handle_t *rx, uint8_t *buf, uint16_t len);
+
+
+/*! @brief function to fill a frame handle from the bytes read by the chain
+ * of enc_rx_buildPeek
+ * @param[in,out] rx       frame handle from enc_rx_buildPeek
+ * @param[in] buf          bytes read, the frame bytes start at ENC_RX_PREAMBLE_LENGTH
+ * @param[in] len          number of frame bytes read
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL if the next packet pointer or
+ *                      the length is corrupt (the ring must be resynchronized)
+ */
+spierr_t enc_rx_parse(enc_rx_handle_t *rx, const uint8_t *buf, uint16_t len);
+
+
+/*! @brief function to build the chain of enc_rx_read
+ * @param[out] items       at least ENC_RX_READ_ITEMS items
+ * @param[in] rx           frame handle
+ * @param[in] offset       offset from the destination address
+ * @param[in] len          number of bytes, within the frame
+ * @param[out] dest        destination, valid until the chain completed
+ * @return              number of items used, chained through next, 0 if the slice is not in the frame
+ */
+uint8_t enc_rx_buildRead(spiQueueItem_t *items, const enc_rx_handle_t *rx, uint16_t offset, uint16_t len, uint8_t *dest);
+
+
+/*! @brief function to build the chain of enc_rx_readInto
+ * @param[out] items       at least ENC_RX_READ_INTO_ITEMS items
+ * @param[in] rx           frame handle
+ * @param[in] dest         destination, valid until the chain completed
+ * @return              number of items used, chained through next, 0 if the frame does not fit
+ *                      or was peeked whole
+ */
+uint8_t enc_rx_buildReadInto(spiQueueItem_t *items, const enc_rx_handle_t *rx, const enc_rx_dest_t *dest);
+
+
+/*! @brief function to capture a frame read whole into a destination, e.g.
+ * with enc_rx_buildReadInto once its chain completed. A frame peeked whole
+ * was already captured by enc_rx_parse and is not captured again, nor is
+ * the frame captured at its release.
+ * @param[in] rx           frame handle
+ * @param[in] dest         destination holding the frame
+ */
+void enc_rx_tapInto(const enc_rx_handle_t *rx, const enc_rx_dest_t *dest);
+
+
+/*! @brief function to build the chain of enc_rx_release: ERXRDPT behind
+ * the frame and EPKTCNT decremented. Call enc_rx_released once it completed.
+ * @param[out] items       at least ENC_RX_RELEASE_ITEMS items
+ * @param[in] rx           frame handle
+ * @return              number of items used, chained through next, 0 if the handle
+ *                      is not the head of the ring
+ */
+uint8_t enc_rx_buildRelease(spiQueueItem_t *items, const enc_rx_handle_t *rx);
+
+
+/*! @brief function to move the host side of the ring behind a frame once
+ * the chain of enc_rx_buildRelease completed
+ * @param[in,out] rx       frame handle, invalid afterwards
+ */
+void enc_rx_released(enc_rx_handle_t *rx);
+
+
+/*! @brief function to move the frames waiting in the receive ring into a
+ * frame ring, from the thread draining the ENC28J60 (producer side).
+ * Frames are read straight into the pool buffers and queued in batches,
+ * ARP requests for the responder addresses are answered before a buffer
+ * is taken. A frame without a free pool buffer, or
+ * larger than one, is released and counted as an overflow of the frame
+ * ring, so a slow consumer never makes the on-chip ring overflow.
+ * A frame whose payload read fails is queued with length 0. Starts a
+ * receive timestamp pass, see encRxTime_passBegin.
+ * @param[in] ring         frame ring from frameRing_init
+ * @param[in] budget       most frames to move, 0 for all
+ * @return              number of frames queued, or ERR_DRIVER_FAIL on failure
+ */
+int16_t ethernet_rxToRing(frameRing_t *ring, uint8_t budget);
+
+
+/*! @brief Lends the destination of a frame, called by ethernet_rxZeroCopy
+ * once the length and the receive status vector are known
+ * @param[in] arg          argument of ethernet_rxZeroCopy
+ * @param[in] rx           frame handle
+ * @param[out] dest        destination to fill
+ * @return              true to receive the frame, false to drop it
+ */
+typedef bool (*ethernet_rxDestFxn)(void *arg, const enc_rx_handle_t *rx, enc_rx_dest_t *dest);
+
+/*! @brief Gives a lent destination back, called by ethernet_rxZeroCopy
+ * @param[in] arg          argument of ethernet_rxZeroCopy
+ * @param[in] rx           frame handle, rx->length bytes in dest
+ * @param[in] dest         destination from the ethernet_rxDestFxn
+ * @param[in] delivered    false if the read failed
+ */
+typedef void (*ethernet_rxDeliverFxn)(void *arg, const enc_rx_handle_t *rx, const enc_rx_dest_t *dest, bool delivered);
+
+
+/*! @brief function to receive the frames waiting in the receive ring
+ * straight into memory lent by the consumer: only the next packet pointer,
+ * the receive status vector and, with ARP responder addresses set, the
+ * EtherType are read first, then destFxn is asked for the destination and
+ * the frame crosses the SPI once into it. Starts a
+ * receive timestamp pass, see encRxTime_passBegin.
+ * @param[in] destFxn      lends the destination of each frame
+ * @param[in] deliverFxn   gets every lent destination back
+ * @param[in] arg          argument of both
+ * @param[in] budget       most frames to receive, 0 for all
+ * @return              number of frames delivered, or ERR_DRIVER_FAIL on failure
+ */
+int16_t ethernet_rxZeroCopy(ethernet_rxDestFxn destFxn, ethernet_rxDeliverFxn deliverFxn, void *arg, uint8_t budget);
+
+
+/* Most IPv4 addresses answered by the ARP responder */
+#define ETH_ARP_MAX_ADDRESSES   4
+
+/*! @brief ARP responder counters */
+typedef struct {
+    uint32_t requests;          /* ARP requests for one of the responder addresses */
+    uint32_t replies;           /* requests answered by the driver */
+    uint32_t failures;          /* requests consumed without a reply, SPI failure */
+    uint32_t skipped;           /* requests consumed without a reply, transmit logic busy */
+} ethernet_arpStats_t;
+
+
+/*! @brief function to let the driver answer ARP requests for the given
+ * IPv4 addresses from the receive path (enc_rx_service, ethernet_rxToRing),
+ * without the frame reaching the application. The reply is written once
+ * to ARP_TXSTART, per request only the destination and the target fields
+ * are patched.
+ * @param[in] addresses    host order, 192.168.0.1 is 0xc0a80001
+ * @param[in] count        number of addresses, at most ETH_ARP_MAX_ADDRESSES, 0 to turn it off
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t ethernet_arpResponderEnable(const uint32_t *addresses, uint8_t count);
+
+
+/*! @brief function to answer the frame of a handle if it is an ARP request
+ * for one of the responder addresses. The ARP body comes from the peeked
+ * bytes, or is the only part read from the ring. The frame is still
+ * released by the caller. The previous frame is not waited for: while it
+ * is still being sent the request goes unanswered and is counted as
+ * skipped, the requester asks again.
+ * @param[in] rx           frame handle from enc_rx_peek
+ * @param[in] header       peeked bytes
+ * @return              true if the frame was an ARP request for us and is consumed
+ */
+bool ethernet_arpRespond(const enc_rx_handle_t *rx, const uint8_t *header);
+
+
+/*! @brief function to get the ARP responder counters
+ * @param[out] stats       copy of the counters
+ */
+void ethernet_getArpStats(ethernet_arpStats_t *stats);
+
 
 /* ============= Helper functions to clear buffer, peek at buffer, 
  *               calculate free space ============================
  */
 
-/*! @brief function to calculate free space
+/*! @brief Receive ring occupancy */
+typedef struct {
+    uint16_t freeBytes;         /* bytes the ENC28J60 can still write */
+    uint16_t usedBytes;         /* bytes of frames not released, with their headers */
+    uint8_t  pendingFrames;     /* EPKTCNT */
+} ethernet_rxOccupancy_t;
+
+
+/*! @brief function to get the receive ring occupancy from the shadowed
+ * read pointer and one snapshot of ERXWRPT and EPKTCNT, a single SPI
+ * chain of four register reads. Cheap enough to call per frame.
+ * @param[out] occ         free bytes, used bytes and pending frames
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t ethernet_rxOccupancy(ethernet_rxOccupancy_t *occ);
+
+
+/*! @brief function to calculate free space in the receive ring, see
+ * ethernet_rxOccupancy
+ * @return              free bytes, 0 on failure
  */
 uint16_t ethernet_calcfreeSpaceBuffer(void);
 
 
+/*! @brief function to fill a range of the buffer memory with one value.
+ * Each chain is one WBM streaming the same block under a single chip
+ * select, an 8 KB fill takes four chains.
+ * @param[in] start        first address
+ * @param[in] end          last address, at most 0x1FFF
+ * @param[in] value        fill byte
+ *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
+ */
+spierr_t ethernet_memFill(uint16_t start, uint16_t end, uint8_t value);
+
+
 /*! @brief function to clear the receive buffer on ENC28J60
  *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
  */
@@ -119,7 +749,9 @@ spierr_t clearRxBuf(void);
 spierr_t clearTxBuf(void);
 
 
-/*! @brief function to clear the entire buffer
+/*! @brief function to clear the entire buffer. The stream and ARP reply
+ * templates are lost as well, so the stream is stopped and the ARP
+ * responder turned off; start them again afterwards.
  *  @return     ERR_SUCCESS if success, ERR_DRIVER_FAIL if failure
  */
 spierr_t clearWholeBuf(void);
@@ -0,0 +1,230 @@
+/*
+ * enc_framering.c
+ *
+ *  Lock-free SPSC frame ring and buffer pool
+ */
+
+#include "enc_framering.h"
+#include "enc_rxtime.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <semaphore.h>
+
+/* Index loads and stores between the two threads. GCC and clang get the
+ * C11 memory model builtins, sequentially consistent so that the store of
+ * an index and the load of the waiting flag are not reordered (host SMP).
+ * The TI compiler targets the single core Cortex-M4, where aligned 32 bit
+ * accesses are atomic; volatile only orders the index accesses among
+ * themselves, so a barrier keeps the descriptor writes before each index
+ * store and the descriptor reads after each index load. Only the exchange
+ * needs interrupts off. */
+#if defined(__GNUC__) && !defined(__TI_COMPILER_VERSION__)
+#define RING_LOAD(p)            __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define RING_STORE(p, v)        __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define RING_EXCHANGE(p, v)     __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#else
+#include <ti/drivers/dpl/HwiP.h>
+#define RING_BARRIER()          __asm(" dmb")
+#define RING_LOAD(p)            frameRing_load(p)
+#define RING_STORE(p, v)        frameRing_store((p), (v))
+#define RING_EXCHANGE(p, v)     frameRing_exchange((p), (v))
+
+static inline uint32_t frameRing_load(const uint32_t *p){
+    uint32_t v = *(const volatile uint32_t *) p;
+    RING_BARRIER();
+    return v;
+}
+
+static inline void frameRing_store(uint32_t *p, uint32_t v){
+    RING_BARRIER();
+    *(volatile uint32_t *) p = v;
+}
+
+static uint32_t frameRing_exchange(uint32_t *p, uint32_t v){
+    uintptr_t key;
+    uint32_t old;
+
+    RING_BARRIER();
+    key = HwiP_disable();
+    old = *(volatile uint32_t *) p;
+    *(volatile uint32_t *) p = v;
+    HwiP_restore(key);
+    RING_BARRIER();
+    return old;
+}
+#endif
+
+
+/*! @brief function to set up a ring
+ * @param[out] ring        ring
+ * @param[in] pool         count * bufSize bytes
+ * @param[in] bufSize      size of a buffer, MAX_MAC_LENGTH for any frame
+ * @param[in] count        number of buffers, a power of two up to FRAMERING_MAX_BUFFERS
+ * @return              0 on success, -1 on failure
+ */
+int frameRing_init(frameRing_t *ring, uint8_t *pool, uint16_t bufSize, uint16_t count){
+    uint16_t i;
+
+    if (ring == NULL || pool == NULL || bufSize == 0 || count == 0
+            || count > FRAMERING_MAX_BUFFERS || (count & (count - 1)))
+        return -1;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->pool = pool;
+    ring->bufSize = bufSize;
+    ring->count = count;
+    for (i = 0; i < count; i++){
+        ring->free[i] = i;
+        ring->desc[i].data = pool + (uint32_t) i * bufSize;
+        ring->desc[i].index = i;
+    }
+    /* Every buffer starts in the free ring */
+    ring->freeHead = count;
+    if (sem_init(&ring->ready, 0, 0) != 0)
+        return -1;
+    return 0;
+}
+
+
+/*! @brief function to take a free buffer, producer side. Counts an
+ * overflow when there is none.
+ * @param[in] ring         ring
+ * @param[out] desc        descriptor of the buffer, length 0, stamped
+ *                         with the current receive service pass
+ * @return              true if a buffer was taken
+ */
+bool frameRing_alloc(frameRing_t *ring, frameDesc_t *desc){
+    uint32_t tail = ring->freeTail;
+    uint16_t index;
+
+    if (RING_LOAD(&ring->freeHead) == tail){
+        ring->stats.overflows++;
+        return false;
+    }
+    index = ring->free[tail & (ring->count - 1)];
+    RING_STORE(&ring->freeTail, tail + 1);
+
+    desc->data = ring->pool + (uint32_t) index * ring->bufSize;
+    desc->index = index;
+    desc->length = 0;
+    desc->rsv = 0;
+    desc->stamp = encRxTime_passStamp();
+    desc->delivered = 0;
+    return true;
+}
+
+
+/*! @brief function to hand filled buffers to the consumer, producer side
+ * @param[in] ring         ring
+ * @param[in] desc         descriptors from frameRing_alloc
+ * @param[in] n            number of descriptors
+ */
+void frameRing_enqueue(frameRing_t *ring, const frameDesc_t *desc, uint16_t n){
+    uint32_t head = ring->fullHead;
+    uint16_t used;
+    uint16_t i;
+
+    if (n == 0)
+        return;
+    /* A buffer from alloc always has a slot, full holds as many as the pool */
+    for (i = 0; i < n; i++){
+        ring->desc[desc[i].index] = desc[i];
+        ring->full[(head + i) & (ring->count - 1)] = desc[i].index;
+    }
+    RING_STORE(&ring->fullHead, head + n);
+
+    ring->stats.enqueued += n;
+    used = (uint16_t) (head + n - RING_LOAD(&ring->fullTail));
+    if (used > ring->stats.highWater)
+        ring->stats.highWater = used;
+
+    /* One post per wait, the consumer clears the flag it set if it finds frames itself */
+    if (RING_EXCHANGE(&ring->waiting, 0))
+        sem_post(&ring->ready);
+}
+
+
+/*! @brief function to take queued frames, consumer side. Records the
+ * arrival -> delivery latency of each frame.
+ * @param[in] ring         ring
+ * @param[out] desc        descriptors of the frames, n entries
+ * @param[in] n            most frames wanted
+ * @param[in] wait         block until at least one frame is queued
+ * @return              number of frames taken, 0 if none and not waiting
+ */
+uint16_t frameRing_dequeue(frameRing_t *ring, frameDesc_t *desc, uint16_t n, bool wait){
+    uint32_t tail = ring->fullTail;
+    uint32_t head, now;
+    uint16_t i;
+
+    if (n == 0)
+        return 0;
+
+    while ((head = RING_LOAD(&ring->fullHead)) == tail){
+        if (!wait)
+            return 0;
+        RING_STORE(&ring->waiting, 1);
+        if (RING_LOAD(&ring->fullHead) != tail){
+            /* The producer may have taken the flag already, its post must be consumed */
+            if (RING_EXCHANGE(&ring->waiting, 0) == 0)
+                sem_wait(&ring->ready);
+            continue;
+        }
+        sem_wait(&ring->ready);
+    }
+
+    if (head - tail < n)
+        n = (uint16_t) (head - tail);
+    now = encRxTime_now();
+    for (i = 0; i < n; i++){
+        frameDesc_t *d = &ring->desc[ring->full[(tail + i) & (ring->count - 1)]];
+        d->delivered = now;
+        /* Empty frames are payload reads that failed, not deliveries */
+        if (d->length != 0)
+            encRxTime_record(ENC_RXLAT_ARRIVAL_TO_DELIVERY, now - d->stamp);
+        desc[i] = *d;
+    }
+    RING_STORE(&ring->fullTail, tail + n);
+    ring->stats.dequeued += n;
+    return n;
+}
+
+
+/*! @brief function to give buffers back to the pool, consumer side.
+ * Records the delivery -> release latency of each frame.
+ * @param[in] ring         ring
+ * @param[in] desc         descriptors from frameRing_dequeue
+ * @param[in] n            number of descriptors
+ */
+void frameRing_free(frameRing_t *ring, const frameDesc_t *desc, uint16_t n){
+    uint32_t head = ring->freeHead;
+    uint32_t now = encRxTime_now();
+    uint16_t i;
+
+    for (i = 0; i < n; i++){
+        if (ring->desc[desc[i].index].length != 0)
+            encRxTime_record(ENC_RXLAT_DELIVERY_TO_RELEASE, now - ring->desc[desc[i].index].delivered);
+        ring->free[(head + i) & (ring->count - 1)] = desc[i].index;
+    }
+    RING_STORE(&ring->freeHead, head + n);
+}
+
+
+/*! @brief function to get the number of frames queued
+ * @param[in] ring         ring
+ * @return              frames queued and not dequeued yet
+ */
+uint16_t frameRing_used(frameRing_t *ring){
+    return (uint16_t) (RING_LOAD(&ring->fullHead) - RING_LOAD(&ring->fullTail));
+}
+
+
+/*! @brief function to get the ring counters
+ * @param[in] ring         ring
+ * @param[out] stats       copy of the counters
+ */
+void frameRing_getStats(frameRing_t *ring, frameRingStats_t *stats){
+    if (stats != NULL)
+        *stats = ring->stats;
+}
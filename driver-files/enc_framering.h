@@ -0,0 +1,122 @@
+/*
+ * enc_framering.h
+ *
+ *  Lock-free single producer / single consumer ring of received frames,
+ *  backed by a pool of fixed size buffers. The producer is the thread
+ *  draining the ENC28J60, the consumer an application thread.
+ *  The ring records the receive latencies of enc_rxtime.h when frames
+ *  are dequeued and freed. Builds and runs on a Linux host.
+ */
+
+#ifndef ENC_FRAMERING_H_
+#define ENC_FRAMERING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <semaphore.h>
+
+/* Most buffers in a ring, the number of buffers must be a power of two */
+#define FRAMERING_MAX_BUFFERS  32
+
+/*! @brief Frame descriptor */
+typedef struct {
+    uint8_t  *data;      /* pool buffer */
+    uint16_t  length;    /* bytes in data */
+    uint16_t  index;     /* pool buffer index, owned by the ring */
+    uint32_t  rsv;       /* receive status vector */
+    uint32_t  stamp;     /* encRxTime_now() of the INT edge that announced the frame */
+    uint32_t  delivered; /* encRxTime_now() when frameRing_dequeue handed it out */
+} frameDesc_t;
+
+/*! @brief Ring counters */
+typedef struct {
+    uint32_t enqueued;      /* frames handed to the consumer */
+    uint32_t dequeued;      /* frames taken by the consumer */
+    uint32_t overflows;     /* frames the producer could not queue, no free buffer */
+    uint16_t highWater;     /* most frames queued at once */
+} frameRingStats_t;
+
+/*! @brief Ring, the fields are private.
+ * Full and free are two index rings: buffers go producer -> consumer
+ * through full and back through free. Indices run freely, a ring is
+ * empty when head == tail.
+ */
+typedef struct {
+    uint8_t          *pool;
+    uint16_t          bufSize;
+    uint16_t          count;
+    uint16_t          full[FRAMERING_MAX_BUFFERS];
+    uint16_t          free[FRAMERING_MAX_BUFFERS];
+    frameDesc_t       desc[FRAMERING_MAX_BUFFERS];
+    uint32_t          fullHead;    /* written by the producer */
+    uint32_t          fullTail;    /* written by the consumer */
+    uint32_t          freeHead;    /* written by the consumer */
+    uint32_t          freeTail;    /* written by the producer */
+    uint32_t          waiting;     /* consumer blocked in frameRing_dequeue */
+    sem_t             ready;
+    frameRingStats_t  stats;       /* enqueued/overflows/highWater by the producer, dequeued by the consumer */
+} frameRing_t;
+
+
+/*! @brief function to set up a ring
+ * @param[out] ring        ring
+ * @param[in] pool         count * bufSize bytes
+ * @param[in] bufSize      size of a buffer, MAX_MAC_LENGTH for any frame
+ * @param[in] count        number of buffers, a power of two up to FRAMERING_MAX_BUFFERS
+ * @return              0 on success, -1 on failure
+ */
+int frameRing_init(frameRing_t *ring, uint8_t *pool, uint16_t bufSize, uint16_t count);
+
+
+/*! @brief function to take a free buffer, producer side. Counts an
+ * overflow when there is none.
+ * @param[in] ring         ring
+ * @param[out] desc        descriptor of the buffer, length 0, stamped
+ *                         with the current receive service pass
+ * @return              true if a buffer was taken
+ */
+bool frameRing_alloc(frameRing_t *ring, frameDesc_t *desc);
+
+
+/*! @brief function to hand filled buffers to the consumer, producer side
+ * @param[in] ring         ring
+ * @param[in] desc         descriptors from frameRing_alloc
+ * @param[in] n            number of descriptors
+ */
+void frameRing_enqueue(frameRing_t *ring, const frameDesc_t *desc, uint16_t n);
+
+
+/*! @brief function to take queued frames, consumer side. Records the
+ * arrival -> delivery latency of each frame.
+ * @param[in] ring         ring
+ * @param[out] desc        descriptors of the frames, n entries
+ * @param[in] n            most frames wanted
+ * @param[in] wait         block until at least one frame is queued
+ * @return              number of frames taken, 0 if none and not waiting
+ */
+uint16_t frameRing_dequeue(frameRing_t *ring, frameDesc_t *desc, uint16_t n, bool wait);
+
+
+/*! @brief function to give buffers back to the pool, consumer side.
+ * Records the delivery -> release latency of each frame.
+ * @param[in] ring         ring
+ * @param[in] desc         descriptors from frameRing_dequeue
+ * @param[in] n            number of descriptors
+ */
+void frameRing_free(frameRing_t *ring, const frameDesc_t *desc, uint16_t n);
+
+
+/*! @brief function to get the number of frames queued
+ * @param[in] ring         ring
+ * @return              frames queued and not dequeued yet
+ */
+uint16_t frameRing_used(frameRing_t *ring);
+
+
+/*! @brief function to get the ring counters
+ * @param[in] ring         ring
+ * @param[out] stats       copy of the counters
+ */
+void frameRing_getStats(frameRing_t *ring, frameRingStats_t *stats);
+
+#endif /* ENC_FRAMERING_H_ */
@@ -0,0 +1,430 @@
+/*
+ * enc_net.c
+ *
+ *  Minimal UDP/IPv4/ARP layer
+ */
+
+#include "enc_net.h"
+#include "enc_ethernet.h"
+#include "enc_rxdispatch.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#define ETHERTYPE_IPV4   0x0800
+#define ETHERTYPE_ARP    0x0806
+#define ETH_HDR_LEN      14
+#define IP_HDR_LEN       20
+#define IP_MAX_HDR_LEN   60
+#define UDP_HDR_LEN      8
+#define ARP_LEN          28
+#define IP_PROTO_UDP     17
+#define ARP_REQUEST      1
+#define ARP_REPLY        2
+
+typedef struct {
+    uint32_t ip;          /* 0 if the entry is free */
+    uint8_t  mac[6];
+    uint32_t stamp;       /* seconds, last update */
+} arpEntry_t;
+
+static uint32_t netIp;
+static uint32_t netMask;
+static uint32_t netGateway;
+static uint8_t  netMac[6];
+static uint16_t netIpId;
+static arpEntry_t arpCache[ARP_CACHE_SIZE];
+static udpSocket_t udpSockets[UDP_MAX_SOCKETS];
+static netStats_t netStats;
+
+/* ARP requests and replies, padded to 60 bytes by the MAC */
+static uint8_t arpTxFrame[ETH_HDR_LEN + ARP_LEN];
+
+
+static uint16_t net_get16(const uint8_t *p){
+    return p[0] << 8 | p[1];
+}
+
+static uint32_t net_get32(const uint8_t *p){
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static void net_put16(uint8_t *p, uint16_t v){
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+static void net_put32(uint8_t *p, uint32_t v){
+    net_put16(p, v >> 16);
+    net_put16(p + 2, v & 0xffff);
+}
+
+
+/*! @brief Seconds for the ARP cache ages
+ *  @return     monotonic seconds
+ */
+static uint32_t net_nowS(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ts.tv_sec;
+}
+
+
+/*! @brief Ones' complement sum of big endian 16 bit words, not folded
+ * @param[in] sum          running sum
+ * @param[in] data         bytes
+ * @param[in] len          number of bytes, an odd last byte is padded with 0
+ * @return              new running sum
+ */
+static uint32_t net_sum(uint32_t sum, const uint8_t *data, uint16_t len){
+    uint16_t i;
+
+    for (i = 0; i + 1 < len; i += 2)
+        sum += net_get16(data + i);
+    if (len & 1)
+        sum += data[len - 1] << 8;
+    return sum;
+}
+
+
+/*! @brief Fold a running sum into an Internet checksum
+ * @param[in] sum          running sum
+ * @return              ones' complement of the folded sum
+ */
+static uint16_t net_fold(uint32_t sum){
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum & 0xffff;
+}
+
+
+/*! @brief Insert or refresh an ARP cache entry, the oldest entry is replaced
+ * @param[in] ip           address
+ * @param[in] mac          MAC address
+ */
+static void arp_update(uint32_t ip, const uint8_t *mac){
+    arpEntry_t *entry = NULL;
+    uint8_t i;
+
+    for (i = 0; i < ARP_CACHE_SIZE && entry == NULL; i++)
+        if (arpCache[i].ip == ip)
+            entry = &arpCache[i];
+    for (i = 0; i < ARP_CACHE_SIZE && entry == NULL; i++)
+        if (arpCache[i].ip == 0)
+            entry = &arpCache[i];
+    if (entry == NULL){
+        entry = &arpCache[0];
+        for (i = 1; i < ARP_CACHE_SIZE; i++)
+            if (arpCache[i].stamp - entry->stamp > 0x80000000UL)
+                entry = &arpCache[i];
+    }
+    entry->ip = ip;
+    memcpy(entry->mac, mac, 6);
+    entry->stamp = net_nowS();
+}
+
+
+/*! @brief function to look up the ARP cache
+ * @param[in] ip           address, host order
+ * @param[out] mac         MAC address if cached
+ * @return              true if cached and not expired
+ */
+bool arp_lookup(uint32_t ip, uint8_t *mac){
+    uint8_t i;
+
+    for (i = 0; i < ARP_CACHE_SIZE; i++){
+        if (arpCache[i].ip != ip || ip == 0)
+            continue;
+        if (net_nowS() - arpCache[i].stamp > ARP_CACHE_TIMEOUT_S){
+            arpCache[i].ip = 0;
+            return false;
+        }
+        memcpy(mac, arpCache[i].mac, 6);
+        return true;
+    }
+    return false;
+}
+
+
+/*! @brief Send an ARP request or reply
+ * @param[in] oper         ARP_REQUEST or ARP_REPLY
+ * @param[in] dstMac       Ethernet destination and target hardware address, NULL for a broadcast request
+ * @param[in] targetIp     target protocol address
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+static spierr_t arp_send(uint16_t oper, const uint8_t *dstMac, uint32_t targetIp){
+    uint8_t *arp = arpTxFrame + ETH_HDR_LEN;
+
+    if (dstMac != NULL){
+        memcpy(arpTxFrame, dstMac, 6);
+        memcpy(arp + 18, dstMac, 6);
+    }
+    else{
+        memset(arpTxFrame, 0xff, 6);
+        memset(arp + 18, 0, 6);
+    }
+    memcpy(arpTxFrame + 6, netMac, 6);
+    net_put16(arpTxFrame + 12, ETHERTYPE_ARP);
+
+    net_put16(arp, 1);                  /* Ethernet */
+    net_put16(arp + 2, ETHERTYPE_IPV4);
+    arp[4] = 6;
+    arp[5] = 4;
+    net_put16(arp + 6, oper);
+    memcpy(arp + 8, netMac, 6);
+    net_put32(arp + 14, netIp);
+    net_put32(arp + 24, targetIp);
+    return ethernet_transmitPackets(arpTxFrame, sizeof(arpTxFrame));
+}
+
+
+/*! @brief ARP frames: learn senders addressing us, answer requests for our address
+ * @param[in] frame        Ethernet + ARP, from the receive dispatch
+ */
+static void net_arpHandler(const enc_rx_frame_t *frame){
+    const uint8_t *arp = frame->data + ETH_HDR_LEN;
+    uint32_t senderIp, targetIp;
+    uint8_t mac[6];
+
+    if (frame->len < ETH_HDR_LEN + ARP_LEN || net_get16(arp) != 1 || net_get16(arp + 2) != ETHERTYPE_IPV4
+            || arp[4] != 6 || arp[5] != 4)
+        return;
+    senderIp = net_get32(arp + 14);
+    targetIp = net_get32(arp + 24);
+
+    if (targetIp != netIp){
+        /* Only refresh what is cached already */
+        if (arp_lookup(senderIp, mac))
+            arp_update(senderIp, arp + 8);
+        return;
+    }
+    arp_update(senderIp, arp + 8);
+    if (net_get16(arp + 6) == ARP_REQUEST){
+        netStats.arpRequestsIn++;
+        if (arp_send(ARP_REPLY, arp + 8, senderIp) == ERR_SUCCESS)
+            netStats.arpRepliesOut++;
+    }
+}
+
+
+/*! @brief IPv4 frames: the IPv4 and UDP headers decide, the payload is only
+ * read for an open socket, straight into its receive buffer
+ * @param[in] frame        Ethernet + IPv4 + UDP headers, from the receive dispatch
+ */
+static void net_ipHandler(const enc_rx_frame_t *frame){
+    uint8_t hdr[IP_MAX_HDR_LEN + UDP_HDR_LEN];
+    const uint8_t *ip = hdr;
+    const uint8_t *udp;
+    uint16_t ihl, totalLen, udpLen, payloadLen, dstPort;
+    uint32_t dstIp, srcIp, sum;
+    udpSocket_t *sock = NULL;
+    uint8_t i;
+
+    if (frame->len < ETH_HDR_LEN + IP_HDR_LEN + UDP_HDR_LEN){
+        netStats.ipDropped++;
+        return;
+    }
+    ihl = (frame->data[ETH_HDR_LEN] & 0x0f) * 4;
+    if ((frame->data[ETH_HDR_LEN] >> 4) != 4 || ihl < IP_HDR_LEN){
+        netStats.ipDropped++;
+        return;
+    }
+    /* Options push the UDP header past the peeked bytes */
+    if (ihl == IP_HDR_LEN)
+        memcpy(hdr, frame->data + ETH_HDR_LEN, IP_HDR_LEN + UDP_HDR_LEN);
+    else if (enc_rx_read(frame->rx, ETH_HDR_LEN, ihl + UDP_HDR_LEN, hdr) != ihl + UDP_HDR_LEN){
+        netStats.ipDropped++;
+        return;
+    }
+    udp = hdr + ihl;
+
+    totalLen = net_get16(ip + 2);
+    dstIp = net_get32(ip + 16);
+    srcIp = net_get32(ip + 12);
+    if (net_fold(net_sum(0, ip, ihl)) != 0 || (net_get16(ip + 6) & 0x3fff) || ip[9] != IP_PROTO_UDP
+            || totalLen > frame->length - ETH_HDR_LEN
+            || (dstIp != netIp && dstIp != 0xffffffff && dstIp != (netIp | ~netMask))){
+        netStats.ipDropped++;
+        return;
+    }
+    udpLen = net_get16(udp + 4);
+    if (udpLen < UDP_HDR_LEN || udpLen > totalLen - ihl){
+        netStats.ipDropped++;
+        return;
+    }
+
+    dstPort = net_get16(udp + 2);
+    for (i = 0; i < UDP_MAX_SOCKETS && sock == NULL; i++)
+        if (udpSockets[i].localPort == dstPort)
+            sock = &udpSockets[i];
+    if (sock == NULL){
+        netStats.udpNoSocket++;
+        return;
+    }
+    payloadLen = udpLen - UDP_HDR_LEN;
+    if (payloadLen > sock->rxBufSize){
+        netStats.udpTooLong++;
+        return;
+    }
+    if (payloadLen != 0 && enc_rx_read(frame->rx, ETH_HDR_LEN + ihl + UDP_HDR_LEN, payloadLen, sock->rxBuf) != payloadLen){
+        netStats.ipDropped++;
+        return;
+    }
+
+    if (net_get16(udp + 6) != 0){
+        /* Pseudo header, UDP header and payload */
+        sum = net_sum(0, ip + 12, 8);
+        sum += IP_PROTO_UDP + udpLen;
+        sum = net_sum(sum, udp, UDP_HDR_LEN);
+        sum = net_sum(sum, sock->rxBuf, payloadLen);
+        if (net_fold(sum) != 0){
+            netStats.udpChecksumErrors++;
+            return;
+        }
+    }
+    netStats.udpIn++;
+    sock->recvFxn(sock, srcIp, net_get16(udp), sock->rxBuf, payloadLen);
+}
+
+
+/*! @brief function to set up the stack and register the ARP and IPv4
+ * handlers with the receive dispatch
+ * @param[in] ip           our address, host order (192.168.0.2 is 0xc0a80002)
+ * @param[in] netmask      host order
+ * @param[in] gateway      host order, 0 if none
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t net_init(uint32_t ip, uint32_t netmask, uint32_t gateway){
+    netIp = ip;
+    netMask = netmask;
+    netGateway = gateway;
+    ethernet_getMacAddress(netMac);
+    memset(arpCache, 0, sizeof(arpCache));
+    memset(udpSockets, 0, sizeof(udpSockets));
+    memset(&netStats, 0, sizeof(netStats));
+
+    /* 42 peeked bytes hold Ethernet + ARP, or Ethernet + IPv4 + UDP without options */
+    if (enc_rx_register(ETHERTYPE_ARP, net_arpHandler, ENC_RX_HEADER_ONLY) != ERR_SUCCESS)
+        return ERR_DRIVER_FAIL;
+    if (enc_rx_register(ETHERTYPE_IPV4, net_ipHandler, ENC_RX_HEADER_ONLY) != ERR_SUCCESS)
+        return ERR_DRIVER_FAIL;
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to handle the frames waiting in the receive ring
+ * @param[in] budget       most frames, 0 for all
+ * @return              number of frames handled, or ERR_DRIVER_FAIL on failure
+ */
+int16_t net_service(uint8_t budget){
+    return enc_rx_service(budget);
+}
+
+
+/*! @brief function to open a UDP socket
+ * @param[in] port         local port
+ * @param[in] rxBuf        receive buffer, payloads are read into it
+ * @param[in] rxBufSize    size of rxBuf, longer payloads are dropped
+ * @param[in] recvFxn      receive callback
+ * @param[in] arg          stored in the socket
+ * @return              socket, NULL if the table is full or the port in use
+ */
+udpSocket_t *udp_open(uint16_t port, uint8_t *rxBuf, uint16_t rxBufSize, udp_recvFxn recvFxn, void *arg){
+    udpSocket_t *sock = NULL;
+    uint8_t i;
+
+    if (port == 0 || rxBuf == NULL || recvFxn == NULL)
+        return NULL;
+    for (i = 0; i < UDP_MAX_SOCKETS; i++){
+        if (udpSockets[i].localPort == port)
+            return NULL;
+        if (udpSockets[i].localPort == 0 && sock == NULL)
+            sock = &udpSockets[i];
+    }
+    if (sock != NULL){
+        sock->rxBuf = rxBuf;
+        sock->rxBufSize = rxBufSize;
+        sock->recvFxn = recvFxn;
+        sock->arg = arg;
+        sock->localPort = port;
+    }
+    return sock;
+}
+
+
+/*! @brief function to close a UDP socket
+ * @param[in] sock         socket from udp_open
+ */
+void udp_close(udpSocket_t *sock){
+    if (sock != NULL)
+        sock->localPort = 0;
+}
+
+
+/*! @brief function to send a UDP datagram. The headers are written in
+ * place into the UDP_HEADROOM bytes in front of the payload and the frame
+ * goes out with ethernet_transmitPackets, the payload is not copied.
+ * @param[in] sock         socket, gives the source port
+ * @param[in] dstIp        destination, host order, 0xffffffff for broadcast
+ * @param[in] dstPort      destination port
+ * @param[in,out] frame    UDP_HEADROOM bytes followed by the payload
+ * @param[in] len          payload length, at most UDP_MAX_PAYLOAD
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure or while the
+ *                      destination is being resolved (an ARP request was sent, retry)
+ */
+spierr_t udp_send(udpSocket_t *sock, uint32_t dstIp, uint16_t dstPort, uint8_t *frame, uint16_t len){
+    uint8_t *ip = frame + ETH_HDR_LEN;
+    uint8_t *udp = ip + IP_HDR_LEN;
+    uint32_t nextHop = dstIp;
+
+    if (sock == NULL || sock->localPort == 0 || frame == NULL || len > UDP_MAX_PAYLOAD)
+        return ERR_DRIVER_FAIL;
+
+    if (dstIp == 0xffffffff || dstIp == (netIp | ~netMask)){
+        memset(frame, 0xff, 6);
+    }
+    else{
+        if ((dstIp & netMask) != (netIp & netMask) && netGateway != 0)
+            nextHop = netGateway;
+        if (!arp_lookup(nextHop, frame)){
+            netStats.arpRequestsOut++;
+            arp_send(ARP_REQUEST, NULL, nextHop);
+            return ERR_DRIVER_FAIL;
+        }
+    }
+    memcpy(frame + 6, netMac, 6);
+    net_put16(frame + 12, ETHERTYPE_IPV4);
+
+    ip[0] = 0x45;
+    ip[1] = 0;
+    net_put16(ip + 2, IP_HDR_LEN + UDP_HDR_LEN + len);
+    net_put16(ip + 4, netIpId++);
+    net_put16(ip + 6, 0x4000);          /* don't fragment */
+    ip[8] = 64;
+    ip[9] = IP_PROTO_UDP;
+    net_put16(ip + 10, 0);
+    net_put32(ip + 12, netIp);
+    net_put32(ip + 16, dstIp);
+    net_put16(ip + 10, net_fold(net_sum(0, ip, IP_HDR_LEN)));
+
+    /* UDP checksum 0, not computed */
+    net_put16(udp, sock->localPort);
+    net_put16(udp + 2, dstPort);
+    net_put16(udp + 4, UDP_HDR_LEN + len);
+    net_put16(udp + 6, 0);
+
+    if (ethernet_transmitPackets(frame, UDP_HEADROOM + len) != ERR_SUCCESS)
+        return ERR_DRIVER_FAIL;
+    netStats.udpOut++;
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to get the stack counters
+ * @param[out] stats       copy of the counters
+ */
+void net_getStats(netStats_t *stats){
+    if (stats != NULL)
+        *stats = netStats;
+}
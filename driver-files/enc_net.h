@@ -0,0 +1,119 @@
+/*
+ * enc_net.h
+ *
+ *  Minimal UDP/IPv4/ARP layer on top of the raw frame functions, for
+ *  deployments without lwIP: fixed ARP cache, static socket table,
+ *  headers built in place in front of the payload
+ */
+
+#ifndef ENC_NET_H_
+#define ENC_NET_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spimaster.h"
+
+#define ARP_CACHE_SIZE        8
+#define ARP_CACHE_TIMEOUT_S   300
+#define UDP_MAX_SOCKETS       4
+
+/* Bytes in front of a UDP payload for the Ethernet, IPv4 and UDP headers */
+#define UDP_HEADROOM          42
+/* Largest UDP payload in one frame */
+#define UDP_MAX_PAYLOAD       1472
+
+typedef struct udpSocket udpSocket_t;
+
+/*! @brief UDP receive callback, runs from net_service
+ *  @param[in] sock        socket
+ *  @param[in] srcIp       sender, host order
+ *  @param[in] srcPort     sender port
+ *  @param[in] payload     payload, in the receive buffer of the socket
+ *  @param[in] len         payload length
+ */
+typedef void (*udp_recvFxn)(udpSocket_t *sock, uint32_t srcIp, uint16_t srcPort, uint8_t *payload, uint16_t len);
+
+struct udpSocket {
+    uint16_t    localPort;    /* 0 if the entry is free */
+    uint8_t    *rxBuf;        /* payloads are read straight into it */
+    uint16_t    rxBufSize;
+    udp_recvFxn recvFxn;
+    void       *arg;          /* free for the owner of the socket */
+};
+
+/*! @brief Stack counters */
+typedef struct {
+    uint32_t arpRequestsIn;     /* ARP requests for our address */
+    uint32_t arpRequestsOut;    /* ARP requests sent to resolve a destination */
+    uint32_t arpRepliesOut;
+    uint32_t ipDropped;         /* not for us, bad checksum, fragments, not UDP */
+    uint32_t udpIn;             /* payloads handed to a socket */
+    uint32_t udpNoSocket;       /* dropped from the header, payload never read */
+    uint32_t udpTooLong;        /* payload larger than the socket receive buffer */
+    uint32_t udpChecksumErrors;
+    uint32_t udpOut;
+} netStats_t;
+
+
+/*! @brief function to set up the stack and register the ARP and IPv4
+ * handlers with the receive dispatch
+ * @param[in] ip           our address, host order (192.168.0.2 is 0xc0a80002)
+ * @param[in] netmask      host order
+ * @param[in] gateway      host order, 0 if none
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t net_init(uint32_t ip, uint32_t netmask, uint32_t gateway);
+
+
+/*! @brief function to handle the frames waiting in the receive ring
+ * @param[in] budget       most frames, 0 for all
+ * @return              number of frames handled, or ERR_DRIVER_FAIL on failure
+ */
+int16_t net_service(uint8_t budget);
+
+
+/*! @brief function to open a UDP socket
+ * @param[in] port         local port
+ * @param[in] rxBuf        receive buffer, payloads are read into it
+ * @param[in] rxBufSize    size of rxBuf, longer payloads are dropped
+ * @param[in] recvFxn      receive callback
+ * @param[in] arg          stored in the socket
+ * @return              socket, NULL if the table is full or the port in use
+ */
+udpSocket_t *udp_open(uint16_t port, uint8_t *rxBuf, uint16_t rxBufSize, udp_recvFxn recvFxn, void *arg);
+
+
+/*! @brief function to close a UDP socket
+ * @param[in] sock         socket from udp_open
+ */
+void udp_close(udpSocket_t *sock);
+
+
+/*! @brief function to send a UDP datagram. The headers are written in
+ * place into the UDP_HEADROOM bytes in front of the payload and the frame
+ * goes out with ethernet_transmitPackets, the payload is not copied.
+ * @param[in] sock         socket, gives the source port
+ * @param[in] dstIp        destination, host order, 0xffffffff for broadcast
+ * @param[in] dstPort      destination port
+ * @param[in,out] frame    UDP_HEADROOM bytes followed by the payload
+ * @param[in] len          payload length, at most UDP_MAX_PAYLOAD
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure or while the
+ *                      destination is being resolved (an ARP request was sent, retry)
+ */
+spierr_t udp_send(udpSocket_t *sock, uint32_t dstIp, uint16_t dstPort, uint8_t *frame, uint16_t len);
+
+
+/*! @brief function to look up the ARP cache
+ * @param[in] ip           address, host order
+ * @param[out] mac         MAC address if cached
+ * @return              true if cached and not expired
+ */
+bool arp_lookup(uint32_t ip, uint8_t *mac);
+
+
+/*! @brief function to get the stack counters
+ * @param[out] stats       copy of the counters
+ */
+void net_getStats(netStats_t *stats);
+
+#endif /* ENC_NET_H_ */
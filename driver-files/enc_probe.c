@@ -0,0 +1,189 @@
+/*
+ * enc_probe.c
+ *
+ *  Latency probes for the receive and transmit paths
+ */
+
+#include "enc_probe.h"
+#include "enc_clock.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ti/drivers/dpl/HwiP.h>
+#include <ti/display/Display.h>
+
+extern Display_Handle display;
+
+/* Power of two latency buckets, bucket n holds [2^(n-1), 2^n) ns */
+#define PROBE_BUCKETS   33
+
+typedef struct {
+    uint32_t count;
+    uint32_t minNs;
+    uint32_t maxNs;
+    uint64_t sumNs;
+    uint32_t buckets[PROBE_BUCKETS];
+} probeStage_t;
+
+static probeStage_t probeStages[ENC_PROBE_STAGES];
+
+#ifdef ENC28J60_PROBES
+
+static const char *const probeStageNames[ENC_PROBE_STAGES] = {
+    "ISR -> RSV read",
+    "RSV read -> payload",
+    "payload -> PKTDEC",
+    "TX request -> WBM done",
+    "WBM done -> TXRTS",
+    "TXRTS -> TXIF",
+};
+
+/* Last timestamp of each point, valid until a stage consumed it */
+static volatile uint32_t probeStamp[ENC_PROBE_POINTS];
+static volatile bool     probeValid[ENC_PROBE_POINTS];
+
+/* Stage ended by each point, and the point that starts it */
+static const int8_t probeStageOf[ENC_PROBE_POINTS] = {
+    -1,
+    ENC_STAGE_ISR_TO_RSV,
+    ENC_STAGE_RSV_TO_PAYLOAD,
+    ENC_STAGE_PAYLOAD_TO_PKTDEC,
+    -1,
+    ENC_STAGE_REQUEST_TO_WBM,
+    ENC_STAGE_WBM_TO_TXRTS,
+    ENC_STAGE_TXRTS_TO_TXIF,
+};
+static const uint8_t probeStartOf[ENC_PROBE_STAGES] = {
+    ENC_PROBE_ISR_ENTRY,
+    ENC_PROBE_RSV_READ,
+    ENC_PROBE_PAYLOAD_DONE,
+    ENC_PROBE_TX_REQUEST,
+    ENC_PROBE_WBM_DONE,
+    ENC_PROBE_TXRTS_SET,
+};
+
+
+/*! @brief Add a sample to a stage
+ *  @param[in] stage       stage
+ *  @param[in] ns          latency of the sample
+ */
+static void encProbe_record(uint8_t stage, uint32_t ns){
+    probeStage_t *s = &probeStages[stage];
+    uint8_t bucket = 0;
+    uint32_t v = ns;
+
+    while (v != 0){
+        bucket++;
+        v >>= 1;
+    }
+    if (s->count == 0 || ns < s->minNs)
+        s->minNs = ns;
+    if (ns > s->maxNs)
+        s->maxNs = ns;
+    s->sumNs += ns;
+    s->buckets[bucket]++;
+    s->count++;
+}
+
+
+/*! @brief Timestamp a probe point, safe from interrupt context
+ *  @param[in] point       ENC_PROBE_* point
+ */
+void encProbe_mark(encProbePoint_t point){
+    uint32_t now = encClock_now();
+    int8_t stage = probeStageOf[point];
+    uintptr_t key;
+
+    if (stage >= 0){
+        /* The start stamp is consumed, each start is measured once */
+        key = HwiP_disable();
+        if (probeValid[probeStartOf[stage]]){
+            probeValid[probeStartOf[stage]] = false;
+            encProbe_record(stage, encClock_toNs(now - probeStamp[probeStartOf[stage]]));
+        }
+        HwiP_restore(key);
+    }
+    probeStamp[point] = now;
+    probeValid[point] = true;
+}
+
+#endif /* ENC28J60_PROBES */
+
+
+/*! @brief Start the timestamp clock and clear the statistics.
+ * Without ENC28J60_PROBES the statistics stay empty.
+ */
+void encProbe_init(void){
+#ifdef ENC28J60_PROBES
+    encClock_init();
+#endif
+    encProbe_reset();
+}
+
+
+/*! @brief Get the latency of a stage
+ *  @param[in] stage       ENC_STAGE_* stage
+ *  @param[out] stats      latency summary, all 0 without samples
+ */
+void encProbe_getStage(encProbeStage_t stage, encProbeStats_t *stats){
+    probeStage_t s;
+    uint32_t rank, seen = 0;
+    uint8_t bucket;
+    uintptr_t key;
+
+    if (stats == NULL || stage >= ENC_PROBE_STAGES)
+        return;
+    memset(stats, 0, sizeof(*stats));
+
+    key = HwiP_disable();
+    s = probeStages[stage];
+    HwiP_restore(key);
+    if (s.count == 0)
+        return;
+
+    stats->count = s.count;
+    stats->minNs = s.minNs;
+    stats->maxNs = s.maxNs;
+    stats->avgNs = (uint32_t) (s.sumNs / s.count);
+
+    /* Smallest sample rank at or above 99 % of the samples */
+    rank = s.count - s.count / 100;
+    for (bucket = 0; bucket < PROBE_BUCKETS; bucket++){
+        seen += s.buckets[bucket];
+        if (seen >= rank)
+            break;
+    }
+    stats->p99Ns = (bucket == 0) ? 0 : (bucket >= 32) ? 0xffffffff : (1UL << bucket) - 1;
+    if (stats->p99Ns > s.maxNs)
+        stats->p99Ns = s.maxNs;
+}
+
+
+/*! @brief Clear the statistics of all stages
+ */
+void encProbe_reset(void){
+    uintptr_t key = HwiP_disable();
+    memset(probeStages, 0, sizeof(probeStages));
+#ifdef ENC28J60_PROBES
+    memset((void *) probeValid, 0, sizeof(probeValid));
+#endif
+    HwiP_restore(key);
+}
+
+
+/*! @brief Print the latency of all stages on the display
+ */
+void encProbe_dump(void){
+#ifdef ENC28J60_PROBES
+    encProbeStats_t stats;
+    uint8_t i;
+
+    for (i = 0; i < ENC_PROBE_STAGES; i++){
+        encProbe_getStage((encProbeStage_t) i, &stats);
+        Display_printf(display, 0, 0, "%s: n %u min %u avg %u max %u p99 %u ns\n", probeStageNames[i],
+                stats.count, stats.minNs, stats.avgNs, stats.maxNs, stats.p99Ns);
+    }
+#else
+    Display_printf(display, 0, 0, "Latency probes not built, define ENC28J60_PROBES\n");
+#endif
+}
@@ -0,0 +1,83 @@
+/*
+ * enc_probe.h
+ *
+ *  Latency probes: timestamps at fixed points of the receive and transmit
+ *  paths, aggregated per stage. Built only with ENC28J60_PROBES defined,
+ *  otherwise ENC_PROBE() compiles to nothing.
+ */
+
+#ifndef ENC_PROBE_H_
+#define ENC_PROBE_H_
+
+#include <stdint.h>
+
+/* Probe points */
+typedef enum {
+    ENC_PROBE_ISR_ENTRY = 0,    /* INT line interrupt entered */
+    ENC_PROBE_RSV_READ,         /* next packet pointer and receive status vector read */
+    ENC_PROBE_PAYLOAD_DONE,     /* frame copied out of the receive ring */
+    ENC_PROBE_PKTDEC,           /* ECON2.PKTDEC issued */
+    ENC_PROBE_TX_REQUEST,       /* transmit accepted, previous frame finished */
+    ENC_PROBE_WBM_DONE,         /* frame written to the transmit buffer */
+    ENC_PROBE_TXRTS_SET,        /* ECON1.TXRTS set */
+    ENC_PROBE_TXIF,             /* transmit seen complete */
+    ENC_PROBE_POINTS
+} encProbePoint_t;
+
+/* Stages, measured from one probe point to the next */
+typedef enum {
+    ENC_STAGE_ISR_TO_RSV = 0,
+    ENC_STAGE_RSV_TO_PAYLOAD,
+    ENC_STAGE_PAYLOAD_TO_PKTDEC,
+    ENC_STAGE_REQUEST_TO_WBM,
+    ENC_STAGE_WBM_TO_TXRTS,
+    ENC_STAGE_TXRTS_TO_TXIF,
+    ENC_PROBE_STAGES
+} encProbeStage_t;
+
+/*! @brief Latency of one stage, in nanoseconds */
+typedef struct {
+    uint32_t count;     /* samples */
+    uint32_t minNs;
+    uint32_t avgNs;
+    uint32_t maxNs;
+    uint32_t p99Ns;     /* upper bound of the power of two bucket holding the 99th percentile, at most maxNs */
+} encProbeStats_t;
+
+#ifdef ENC28J60_PROBES
+
+/* Timestamps come from the clock of enc_clock.h */
+
+/*! @brief Timestamp a probe point, safe from interrupt context
+ *  @param[in] point       ENC_PROBE_* point
+ */
+void encProbe_mark(encProbePoint_t point);
+
+#define ENC_PROBE(point)    encProbe_mark(point)
+
+#else
+
+#define ENC_PROBE(point)    ((void) 0)
+
+#endif /* ENC28J60_PROBES */
+
+/*! @brief Start the timestamp clock and clear the statistics.
+ * Without ENC28J60_PROBES the statistics stay empty.
+ */
+void encProbe_init(void);
+
+/*! @brief Get the latency of a stage
+ *  @param[in] stage       ENC_STAGE_* stage
+ *  @param[out] stats      latency summary, all 0 without samples
+ */
+void encProbe_getStage(encProbeStage_t stage, encProbeStats_t *stats);
+
+/*! @brief Clear the statistics of all stages
+ */
+void encProbe_reset(void);
+
+/*! @brief Print the latency of all stages on the display
+ */
+void encProbe_dump(void);
+
+#endif /* ENC_PROBE_H_ */
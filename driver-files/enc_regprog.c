@@ -0,0 +1,249 @@
+/*
+ * enc_regprog.c
+ *
+ *  Register program compiler and runner
+ */
+
+#include "enc_regprog.h"
+#include "registerlib.h"
+#include "spimaster.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* Items built per flush, the program is run in several chains if needed */
+#define REGPROG_MAX_ITEMS 32
+
+/* Group of registers common to all banks */
+#define REGPROG_COMMON 4
+
+static regOp_t        regProgOps[REGPROG_MAX_OPS];
+static uint8_t        regProgGroup[REGPROG_MAX_OPS];
+static spiQueueItem_t regProgItems[REGPROG_MAX_ITEMS];
+static pthread_mutex_t regProgLock;
+
+
+/*! @brief Bank group of a register
+ *  @param[in] reg         name of register
+ *  @return             bank 0-3, REGPROG_COMMON for registers mapped into every bank
+ */
+static uint8_t regProgram_group(uint8_t reg){
+    uint8_t bank = ENC_REG_BANK(reg);
+    return (bank == SPIQ_BANK_ANY) ? REGPROG_COMMON : bank;
+}
+
+
+/*! @brief Number of BFC/BFS needed to go from one bank to another
+ *  @param[in] from        current bank or SPIQ_BANK_ANY if unknown
+ *  @param[in] to          bank to select
+ *  @return             0, 1 or 2
+ */
+static uint8_t regProgram_switchCost(uint8_t from, uint8_t to){
+    if (from == to)
+        return 0;
+    if (from == SPIQ_BANK_ANY)
+        return ((0x03 & ~to) != 0) + (to != 0);
+    return ((from & ~to) != 0) + ((to & ~from) != 0);
+}
+
+
+/*! @brief Step to the next permutation in lexicographic order
+ *  @param[in,out] perm    permutation
+ *  @param[in] n           number of elements
+ *  @return             false once all permutations were visited
+ */
+static bool regProgram_nextPermutation(uint8_t *perm, uint8_t n){
+    int8_t i = n - 2;
+    int8_t j = n - 1;
+    uint8_t tmp;
+
+    while (i >= 0 && perm[i] >= perm[i + 1])
+        i--;
+    if (i < 0)
+        return false;
+    while (perm[j] <= perm[i])
+        j--;
+    tmp = perm[i]; perm[i] = perm[j]; perm[j] = tmp;
+    for (i++, j = n - 1; i < j; i++, j--){
+        tmp = perm[i]; perm[i] = perm[j]; perm[j] = tmp;
+    }
+    return true;
+}
+
+
+/*! @brief Pick the order of the bank groups with the fewest bank switch transfers
+ *  @param[in] used        bit n set if bank n has operations
+ *  @param[out] order      banks in the order to run them
+ *  @return             number of banks in order
+ */
+static uint8_t regProgram_orderBanks(uint8_t used, uint8_t *order){
+    uint8_t perm[4];
+    uint8_t n = 0;
+    uint8_t best = 0xff;
+    uint8_t cost, from, i;
+
+    for (i = 0; i < 4; i++)
+        if (used & (1 << i))
+            perm[n++] = i;
+
+    /* At most 4! = 24 orders, try them all */
+    do {
+        from = currentMemBank();
+        cost = 0;
+        for (i = 0; i < n; i++){
+            cost += regProgram_switchCost(from, perm[i]);
+            from = perm[i];
+        }
+        if (cost < best){
+            best = cost;
+            for (i = 0; i < n; i++)
+                order[i] = perm[i];
+        }
+    } while (n > 1 && regProgram_nextPermutation(perm, n));
+    return n;
+}
+
+
+/*! @brief Run the items built so far
+ *  @param[in,out] used    number of items, reset to 0
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+static spierr_t regProgram_flush(uint8_t *used){
+    spierr_t ret = spi_transferItems(regProgItems, *used);
+    *used = 0;
+    return ret;
+}
+
+
+/*! @brief Compile the operations of one bank group into items and run them
+ *  @param[in] count       number of merged operations
+ *  @param[in] group       bank group to run
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+static spierr_t regProgram_runGroup(uint8_t count, uint8_t group){
+    uint8_t oldValue[REGPROG_MAX_OPS];
+    uint8_t readOp[REGPROG_MAX_ITEMS];
+    uint8_t nReads = 0;
+    uint8_t used = 0;
+    uint8_t i, r;
+
+    /* Old values for the MAC/MII read-modify-writes, from the register
+     * shadow or read first so the writes of the bank follow each other */
+    for (i = 0; i < count; i++){
+        if (regProgGroup[i] != group || regProgOps[i].mask == 0xff || !(regProgOps[i].attr & ENC_REG_MAC))
+            continue;
+        if (spi_shadowRead(regProgOps[i].reg, &oldValue[i]))
+            continue;
+        if (nReads == REGPROG_MAX_ITEMS)
+            return (spierr_t) ERR_DRIVER_FAIL;
+        readOp[nReads++] = i;
+        used += spiQueue_buildRead(&regProgItems[used], regProgOps[i].reg, true);
+    }
+    if (regProgram_flush(&used) != ERR_SUCCESS)
+        return (spierr_t) ERR_DRIVER_FAIL;
+    for (r = 0; r < nReads; r++)
+        oldValue[readOp[r]] = spiQueue_readValue(&regProgItems[r]);
+
+    for (i = 0; i < count; i++){
+        regOp_t *op = &regProgOps[i];
+
+        if (regProgGroup[i] != group)
+            continue;
+        if (used + 2 > REGPROG_MAX_ITEMS && regProgram_flush(&used) != ERR_SUCCESS)
+            return (spierr_t) ERR_DRIVER_FAIL;
+
+        if (op->mask == 0xff){
+            used += spiQueue_buildWrite(&regProgItems[used], op->reg, op->value);
+        }
+        else if (op->attr & ENC_REG_MAC){
+            used += spiQueue_buildWrite(&regProgItems[used], op->reg, (oldValue[i] & ~op->mask) | op->value);
+        }
+        else{
+            if (op->value)
+                spiQueue_buildBitField(&regProgItems[used++], op->reg, op->value, true);
+            if (op->mask & ~op->value)
+                spiQueue_buildBitField(&regProgItems[used++], op->reg, op->mask & ~op->value, false);
+        }
+    }
+    return regProgram_flush(&used);
+}
+
+
+/*! @brief Set up the lock serializing regProgram_run. Called once by
+ * ethernet_Init before the first program, further calls do nothing.
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t regProgram_init(void){
+    static bool lockInit = false;
+
+    /* Runs from ethernet_Init, before any other thread uses the driver */
+    if (!lockInit){
+        if (pthread_mutex_init(&regProgLock, NULL) != 0)
+            return (spierr_t) ERR_DRIVER_FAIL;
+        lockInit = true;
+    }
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief Run a register program.
+ * Operations on the same register are merged, then grouped by bank starting
+ * with the bank currently selected so that each bank is selected once.
+ * Within a bank the table order is kept. Registers common to all banks
+ * (EIE, EIR, ESTAT, ECON2, ECON1) are written last, in table order.
+ * Partial ETH register updates become BFS/BFC, partial MAC/MII register
+ * updates are read-modify-write on the register shadow, with the reads of
+ * registers it does not know yet done first for the whole bank.
+ * ECON1.BSEL can't be part of a program.
+ *  @param[in] program     table of operations
+ *  @param[in] count       number of operations, at most REGPROG_MAX_OPS
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t regProgram_run(const regOp_t *program, uint8_t count){
+    uint8_t merged = 0;
+    uint8_t usedBanks = 0;
+    uint8_t order[4];
+    uint8_t nBanks;
+    uint8_t i, j;
+    spierr_t ret = ERR_SUCCESS;
+
+    if (program == NULL || count > REGPROG_MAX_OPS)
+        return (spierr_t) ERR_DRIVER_FAIL;
+
+    /* The compiled program lives in static storage, one runner at a time */
+    pthread_mutex_lock(&regProgLock);
+
+    /* Merge the operations on the same register, later ones win */
+    for (i = 0; i < count && ret == ERR_SUCCESS; i++){
+        if ((program[i].reg & 0x1f) == ECON1 && (program[i].mask & 0x03)){
+            ret = (spierr_t) ERR_DRIVER_FAIL;
+            break;
+        }
+        for (j = 0; j < merged; j++)
+            if (regProgOps[j].reg == program[i].reg)
+                break;
+        if (j == merged){
+            regProgOps[j].reg = program[i].reg;
+            regProgOps[j].value = 0;
+            regProgOps[j].mask = 0;
+            regProgOps[j].attr = program[i].attr;
+            regProgGroup[j] = regProgram_group(program[i].reg);
+            merged++;
+        }
+        regProgOps[j].value = (regProgOps[j].value & ~program[i].mask) | (program[i].value & program[i].mask);
+        regProgOps[j].mask |= program[i].mask;
+        if (regProgGroup[j] != REGPROG_COMMON)
+            usedBanks |= 1 << regProgGroup[j];
+    }
+
+    if (ret == ERR_SUCCESS){
+        nBanks = regProgram_orderBanks(usedBanks, order);
+        for (i = 0; i < nBanks && ret == ERR_SUCCESS; i++)
+            ret = regProgram_runGroup(merged, order[i]);
+        if (ret == ERR_SUCCESS)
+            ret = regProgram_runGroup(merged, REGPROG_COMMON);
+    }
+
+    pthread_mutex_unlock(&regProgLock);
+    return ret;
+}
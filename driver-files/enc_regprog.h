@@ -0,0 +1,61 @@
+/*
+ * enc_regprog.h
+ *
+ *  Register programs: tables of control register writes which are
+ *  compiled into as few SPI transfers and bank switches as possible
+ */
+
+#ifndef ENC_REGPROG_H_
+#define ENC_REGPROG_H_
+
+#include <stdint.h>
+#include "spimaster.h"
+
+/* Maximum number of operations in one program */
+#define REGPROG_MAX_OPS 48
+
+/*! @brief One operation of a register program: the bits of reg selected
+ * by mask take the bits of value, the other bits are left untouched
+ */
+typedef struct {
+    uint8_t reg;      /* name of register, as in registerlib.h */
+    uint8_t value;    /* new value of the bits in mask */
+    uint8_t mask;     /* 0xff overwrites the whole register */
+    uint8_t attr;     /* ENC_REG_* class and access from the register descriptors */
+} regOp_t;
+
+/* The register descriptor is looked up at compile time, writing a read
+ * only or unknown register does not compile */
+#define REGOP_ATTR(attr)                ((attr) + 0 * sizeof(char[((attr) & ENC_REG_RO) ? -1 : 1]))
+#define REGOP_WRITE(reg, value)         { (reg), (value), 0xff, REGOP_ATTR(reg##_ATTR) }
+#define REGOP_SET(reg, bits)            { (reg), (bits), (bits), REGOP_ATTR(reg##_ATTR) }
+#define REGOP_CLEAR(reg, bits)          { (reg), 0x00, (bits), REGOP_ATTR(reg##_ATTR) }
+#define REGOP_FIELD(reg, value, mask)   { (reg), (value), (mask), REGOP_ATTR(reg##_ATTR) }
+/* 16 bit register pair, low byte first as the datasheet requires for pointers */
+#define REGOP_WRITE16(regL, regH, value) \
+    { (regL), (value) & 0x00ff, 0xff, REGOP_ATTR(regL##_ATTR) }, \
+    { (regH), ((value) & 0xff00) >> 8, 0xff, REGOP_ATTR(regH##_ATTR) }
+
+/*! @brief Set up the lock serializing regProgram_run. Called once by
+ * ethernet_Init before the first program, further calls do nothing.
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t regProgram_init(void);
+
+
+/*! @brief Run a register program.
+ * Operations on the same register are merged, then grouped by bank starting
+ * with the bank currently selected so that each bank is selected once.
+ * Within a bank the table order is kept. Registers common to all banks
+ * (EIE, EIR, ESTAT, ECON2, ECON1) are written last, in table order.
+ * Partial ETH register updates become BFS/BFC, partial MAC/MII register
+ * updates are read-modify-write on the register shadow, with the reads of
+ * registers it does not know yet done first for the whole bank.
+ * ECON1.BSEL can't be part of a program.
+ *  @param[in] program     table of operations
+ *  @param[in] count       number of operations, at most REGPROG_MAX_OPS
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t regProgram_run(const regOp_t *program, uint8_t count);
+
+#endif /* ENC_REGPROG_H_ */
@@ -0,0 +1,302 @@
+/*
+ * enc_rxdispatch.c
+ *
+ *  Receive dispatch by EtherType
+ */
+
+#include "enc_rxdispatch.h"
+#include "enc_ethernet.h"
+#include "registerlib.h"
+#include "enc_rxtime.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <semaphore.h>
+
+typedef struct {
+    uint16_t          ethertype;
+    uint8_t           flags;
+    enc_rx_handlerFxn handler;
+    enc_rx_queue_t   *queue;
+} rxDispatchEntry_t;
+
+static rxDispatchEntry_t rxDispatchTable[ENC_RX_MAX_HANDLERS];
+static uint8_t rxDispatchCount = 0;
+static enc_rx_dispatchStats_t rxDispatchStats;
+
+/* Inline full copies */
+static uint8_t rxDispatchBuffer[MAX_MAC_LENGTH];
+
+
+/*! @brief Entry of an EtherType
+ * @param[in] ethertype    EtherType
+ * @return              entry, NULL if not registered
+ */
+static rxDispatchEntry_t *enc_rx_find(uint16_t ethertype){
+    uint8_t i;
+
+    for (i = 0; i < rxDispatchCount; i++)
+        if (rxDispatchTable[i].ethertype == ethertype)
+            return &rxDispatchTable[i];
+    return NULL;
+}
+
+
+/*! @brief function to register the handler of an EtherType. Registration
+ * is done before the receive service runs.
+ * @param[in] ethertype    EtherType, ENC_RX_ANY_TYPE for the catch-all
+ * @param[in] handler      handler, may be NULL with ENC_RX_DROP
+ * @param[in] flags        one ENC_RX_* policy, optionally ENC_RX_ACCEPT_ERRORS
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL if the table is full or the flags are invalid
+ */
+spierr_t enc_rx_register(uint16_t ethertype, enc_rx_handlerFxn handler, uint8_t flags){
+    rxDispatchEntry_t *entry = enc_rx_find(ethertype);
+    uint8_t policy = flags & ENC_RX_POLICY_MASK;
+
+    if (policy != ENC_RX_HEADER_ONLY && policy != ENC_RX_FULL_COPY && policy != ENC_RX_DROP)
+        return ERR_DRIVER_FAIL;
+    if (handler == NULL && policy != ENC_RX_DROP)
+        return ERR_DRIVER_FAIL;
+
+    if (entry == NULL){
+        if (rxDispatchCount == ENC_RX_MAX_HANDLERS)
+            return ERR_DRIVER_FAIL;
+        entry = &rxDispatchTable[rxDispatchCount++];
+    }
+    entry->ethertype = ethertype;
+    entry->flags = flags;
+    entry->handler = handler;
+    entry->queue = NULL;
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to prepare a handler queue
+ * @param[out] queue       queue
+ * @param[in] buffers      depth * slotSize bytes
+ * @param[in] lengths      depth entries
+ * @param[in] rsvs         depth entries
+ * @param[in] stamps       depth entries for the receive timestamps, may be NULL
+ * @param[in] slotSize     largest frame kept, MAX_MAC_LENGTH for any frame
+ * @param[in] depth        number of slots
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t enc_rx_queueInit(enc_rx_queue_t *queue, uint8_t *buffers, uint16_t *lengths, uint32_t *rsvs,
+                          uint32_t *stamps, uint16_t slotSize, uint8_t depth){
+    if (queue == NULL || buffers == NULL || lengths == NULL || rsvs == NULL || slotSize == 0 || depth < 2)
+        return ERR_DRIVER_FAIL;
+    memset(queue, 0, sizeof(*queue));
+    queue->buffers = buffers;
+    queue->lengths = lengths;
+    queue->rsvs = rsvs;
+    queue->stamps = stamps;
+    queue->slotSize = slotSize;
+    queue->depth = depth;
+    if (sem_init(&queue->ready, 0, 0) != 0)
+        return ERR_DRIVER_FAIL;
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief function to route the frames of a registered ENC_RX_FULL_COPY
+ * EtherType to a queue instead of running the handler inline
+ * @param[in] ethertype    registered EtherType
+ * @param[in] queue        queue from enc_rx_queueInit
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t enc_rx_attachQueue(uint16_t ethertype, enc_rx_queue_t *queue){
+    rxDispatchEntry_t *entry = enc_rx_find(ethertype);
+
+    if (entry == NULL || queue == NULL || (entry->flags & ENC_RX_POLICY_MASK) != ENC_RX_FULL_COPY)
+        return ERR_DRIVER_FAIL;
+    queue->handler = entry->handler;
+    queue->ethertype = ethertype;
+    entry->queue = queue;
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief Copy the frame of a handle: the peeked bytes, then the rest from the ring
+ * @param[in] rx           frame handle
+ * @param[in] header       peeked bytes
+ * @param[out] dest        frame buffer, rx->length bytes
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+static spierr_t enc_rx_copy(const enc_rx_handle_t *rx, const uint8_t *header, uint8_t *dest){
+    uint16_t rest = rx->length - rx->headerLen;
+
+    memcpy(dest, header, rx->headerLen);
+    if (rest != 0 && enc_rx_read(rx, rx->headerLen, rest, dest + rx->headerLen) != rest)
+        return ERR_DRIVER_FAIL;
+    return ERR_SUCCESS;
+}
+
+
+/*! @brief Put a frame in a handler queue, from the receive service
+ * @param[in] queue        queue
+ * @param[in] rx           frame handle
+ * @param[in] header       peeked bytes
+ */
+static void enc_rx_enqueue(enc_rx_queue_t *queue, const enc_rx_handle_t *rx, const uint8_t *header){
+    uint8_t head = queue->head;
+    uint8_t next = (head + 1) % queue->depth;
+
+    if (next == queue->tail || rx->length > queue->slotSize
+            || enc_rx_copy(rx, header, queue->buffers + (uint32_t) head * queue->slotSize) != ERR_SUCCESS){
+        queue->drops++;
+        rxDispatchStats.dropped++;
+        return;
+    }
+    queue->lengths[head] = rx->length;
+    queue->rsvs[head] = rx->rsv;
+    if (queue->stamps != NULL)
+        queue->stamps[head] = rx->stamp;
+    /* The slot is complete before the consumer can see it */
+    queue->head = next;
+    rxDispatchStats.queued++;
+    sem_post(&queue->ready);
+}
+
+
+/*! @brief Run a handler and record its receive latencies: the handler
+ * call is the delivery, its return the release of the frame
+ * @param[in] handler      handler
+ * @param[in] frame        frame
+ */
+static void enc_rx_runHandler(enc_rx_handlerFxn handler, const enc_rx_frame_t *frame){
+    uint32_t delivered = encRxTime_now();
+
+    encRxTime_record(ENC_RXLAT_ARRIVAL_TO_DELIVERY, delivered - frame->stamp);
+    handler(frame);
+    encRxTime_record(ENC_RXLAT_DELIVERY_TO_RELEASE, encRxTime_now() - delivered);
+}
+
+
+/*! @brief Route one peeked frame
+ * @param[in] rx           frame handle
+ * @param[in] header       peeked bytes
+ */
+static void enc_rx_dispatch(const enc_rx_handle_t *rx, const uint8_t *header){
+    rxDispatchEntry_t *entry;
+    enc_rx_frame_t frame;
+
+    frame.ethertype = (rx->headerLen >= 14) ? (header[12] << 8 | header[13]) : ENC_RX_ANY_TYPE;
+    frame.length = rx->length;
+    frame.rsv = rx->rsv;
+    frame.stamp = rx->stamp;
+    frame.rx = NULL;
+
+    entry = enc_rx_find(frame.ethertype);
+    if (entry == NULL)
+        entry = enc_rx_find(ENC_RX_ANY_TYPE);
+    if (!(rx->rsv & RSV_RECEIVED_OK)){
+        rxDispatchStats.errors++;
+        if (entry == NULL || !(entry->flags & ENC_RX_ACCEPT_ERRORS)){
+            rxDispatchStats.dropped++;
+            return;
+        }
+    }
+    if (entry == NULL || (entry->flags & ENC_RX_POLICY_MASK) == ENC_RX_DROP){
+        rxDispatchStats.dropped++;
+        return;
+    }
+
+    if (entry->queue != NULL){
+        enc_rx_enqueue(entry->queue, rx, header);
+        return;
+    }
+
+    if ((entry->flags & ENC_RX_POLICY_MASK) == ENC_RX_HEADER_ONLY){
+        frame.data = header;
+        frame.len = rx->headerLen;
+        frame.rx = rx;
+    }
+    else{
+        if (enc_rx_copy(rx, header, rxDispatchBuffer) != ERR_SUCCESS){
+            rxDispatchStats.dropped++;
+            return;
+        }
+        frame.data = rxDispatchBuffer;
+        frame.len = rx->length;
+    }
+    rxDispatchStats.handled++;
+    enc_rx_runHandler(entry->handler, &frame);
+}
+
+
+/*! @brief function to run the handler of a queue on the frames queued,
+ * from the consumer thread
+ * @param[in] queue        queue
+ * @param[in] wait         block until a frame is queued
+ * @return              number of frames handled
+ */
+uint8_t enc_rx_queueService(enc_rx_queue_t *queue, bool wait){
+    enc_rx_frame_t frame;
+    uint8_t tail;
+    uint8_t done = 0;
+
+    if (queue == NULL || queue->handler == NULL)
+        return 0;
+
+    while (1){
+        if (wait && done == 0)
+            sem_wait(&queue->ready);
+        else if (sem_trywait(&queue->ready) != 0)
+            break;
+
+        tail = queue->tail;
+        frame.data = queue->buffers + (uint32_t) tail * queue->slotSize;
+        frame.length = queue->lengths[tail];
+        frame.len = frame.length;
+        frame.rsv = queue->rsvs[tail];
+        frame.stamp = (queue->stamps != NULL) ? queue->stamps[tail] : 0;
+        frame.ethertype = queue->ethertype;
+        frame.rx = NULL;
+        if (queue->stamps != NULL)
+            enc_rx_runHandler(queue->handler, &frame);
+        else
+            queue->handler(&frame);
+
+        /* The slot goes back to the receive service after the handler */
+        queue->tail = (tail + 1) % queue->depth;
+        done++;
+    }
+    return done;
+}
+
+
+/*! @brief function to dispatch the frames waiting in the receive ring:
+ * each frame is peeked, routed by EtherType and released. Starts a
+ * receive timestamp pass, see encRxTime_passBegin.
+ * @param[in] budget       most frames to dispatch, 0 for all
+ * @return              number of frames dispatched, or ERR_DRIVER_FAIL on failure
+ */
+int16_t enc_rx_service(uint8_t budget){
+    uint8_t header[ENC_RX_DISPATCH_PEEK];
+    enc_rx_handle_t rx;
+    int16_t done = 0;
+
+    encRxTime_passBegin();
+    while (budget == 0 || done < budget){
+        /* Fails on an empty ring as well */
+        if (enc_rx_peek(&rx, header, ENC_RX_DISPATCH_PEEK) != ERR_SUCCESS)
+            break;
+        rxDispatchStats.frames++;
+        /* ARP requests for the responder addresses never reach a handler */
+        if (!ethernet_arpRespond(&rx, header))
+            enc_rx_dispatch(&rx, header);
+        if (enc_rx_release(&rx) != ERR_SUCCESS)
+            return ERR_DRIVER_FAIL;
+        done++;
+    }
+    return done;
+}
+
+
+/*! @brief function to get the dispatch counters
+ * @param[out] stats       copy of the counters
+ */
+void enc_rx_getDispatchStats(enc_rx_dispatchStats_t *stats){
+    if (stats != NULL)
+        *stats = rxDispatchStats;
+}
@@ -0,0 +1,135 @@
+/*
+ * enc_rxdispatch.h
+ *
+ *  Receive dispatch: frames are routed by EtherType right after the
+ *  header fetch, to handlers run inline or from a per-handler queue
+ */
+
+#ifndef ENC_RXDISPATCH_H_
+#define ENC_RXDISPATCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <semaphore.h>
+#include "spimaster.h"
+#include "enc_ethernet.h"
+
+/* Handlers in the table, the catch-all included */
+#define ENC_RX_MAX_HANDLERS   8
+
+/* Frame bytes fetched with the receive status vector: Ethernet + IPv4 + UDP
+ * headers, or Ethernet + ARP */
+#define ENC_RX_DISPATCH_PEEK  42
+
+/* EtherType of the catch-all handler, for frames no other handler takes */
+#define ENC_RX_ANY_TYPE       0x0000
+
+/* Handler policies */
+#define ENC_RX_HEADER_ONLY    0x01    /* handler gets the peeked bytes and the handle for enc_rx_read */
+#define ENC_RX_FULL_COPY      0x02    /* handler gets the whole frame */
+#define ENC_RX_DROP           0x04    /* frame released without a handler */
+#define ENC_RX_POLICY_MASK    0x07
+#define ENC_RX_ACCEPT_ERRORS  0x08    /* also take frames without the RSV received ok bit */
+
+/*! @brief Frame handed to a handler */
+typedef struct {
+    uint16_t               ethertype;
+    uint16_t               length;   /* frame length, without CRC */
+    const uint8_t         *data;     /* frame bytes from the destination address */
+    uint16_t               len;      /* bytes in data, length for full copies */
+    uint32_t               rsv;      /* receive status vector */
+    uint32_t               stamp;    /* encRxTime_now() of the INT edge, 0 from a queue without stamps */
+    const enc_rx_handle_t *rx;       /* ring handle for header only handlers run inline, NULL otherwise */
+} enc_rx_frame_t;
+
+/*! @brief Frame handler
+ *  @param[in] frame       frame, valid until the handler returns
+ */
+typedef void (*enc_rx_handlerFxn)(const enc_rx_frame_t *frame);
+
+/*! @brief Queue of full frame copies between the receive service and a
+ * handler running in its own thread. One producer (the receive service),
+ * one consumer (enc_rx_queueService).
+ */
+typedef struct {
+    uint8_t          *buffers;   /* depth slots of slotSize bytes */
+    uint16_t         *lengths;   /* frame length of each slot */
+    uint32_t         *rsvs;      /* receive status vector of each slot */
+    uint32_t         *stamps;    /* receive timestamp of each slot, may be NULL */
+    uint16_t          slotSize;
+    uint8_t           depth;
+    volatile uint8_t  head;      /* next slot written by the receive service */
+    volatile uint8_t  tail;      /* next slot read by the consumer */
+    uint32_t          drops;     /* frames dropped, queue full or frame larger than a slot */
+    sem_t             ready;
+    enc_rx_handlerFxn handler;
+    uint16_t          ethertype;
+} enc_rx_queue_t;
+
+/*! @brief Dispatch counters */
+typedef struct {
+    uint32_t frames;        /* frames taken from the ring */
+    uint32_t handled;       /* handlers run from the receive service */
+    uint32_t queued;        /* frames put in a handler queue */
+    uint32_t dropped;       /* ENC_RX_DROP, no handler, errors or queue full */
+    uint32_t errors;        /* frames without the RSV received ok bit */
+} enc_rx_dispatchStats_t;
+
+
+/*! @brief function to register the handler of an EtherType. Registration
+ * is done before the receive service runs.
+ * @param[in] ethertype    EtherType, ENC_RX_ANY_TYPE for the catch-all
+ * @param[in] handler      handler, may be NULL with ENC_RX_DROP
+ * @param[in] flags        one ENC_RX_* policy, optionally ENC_RX_ACCEPT_ERRORS
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL if the table is full or the flags are invalid
+ */
+spierr_t enc_rx_register(uint16_t ethertype, enc_rx_handlerFxn handler, uint8_t flags);
+
+
+/*! @brief function to prepare a handler queue
+ * @param[out] queue       queue
+ * @param[in] buffers      depth * slotSize bytes
+ * @param[in] lengths      depth entries
+ * @param[in] rsvs         depth entries
+ * @param[in] stamps       depth entries for the receive timestamps, may be NULL
+ * @param[in] slotSize     largest frame kept, MAX_MAC_LENGTH for any frame
+ * @param[in] depth        number of slots
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t enc_rx_queueInit(enc_rx_queue_t *queue, uint8_t *buffers, uint16_t *lengths, uint32_t *rsvs,
+                          uint32_t *stamps, uint16_t slotSize, uint8_t depth);
+
+
+/*! @brief function to route the frames of a registered ENC_RX_FULL_COPY
+ * EtherType to a queue instead of running the handler inline
+ * @param[in] ethertype    registered EtherType
+ * @param[in] queue        queue from enc_rx_queueInit
+ * @return              ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
+ */
+spierr_t enc_rx_attachQueue(uint16_t ethertype, enc_rx_queue_t *queue);
+
+
+/*! @brief function to run the handler of a queue on the frames queued,
+ * from the consumer thread
+ * @param[in] queue        queue
+ * @param[in] wait         block until a frame is queued
+ * @return              number of frames handled
+ */
+uint8_t enc_rx_queueService(enc_rx_queue_t *queue, bool wait);
+
+
+/*! @brief function to dispatch the frames waiting in the receive ring:
+ * each frame is peeked, routed by EtherType and released. Starts a
+ * receive timestamp pass, see encRxTime_passBegin.
+ * @param[in] budget       most frames to dispatch, 0 for all
+ * @return              number of frames dispatched, or ERR_DRIVER_FAIL on failure
+ */
+int16_t enc_rx_service(uint8_t budget);
+
+
+/*! @brief function to get the dispatch counters
+ * @param[out] stats       copy of the counters
+ */
+void enc_rx_getDispatchStats(enc_rx_dispatchStats_t *stats);
+
+#endif /* ENC_RXDISPATCH_H_ */
@@ -0,0 +1,220 @@
+/*
+ * enc_rxtime.c
+ *
+ *  Receive timestamps and latency histograms
+ */
+
+#include "enc_rxtime.h"
+#include "enc_clock.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ti/drivers/dpl/HwiP.h>
+
+/* Default bucket bounds: 10 us to 100 ms in 1-2-5 steps */
+static const uint32_t rxTimeDefaultBounds[] = {
+    10000, 20000, 50000, 100000, 200000, 500000,
+    1000000, 2000000, 5000000, 10000000, 20000000, 50000000, 100000000,
+};
+#define RXTIME_DEFAULT_BUCKETS  (sizeof(rxTimeDefaultBounds) / sizeof(rxTimeDefaultBounds[0]))
+
+static encRxHistogram_t rxTimeHist[ENC_RXLAT_HISTOGRAMS];
+
+/* INT edge latched by the interrupt, taken by the next service pass */
+static volatile uint32_t rxTimeIntStamp;
+static volatile bool     rxTimeIntValid;
+/* Timestamp of the current service pass */
+static uint32_t rxTimePassStamp;
+
+
+/*! @brief Clear the samples of a histogram, the bounds are kept
+ *  @param[in] hist        histogram
+ */
+static void encRxTime_clear(encRxHistogram_t *hist){
+    memset(hist->count, 0, sizeof(hist->count));
+    hist->samples = 0;
+    hist->minNs = 0xffffffff;
+    hist->maxNs = 0;
+    hist->sumNs = 0;
+}
+
+
+/*! @brief Set the bounds of both histograms and clear them, interrupts disabled
+ *  @param[in] boundNs     upper bounds, ascending
+ *  @param[in] count       number of bounds
+ */
+static void encRxTime_setBounds(const uint32_t *boundNs, uint8_t count){
+    uint8_t i;
+
+    for (i = 0; i < ENC_RXLAT_HISTOGRAMS; i++){
+        rxTimeHist[i].buckets = count;
+        memset(rxTimeHist[i].boundNs, 0, sizeof(rxTimeHist[i].boundNs));
+        memcpy(rxTimeHist[i].boundNs, boundNs, count * sizeof(boundNs[0]));
+        encRxTime_clear(&rxTimeHist[i]);
+    }
+}
+
+
+/*! @brief Start the timestamp clock and clear the histograms, the bucket
+ * bounds are kept
+ */
+void encRxTime_init(void){
+    uintptr_t key;
+
+    encClock_init();
+    key = HwiP_disable();
+    rxTimeIntValid = false;
+    rxTimePassStamp = 0;
+    HwiP_restore(key);
+
+    if (rxTimeHist[0].buckets == 0){
+        key = HwiP_disable();
+        encRxTime_setBounds(rxTimeDefaultBounds, RXTIME_DEFAULT_BUCKETS);
+        HwiP_restore(key);
+    } else {
+        encRxTime_reset();
+    }
+}
+
+
+/*! @brief Current timestamp, safe from interrupt context
+ *  @return     CPU cycles on target, nanoseconds on host builds
+ */
+uint32_t encRxTime_now(void){
+    return encClock_now();
+}
+
+
+/*! @brief Convert a timestamp difference to nanoseconds
+ *  @param[in] ticks       difference of two encRxTime_now() values
+ *  @return     nanoseconds
+ */
+uint32_t encRxTime_toNs(uint32_t ticks){
+    return encClock_toNs(ticks);
+}
+
+
+/*! @brief Latch the time of an INT edge, from the INT line interrupt.
+ * The first edge since the last service pass is kept.
+ */
+void encRxTime_intMark(void){
+    uint32_t now = encRxTime_now();
+    uintptr_t key = HwiP_disable();
+
+    if (!rxTimeIntValid){
+        rxTimeIntStamp = now;
+        rxTimeIntValid = true;
+    }
+    HwiP_restore(key);
+}
+
+
+/*! @brief Start a receive service pass: the frames drained until the next
+ * pass carry the latched INT timestamp, or the current time when the pass
+ * was not started by an edge (polling). Called by ethernet_rxToRing,
+ * enc_rx_service and the engine; code draining the ring itself with
+ * enc_rx_peek calls it before its loop.
+ *  @return     timestamp of the pass
+ */
+uint32_t encRxTime_passBegin(void){
+    uint32_t now = encRxTime_now();
+    uintptr_t key = HwiP_disable();
+
+    rxTimePassStamp = rxTimeIntValid ? rxTimeIntStamp : now;
+    rxTimeIntValid = false;
+    HwiP_restore(key);
+    return rxTimePassStamp;
+}
+
+
+/*! @brief Timestamp of the current service pass, for the frames it drains
+ *  @return     timestamp of the last encRxTime_passBegin
+ */
+uint32_t encRxTime_passStamp(void){
+    return rxTimePassStamp;
+}
+
+
+/*! @brief Set the bucket bounds of both histograms and clear them
+ *  @param[in] boundNs     upper bounds in nanoseconds, strictly ascending
+ *  @param[in] count       number of bounds, 1 to ENC_RXTIME_MAX_BUCKETS
+ *  @return     0 on success, -1 on invalid bounds
+ */
+int encRxTime_setBuckets(const uint32_t *boundNs, uint8_t count){
+    uintptr_t key;
+    uint8_t i;
+
+    if (boundNs == NULL || count == 0 || count > ENC_RXTIME_MAX_BUCKETS)
+        return -1;
+    for (i = 1; i < count; i++){
+        if (boundNs[i] <= boundNs[i - 1])
+            return -1;
+    }
+
+    key = HwiP_disable();
+    encRxTime_setBounds(boundNs, count);
+    HwiP_restore(key);
+    return 0;
+}
+
+
+/*! @brief Add a sample to a histogram
+ *  @param[in] which       ENC_RXLAT_* histogram
+ *  @param[in] ticks       latency as a difference of encRxTime_now() values
+ */
+void encRxTime_record(encRxLatency_t which, uint32_t ticks){
+    encRxHistogram_t *hist;
+    uint32_t ns = encRxTime_toNs(ticks);
+    uintptr_t key;
+    uint8_t bucket;
+
+    if (which >= ENC_RXLAT_HISTOGRAMS)
+        return;
+    hist = &rxTimeHist[which];
+
+    key = HwiP_disable();
+    if (hist->buckets == 0)
+        encRxTime_setBounds(rxTimeDefaultBounds, RXTIME_DEFAULT_BUCKETS);
+    /* Few buckets, a linear search is shorter than the lock around a binary one */
+    for (bucket = 0; bucket < hist->buckets; bucket++){
+        if (ns <= hist->boundNs[bucket])
+            break;
+    }
+    hist->count[bucket]++;
+    if (hist->samples == 0 || ns < hist->minNs)
+        hist->minNs = ns;
+    if (ns > hist->maxNs)
+        hist->maxNs = ns;
+    hist->sumNs += ns;
+    hist->samples++;
+    HwiP_restore(key);
+}
+
+
+/*! @brief Get a histogram
+ *  @param[in] which       ENC_RXLAT_* histogram
+ *  @param[out] hist       copy of the histogram
+ */
+void encRxTime_getHistogram(encRxLatency_t which, encRxHistogram_t *hist){
+    uintptr_t key;
+
+    if (hist == NULL || which >= ENC_RXLAT_HISTOGRAMS)
+        return;
+    key = HwiP_disable();
+    *hist = rxTimeHist[which];
+    HwiP_restore(key);
+    if (hist->samples == 0)
+        hist->minNs = 0;
+}
+
+
+/*! @brief Clear both histograms, the bucket bounds are kept
+ */
+void encRxTime_reset(void){
+    uintptr_t key = HwiP_disable();
+    uint8_t i;
+
+    for (i = 0; i < ENC_RXLAT_HISTOGRAMS; i++)
+        encRxTime_clear(&rxTimeHist[i]);
+    HwiP_restore(key);
+}
@@ -0,0 +1,108 @@
+/*
+ * enc_rxtime.h
+ *
+ *  Receive timestamps and latency histograms. The INT line interrupt
+ *  latches a timestamp, the next receive service pass takes it and every
+ *  frame drained in that pass carries it in its descriptor. The frame
+ *  ring then measures arrival -> delivery (frameRing_dequeue) and
+ *  delivery -> release (frameRing_free) into histograms with
+ *  configurable buckets. Always built, unlike the probes of enc_probe.h.
+ */
+
+#ifndef ENC_RXTIME_H_
+#define ENC_RXTIME_H_
+
+#include <stdint.h>
+
+/* Timestamps come from the clock of enc_clock.h */
+
+/* Most bucket bounds of a histogram, one more bucket takes the samples above the last bound */
+#define ENC_RXTIME_MAX_BUCKETS  16
+
+/* Histograms */
+typedef enum {
+    ENC_RXLAT_ARRIVAL_TO_DELIVERY = 0,  /* INT edge of the service pass -> frame dequeued by the application */
+    ENC_RXLAT_DELIVERY_TO_RELEASE,      /* frame dequeued -> buffer given back to the pool */
+    ENC_RXLAT_HISTOGRAMS
+} encRxLatency_t;
+
+/*! @brief Latency histogram, in nanoseconds */
+typedef struct {
+    uint8_t  buckets;                           /* bounds in use */
+    uint32_t boundNs[ENC_RXTIME_MAX_BUCKETS];   /* bucket n holds samples up to boundNs[n], ascending */
+    uint32_t count[ENC_RXTIME_MAX_BUCKETS + 1]; /* count[buckets] holds the samples above the last bound */
+    uint32_t samples;
+    uint32_t minNs;
+    uint32_t maxNs;
+    uint64_t sumNs;                             /* divide by samples for the average */
+} encRxHistogram_t;
+
+
+/*! @brief Start the timestamp clock and clear the histograms, the bucket
+ * bounds are kept
+ */
+void encRxTime_init(void);
+
+
+/*! @brief Current timestamp, safe from interrupt context
+ *  @return     CPU cycles on target, nanoseconds on host builds
+ */
+uint32_t encRxTime_now(void);
+
+
+/*! @brief Convert a timestamp difference to nanoseconds
+ *  @param[in] ticks       difference of two encRxTime_now() values
+ *  @return     nanoseconds
+ */
+uint32_t encRxTime_toNs(uint32_t ticks);
+
+
+/*! @brief Latch the time of an INT edge, from the INT line interrupt.
+ * The first edge since the last service pass is kept.
+ */
+void encRxTime_intMark(void);
+
+
+/*! @brief Start a receive service pass: the frames drained until the next
+ * pass carry the latched INT timestamp, or the current time when the pass
+ * was not started by an edge (polling). Called by ethernet_rxToRing,
+ * enc_rx_service and the engine; code draining the ring itself with
+ * enc_rx_peek calls it before its loop.
+ *  @return     timestamp of the pass
+ */
+uint32_t encRxTime_passBegin(void);
+
+
+/*! @brief Timestamp of the current service pass, for the frames it drains
+ *  @return     timestamp of the last encRxTime_passBegin
+ */
+uint32_t encRxTime_passStamp(void);
+
+
+/*! @brief Set the bucket bounds of both histograms and clear them
+ *  @param[in] boundNs     upper bounds in nanoseconds, strictly ascending
+ *  @param[in] count       number of bounds, 1 to ENC_RXTIME_MAX_BUCKETS
+ *  @return     0 on success, -1 on invalid bounds
+ */
+int encRxTime_setBuckets(const uint32_t *boundNs, uint8_t count);
+
+
+/*! @brief Add a sample to a histogram
+ *  @param[in] which       ENC_RXLAT_* histogram
+ *  @param[in] ticks       latency as a difference of encRxTime_now() values
+ */
+void encRxTime_record(encRxLatency_t which, uint32_t ticks);
+
+
+/*! @brief Get a histogram
+ *  @param[in] which       ENC_RXLAT_* histogram
+ *  @param[out] hist       copy of the histogram
+ */
+void encRxTime_getHistogram(encRxLatency_t which, encRxHistogram_t *hist);
+
+
+/*! @brief Clear both histograms, the bucket bounds are kept
+ */
+void encRxTime_reset(void);
+
+#endif /* ENC_RXTIME_H_ */
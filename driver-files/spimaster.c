@@ -42,16 +42,19 @@
 #include <registerlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <semaphore.h>
 
 /* Driver Header files */
 #include <ti/drivers/GPIO.h>
 #include <ti/drivers/SPI.h>
 #include <ti/display/Display.h>
 #include <ti/drivers/Pin.h>
+#include <ti/drivers/dpl/HwiP.h>
 
 /* Example/Board Header files */
 #include "Board.h"
 #include "spimaster.h"
+#include "enc_clock.h"
 
 #define THREADSTACKSIZE (1024)
 
@@ -74,6 +77,15 @@
 #define WRITE_CONTROL_MSG       0x40AA
 #define READ_CONTROL_MSG        0x0000
 
+/* ENC28J60 SPI instruction set opcodes */
+#define ENC_OP_RCR      0x00    /* Read Control Register  - 000 aaaaa */
+#define ENC_OP_RBM      0x3a    /* Read Buffer Memory     - 001 11010 */
+#define ENC_OP_WCR      0x40    /* Write Control Register - 010 aaaaa */
+#define ENC_OP_WBM      0x7a    /* Write Buffer Memory    - 011 11010 */
+#define ENC_OP_BFS      0x80    /* Bit Field Set          - 100 aaaaa */
+#define ENC_OP_BFC      0xa0    /* Bit Field Clear        - 101 aaaaa */
+#define ENC_OP_SRC      0xff    /* System Reset Command   - 111 11111 */
+
 
 #define MAX_LOOP        (10)
 
@@ -105,6 +117,83 @@ SPI_Handle      masterSpi;
 SPI_Params      spiParams;
 SPI_Transaction controlReg;
 
+
+/*
+ * SPI transaction queue state
+ * Items are handed over between task context (spiQueue_submit) and the
+ * SPI callback, the pending list is protected by disabling interrupts
+ */
+
+static spiQueueItem_t  *spiQueueHead[SPIQ_PRIO_CLASSES];
+static spiQueueItem_t  *spiQueueTail[SPIQ_PRIO_CLASSES];
+static spiQueueItem_t  *spiQueueActive;
+static SPI_Transaction  spiQueueTransaction;
+static sem_t            spiQueueDone[SPIQ_PRIO_CLASSES];
+static pthread_mutex_t  spiQueueSyncLock[SPIQ_PRIO_CLASSES];
+static bool             spiQueueEnabled = false;
+
+/* ECON1.BSEL as left by the last transfer, SPIQ_BANK_ANY when unknown.
+ * Only touched by whoever owns the bus (the active item) */
+static uint8_t          spiCurrentBank = SPIQ_BANK_ANY;
+static spiQueueItem_t   spiBankItems[2];
+
+/* Bus cost counters, updated by whoever completes an item */
+static spiStats_t       spiStats;
+
+/* Bus arbiter: chip selects, the class and device of the chain on the bus,
+ * and the one bulk transfer parked at a chunk boundary. Only bulk chains
+ * are parked and a parked one resumes before the next bulk chain starts */
+#define SPI_SRAM_MASK   0x1fff
+static uint_least8_t    spiDeviceCs[SPIQ_MAX_DEVICES] = { Board_GPIO_CSN0 };
+static uint8_t          spiDeviceCount = 1;
+static uint8_t          spiActiveDevice;
+static uint8_t          spiActivePrio;
+static uint16_t         spiChunkBytes = SPIQ_CHUNK_DEFAULT;
+static spiArbStats_t    spiArbStats;
+
+typedef struct {
+    spiQueueItem_t *item;       /* data item to resume, NULL if none */
+    uint8_t         device;
+    uint8_t         op;         /* ENC_OP_RBM or ENC_OP_WBM */
+    uint16_t        ptr;        /* ERDPT/EWRPT at the chunk boundary */
+    uint32_t        epoch;      /* pointer epoch at the chunk boundary */
+} spiParked_t;
+static spiParked_t      spiParked;
+static spiQueueItem_t   spiResumeItems[2*SPIQ_REG_ITEMS + 1];
+
+/* Buffer memory pointers as last written and moved by AUTOINC. The epoch
+ * counts changes from anyone, a resume after none needs only the opcode.
+ * spiBufferOp is the RBM/WBM opcode of the CS frame on the bus, 0 if none */
+static uint8_t          spiBufferOp;
+static uint16_t         spiRdPtr, spiWrPtr;
+static uint16_t         spiRxStart = 0x05fa;
+static uint16_t         spiRxEnd = SPI_SRAM_MASK;
+static uint8_t          spiPtrKnown;        /* bits 0/1 ERDPT L/H, bits 2/3 EWRPT L/H */
+static uint32_t         spiRdEpoch, spiWrEpoch;
+
+/* Register shadow, indexed by the register name with the registers mapped
+ * into every bank under bank 0. The attributes come from ENC_REGISTERS,
+ * SPI_SHADOW_LISTED tells a listed register from a hole of the map */
+#define SPI_SHADOW_REGS     128
+#define SPI_SHADOW_LISTED   0x80
+#define SPI_SHADOW_ATTR(name, cls, access)  [(name) & 0x7f] = SPI_SHADOW_LISTED | (cls) | (access),
+static const uint8_t    spiShadowAttr[SPI_SHADOW_REGS] = { ENC_REGISTERS(SPI_SHADOW_ATTR) };
+static uint8_t          spiShadow[SPI_SHADOW_REGS];
+static uint8_t          spiShadowKnown[SPI_SHADOW_REGS / 8];
+
+/* Owned registers with a reset value other than 0 (datasheet table 3-2) */
+static const uint8_t    spiShadowResetValues[][2] = {
+    { ERXSTL, 0xfa }, { ERXSTH, 0x05 }, { ERXNDL, 0xff }, { ERXNDH, 0x1f },
+    { ERXRDPTL, 0xfa }, { ERXRDPTH, 0x05 }, { ERXFCON, 0xa1 }, { MACLCON1, 0x0f },
+    { MACLCON2, 0x37 }, { MAMXFLH, 0x06 }, { ECOCON, 0x04 }, { EPAUSH, 0x10 },
+};
+
+/* PHY registers the driver owns. PHCON1.PDPXMD resets to the LEDB strap,
+ * so the PHY shadow is only learnt from reads and writes */
+#define SPI_PHY_OWNED       ((1ul << PHCON1) | (1ul << PHID1) | (1ul << PHID2) | (1ul << PHCON2) | (1ul << PHIE) | (1ul << PHLCON))
+static uint16_t         spiPhyShadow[PHLCON + 1];
+static uint32_t         spiPhyKnown;
+
 /* =========== SPI Access functions ==========
  *
  * ===========================================
@@ -165,141 +254,1106 @@ uint8_t setBufReadFromAddress(uint8_t address){
 }
 
 
-/* operations */
+/* =========== SPI transaction queue ==========
+ *
+ * ============================================
+ */
 
+/*! @brief Reset an item to an inline command of count bytes
+ *  @param[in] item        item to fill
+ *  @param[in] count       number of bytes of cmd to clock out
+ *  @param[in] flags       SPIQ_CS_* handling
+ */
+static void spiQueue_setCmd(spiQueueItem_t *item, uint8_t count, uint8_t flags){
+    memset((void *) item->cmd, 0, sizeof(item->cmd));
+    memset((void *) item->rsp, 0, sizeof(item->rsp));
+    item->txBuf = (void *) item->cmd;
+    item->rxBuf = (void *) item->rsp;
+    item->count = count;
+    item->flags = flags;
+    item->bank = SPIQ_BANK_ANY;
+    item->status = false;
+    item->done = 0;
+    item->callback = NULL;
+    item->next = NULL;
+}
 
-/*! @brief perform spi write operation to specified register
+
+/*! @brief Link consecutive items of an array through next
+ *  @param[in] items       items to link
+ *  @param[in] used        number of items
+ *  @return             number of items
+ */
+static uint8_t spiQueue_chain(spiQueueItem_t *items, uint8_t used){
+    uint8_t i;
+    for (i = 0; i + 1 < used; i++)
+        items[i].next = &items[i + 1];
+    items[used - 1].next = NULL;
+    return used;
+}
+
+
+/*! @brief Reset an item to a single register operation
+ *  @param[in] item        item to fill
+ *  @param[in] opcode      ENC_OP_* opcode
  *  @param[in] reg         name of register
- *  @param[in] data        data to write to register
- *  @return		   Return 0 (transferOK) on success
+ *  @param[in] data        second byte, data or bits
+ *  @param[in] count       2, or 3 for MAC/MII reads
+ *  @param[in] bank        bank of register or SPIQ_BANK_ANY
  */
-spierr_t spi_write(uint8_t reg, uint8_t data){
-    //uint16_t controlWord = setBufWriteToAddress(address, data);
-    uint8_t bank_selector = whichBank(reg);
-    if ((bank_selector != 0) && (bank_selector != 1) && (bank_selector != 2) && (bank_selector != 3) && (bank_selector != 4)){
-        Display_printf(display, 0, 0, "Fatal Error - Wrong Register");
-        while(1);
+static void spiQueue_setReg(spiQueueItem_t *item, uint8_t opcode, uint8_t reg, uint8_t data, uint8_t count, uint8_t bank){
+    spiQueue_setCmd(item, count, SPIQ_CS_FRAME);
+    item->bank = bank;
+    item->cmd[0] = opcode | (reg & 0x1f);
+    item->cmd[1] = data;
+}
+
+
+/*! @brief Build the fewest BFC/BFS on ECON1 to go from one bank to another
+ *  @param[out] items      up to 2 items
+ *  @param[in] from        current bank or SPIQ_BANK_ANY if unknown
+ *  @param[in] to          bank to select
+ *  @return             number of items used
+ */
+static uint8_t spiQueue_buildBankSwitch(spiQueueItem_t *items, uint8_t from, uint8_t to){
+    uint8_t clearBits;
+    uint8_t setBits;
+    uint8_t used = 0;
+
+    if (to == SPIQ_BANK_ANY || from == to)
+        return 0;
+    if (from == SPIQ_BANK_ANY){
+        clearBits = 0x03 & ~to;
+        setBits = to;
     }
+    else{
+        clearBits = from & ~to;
+        setBits = to & ~from;
+    }
+    if (clearBits)
+        spiQueue_buildBitField(&items[used++], ECON1, clearBits, false);
+    if (setBits)
+        spiQueue_buildBitField(&items[used++], ECON1, setBits, true);
+    return used;
+}
 
-    selectMemBank(bank_selector);
-    uint8_t address = reg & 0x1f;
 
-    bool transferOK;
-    masterTxBuffer_eight[0] = 0x2<<5 | (address & 0x1f);//((1<<14) | (address & 0x1F) << 8 ) ;
-    masterTxBuffer_eight[1] = data;
+/*! @brief Follow ECON1.BSEL through a completed item
+ *  @param[in] item        item which was transferred successfully
+ */
+static void spiQueue_trackBank(spiQueueItem_t *item){
+    uint8_t op = item->cmd[0] & 0xe0;
+    uint8_t bits = item->cmd[1] & 0x03;
+
+    if (item->txBuf != (void *) item->cmd)
+        return;
+    if (item->cmd[0] == ENC_OP_SRC){
+        spiCurrentBank = SPIQ_BANK_ANY;
+        return;
+    }
+    if ((item->cmd[0] & 0x1f) != ECON1)
+        return;
+
+    if (op == ENC_OP_WCR){
+        spiCurrentBank = bits;
+    }
+    else if (bits == 0){
+        return;
+    }
+    else if (op == ENC_OP_BFS){
+        spiCurrentBank = (spiCurrentBank == SPIQ_BANK_ANY) ? (bits == 0x03 ? 0x03 : SPIQ_BANK_ANY) : (spiCurrentBank | bits);
+    }
+    else if (op == ENC_OP_BFC){
+        spiCurrentBank = (spiCurrentBank == SPIQ_BANK_ANY) ? (bits == 0x03 ? 0x00 : SPIQ_BANK_ANY) : (spiCurrentBank & ~bits);
+    }
+}
+
+
+/*! @brief Count a completed item in the bus cost counters
+ *  @param[in] item        item which was transferred
+ *  @param[in] transferOK  false if the transfer failed
+ *  @param[in] bytes       bytes clocked, a chunk of a chunked item
+ */
+static void spiQueue_account(spiQueueItem_t *item, bool transferOK, uint16_t bytes){
+    if (!transferOK){
+        spiStats.failures++;
+        return;
+    }
+    if ((item->flags & SPIQ_CS_ASSERT) && item->done == 0)
+        spiStats.transactions++;
+    spiStats.bytes += bytes;
+    if (item == &spiBankItems[0] || item == &spiBankItems[1])
+        spiStats.bankSwitches++;
+}
+
+
+/*! @brief Move the read pointer mirror like AUTOINC: inside the receive
+ * buffer ERDPT wraps from ERXND to ERXST, elsewhere at the end of memory
+ *  @param[in] ptr         ERDPT
+ *  @param[in] bytes       bytes read
+ *  @return             ERDPT after the read
+ */
+static uint16_t spiQueue_advanceRead(uint16_t ptr, uint16_t bytes){
+    if (spiRxStart <= spiRxEnd && ptr >= spiRxStart && ptr <= spiRxEnd)
+        return spiRxStart + (uint16_t) ((uint32_t) (ptr - spiRxStart) + bytes) % (spiRxEnd - spiRxStart + 1);
+    return (ptr + bytes) & SPI_SRAM_MASK;
+}
+
+
+/*! @brief Follow the buffer memory pointers through a completed ENC28J60 item:
+ * ERDPT/EWRPT/ERXST/ERXND writes, RBM/WBM opcodes and the data behind them.
+ * A chunk of a chunked item neither opens nor closes the CS frame.
+ *  @param[in] item        item which was transferred successfully, done not yet advanced
+ *  @param[in] bytes       bytes clocked
+ */
+static void spiQueue_trackPointer(spiQueueItem_t *item, uint16_t bytes){
+    uint8_t op = item->cmd[0] & 0xe0;
+    uint8_t addr = item->cmd[0] & 0x1f;
+    uint8_t data = item->cmd[1];
+
+    if ((item->flags & SPIQ_CS_ASSERT) && item->done == 0)
+        spiBufferOp = 0;
+    if (spiBufferOp != 0){
+        /* Data of the CS frame opened by an opcode */
+        if (spiBufferOp == ENC_OP_RBM)
+            spiRdPtr = spiQueue_advanceRead(spiRdPtr, bytes);
+        else
+            spiWrPtr = (spiWrPtr + bytes) & SPI_SRAM_MASK;
+    }
+    else if (item->txBuf == (void *) item->cmd){
+        if (item->cmd[0] == ENC_OP_SRC){
+            spiPtrKnown = 0;
+            spiRxStart = 0x05fa;
+            spiRxEnd = SPI_SRAM_MASK;
+            spiRdEpoch++;
+            spiWrEpoch++;
+        }
+        else if (item->cmd[0] == ENC_OP_RBM || item->cmd[0] == ENC_OP_WBM){
+            spiBufferOp = item->cmd[0];
+            if (spiBufferOp == ENC_OP_RBM)
+                spiRdEpoch++;
+            else
+                spiWrEpoch++;
+        }
+        else if (op == ENC_OP_WCR && item->bank == 0){
+            switch (addr){
+            case ERDPTL: spiRdPtr = (spiRdPtr & 0xff00) | data; spiPtrKnown |= 0x01; spiRdEpoch++; break;
+            case ERDPTH: spiRdPtr = (spiRdPtr & 0x00ff) | (data & 0x1f) << 8; spiPtrKnown |= 0x02; spiRdEpoch++; break;
+            case EWRPTL: spiWrPtr = (spiWrPtr & 0xff00) | data; spiPtrKnown |= 0x04; spiWrEpoch++; break;
+            case EWRPTH: spiWrPtr = (spiWrPtr & 0x00ff) | (data & 0x1f) << 8; spiPtrKnown |= 0x08; spiWrEpoch++; break;
+            case ERXSTL: spiRxStart = (spiRxStart & 0xff00) | data; break;
+            case ERXSTH: spiRxStart = (spiRxStart & 0x00ff) | (data & 0x1f) << 8; break;
+            case ERXNDL: spiRxEnd = (spiRxEnd & 0xff00) | data; break;
+            case ERXNDH: spiRxEnd = (spiRxEnd & 0x00ff) | (data & 0x1f) << 8; break;
+            default: break;
+            }
+        }
+    }
+    if ((item->flags & SPIQ_CS_RELEASE) && item->done + bytes >= item->count)
+        spiBufferOp = 0;
+}
+
+
+/*! @brief Check whether the shadow keeps a register
+ *  @param[in] reg         name of register, registers of every bank without bank bits
+ *  @return             true if the register is listed, writable and not changed by the chip
+ */
+static bool spiShadow_owned(uint8_t reg){
+    uint8_t attr = spiShadowAttr[reg & 0x7f];
 
-    memset((void *) masterRxBuffer_eight, 0, SPI_MSG_LENGTH);
-    controlReg.count = SPI_MSG_LENGTH;
-    controlReg.txBuf = (void *) masterTxBuffer_eight;
-    controlReg.rxBuf = (void *) masterRxBuffer_eight;
+    return (attr & SPI_SHADOW_LISTED) && !(attr & (ENC_REG_RO | ENC_REG_LIVE));
+}
 
-    /* Toggle user LED, indicating a SPI transfer is in progress */
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_ON);
 
-    /* Bitbanging attempt for Chip Select */
-    GPIO_write(Board_GPIO_CSN0, 0);
+/*! @brief Shadow index of a register name
+ *  @param[in] reg         name of register
+ *  @return             index, SPI_SHADOW_REGS if the register is not owned
+ */
+static uint8_t spiShadow_index(uint8_t reg){
+    reg = ((reg & 0x1f) >= EIE) ? (reg & 0x1f) : (reg & 0x7f);
+    return spiShadow_owned(reg) ? reg : SPI_SHADOW_REGS;
+}
+
+
+static void spiShadow_set(uint8_t index, uint8_t value){
+    spiShadow[index] = value;
+    spiShadowKnown[index >> 3] |= 1 << (index & 7);
+}
+
+
+static bool spiShadow_known(uint8_t index){
+    return (spiShadowKnown[index >> 3] & (1 << (index & 7))) != 0;
+}
 
-    /* Perform SPI transfer */
-    transferOK = SPI_transfer(masterSpi, &controlReg);
+
+/*! @brief Reset values of the owned registers, after SRC
+ */
+static void spiShadow_loadReset(void){
+    uint8_t i;
+
+    memset(spiShadow, 0, sizeof(spiShadow));
+    memset(spiShadowKnown, 0, sizeof(spiShadowKnown));
+    for (i = 0; i < sizeof(spiShadowResetValues) / sizeof(spiShadowResetValues[0]); i++)
+        spiShadow[spiShadowResetValues[i][0] & 0x7f] = spiShadowResetValues[i][1];
+    for (i = 0; i < SPI_SHADOW_REGS; i++){
+        if (spiShadow_owned(i))
+            spiShadowKnown[i >> 3] |= 1 << (i & 7);
+    }
+    spiPhyKnown = 0;
+}
+
+
+/*! @brief Follow the register shadow through a completed ENC28J60 item:
+ * WCR, BFS and BFC on owned registers, the first RCR of an owned register
+ * and SRC. A failed item leaves the register it addressed unknown.
+ *  @param[in] item        item which completed
+ *  @param[in] transferOK  result of the transfer
+ */
+static void spiShadow_track(spiQueueItem_t *item, bool transferOK){
+    uint8_t op = item->cmd[0] & 0xe0;
+    uint8_t addr = item->cmd[0] & 0x1f;
+    uint8_t index;
+
+    if (item->txBuf != (void *) item->cmd)
+        return;
+    if (item->cmd[0] == ENC_OP_SRC){
+        if (transferOK)
+            spiShadow_loadReset();
+        else
+            spi_shadowInvalidate();
+        return;
+    }
+    if (op != ENC_OP_RCR && op != ENC_OP_WCR && op != ENC_OP_BFS && op != ENC_OP_BFC)
+        return;
+    if (addr < EIE && item->bank == SPIQ_BANK_ANY)
+        return;
+    index = spiShadow_index((addr < EIE) ? (item->bank << 5 | addr) : addr);
+    if (index == SPI_SHADOW_REGS)
+        return;
     if (!transferOK){
-        Display_printf(display, 0, 0, "Unsuccessful SPI transfer\n");
-       	return (spierr_t) ERR_DRIVER_FAIL;
+        spiShadowKnown[index >> 3] &= ~(1 << (index & 7));
+        return;
     }
 
-    /* Bitbanging attempt for Chip Select */
-    GPIO_write(Board_GPIO_CSN0, 1);
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_OFF);
+    switch (op){
+    case ENC_OP_RCR:
+        /* Only a read of the right length, MAC/MII registers answer after a dummy byte */
+        if (item->count == ((spiShadowAttr[index] & ENC_REG_MAC) ? SPI_MSG_LENGTH_MAC : SPI_MSG_LENGTH))
+            spiShadow_set(index, spiQueue_readValue(item));
+        break;
+    case ENC_OP_WCR:
+        spiShadow_set(index, item->cmd[1]);
+        break;
+    case ENC_OP_BFS:
+        if (spiShadow_known(index))
+            spiShadow_set(index, spiShadow[index] | item->cmd[1]);
+        break;
+    default:
+        if (spiShadow_known(index))
+            spiShadow_set(index, spiShadow[index] & ~item->cmd[1]);
+        break;
+    }
+}
 
 
-    sleep(0.5);
-    return (spierr_t) ERR_SUCCESS;	
+/*! @brief Look a control register up in the shadow
+ *  @param[in] reg         name of register
+ *  @param[out] value      shadow value
+ *  @return             true if reg is owned and its value known, false if it must be read
+ */
+bool spi_shadowRead(uint8_t reg, uint8_t *value){
+    uint8_t index = spiShadow_index(reg);
+    bool known = false;
+    uintptr_t key;
+
+    if (index == SPI_SHADOW_REGS)
+        return false;
+    key = HwiP_disable();
+    if (spiShadow_known(index)){
+        *value = spiShadow[index];
+        spiStats.shadowHits++;
+        known = true;
+    }
+    HwiP_restore(key);
+    return known;
 }
 
 
+/*! @brief Forget the shadow, e.g. after the chip was reset through its RESET
+ * pin or lost power. Registers are read again on their next use.
+ */
+void spi_shadowInvalidate(void){
+    uintptr_t key = HwiP_disable();
+    memset(spiShadowKnown, 0, sizeof(spiShadowKnown));
+    spiPhyKnown = 0;
+    HwiP_restore(key);
+}
 
-/*! @brief perform spi read operation from specified register
+
+/*! @brief Put the bank switch an item needs in front of it
+ *  @param[in] item        item about to run
+ *  @return             first item to run, item itself if no switch is needed
+ */
+static spiQueueItem_t *spiQueue_prependBank(spiQueueItem_t *item){
+    uint8_t used = spiQueue_buildBankSwitch(spiBankItems, spiCurrentBank, item->bank);
+    if (used == 0)
+        return item;
+    spiQueue_chain(spiBankItems, used);
+    spiBankItems[used - 1].next = item;
+    return spiBankItems;
+}
+
+
+/*! @brief Build AUTOINC and a 16 bit buffer pointer write
+ *  @param[out] items      3 items
+ *  @param[in] regL        low byte register of the pointer, ERDPTL or EWRPTL
+ *  @param[in] address     value of the pointer
+ *  @return             number of items used
+ */
+static uint8_t spiQueue_buildBufferPointer(spiQueueItem_t *items, uint8_t regL, uint16_t address){
+    uint8_t used = 0;
+
+    spiQueue_buildBitField(&items[used++], ECON2, ECON2_AUTOINC, true);
+    used += spiQueue_buildWrite(&items[used], regL, address & 0x00ff);
+    used += spiQueue_buildWrite(&items[used], regL + 1, (address & 0xff00) >> 8);
+    return used;
+}
+
+
+/*! @brief Build the items for a control register write
+ *  @param[out] items      at least SPIQ_REG_ITEMS items
  *  @param[in] reg         name of register
- *  @return 		   8 bit value read back from register : -1 on failure
+ *  @param[in] data        data to write to register
+ *  @return             number of items used, chained through next
  */
-uint8_t spi_read(uint8_t reg){
-    uint8_t readVal;
-//    uint16_t controlWord = setBufReadFromAddress(address);
-    bool transferOK;
-    uint8_t bank_selector = whichBank(reg);
-    if ((bank_selector != 0) && (bank_selector != 1) && (bank_selector != 2) && (bank_selector != 3) && (bank_selector != 4)){
-        Display_printf(display, 0, 0, "Fatal Error - Wrong Register");
-        //while(1);
-	return (uint8_t) ERR_DRIVER_FAIL;
+uint8_t spiQueue_buildWrite(spiQueueItem_t *items, uint8_t reg, uint8_t data){
+    spiQueue_setReg(items, ENC_OP_WCR, reg, data, SPI_MSG_LENGTH, ENC_REG_BANK(reg));
+    return 1;
+}
+
+
+/*! @brief Build the items for a control register read.
+ * Fetch the value with spiQueue_readValue() on the last item once it completed
+ *  @param[out] items      at least SPIQ_REG_ITEMS items
+ *  @param[in] reg         name of register
+ *  @param[in] macReg      true for MAC/MII registers which need a dummy byte
+ *  @return             number of items used, chained through next
+ */
+uint8_t spiQueue_buildRead(spiQueueItem_t *items, uint8_t reg, bool macReg){
+    spiQueue_setReg(items, ENC_OP_RCR, reg, 0, macReg ? SPI_MSG_LENGTH_MAC : SPI_MSG_LENGTH, ENC_REG_BANK(reg));
+    return 1;
+}
+
+
+/*! @brief Value read by the last item of a spiQueue_buildRead() chain
+ *  @param[in] item        last item of the chain
+ *  @return             8 bit value read from the register
+ */
+uint8_t spiQueue_readValue(spiQueueItem_t *item){
+    return item->rsp[item->count - 1];
+}
+
+
+/*! @brief Build a bit field set/clear on an ETH register
+ *  @param[out] item       one item
+ *  @param[in] address     name of register, plain addresses below 0x20 are bank 0 or common
+ *  @param[in] data        bits to set or clear
+ *  @param[in] set         true for BFS, false for BFC
+ */
+void spiQueue_buildBitField(spiQueueItem_t *item, uint8_t address, uint8_t data, bool set){
+    spiQueue_setReg(item, set ? ENC_OP_BFS : ENC_OP_BFC, address, data, SPI_MSG_LENGTH, ENC_REG_BANK(address));
+}
+
+
+/*! @brief Build the items to write host memory into the buffer memory:
+ * EWRPT write followed by the WBM opcode and data under a single CS
+ *  @param[out] items      at least SPIQ_BUFFER_ITEMS items
+ *  @param[in] address     address inside buffer memory to write to
+ *  @param[in] buf         data to write, must stay valid until completion
+ *  @param[in] length      length of data
+ *  @return             number of items used, chained through next
+ */
+uint8_t spiQueue_buildWriteBuffer(spiQueueItem_t *items, uint16_t address, uint8_t *buf, uint16_t length){
+    uint8_t used = spiQueue_buildBufferPointer(items, EWRPTL, address);
+
+    /* Opcode keeps CS low, the data item raises it */
+    spiQueue_setCmd(&items[used], 1, SPIQ_CS_ASSERT);
+    items[used++].cmd[0] = ENC_OP_WBM;
+
+    spiQueue_setCmd(&items[used], 0, SPIQ_CS_RELEASE);
+    items[used].txBuf = (void *) buf;
+    items[used].rxBuf = NULL;
+    items[used++].count = length;
+    return spiQueue_chain(items, used);
+}
+
+
+/*! @brief Build the items to read the buffer memory into host memory:
+ * ERDPT write followed by the RBM opcode and data under a single CS
+ *  @param[out] items      at least SPIQ_BUFFER_ITEMS items
+ *  @param[in] address     address inside buffer memory to read from
+ *  @param[in] buf         destination, must stay valid until completion
+ *  @param[in] length      length of data
+ *  @return             number of items used, chained through next
+ */
+uint8_t spiQueue_buildReadBuffer(spiQueueItem_t *items, uint16_t address, uint8_t *buf, uint16_t length){
+    uint8_t used = spiQueue_buildBufferPointer(items, ERDPTL, address);
+
+    spiQueue_setCmd(&items[used], 1, SPIQ_CS_ASSERT);
+    items[used++].cmd[0] = ENC_OP_RBM;
+
+    spiQueue_setCmd(&items[used], 0, SPIQ_CS_RELEASE);
+    items[used].txBuf = NULL;
+    items[used].rxBuf = (void *) buf;
+    items[used++].count = length;
+    return spiQueue_chain(items, used);
+}
+
+
+/*! @brief Build the items to read the buffer memory into two destinations:
+ * ERDPT write followed by the RBM opcode, the first headLen bytes into head
+ * and the next length bytes into buf, all under a single CS
+ *  @param[out] items      at least SPIQ_SCATTER_ITEMS items
+ *  @param[in] address     address inside buffer memory to read from
+ *  @param[in] head        first destination, may be NULL if headLen is 0
+ *  @param[in] headLen     length of the first part
+ *  @param[in] buf         second destination, may be NULL if length is 0
+ *  @param[in] length      length of the second part
+ *  @return             number of items used, chained through next
+ */
+uint8_t spiQueue_buildReadScatter(spiQueueItem_t *items, uint16_t address, uint8_t *head, uint16_t headLen,
+                                  uint8_t *buf, uint16_t length){
+    uint8_t used;
+
+    if (headLen == 0)
+        return spiQueue_buildReadBuffer(items, address, buf, length);
+    if (length == 0)
+        return spiQueue_buildReadBuffer(items, address, head, headLen);
+
+    /* The read pointer runs on from the first part, CS stays low in between */
+    used = spiQueue_buildReadBuffer(items, address, head, headLen);
+    items[used - 1].flags &= ~SPIQ_CS_RELEASE;
+    spiQueue_setCmd(&items[used], 0, SPIQ_CS_RELEASE);
+    items[used].txBuf = NULL;
+    items[used].rxBuf = (void *) buf;
+    items[used++].count = length;
+    return spiQueue_chain(items, used);
+}
+
+
+/*! @brief Make a queued chain the one on the bus and count its wait
+ *  @param[in] first       first item of the chain
+ */
+static void spiQueue_activate(spiQueueItem_t *first){
+    spiArbClassStats_t *cls = &spiArbStats.cls[first->priority];
+    /* A counter read, cheap enough for the interrupts off sections and the SPI callback */
+    uint32_t waitUs = encClock_toUs(encClock_now() - first->queuedAt);
+
+    spiActiveDevice = first->device;
+    spiActivePrio = first->priority;
+    spiQueueActive = first;
+    cls->chains++;
+    cls->totalWaitUs += waitUs;
+    if (waitUs > cls->maxWaitUs)
+        cls->maxWaitUs = waitUs;
+}
+
+
+/*! @brief Build the resume of the parked transfer: the pointer again if
+ * someone moved it meanwhile, then the opcode opening a new CS frame
+ *  @return             first item to run
+ */
+static spiQueueItem_t *spiQueue_resume(void){
+    spiParked_t *p = &spiParked;
+    uint8_t used = 0;
+    uint8_t regL = (p->op == ENC_OP_RBM) ? ERDPTL : EWRPTL;
+
+    if (p->epoch != ((p->op == ENC_OP_RBM) ? spiRdEpoch : spiWrEpoch)){
+        used += spiQueue_buildWrite(&spiResumeItems[used], regL, p->ptr & 0x00ff);
+        used += spiQueue_buildWrite(&spiResumeItems[used], regL + 1, (p->ptr & 0xff00) >> 8);
+        spiArbStats.pointerRestores++;
     }
+    spiQueue_setCmd(&spiResumeItems[used], 1, SPIQ_CS_ASSERT);
+    spiResumeItems[used++].cmd[0] = p->op;
+    spiQueue_chain(spiResumeItems, used);
+    spiResumeItems[used - 1].next = p->item;
+
+    spiActiveDevice = p->device;
+    spiActivePrio = SPIQ_PRIO_BULK;
+    spiQueueActive = spiResumeItems;
+    p->item = NULL;
+    spiArbStats.resumes++;
+    return spiResumeItems;
+}
 
-    if(selectMemBank(bank_selector)!=ERR_SUCCESS)
-	return (spierr_t) ERR_DRIVER_FAIL;
 
-    uint8_t address = reg & 0x1f;
+/*! @brief Pick the chain to run next: the highest class with work, a
+ * parked transfer before the queued chains of its class
+ *  @return             first item to run, NULL if there is nothing to do
+ */
+static spiQueueItem_t *spiQueue_pick(void){
+    spiQueueItem_t *next = NULL;
+    uintptr_t key;
+    uint8_t cls;
+
+    key = HwiP_disable();
+    for (cls = 0; cls < SPIQ_PRIO_CLASSES && next == NULL; cls++){
+        if (cls == SPIQ_PRIO_BULK && spiParked.item != NULL){
+            next = spiQueue_resume();
+        }
+        else if (spiQueueHead[cls] != NULL){
+            next = spiQueueHead[cls];
+            spiQueueHead[cls] = next->link;
+            if (spiQueueHead[cls] == NULL)
+                spiQueueTail[cls] = NULL;
+            spiQueue_activate(next);
+        }
+    }
+    if (next == NULL)
+        spiQueueActive = NULL;
+    HwiP_restore(key);
+    return next;
+}
+
+
+/*! @brief Check for a queued chain of a higher class than the one on the bus
+ *  @return             true if one is waiting
+ */
+static bool spiQueue_higherWaiting(void){
+    uint8_t cls;
+
+    for (cls = 0; cls < spiActivePrio; cls++){
+        if (spiQueueHead[cls] != NULL)
+            return true;
+    }
+    return false;
+}
+
 
-    masterTxBuffer_eight[0] = address & 0x1f;
-    masterTxBuffer_eight[1] = 0;
-    memset((void *) masterRxBuffer_eight, 0, SPI_MSG_LENGTH);
-    controlReg.count = SPI_MSG_LENGTH;
-    controlReg.txBuf = (void *) masterTxBuffer_eight;
-    controlReg.rxBuf = (void *) masterRxBuffer_eight;
+/*! @brief Check whether the data item about to run is moved in chunks:
+ * buffer memory data of a bulk chain for the ENC28J60, with the pointer
+ * known so that it can be restored after a preemption
+ *  @return             true if it is chunked
+ */
+static bool spiQueue_chunked(void){
+    uint8_t known = (spiBufferOp == ENC_OP_RBM) ? 0x03 : 0x0c;
+
+    return spiChunkBytes != 0 && spiBufferOp != 0 && spiActivePrio == SPIQ_PRIO_BULK
+        && spiActiveDevice == SPIQ_DEV_ENC && (spiPtrKnown & known) == known;
+}
+
+
+/*! @brief Finish an item: CS, callback, and pick the item to run next.
+ * A chunk of a chunked item keeps CS low and continues with the next
+ * chunk, or parks the transfer when a chain of a higher class waits.
+ *  @param[in] item        item which completed
+ *  @param[in] transferOK  result of the transfer
+ *  @param[in] bytes       bytes clocked by the transfer
+ *  @return             next item to start, NULL if the queue ran empty
+ */
+static spiQueueItem_t *spiQueue_complete(spiQueueItem_t *item, bool transferOK, uint16_t bytes){
+    spiQueueItem_t *next = item->next;
+
+    if (transferOK && item->done + bytes < item->count){
+        spiQueue_account(item, true, bytes);
+        spiQueue_trackPointer(item, bytes);
+        item->done += bytes;
+        spiArbStats.chunks++;
+        if (!spiQueue_higherWaiting())
+            return item;
+        /* Park at the chunk boundary, the opcode opens a new frame later */
+        GPIO_write(spiDeviceCs[spiActiveDevice], 1);
+        GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_OFF);
+        spiParked.item = item;
+        spiParked.device = spiActiveDevice;
+        spiParked.op = spiBufferOp;
+        spiParked.ptr = (spiBufferOp == ENC_OP_RBM) ? spiRdPtr : spiWrPtr;
+        spiParked.epoch = (spiBufferOp == ENC_OP_RBM) ? spiRdEpoch : spiWrEpoch;
+        spiArbStats.cls[spiActivePrio].preempted++;
+        spiBufferOp = 0;
+        return spiQueue_pick();
+    }
 
-    /* Toggle user LED, indicating a SPI transfer is in progress */
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_ON);
+    if (!transferOK || (item->flags & SPIQ_CS_RELEASE)){
+        GPIO_write(spiDeviceCs[spiActiveDevice], 1);
+        GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_OFF);
+    }
 
-    /* Bitbanging attempt for Chip Select */
-    GPIO_write(Board_GPIO_CSN0, 0);
+    spiQueue_account(item, transferOK, bytes);
+    if (spiActiveDevice == SPIQ_DEV_ENC){
+        spiShadow_track(item, transferOK);
+        if (transferOK){
+            spiQueue_trackBank(item);
+            spiQueue_trackPointer(item, bytes);
+        }
+        else{
+            /* A failed write may have half moved a pointer */
+            spiCurrentBank = SPIQ_BANK_ANY;
+            spiBufferOp = 0;
+            spiPtrKnown = 0;
+            spiRdEpoch++;
+            spiWrEpoch++;
+        }
+    }
+    item->done = 0;
 
-    /* Perform SPI transfer */
-    transferOK = SPI_transfer(masterSpi, &controlReg);
+    /* next is read before the callback, which may recycle the item */
+    item->status = transferOK;
+    if (item->callback != NULL)
+        item->callback(item, transferOK);
 
+    /* Abort the dependent items of a failed transfer */
     if (!transferOK){
-        Display_printf(display, 0, 0, "Unsuccessful SPI transfer\n");
-	return (uint8_t) ERR_DRIVER_FAIL;
+        while (next != NULL){
+            item = next;
+            next = item->next;
+            item->status = false;
+            item->done = 0;
+            if (item->callback != NULL)
+                item->callback(item, false);
+        }
     }
 
-    /* Bitbanging attempt for Chip Select */
-    GPIO_write(Board_GPIO_CSN0, 1);
+    if (next == NULL)
+        return spiQueue_pick();
+    spiQueueActive = next;
+    return next;
+}
 
-    readVal = masterRxBuffer_eight[1];
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_OFF);
 
-    sleep(0.5);
-    return readVal;
+/*! @brief Start the transfer of an item (and of the following ones if it is refused)
+ *  @param[in] item        item to start, NULL does nothing
+ */
+static void spiQueue_start(spiQueueItem_t *item){
+    uint16_t count;
+
+    while (item != NULL){
+        if (spiActiveDevice == SPIQ_DEV_ENC)
+            item = spiQueue_prependBank(item);
+        spiQueueActive = item;
+        if ((item->flags & SPIQ_CS_ASSERT) && item->done == 0){
+            /* Toggle user LED, indicating a SPI transfer is in progress */
+            GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_ON);
+            GPIO_write(spiDeviceCs[spiActiveDevice], 0);
+        }
+
+        count = item->count - item->done;
+        if (count > spiChunkBytes && spiQueue_chunked())
+            count = spiChunkBytes;
+        spiQueueTransaction.count = count;
+        spiQueueTransaction.txBuf = (item->txBuf != NULL) ? (uint8_t *) item->txBuf + item->done : NULL;
+        spiQueueTransaction.rxBuf = (item->rxBuf != NULL) ? (uint8_t *) item->rxBuf + item->done : NULL;
+        spiQueueTransaction.arg = (void *) item;
+
+        if (SPI_transfer(masterSpi, &spiQueueTransaction))
+            return;
+        item = spiQueue_complete(item, false, count);
+    }
 }
 
 
+/*! @brief SPI_MODE_CALLBACK transfer callback driving the queue
+ *  @param[in] handle       SPI handle
+ *  @param[in] transaction  completed transaction
+ */
+void spiQueue_transferCallback(SPI_Handle handle, SPI_Transaction *transaction){
+    spiQueueItem_t *item = (spiQueueItem_t *) transaction->arg;
+    spiQueue_start(spiQueue_complete(item, transaction->status == SPI_TRANSFER_COMPLETED, transaction->count));
+}
 
-/*! @brief perform software reset of ENC28J60
- *  @return 	ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+
+/*! @brief Queue a chain of items. Items linked through next run back to back
+ * without anything else on the bus in between; the chain is aborted on the
+ * first failed transfer. Items must stay valid until their completion.
+ *  @param[in] first       first item of the chain
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
  */
-spierr_t systemSoftReset(void){
-    /* 0b 1111 1111 1111 1111 */
+spierr_t spiQueue_submit(spiQueueItem_t *first){
+    return spiQueue_submitTo(first, SPIQ_DEV_ENC, SPIQ_PRIO_NORMAL);
+}
 
-    masterTxBuffer_eight[0] = 0xFF;
-    masterTxBuffer_eight[1] = 0xFF;
-    bool transferOK;
 
-    memset((void *) masterRxBuffer_eight, 0, SPI_MSG_LENGTH);
-    controlReg.count = SPI_MSG_LENGTH;
-    controlReg.txBuf = (void *) masterTxBuffer_eight;
-    controlReg.rxBuf = (void *) masterRxBuffer_eight;
+/*! @brief Queue a chain of items for a device in a priority class. Chains
+ * of a class run in submission order, after every waiting chain of a
+ * higher class. Buffer memory data of a SPIQ_PRIO_BULK chain for the
+ * ENC28J60 is moved in chunks; between two chunks chains of a higher class
+ * may run, so a bulk chain must not depend on state they change (ERDPT and
+ * EWRPT are restored). Bank selection only applies to SPIQ_DEV_ENC.
+ *  @param[in] first       first item of the chain
+ *  @param[in] device      SPIQ_DEV_ENC or a device of spiQueue_addDevice
+ *  @param[in] priority    SPIQ_PRIO_*
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t spiQueue_submitTo(spiQueueItem_t *first, uint8_t device, uint8_t priority){
+    uintptr_t key;
+    bool idle;
+
+    if (!spiQueueEnabled || first == NULL || device >= spiDeviceCount || priority >= SPIQ_PRIO_CLASSES)
+        return (spierr_t) ERR_DRIVER_FAIL;
+
+    first->link = NULL;
+    first->device = device;
+    first->priority = priority;
+    first->queuedAt = encClock_now();
+    key = HwiP_disable();
+    idle = (spiQueueActive == NULL);
+    if (idle){
+        spiQueue_activate(first);
+    }
+    else if (spiQueueTail[priority] == NULL){
+        spiQueueHead[priority] = first;
+        spiQueueTail[priority] = first;
+    }
+    else{
+        spiQueueTail[priority]->link = first;
+        spiQueueTail[priority] = first;
+    }
+    HwiP_restore(key);
 
-    /* Toggle user LED, indicating a SPI transfer is in progress */
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_ON);
-    GPIO_write(Board_GPIO_CSN0, 0);
+    if (idle)
+        spiQueue_start(first);
+    return (spierr_t) ERR_SUCCESS;
+}
 
-    /* Perform SPI transfer */
-    transferOK = SPI_transfer(masterSpi, &controlReg);
 
-    if (!transferOK){
+/*! @brief Add a device with its own chip select on the SPI bus, after spiQueue_init
+ *  @param[in] csIndex     GPIO index of the chip select, active low, configured as an output driven high
+ *  @return             device number for spiQueue_submitTo, SPIQ_DEV_NONE if the table is full
+ */
+uint8_t spiQueue_addDevice(uint_least8_t csIndex){
+    uintptr_t key;
+    uint8_t device = SPIQ_DEV_NONE;
+
+    key = HwiP_disable();
+    if (spiDeviceCount < SPIQ_MAX_DEVICES){
+        device = spiDeviceCount;
+        spiDeviceCs[spiDeviceCount++] = csIndex;
+    }
+    HwiP_restore(key);
+    return device;
+}
+
+
+/*! @brief Set the largest buffer memory chunk of a SPIQ_PRIO_BULK chain.
+ * A higher class waits at most one chunk plus the atomic part of the chain on the bus.
+ *  @param[in] bytes       chunk size, 0 moves buffer memory data in one transfer
+ */
+void spiQueue_setChunkSize(uint16_t bytes){
+    spiChunkBytes = bytes;
+}
+
+
+/*! @brief Snapshot of the arbiter counters
+ *  @param[out] stats      copy of the counters
+ */
+void spiQueue_getArbStats(spiArbStats_t *stats){
+    uintptr_t key;
+
+    if (stats == NULL)
+        return;
+    key = HwiP_disable();
+    *stats = spiArbStats;
+    HwiP_restore(key);
+}
+
+
+/*! @brief Reset the arbiter counters
+ */
+void spiQueue_resetArbStats(void){
+    uintptr_t key = HwiP_disable();
+    memset(&spiArbStats, 0, sizeof(spiArbStats));
+    HwiP_restore(key);
+}
+
+
+/*! @brief Initialize the transaction queue. Must be called before the SPI
+ * is opened in SPI_MODE_CALLBACK with spiQueue_transferCallback as the
+ * transfer callback. Blocking register functions keep working and are
+ * serialized behind queued items.
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t spiQueue_init(void){
+    uint8_t cls;
+
+    memset(spiQueueHead, 0, sizeof(spiQueueHead));
+    memset(spiQueueTail, 0, sizeof(spiQueueTail));
+    spiQueueActive = NULL;
+    spiParked.item = NULL;
+    memset((void *) &spiQueueTransaction, 0, sizeof(spiQueueTransaction));
+
+    /* One blocking caller per class at a time, a high class call does not wait for a bulk one */
+    for (cls = 0; cls < SPIQ_PRIO_CLASSES; cls++){
+        if (sem_init(&spiQueueDone[cls], 0, 0) != 0)
+            return (spierr_t) ERR_DRIVER_FAIL;
+        if (pthread_mutex_init(&spiQueueSyncLock[cls], NULL) != 0)
+            return (spierr_t) ERR_DRIVER_FAIL;
+    }
+    spiQueueEnabled = true;
+    return (spierr_t) ERR_SUCCESS;
+}
+
+
+/*! @brief Completion of the last item of a blocking call, wakes the caller
+ * waiting on the semaphore of its class in item->arg
+ */
+static void spiQueue_syncCallback(spiQueueItem_t *item, bool transferOK){
+    sem_post((sem_t *) item->arg);
+}
+
+
+/*! @brief Run items back to back and wait for them. Goes through the queue
+ * when it is enabled, otherwise straight to SPI_transfer in blocking mode
+ *  @param[in] items       items to run, relinked through next
+ *  @param[in] used        number of items
+ *  @param[in] priority    SPIQ_PRIO_* class in the queue
+ *  @return             true if every transfer succeeded
+ */
+static bool spi_runItemsPrio(spiQueueItem_t *items, uint8_t used, uint8_t priority){
+    uint8_t i;
+    bool transferOK = true;
+
+    for (i = 0; i < used; i++){
+        if (items[i].count == 0)
+            return false;
+    }
+    spiQueue_chain(items, used);
+
+    if (spiQueueEnabled){
+        pthread_mutex_lock(&spiQueueSyncLock[priority]);
+        items[used - 1].callback = spiQueue_syncCallback;
+        items[used - 1].arg = (void *) &spiQueueDone[priority];
+        if (spiQueue_submitTo(items, SPIQ_DEV_ENC, priority) == (spierr_t) ERR_SUCCESS)
+            sem_wait(&spiQueueDone[priority]);
+        else
+            transferOK = false;
+        pthread_mutex_unlock(&spiQueueSyncLock[priority]);
+
+        for (i = 0; i < used; i++)
+            transferOK = transferOK && items[i].status;
+    }
+    else{
+        spiQueueItem_t *item = spiQueue_prependBank(items);
+        while (item != NULL && transferOK){
+            if (item->flags & SPIQ_CS_ASSERT){
+                /* Toggle user LED, indicating a SPI transfer is in progress */
+                GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_ON);
+                GPIO_write(Board_GPIO_CSN0, 0);
+            }
+
+            controlReg.count = item->count;
+            controlReg.txBuf = item->txBuf;
+            controlReg.rxBuf = item->rxBuf;
+
+            /* Perform SPI transfer */
+            transferOK = SPI_transfer(masterSpi, &controlReg);
+            item->status = transferOK;
+
+            if (!transferOK || (item->flags & SPIQ_CS_RELEASE)){
+                GPIO_write(Board_GPIO_CSN0, 1);
+                GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_OFF);
+            }
+
+            spiQueue_account(item, transferOK, item->count);
+            spiShadow_track(item, transferOK);
+            if (transferOK){
+                spiQueue_trackBank(item);
+                spiQueue_trackPointer(item, item->count);
+                item = item->next;
+                if (item != NULL)
+                    item = spiQueue_prependBank(item);
+            }
+            else{
+                spiCurrentBank = SPIQ_BANK_ANY;
+                spiBufferOp = 0;
+                spiPtrKnown = 0;
+                spiRdEpoch++;
+                spiWrEpoch++;
+            }
+        }
+    }
+
+    if (!transferOK)
         Display_printf(display, 0, 0, "Unsuccessful SPI transfer\n");
-	return (spierr_t) ERR_DRIVER_FAIL;
+    return transferOK;
+}
+
+
+/*! @brief Run items back to back and wait for them, in the normal class
+ *  @param[in] items       items to run, relinked through next
+ *  @param[in] used        number of items
+ *  @return             true if every transfer succeeded
+ */
+static bool spi_runItems(spiQueueItem_t *items, uint8_t used){
+    return spi_runItemsPrio(items, used, SPIQ_PRIO_NORMAL);
+}
+
+
+/*! @brief Run items back to back and wait for their completion, through the
+ * queue when it is enabled or with blocking SPI transfers otherwise
+ *  @param[in] items       items to run, relinked through next
+ *  @param[in] used        number of items
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t spi_transferItems(spiQueueItem_t *items, uint8_t used){
+    return spi_transferItemsPrio(items, used, SPIQ_PRIO_NORMAL);
+}
+
+
+/*! @brief spi_transferItems in a priority class of the queue. Without the
+ * queue the class has no effect.
+ *  @param[in] items       items to run, relinked through next
+ *  @param[in] used        number of items
+ *  @param[in] priority    SPIQ_PRIO_*
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t spi_transferItemsPrio(spiQueueItem_t *items, uint8_t used, uint8_t priority){
+    if (used == 0)
+        return (spierr_t) ERR_SUCCESS;
+    if (priority >= SPIQ_PRIO_CLASSES || !spi_runItemsPrio(items, used, priority))
+        return (spierr_t) ERR_DRIVER_FAIL;
+    return (spierr_t) ERR_SUCCESS;
+}
+
+
+/* =========== Register descriptors ==========
+ *
+ * ===========================================
+ */
+
+#define ENC_REG_DESC(name, cls, access)  { name, (cls) | (access), #name },
+const encRegDesc_t encRegTable[] = {
+    ENC_REGISTERS(ENC_REG_DESC)
+};
+const uint8_t encRegTableSize = sizeof(encRegTable) / sizeof(encRegTable[0]);
+
+
+/*! @brief Read a control register, no validation - use ENC_READ.
+ * Owned registers are answered from the shadow.
+ *  @param[in] reg         name of register
+ *  @param[in] bank        bank of register or SPIQ_BANK_ANY
+ *  @param[in] macReg      true for MAC/MII registers which need a dummy byte
+ *  @return             8 bit value read from register - ERR_DRIVER_FAIL on failure
+ */
+uint8_t spi_readReg(uint8_t reg, uint8_t bank, bool macReg){
+    uint8_t value;
+
+    if (spi_shadowRead(reg, &value))
+        return value;
+    return spi_readRegLive(reg, bank, macReg);
+}
+
+
+/*! @brief Read a control register from the chip, bypassing the shadow,
+ * e.g. to test the register file
+ *  @param[in] reg         name of register
+ *  @param[in] bank        bank of register or SPIQ_BANK_ANY
+ *  @param[in] macReg      true for MAC/MII registers which need a dummy byte
+ *  @return             8 bit value read from register - ERR_DRIVER_FAIL on failure
+ */
+uint8_t spi_readRegLive(uint8_t reg, uint8_t bank, bool macReg){
+    spiQueueItem_t item;
+
+    spiQueue_setReg(&item, ENC_OP_RCR, reg, 0, macReg ? SPI_MSG_LENGTH_MAC : SPI_MSG_LENGTH, bank);
+    if (!spi_runItems(&item, 1))
+        return (uint8_t) ERR_DRIVER_FAIL;
+    return spiQueue_readValue(&item);
+}
+
+
+/*! @brief Write a control register, no validation - use ENC_WRITE
+ *  @param[in] reg         name of register
+ *  @param[in] bank        bank of register or SPIQ_BANK_ANY
+ *  @param[in] data        data to write to register
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t spi_writeReg(uint8_t reg, uint8_t bank, uint8_t data){
+    spiQueueItem_t item;
+
+    spiQueue_setReg(&item, ENC_OP_WCR, reg, data, SPI_MSG_LENGTH, bank);
+    if (!spi_runItems(&item, 1))
+        return (spierr_t) ERR_DRIVER_FAIL;
+    return (spierr_t) ERR_SUCCESS;
+}
+
+
+/*! @brief Set or clear bits of an ETH register, no validation - use ENC_BFS/ENC_BFC
+ *  @param[in] reg         name of register
+ *  @param[in] bank        bank of register or SPIQ_BANK_ANY
+ *  @param[in] bits        bits to set or clear
+ *  @param[in] set         true for BFS, false for BFC
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t spi_bitFieldReg(uint8_t reg, uint8_t bank, uint8_t bits, bool set){
+    spiQueueItem_t item;
+
+    spiQueue_setReg(&item, set ? ENC_OP_BFS : ENC_OP_BFC, reg, bits, SPI_MSG_LENGTH, bank);
+    if (!spi_runItems(&item, 1))
+        return (spierr_t) ERR_DRIVER_FAIL;
+    return (spierr_t) ERR_SUCCESS;
+}
+
+
+/* operations */
+
+
+/*! @brief perform spi write operation to specified register
+ *  @param[in] reg         name of register
+ *  @param[in] data        data to write to register
+ *  @return		   Return 0 (transferOK) on success
+ */
+spierr_t spi_write(uint8_t reg, uint8_t data){
+    spiQueueItem_t items[SPIQ_REG_ITEMS];
+    uint8_t bank_selector = whichBank(reg);
+    if ((bank_selector != 0) && (bank_selector != 1) && (bank_selector != 2) && (bank_selector != 3) && (bank_selector != 4)){
+        Display_printf(display, 0, 0, "Fatal Error - Wrong Register");
+        while(1);
     }
-    GPIO_write(Board_GPIO_CSN0, 1);
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_OFF);
-    sleep(0.5);
-    return (spierr_t) ERR_SUCCESS;	
+
+    /* The bank is selected by the queue only if needed */
+    if (!spi_runItems(items, spiQueue_buildWrite(items, reg, data)))
+       	return (spierr_t) ERR_DRIVER_FAIL;
+    return (spierr_t) ERR_SUCCESS;
+}
+
+
+
+/*! @brief perform spi read operation from specified register
+ *  @param[in] reg         name of register
+ *  @return 		   8 bit value read back from register : -1 on failure
+ */
+uint8_t spi_read(uint8_t reg){
+    spiQueueItem_t items[SPIQ_REG_ITEMS];
+    uint8_t used;
+    uint8_t value;
+    uint8_t bank_selector = whichBank(reg);
+    if ((bank_selector != 0) && (bank_selector != 1) && (bank_selector != 2) && (bank_selector != 3) && (bank_selector != 4)){
+        Display_printf(display, 0, 0, "Fatal Error - Wrong Register");
+        //while(1);
+	return (uint8_t) ERR_DRIVER_FAIL;
+    }
+
+    if (spi_shadowRead(reg, &value))
+        return value;
+    used = spiQueue_buildRead(items, reg, false);
+    if (!spi_runItems(items, used))
+	return (uint8_t) ERR_DRIVER_FAIL;
+    return spiQueue_readValue(&items[used - 1]);
+}
+
+
+
+/*! @brief perform software reset of ENC28J60
+ *  @return 	ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t systemSoftReset(void){
+    /* 0b 1111 1111 */
+    spiQueueItem_t item;
+    spiQueue_setCmd(&item, 1, SPIQ_CS_FRAME);
+    item.cmd[0] = ENC_OP_SRC;
+
+    if (!spi_runItems(&item, 1))
+	return (spierr_t) ERR_DRIVER_FAIL;
+    return (spierr_t) ERR_SUCCESS;
 }
 
 
@@ -310,30 +1364,12 @@ spierr_t systemSoftReset(void){
  *  @return 		   return ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
  */
 spierr_t bitFieldSet(uint8_t address, uint8_t data){
-//    uint8_t readVal;
     /* 0b 100 aaaaa dddddddd */
-    uint8_t controlWord =  setBitSetField(address, data);
-    bool transferOK;
-
-    memset((void *) masterRxBuffer_eight, 0, SPI_MSG_LENGTH);
-    controlReg.count = SPI_MSG_LENGTH;
-    controlReg.txBuf = (void *) masterTxBuffer_eight;
-    controlReg.rxBuf = (void *) masterRxBuffer_eight;
-
-    /* Toggle user LED, indicating a SPI transfer is in progress */
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_ON);
-
-    GPIO_write(Board_GPIO_CSN0, 0);
-    /* Perform SPI transfer */
-    transferOK = SPI_transfer(masterSpi, &controlReg);
+    spiQueueItem_t item;
+    spiQueue_buildBitField(&item, address, data, true);
 
-    if (!transferOK){
-        Display_printf(display, 0, 0, "Unsuccessful SPI transfer\n");
+    if (!spi_runItems(&item, 1))
 	return (spierr_t) ERR_DRIVER_FAIL;
-    }
-    GPIO_write(Board_GPIO_CSN0, 1);
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_OFF);
-    sleep(0.5);
     return (spierr_t) ERR_SUCCESS;
 }
 
@@ -345,88 +1381,46 @@ spierr_t bitFieldSet(uint8_t address, uint8_t data){
  *  @return 		   return ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
  */
 spierr_t bitFieldClear(uint8_t address, uint8_t data){
-    uint8_t controlWord = setBitClearField(address, data);
-    bool transferOK;
+    /* 0b 101 aaaaa dddddddd */
+    spiQueueItem_t item;
+    spiQueue_buildBitField(&item, address, data, false);
 
-    memset((void *) masterRxBuffer_eight, 0, SPI_MSG_LENGTH);
-    controlReg.count = SPI_MSG_LENGTH;
-    controlReg.txBuf = (void *) masterTxBuffer_eight;
-    controlReg.rxBuf = (void *) masterRxBuffer_eight;
-
-    /* Toggle user LED, indicating a SPI transfer is in progress */
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_ON);
-    GPIO_write(Board_GPIO_CSN0, 0);
-
-    /* Perform SPI transfer */
-    transferOK = SPI_transfer(masterSpi, &controlReg);
-
-    if (!transferOK){
-        Display_printf(display, 0, 0, "Unsuccessful SPI transfer\n");
+    if (!spi_runItems(&item, 1))
 	return (spierr_t) ERR_DRIVER_FAIL;
-    }
-    GPIO_write(Board_GPIO_CSN0, 1);
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_OFF);
-    sleep(0.05);
-    return (spierr_t) ERR_SUCCESS;	
+    return (spierr_t) ERR_SUCCESS;
 }
 
 /* Buffer Memory */
 
 
 
-/*! @brief send opcode to Read Buffer Memory
+/*! @brief send opcode to Read Buffer Memory, CS is left to the caller
  *  @return 		   return ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
  */
 spierr_t sendRBMOpcode(void){
     /* 0b 001 11010  */
-    bool transferOK;
-    masterTxBuffer_eight[0] = 0x3a;
-    masterTxBuffer_eight[1] = 0x00;
-
-    memset((void *) masterRxBuffer_eight, 0, SPI_MSG_LENGTH);
-    controlReg.count = SPI_MSG_LENGTH;
-    controlReg.txBuf = (void *) masterTxBuffer_eight;
-    controlReg.rxBuf = (void *) masterRxBuffer_eight;
-
-    /* Toggle user LED, indicating a SPI transfer is in progress */
-
-    /* Perform SPI transfer */
-    transferOK = SPI_transfer(masterSpi, &controlReg);
-
-    if (!transferOK){
-        Display_printf(display, 0, 0, "Unsuccessful SPI transfer\n");
-	return (spierr_t) ERR_DRIVER_FAIL;
-    }
+    spiQueueItem_t item;
+    spiQueue_setCmd(&item, 1, 0);
+    item.cmd[0] = ENC_OP_RBM;
 
     /* Do NOT do anything with the CS pin */
-    sleep(0.5);
+    if (!spi_runItems(&item, 1))
+	return (spierr_t) ERR_DRIVER_FAIL;
     return (spierr_t) ERR_SUCCESS;
 }
 
-/*! @brief perform bit clear operation for address
+/*! @brief send opcode to Write Buffer Memory, CS is left to the caller
+ *  @return 		   return ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
  */
 spierr_t sendWBMOpcode(void){
-    /* 0b 011 11010 dddddddd */
-    bool transferOK;
+    /* 0b 011 11010 */
+    spiQueueItem_t item;
+    spiQueue_setCmd(&item, 1, 0);
+    item.cmd[0] = ENC_OP_WBM;
 
-    masterTxBuffer_eight[0] = 0x7a;
-    masterTxBuffer_eight[1] = 0x00;
-    memset((void *) masterRxBuffer_eight, 0, SPI_MSG_LENGTH);
-    controlReg.count = SPI_MSG_LENGTH;
-    controlReg.txBuf = (void *) masterTxBuffer_eight;
-    controlReg.rxBuf = (void *) masterRxBuffer_eight;
-
-
-
-    /* Perform SPI transfer */
-    transferOK = SPI_transfer(masterSpi, &controlReg);
-    if (!transferOK){
-        Display_printf(display, 0, 0, "Unsuccessful SPI transfer\n");
-	return (spierr_t) ERR_DRIVER_FAIL;
-    }
     /* Do NOT raise the CS pin */
-
-    sleep(0.5);
+    if (!spi_runItems(&item, 1))
+	return (spierr_t) ERR_DRIVER_FAIL;
     return (spierr_t) ERR_SUCCESS;
 }
 
@@ -435,29 +1429,50 @@ spierr_t sendWBMOpcode(void){
 
 
 /* Higher functions  */
-/*! @brief Helper function to select a memory bank
+/*! @brief Helper function to select a memory bank, skipped if it is already selected
  * need not be used for spi_write/read but must be used before basic operations
  *  @param[in] bank_no     bank number - 0,1,2,3
  *  @return 		   return ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
  */
 spierr_t selectMemBank(uint8_t bank_no){
-    spierr_t errno;	
-    if (bank_no == 0){
-        errno = bitFieldClear(0x1f, 0x3);
-    }
-    else if (bank_no == 1){
-        errno = bitFieldClear(0x1f, 0x3);
-        errno = bitFieldSet(0x1f,0x1);
-    }
-    else if (bank_no == 2){
-        errno = bitFieldClear(0x1f, 0x3);
-        errno = bitFieldSet(0x1f,0x2);
-    }
-    else if (bank_no == 3){
-        errno = bitFieldSet(0x1f,0x3);
-    }
-    
-    return errno; 
+    spiQueueItem_t items[2];
+    uint8_t used;
+
+    if (bank_no > 3)
+        return (spierr_t) ERR_DRIVER_FAIL;
+    used = spiQueue_buildBankSwitch(items, spiCurrentBank, bank_no);
+    return spi_transferItems(items, used);
+}
+
+
+/*! @brief Snapshot of the SPI bus cost counters
+ *  @param[out] stats      copy of the counters
+ */
+void spi_getStats(spiStats_t *stats){
+    uintptr_t key;
+
+    if (stats == NULL)
+        return;
+    key = HwiP_disable();
+    *stats = spiStats;
+    HwiP_restore(key);
+}
+
+
+/*! @brief Reset the SPI bus cost counters
+ */
+void spi_resetStats(void){
+    uintptr_t key = HwiP_disable();
+    memset(&spiStats, 0, sizeof(spiStats));
+    HwiP_restore(key);
+}
+
+
+/*! @brief Bank currently selected in ECON1.BSEL, as tracked by the driver
+ *  @return         bank number - 0,1,2,3, or SPIQ_BANK_ANY if unknown
+ */
+uint8_t currentMemBank(void){
+    return spiCurrentBank;
 }
 
 
@@ -466,8 +1481,9 @@ spierr_t selectMemBank(uint8_t bank_no){
  *  @return 		   return read value from MAC reg success - ERR_DRIVER_FAIL on failure
  */
 uint8_t spi_readMACReg(uint8_t reg){
-
-    uint8_t returnVal;
+    spiQueueItem_t items[SPIQ_REG_ITEMS];
+    uint8_t used;
+    uint8_t value;
     uint8_t bank_selector = whichBank(reg);
     if ((bank_selector != 0) && (bank_selector != 1) && (bank_selector != 2) && (bank_selector != 3) && (bank_selector != 4)){
         Display_printf(display, 0, 0, "Fatal Error - Wrong Register");
@@ -475,42 +1491,13 @@ uint8_t spi_readMACReg(uint8_t reg){
 	//while(1);
     }
 
-    selectMemBank(bank_selector);
-
-    uint8_t address = reg & 0x1f;
-
-    masterTxBuffer_MAC[0] = address & 0x1f;
-    masterTxBuffer_MAC[1] = 0;
-    masterTxBuffer_MAC[2] = 0;
-
-    bool transferOK;
-    memset((void *) masterRxBuffer_MAC, 0, SPI_MSG_LENGTH_MAC);
-    controlReg.count = SPI_MSG_LENGTH_MAC;
-    controlReg.txBuf = (void *) masterTxBuffer_MAC;
-    controlReg.rxBuf = (void *) masterRxBuffer_MAC;
-
-    /* Toggle user LED, indicating a SPI transfer is in progress */
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_ON);
-
-    /* Bitbanging attempt for Chip Select */
-    GPIO_write(Board_GPIO_CSN0, 0);
-
-    /* Perform SPI transfer */
-    transferOK = SPI_transfer(masterSpi, &controlReg);
-    if (!transferOK){
-        Display_printf(display, 0, 0, "Unsuccessful SPI transfer\n");
+    if (spi_shadowRead(reg, &value))
+        return value;
+    /* The dummy byte comes first, the value is in the third byte */
+    used = spiQueue_buildRead(items, reg, true);
+    if (!spi_runItems(items, used))
 	return (uint8_t) ERR_DRIVER_FAIL;
-    }
-
-    /* Bitbanging attempt for Chip Select */
-    GPIO_write(Board_GPIO_CSN0, 1);
-
-    returnVal = masterRxBuffer_MAC[2];
-
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_OFF);
-    sleep(0.5);
-    return returnVal;
-
+    return spiQueue_readValue(&items[used - 1]);
 }
 
 /* ========== Functions meant only for Physical register =====
@@ -529,24 +1516,33 @@ uint8_t spi_readMACReg(uint8_t reg){
 spierr_t spi_writePHYReg(uint8_t address, uint8_t higher_bits, uint8_t lower_bits){
     
     /* First write the address of the PHY register to write to into the MIREGADR register */
-    if(spi_write(MIREGADR, address) != (spierr_t) ERR_SUCCESS)
+    if(ENC_WRITE(MIREGADR, address) != (spierr_t) ERR_SUCCESS)
 	return (spierr_t) ERR_DRIVER_FAIL;
     /* Write the lower 8 bits of data to write to into the MIWRL register */
     /* 0b 010 10000 1010 0010 0r 0x5*/
-    if(spi_write(MIWRL, lower_bits) != (spierr_t) ERR_SUCCESS)
+    if(ENC_WRITE(MIWRL, lower_bits) != (spierr_t) ERR_SUCCESS)
 	return (spierr_t) ERR_DRIVER_FAIL;
     /* Write the upper 8 bits of data to write to into the MIWRH register */
-    if( spi_write(MIWRH, higher_bits) != (spierr_t) ERR_SUCCESS)
+    if( ENC_WRITE(MIWRH, higher_bits) != (spierr_t) ERR_SUCCESS)
 	return (spierr_t) ERR_DRIVER_FAIL;
     /* Wait until the MISTAT.busy bit is clear*/
-    while(spi_readMACReg(MISTAT) & 0x1);
+    while(ENC_READ(MISTAT) & 0x1);
+
+    /* PHCON1.PRST resets every PHY register */
+    if (address == PHCON1 && (higher_bits & 0x80))
+        spiPhyKnown = 0;
+    else if (address <= PHLCON && (SPI_PHY_OWNED & (1ul << address))){
+        spiPhyShadow[address] = (uint16_t) higher_bits << 8 | lower_bits;
+        spiPhyKnown |= 1ul << address;
+    }
     return (spierr_t) ERR_SUCCESS;
 }
 
 /*! @brief Read from a physical register - address of Physical register
  * written into MIREGADR, set MICMD.MIRRD bit, then sleep for 14.2 us and
  * then poll MISTAT.busy until it is low, clear MICMD.MIRRD bit
- * read the higher byte from MIRDH, lower byte from MIRDL
+ * read the higher byte from MIRDH, lower byte from MIRDL. Owned PHY
+ * registers are answered from the shadow once known.
  *  @param[in] address     address of physical register
  *  @param[in]             16 bit value read from PHY reg
  *  @return 		   return 16 bit read value on success - ERR_DRIVER_FAIL on failure
@@ -557,29 +1553,44 @@ uint16_t spi_readPHYReg(uint8_t address){
     uint8_t readValL;
     uint16_t readVal;
     uint16_t errno;
-    errno = spi_write(MIREGADR, address);
+    bool owned = address <= PHLCON && (SPI_PHY_OWNED & (1ul << address));
+    uint32_t failures = spiStats.failures;
+    uintptr_t key;
+
+    if (owned && (spiPhyKnown & (1ul << address))){
+        key = HwiP_disable();
+        spiStats.shadowHits++;
+        HwiP_restore(key);
+        return spiPhyShadow[address];
+    }
+    errno = ENC_WRITE(MIREGADR, address);
     if (errno != (spierr_t) ERR_SUCCESS)
 	return (spierr_t) ERR_DRIVER_FAIL;
     /* Begin operation by setting MIRRD bit */
-    uint8_t MICMD_val = 0x3 & (spi_readMACReg(0x12));
-    errno = spi_write(MICMD, (MICMD_val & 0xfe) | 0x1 );
+    uint8_t MICMD_val = 0x3 & (ENC_READ(MICMD));
+    errno = ENC_WRITE(MICMD, (MICMD_val & 0xfe) | 0x1 );
     if (errno != (spierr_t) ERR_SUCCESS)
 	return (uint16_t) ERR_DRIVER_FAIL;
 
     usleep(20);
 
     /* Polling until the PHY read completes */
-    while(spi_readMACReg(MISTAT) & 0x1);
+    while(ENC_READ(MISTAT) & 0x1);
 
     /* Clear MICMD bit when you are done */
-    MICMD_val = 0x3 & (spi_readMACReg(MICMD));
-    errno = spi_write(MICMD,(MICMD_val & 0xfe));
+    MICMD_val = 0x3 & (ENC_READ(MICMD));
+    errno = ENC_WRITE(MICMD,(MICMD_val & 0xfe));
     if (errno != (spierr_t) ERR_SUCCESS)
 	return (uint16_t) ERR_DRIVER_FAIL;
-    readValH = spi_readMACReg(MIRDH);
-    readValL = spi_readMACReg(MIRDL);
+    readValH = ENC_READ(MIRDH);
+    readValL = ENC_READ(MIRDL);
 
     readVal = readValH << 8 | readValL;
+    /* A failed MIRDL/MIRDH read is not learnt */
+    if (owned && spiStats.failures == failures){
+        spiPhyShadow[address] = readVal;
+        spiPhyKnown |= 1ul << address;
+    }
     return readVal;
 }
 
@@ -613,50 +1624,11 @@ uint8_t whichBank(uint8_t reg){
  *  @return 		       return ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
  */
 spierr_t writeBufferMemory(uint8_t* test_TxBuf, uint16_t address, uint16_t length){
-    uint8_t* test_RxBuf = (uint8_t*) malloc(sizeof(uint8_t)*length);
- 
-    /* Set Test Stuff to send in */
-
-
-    /* Set AUTOINC */
-    selectMemBank(0);
-    bitFieldSet(0x1e, 0x80);
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_ON);
+    spiQueueItem_t items[SPIQ_BUFFER_ITEMS];
 
-
-    if(spi_write(EWRPTL, address & 0x00ff)!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-    if(spi_write(EWRPTH, (address & 0xff00) >>8)!=ERR_SUCCESS)
-	return ERR_DRIVER_FAIL;
-
-    GPIO_write(Board_GPIO_CSN0, 0);
-
-    if (sendWBMOpcode()!= (spierr_t) ERR_SUCCESS)
+    /* EWRPT, then WBM opcode and payload under one chip select */
+    if (!spi_runItems(items, spiQueue_buildWriteBuffer(items, address, test_TxBuf, length)))
 	return (spierr_t) ERR_DRIVER_FAIL;
-
-    bool transferOK;
-    memset((void *) test_RxBuf, 0, length);
-    controlReg.count = length;
-    controlReg.txBuf = (void *) test_TxBuf;
-    controlReg.rxBuf = (void *) test_RxBuf;
-
-    /* Perform SPI transfer */
-    transferOK = SPI_transfer(masterSpi, &controlReg);
-    if (!transferOK){
-        Display_printf(display, 0, 0, "Unsuccessful SPI transfer\n");
-	return (spierr_t) ERR_DRIVER_FAIL;
-    }
-
-    /* Bitbanging attempt for Chip Select */
-    GPIO_write(Board_GPIO_CSN0, 1);
-
-
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_OFF);
-    sleep(0.5);
-    free(test_RxBuf);
-    /* Clear AUTOINC */
-    selectMemBank(0);
-    bitFieldClear(0x1e, 0x80);
     return (spierr_t) ERR_SUCCESS;
 }
 
@@ -668,57 +1640,14 @@ spierr_t writeBufferMemory(uint8_t* test_TxBuf, uint16_t address, uint16_t lengt
  *  @return 		       return ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
  */
 spierr_t readBufferMemory(uint8_t* test_RxBuf, uint16_t address, uint16_t length){
-    uint8_t* test_TxBuf = (uint8_t*) malloc(sizeof(uint8_t)*length);
-
-
-    /* Set AUTOINC */
-    selectMemBank(0);
-    bitFieldSet(0x1e, 0x80);
-    if(spi_write(ERDPTL, address & 0x00ff)!=(spierr_t) ERR_SUCCESS)
-	return (spierr_t) ERR_DRIVER_FAIL;
-    if(spi_write(ERDPTH, (address & 0xff00) >> 8)!= (spierr_t) ERR_SUCCESS )
-	return (spierr_t) ERR_DRIVER_FAIL;
-
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_ON);
-
-    GPIO_write(Board_GPIO_CSN0, 0);
-
-    if (sendRBMOpcode()!= (spierr_t) ERR_SUCCESS)
-	return (spierr_t) ERR_DRIVER_FAIL;
-
-    bool transferOK;
-    memset((void *) test_TxBuf, 0, length);
-    memset((void *) test_RxBuf, 0, length);
-    controlReg.count = length;
-    controlReg.txBuf = (void *) test_TxBuf;
-    controlReg.rxBuf = (void *) test_RxBuf;
+    spiQueueItem_t items[SPIQ_BUFFER_ITEMS];
 
-    /* Perform SPI transfer */
-    transferOK = SPI_transfer(masterSpi, &controlReg);
-    if (!transferOK){
-        Display_printf(display, 0, 0, "Unsuccessful SPI transfer\n");
+    /* ERDPT, then RBM opcode and payload under one chip select */
+    if (!spi_runItems(items, spiQueue_buildReadBuffer(items, address, test_RxBuf, length)))
 	return (spierr_t) ERR_DRIVER_FAIL;
-    }
-
-    /* Bitbanging attempt for Chip Select */
-    GPIO_write(Board_GPIO_CSN0, 1);
-
-    GPIO_write(Board_GPIO_LED1, Board_GPIO_LED_OFF);
-    sleep(0.5);
-//    Display_printf(display,0,0,"Just after reading from buffer memory - if this is what it is, then it means the issue is somewhere reading from buffer memory if the length is > 256 bytes \n");
-//    int i;
-//    for (i=0;i<length;i++)
-//	Display_printf(display,0,0,"test_RxBuf[%d] = %x\n", i, test_RxBuf[i]);	
-//    Display_printf(display,0,0,"That's the end in read buffer mem \n");
-    free(test_TxBuf);
-
-    /* Clear AUTOINC */
-    selectMemBank(0);
-    bitFieldClear(0x1e, 0x80);	
-    return (spierr_t) ERR_SUCCESS;	
+    return (spierr_t) ERR_SUCCESS;
 }
 
-
 /*! @brief test to write to and read from buffer memory
  *  @param[in] address         address inside buffer memory to write to
  *  @return 		       return ERR_SUCCESS on success, ERR_DRIVER_FAIL on failure
@@ -904,54 +1833,59 @@ spierr_t setClock(uint8_t divider){
 
 
 
-/*! @brief WRite to all w/r register banks
- * read the value back, and then restore the previous values
+/*! @brief Write to the w/r registers of one class in a bank, taken from
+ * the register descriptors, read the value back, and then restore the previous values
  * NOT a fool-proof test
  * @param[in] bank_no      bank to test
+ * @param[in] cls          ENC_REG_ETH or ENC_REG_MAC
  * @param[in] start        start address of bank
  * @param[in] end          end address of bank
- * @param[in]              number of errors
+ * @param[out] tests       incremented by the number of registers tested
+ * @return              number of errors
  */
-uint8_t regBankTest_ETH(uint8_t bank_no, uint8_t start, uint8_t end){
-    /* Bank 0 */
-    selectMemBank(bank_no);
-    uint8_t bufValues[32];
-    int i;
-    uint8_t err_count=0;
-    /* First read in the existing values so you don't lose them */
-    for (i=start;i<end;i++){
-            // Generate a random number in between 0 and 99 to write to the register
-        bufValues[i] = spi_read(i);
-    }
-
-    uint8_t readVal;
-    uint8_t writeVal;
+static uint8_t regBankTest_class(uint8_t bank_no, uint8_t cls, uint8_t start, uint8_t end, uint16_t *tests){
+    uint8_t i;
+    uint8_t err_count = 0;
 
-    for (i=start;i<end;i++){
-        writeVal = 3;
-        spi_write(i, writeVal);
-        readVal = spi_read(i);
+    for (i = 0; i < encRegTableSize; i++){
+        const encRegDesc_t *desc = &encRegTable[i];
+        uint8_t bank = ENC_REG_BANK(desc->reg);
+        bool macReg = (desc->attr & ENC_REG_MAC) != 0;
+        uint8_t savedVal;
+        uint8_t readVal;
+        uint8_t writeVal = 3;
+
+        /* Registers mapped into every bank hold the bank selection and interrupt flags, leave them alone */
+        if (bank != bank_no || (desc->attr & ENC_REG_MAC) != cls || (desc->attr & (ENC_REG_RO | ENC_REG_CMD)))
+            continue;
+        if ((desc->reg & 0x1f) < start || (desc->reg & 0x1f) >= end)
+            continue;
+        (*tests)++;
+
+        /* First read in the existing value so you don't lose it */
+        savedVal = spi_readRegLive(desc->reg, bank, macReg);
+
+        spi_writeReg(desc->reg, bank, writeVal);
+        readVal = spi_readRegLive(desc->reg, bank, macReg);
         if (readVal!=writeVal){
             err_count++;
-            Display_printf(display, 0, 0, "Error Writing to/reading from bank %d, register number %d\n",bank_no,i);
+            Display_printf(display, 0, 0, "Error Writing to/reading from bank %d, register %s\n",bank_no,desc->name);
             Display_printf(display, 0, 0, "value written : %d, value read: %d\n",writeVal, readVal);
         }
-    }
-    /* Write back the initial values */
-    for (i=start;i<end;i++){
-        spi_write(i, bufValues[i]);
-        readVal = spi_read(i);
-        if (readVal!=bufValues[i]){
-            Display_printf(display, 0, 0, "Error Writing to/reading from bank %d, register number %d, and you may have lost a default value, please check manually \n",bank_no,i);
-            Display_printf(display, 0, 0, "value written : %d, value read: %d\n",bufValues[i], readVal);
+
+        /* Write back the initial value */
+        spi_writeReg(desc->reg, bank, savedVal);
+        readVal = spi_readRegLive(desc->reg, bank, macReg);
+        if (readVal!=savedVal){
+            Display_printf(display, 0, 0, "Error Writing to/reading from bank %d, register %s, and you may have lost a default value, please check manually \n",bank_no,desc->name);
+            Display_printf(display, 0, 0, "value written : %d, value read: %d\n",savedVal, readVal);
         }
     }
     return err_count;
 }
 
 
-
-/*! @brief WRite to all w/r MAC register banks
+/*! @brief WRite to all w/r ETH registers of a bank between start and end
  * read the value back, and then restore the previous values
  * NOT a fool-proof test
  * @param[in] bank_no      bank to test
@@ -959,42 +1893,24 @@ uint8_t regBankTest_ETH(uint8_t bank_no, uint8_t start, uint8_t end){
  * @param[in] end          end address of bank
  * @param[in]              number of errors
  */
-uint8_t regBankTest_MAC(uint8_t bank_no, uint8_t start, uint8_t end){
-    /* Bank 0 */
-    selectMemBank(bank_no);
-    uint8_t bufValues[32];
-    int i;
-    uint8_t err_count = 0;
+uint8_t regBankTest_ETH(uint8_t bank_no, uint8_t start, uint8_t end){
+    uint16_t tests = 0;
+    return regBankTest_class(bank_no, ENC_REG_ETH, start, end, &tests);
+}
 
-    /* First read in the existing values so you don't lose them */
-    for (i=start;i<end;i++){
-            // Generate a random number in between 0 and 99 to write to the register
-        bufValues[i] = spi_readMACReg(i);
-    }
 
-    uint8_t readVal;
-    uint8_t writeVal;
 
-    for (i=start;i<end;i++){
-        writeVal = 3;
-        spi_write(i, writeVal);
-        readVal = spi_readMACReg(i);
-        if (readVal!=writeVal){
-            err_count++;
-            Display_printf(display, 0, 0, "Error Writing to/reading from bank %d, register number %d\n",bank_no,i);
-            Display_printf(display, 0, 0, "value written : %d, value read: %d\n",writeVal, readVal);
-        }
-    }
-    /* Write back the initial values */
-    for (i=start;i<end;i++){
-        spi_write(i, bufValues[i]);
-        readVal = spi_readMACReg(i);
-        if (readVal!=bufValues[i]){
-            Display_printf(display, 0, 0, "Error Writing to/reading from bank %d, register number %d, and you may have lost a default value, please check manually \n",bank_no,i);
-            Display_printf(display, 0, 0, "value written : %d, value read: %d\n",bufValues[i], readVal);
-        }
-    }
-    return err_count;
+/*! @brief WRite to all w/r MAC/MII registers of a bank between start and end
+ * read the value back, and then restore the previous values
+ * NOT a fool-proof test
+ * @param[in] bank_no      bank to test
+ * @param[in] start        start address of bank
+ * @param[in] end          end address of bank
+ * @param[in]              number of errors
+ */
+uint8_t regBankTest_MAC(uint8_t bank_no, uint8_t start, uint8_t end){
+    uint16_t tests = 0;
+    return regBankTest_class(bank_no, ENC_REG_MAC, start, end, &tests);
 }
 
 
@@ -1005,47 +1921,23 @@ uint8_t regBankTest_MAC(uint8_t bank_no, uint8_t start, uint8_t end){
  */
 void regBankTest(void){
 
-    uint8_t err_bank_0 =0;
-    uint8_t err_bank_1 =0;
-    uint8_t err_bank_2 =0;
-    uint8_t err_bank_3 =0;
+    uint8_t err_bank[4];
     uint8_t spierr_total =0;
+    uint16_t total_tests = 0;
+    uint8_t bank_no;
+
+    /* Each register is accessed the way its descriptor says, ETH or MAC/MII */
+    for (bank_no = 0; bank_no < 4; bank_no++){
+        err_bank[bank_no] = regBankTest_class(bank_no, ENC_REG_ETH, 0, 32, &total_tests);
+        err_bank[bank_no] += regBankTest_class(bank_no, ENC_REG_MAC, 0, 32, &total_tests);
+        spierr_total += err_bank[bank_no];
+    }
 
-    /* Bank 0 */
-    err_bank_0 = err_bank_0 + regBankTest_ETH(0,0x10,0x18);
-    err_bank_0 = err_bank_0 + regBankTest_ETH(0,27,32);
-
-    /* Bank 1 */
-    err_bank_1 = err_bank_1 + regBankTest_ETH(1,0,18);
-    err_bank_1 = err_bank_1 + regBankTest_ETH(1,20,22);
-    err_bank_1 = err_bank_1 + regBankTest_ETH(1,24,26);
-    err_bank_1 = err_bank_1 + regBankTest_ETH(1,27,32);
-
-
-    /* Bank 2 */
-    err_bank_2 = err_bank_2 + regBankTest_MAC(2,0,1);
-    err_bank_2 = err_bank_2 + regBankTest_MAC(2,2,5);
-    err_bank_2 = err_bank_2 + regBankTest_MAC(2,0x6,0x0c);
-    err_bank_2 = err_bank_2 + regBankTest_MAC(2,0x12,0x13);
-    err_bank_2 = err_bank_2 + regBankTest_MAC(2,0x14,0x15);
-    err_bank_2 = err_bank_2 + regBankTest_MAC(2,0x16,0x1a);
-    err_bank_2 = err_bank_2 + regBankTest_ETH(2,0x1b,32);
-
-    /* Bank 3 */
-    err_bank_3 = err_bank_3 + regBankTest_MAC(3,0,0x6);
-    err_bank_3 = err_bank_3 + regBankTest_ETH(3,0x6,0x09);
-    err_bank_3 = err_bank_3 + regBankTest_MAC(3,0x0a,0x0b);
-    err_bank_3 = err_bank_3 + regBankTest_ETH(3,0x15,0x16);
-    err_bank_3 = err_bank_3 + regBankTest_ETH(3,0x17,0x1a);
-    err_bank_3 = err_bank_3 + regBankTest_ETH(3,0x1b,32);
-
-    spierr_total = err_bank_0 + err_bank_1 +err_bank_2+err_bank_3;
-    uint16_t total_tests = 0x18 - 0x10 + 32-27 + 18+2+2+32-27 + 1 + 3 + 0x0c-6+1+1+0x1a-0x16 + 32 - 0x1b + 6 + 3 + 1 + 1 + 0x1a-0x17+32-0x1b;
     Display_printf(display, 0, 0, "Errors: \n   \
             Bank 0 : %d,  \
             Bank 1 : %d,   \
             Bank 2 : %d,    \
-            Bank 3 : %d", err_bank_0,err_bank_1, err_bank_2,err_bank_3);
+            Bank 3 : %d", err_bank[0],err_bank[1], err_bank[2],err_bank[3]);
     Display_printf(display, 0, 0, " Total errors  : %d, \
                                     Total Tests: :%d\n", spierr_total,total_tests);
 }
@@ -9,6 +9,9 @@
 #define SPIMASTER_H_
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <ti/drivers/SPI.h>
+#include "registerlib.h"
 #define spierr_t uint8_t
 
 enum errors{
@@ -17,6 +20,242 @@ enum errors{
 	ERR_TEST_FAIL = -2
 };
 
+/* =========== SPI transaction queue ==========
+ *
+ * ============================================
+ */
+
+/* Chip select handling of a queued item */
+#define SPIQ_CS_ASSERT    0x01    /* pull CS low before the transfer */
+#define SPIQ_CS_RELEASE   0x02    /* raise CS after the transfer */
+#define SPIQ_CS_FRAME     (SPIQ_CS_ASSERT | SPIQ_CS_RELEASE)
+
+/* Worst case number of items used by the spiQueue_build* helpers */
+#define SPIQ_REG_ITEMS     1     /* register access, the bank is selected on execution */
+#define SPIQ_BUFFER_ITEMS  5     /* AUTOINC, pointer L/H, opcode, data */
+#define SPIQ_SCATTER_ITEMS 6     /* AUTOINC, pointer L/H, opcode, two data parts */
+
+/* Bank of an item that does not need one (common registers, buffer memory) */
+#define SPIQ_BANK_ANY      0xff
+
+/* Priority classes of queued chains, a lower class is served first.
+ * Chains run whole, except buffer memory data in SPIQ_PRIO_BULK chains:
+ * it is moved in chunks and a waiting chain of a higher class runs
+ * between two chunks, the transfer resumes with the RBM/WBM opcode */
+#define SPIQ_PRIO_HIGH     0     /* time critical: audio transmit, PHY reads */
+#define SPIQ_PRIO_NORMAL   1     /* spiQueue_submit and the blocking register calls */
+#define SPIQ_PRIO_BULK     2     /* frame reads, preemptible at chunk boundaries */
+#define SPIQ_PRIO_CLASSES  3
+
+/* Devices on the bus, each with its own chip select */
+#define SPIQ_DEV_ENC       0     /* ENC28J60 on Board_GPIO_CSN0, added by spiQueue_init */
+#define SPIQ_MAX_DEVICES   4
+#define SPIQ_DEV_NONE      0xff
+
+/* Default largest buffer memory chunk of a SPIQ_PRIO_BULK chain */
+#define SPIQ_CHUNK_DEFAULT 128
+
+typedef struct spiQueueItem spiQueueItem_t;
+
+/*! @brief Completion callback of a queued item, runs in SPI callback context
+ *  @param[in] item         item that completed
+ *  @param[in] transferOK   false if the transfer failed or the chain was aborted
+ */
+typedef void (*spiQueue_CallbackFxn)(spiQueueItem_t *item, bool transferOK);
+
+struct spiQueueItem {
+    uint8_t              cmd[3];     /* inline tx bytes for register operations */
+    uint8_t              rsp[3];     /* inline rx bytes for register operations */
+    void                *txBuf;      /* NULL sends the default tx value */
+    void                *rxBuf;      /* NULL discards received bytes */
+    uint16_t             count;
+    uint8_t              flags;      /* SPIQ_CS_* */
+    uint8_t              bank;       /* ECON1.BSEL needed by the item, or SPIQ_BANK_ANY */
+    bool                 status;     /* set on completion */
+    uint8_t              device;     /* internal - SPIQ_DEV_* of the chain, first item */
+    uint8_t              priority;   /* internal - SPIQ_PRIO_* of the chain, first item */
+    uint16_t             done;       /* internal - bytes of a chunked transfer already moved */
+    uint32_t             queuedAt;   /* internal - encClock_now() at submission of the chain, first item */
+    spiQueue_CallbackFxn callback;   /* optional, called when this item completes */
+    void                *arg;        /* free for the owner of the item */
+    spiQueueItem_t      *next;       /* dependent item, started straight from this item's completion */
+    spiQueueItem_t      *link;       /* internal - pending queue linkage */
+};
+
+
+/*! @brief Initialize the transaction queue. Must be called before the SPI
+ * is opened in SPI_MODE_CALLBACK with spiQueue_transferCallback as the
+ * transfer callback. Blocking register functions keep working and are
+ * serialized behind queued items.
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t spiQueue_init(void);
+
+
+/*! @brief SPI_MODE_CALLBACK transfer callback driving the queue
+ *  @param[in] handle       SPI handle
+ *  @param[in] transaction  completed transaction
+ */
+void spiQueue_transferCallback(SPI_Handle handle, SPI_Transaction *transaction);
+
+
+/*! @brief Queue a chain of items. Items linked through next run back to back
+ * without anything else on the bus in between; the chain is aborted on the
+ * first failed transfer. Items must stay valid until their completion.
+ * The bank of each item is selected right before it runs, only when the
+ * tracked ECON1.BSEL differs.
+ *  @param[in] first       first item of the chain
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t spiQueue_submit(spiQueueItem_t *first);
+
+
+/*! @brief Queue a chain of items for a device in a priority class. Chains
+ * of a class run in submission order, after every waiting chain of a
+ * higher class. Buffer memory data of a SPIQ_PRIO_BULK chain for the
+ * ENC28J60 is moved in chunks; between two chunks chains of a higher class
+ * may run, so a bulk chain must not depend on state they change (ERDPT and
+ * EWRPT are restored). Bank selection only applies to SPIQ_DEV_ENC.
+ *  @param[in] first       first item of the chain
+ *  @param[in] device      SPIQ_DEV_ENC or a device of spiQueue_addDevice
+ *  @param[in] priority    SPIQ_PRIO_*
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t spiQueue_submitTo(spiQueueItem_t *first, uint8_t device, uint8_t priority);
+
+
+/*! @brief Add a device with its own chip select on the SPI bus, after spiQueue_init
+ *  @param[in] csIndex     GPIO index of the chip select, active low, configured as an output driven high
+ *  @return             device number for spiQueue_submitTo, SPIQ_DEV_NONE if the table is full
+ */
+uint8_t spiQueue_addDevice(uint_least8_t csIndex);
+
+
+/*! @brief Set the largest buffer memory chunk of a SPIQ_PRIO_BULK chain.
+ * A higher class waits at most one chunk plus the atomic part of the chain on the bus.
+ *  @param[in] bytes       chunk size, 0 moves buffer memory data in one transfer
+ */
+void spiQueue_setChunkSize(uint16_t bytes);
+
+
+/*! @brief Arbiter counters of a priority class */
+typedef struct {
+    uint32_t chains;         /* chains started */
+    uint32_t maxWaitUs;      /* longest time from submission to the first transfer */
+    uint32_t totalWaitUs;    /* sum of the waits, for the mean */
+    uint32_t preempted;      /* times a chain was parked at a chunk boundary */
+} spiArbClassStats_t;
+
+/*! @brief Arbiter counters */
+typedef struct {
+    spiArbClassStats_t cls[SPIQ_PRIO_CLASSES];
+    uint32_t chunks;         /* chunk boundaries passed with CS held */
+    uint32_t resumes;        /* parked transfers resumed */
+    uint32_t pointerRestores;/* resumes which had to write ERDPT/EWRPT again */
+} spiArbStats_t;
+
+
+/*! @brief Snapshot of the arbiter counters
+ *  @param[out] stats      copy of the counters
+ */
+void spiQueue_getArbStats(spiArbStats_t *stats);
+
+
+/*! @brief Reset the arbiter counters
+ */
+void spiQueue_resetArbStats(void);
+
+
+/*! @brief Build the items for a control register write
+ *  @param[out] items      at least SPIQ_REG_ITEMS items
+ *  @param[in] reg         name of register
+ *  @param[in] data        data to write to register
+ *  @return             number of items used, chained through next
+ */
+uint8_t spiQueue_buildWrite(spiQueueItem_t *items, uint8_t reg, uint8_t data);
+
+
+/*! @brief Build the items for a control register read.
+ * Fetch the value with spiQueue_readValue() on the last item once it completed
+ *  @param[out] items      at least SPIQ_REG_ITEMS items
+ *  @param[in] reg         name of register
+ *  @param[in] macReg      true for MAC/MII registers which need a dummy byte
+ *  @return             number of items used, chained through next
+ */
+uint8_t spiQueue_buildRead(spiQueueItem_t *items, uint8_t reg, bool macReg);
+
+
+/*! @brief Value read by the last item of a spiQueue_buildRead() chain
+ *  @param[in] item        last item of the chain
+ *  @return             8 bit value read from the register
+ */
+uint8_t spiQueue_readValue(spiQueueItem_t *item);
+
+
+/*! @brief Build a bit field set/clear on an ETH register
+ *  @param[out] item       one item
+ *  @param[in] address     name of register, plain addresses below 0x20 are bank 0 or common
+ *  @param[in] data        bits to set or clear
+ *  @param[in] set         true for BFS, false for BFC
+ */
+void spiQueue_buildBitField(spiQueueItem_t *item, uint8_t address, uint8_t data, bool set);
+
+
+/*! @brief Build the items to write host memory into the buffer memory:
+ * EWRPT write followed by the WBM opcode and data under a single CS
+ *  @param[out] items      at least SPIQ_BUFFER_ITEMS items
+ *  @param[in] address     address inside buffer memory to write to
+ *  @param[in] buf         data to write, must stay valid until completion
+ *  @param[in] length      length of data
+ *  @return             number of items used, chained through next
+ */
+uint8_t spiQueue_buildWriteBuffer(spiQueueItem_t *items, uint16_t address, uint8_t *buf, uint16_t length);
+
+
+/*! @brief Build the items to read the buffer memory into host memory:
+ * ERDPT write followed by the RBM opcode and data under a single CS
+ *  @param[out] items      at least SPIQ_BUFFER_ITEMS items
+ *  @param[in] address     address inside buffer memory to read from
+ *  @param[in] buf         destination, must stay valid until completion
+ *  @param[in] length      length of data
+ *  @return             number of items used, chained through next
+ */
+uint8_t spiQueue_buildReadBuffer(spiQueueItem_t *items, uint16_t address, uint8_t *buf, uint16_t length);
+
+
+/*! @brief Build the items to read the buffer memory into two destinations:
+ * ERDPT write followed by the RBM opcode, the first headLen bytes into head
+ * and the next length bytes into buf, all under a single CS
+ *  @param[out] items      at least SPIQ_SCATTER_ITEMS items
+ *  @param[in] address     address inside buffer memory to read from
+ *  @param[in] head        first destination, may be NULL if headLen is 0
+ *  @param[in] headLen     length of the first part
+ *  @param[in] buf         second destination, may be NULL if length is 0
+ *  @param[in] length      length of the second part
+ *  @return             number of items used, chained through next
+ */
+uint8_t spiQueue_buildReadScatter(spiQueueItem_t *items, uint16_t address, uint8_t *head, uint16_t headLen,
+                                  uint8_t *buf, uint16_t length);
+
+
+/*! @brief Run items back to back and wait for their completion, through the
+ * queue when it is enabled or with blocking SPI transfers otherwise
+ *  @param[in] items       items to run, relinked through next
+ *  @param[in] used        number of items
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t spi_transferItems(spiQueueItem_t *items, uint8_t used);
+
+
+/*! @brief spi_transferItems in a priority class of the queue. Without the
+ * queue the class has no effect.
+ *  @param[in] items       items to run, relinked through next
+ *  @param[in] used        number of items
+ *  @param[in] priority    SPIQ_PRIO_*
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t spi_transferItemsPrio(spiQueueItem_t *items, uint8_t used, uint8_t priority);
+
 /* =========== SPI Access functions ==========
  *
  * ===========================================
@@ -89,13 +328,13 @@ spierr_t bitFieldSet(uint8_t address, uint8_t data);
 spierr_t bitFieldClear(uint8_t address, uint8_t data);
 
 
-/*! @brief send opcode to Read Buffer Memory
+/*! @brief send opcode to Read Buffer Memory, CS is left to the caller
  *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
  */
 spierr_t sendRBMOpcode(void);
 
 
-/*! @brief perform bit clear operation for address
+/*! @brief send opcode to Write Buffer Memory, CS is left to the caller
  *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
  */
 spierr_t sendWBMOpcode(void);
@@ -104,7 +343,7 @@ spierr_t sendWBMOpcode(void);
 
 
 /* Higher functions  */
-/*! @brief Helper function to select a memory bank
+/*! @brief Helper function to select a memory bank, skipped if it is already selected
  * need not be used for spi_write/read but must be used before basic operations
  *  @param[in] bank_no     bank number - 0,1,2,3
  *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
@@ -112,6 +351,33 @@ spierr_t sendWBMOpcode(void);
 spierr_t selectMemBank(uint8_t bank_no);
 
 
+/*! @brief SPI bus cost counters */
+typedef struct {
+    uint32_t transactions;   /* chip select frames */
+    uint32_t bytes;          /* bytes clocked, both directions counted once */
+    uint32_t bankSwitches;   /* BFC/BFS on ECON1 inserted to change bank */
+    uint32_t failures;       /* failed or aborted transfers */
+    uint32_t shadowHits;     /* register reads served from the shadow, no transfer */
+} spiStats_t;
+
+
+/*! @brief Snapshot of the SPI bus cost counters
+ *  @param[out] stats      copy of the counters
+ */
+void spi_getStats(spiStats_t *stats);
+
+
+/*! @brief Reset the SPI bus cost counters
+ */
+void spi_resetStats(void);
+
+
+/*! @brief Bank currently selected in ECON1.BSEL, as tracked by the driver
+ *  @return         bank number - 0,1,2,3, or SPIQ_BANK_ANY if unknown
+ */
+uint8_t currentMemBank(void);
+
+
 /*! @brief Function to read a MAC register - send 24 clock cycles insteado of 16
  *  @param[in] reg     name of MAC register to read from
  *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
@@ -157,6 +423,110 @@ uint16_t spi_readPHYReg(uint8_t address);
 uint8_t whichBank(uint8_t reg);
 
 
+/* =========== Register descriptors ==========
+ *
+ * ===========================================
+ */
+
+/* name##_ATTR holds the class and access of every register in ENC_REGISTERS */
+#define ENC_REG_ATTR_ENUM(name, cls, access)  name##_ATTR = (cls) | (access),
+enum encRegAttr {
+    ENC_REGISTERS(ENC_REG_ATTR_ENUM)
+};
+
+/* Bank needed to access reg, SPIQ_BANK_ANY for registers mapped into every bank */
+#define ENC_REG_BANK(reg)  ((((reg) & 0x1f) >= EIE) ? SPIQ_BANK_ANY : (((reg) & 0x60) >> 5))
+
+/* Compile error (negative array size) when cond is false */
+#define ENC_REG_CHECK(cond)  ((void) sizeof(char[(cond) ? 1 : -1]))
+
+/* Register accessors. reg must be a name from ENC_REGISTERS: the transfer
+ * length and the bank are resolved at compile time, and an unknown register,
+ * a write to a read only register or a BFS/BFC on a MAC/MII register does
+ * not compile */
+#define ENC_READ(reg) \
+    spi_readReg((reg), ENC_REG_BANK(reg), ((reg##_ATTR) & ENC_REG_MAC) != 0)
+#define ENC_WRITE(reg, data) \
+    (ENC_REG_CHECK(!((reg##_ATTR) & ENC_REG_RO)), spi_writeReg((reg), ENC_REG_BANK(reg), (data)))
+#define ENC_BFS(reg, bits) \
+    (ENC_REG_CHECK(!((reg##_ATTR) & (ENC_REG_RO | ENC_REG_MAC))), spi_bitFieldReg((reg), ENC_REG_BANK(reg), (bits), true))
+#define ENC_BFC(reg, bits) \
+    (ENC_REG_CHECK(!((reg##_ATTR) & (ENC_REG_RO | ENC_REG_MAC))), spi_bitFieldReg((reg), ENC_REG_BANK(reg), (bits), false))
+
+typedef struct {
+    uint8_t     reg;     /* name of register */
+    uint8_t     attr;    /* ENC_REG_* class and access */
+    const char *name;
+} encRegDesc_t;
+
+/* All registers of ENC_REGISTERS, for code that walks the register map */
+extern const encRegDesc_t encRegTable[];
+extern const uint8_t encRegTableSize;
+
+
+/*! @brief Read a control register, no validation - use ENC_READ
+ *  @param[in] reg         name of register
+ *  @param[in] bank        bank of register or SPIQ_BANK_ANY
+ *  @param[in] macReg      true for MAC/MII registers which need a dummy byte
+ *  @return             8 bit value read from register - ERR_DRIVER_FAIL on failure
+ */
+uint8_t spi_readReg(uint8_t reg, uint8_t bank, bool macReg);
+
+
+/*! @brief Write a control register, no validation - use ENC_WRITE
+ *  @param[in] reg         name of register
+ *  @param[in] bank        bank of register or SPIQ_BANK_ANY
+ *  @param[in] data        data to write to register
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t spi_writeReg(uint8_t reg, uint8_t bank, uint8_t data);
+
+
+/*! @brief Set or clear bits of an ETH register, no validation - use ENC_BFS/ENC_BFC
+ *  @param[in] reg         name of register
+ *  @param[in] bank        bank of register or SPIQ_BANK_ANY
+ *  @param[in] bits        bits to set or clear
+ *  @param[in] set         true for BFS, false for BFC
+ *  @return     ERR_SUCCESS on success - ERR_DRIVER_FAIL on failure
+ */
+spierr_t spi_bitFieldReg(uint8_t reg, uint8_t bank, uint8_t bits, bool set);
+
+
+/* =========== Register shadow ===============
+ * The driver keeps the value of every register it owns: all writable
+ * registers of ENC_REGISTERS except the ENC_REG_LIVE ones, and PHCON1,
+ * PHID1/2, PHCON2, PHIE and PHLCON of the PHY. The shadow follows every
+ * completed write, BFS and BFC, takes the reset values after SRC and
+ * learns the others from their first read. ENC_READ and spi_readPHYReg
+ * answer from it without a transfer.
+ * ===========================================
+ */
+
+
+/*! @brief Read a control register from the chip, bypassing the shadow,
+ * e.g. to test the register file
+ *  @param[in] reg         name of register
+ *  @param[in] bank        bank of register or SPIQ_BANK_ANY
+ *  @param[in] macReg      true for MAC/MII registers which need a dummy byte
+ *  @return             8 bit value read from register - ERR_DRIVER_FAIL on failure
+ */
+uint8_t spi_readRegLive(uint8_t reg, uint8_t bank, bool macReg);
+
+
+/*! @brief Look a control register up in the shadow
+ *  @param[in] reg         name of register
+ *  @param[out] value      shadow value
+ *  @return             true if reg is owned and its value known, false if it must be read
+ */
+bool spi_shadowRead(uint8_t reg, uint8_t *value);
+
+
+/*! @brief Forget the shadow, e.g. after the chip was reset through its RESET
+ * pin or lost power. Registers are read again on their next use.
+ */
+void spi_shadowInvalidate(void);
+
+
 /* ======== Test Functions ==========
  *
  * ==================================
@@ -246,7 +616,7 @@ spierr_t LEDB_Off(void);
 spierr_t setClock(uint8_t divider);
 
 
-/*! @brief WRite to all w/r register banks
+/*! @brief WRite to all w/r ETH registers of a bank between start and end
  * read the value back, and then restore the previous values
  * NOT a fool-proof test
  * @param[in] bank_no      bank to test
@@ -257,7 +627,7 @@ spierr_t setClock(uint8_t divider);
 uint8_t regBankTest_ETH(uint8_t bank_no, uint8_t start, uint8_t end);
 
 
-/*! @brief WRite to all w/r MAC register banks
+/*! @brief WRite to all w/r MAC/MII registers of a bank between start and end
  * read the value back, and then restore the previous values
  * NOT a fool-proof test
  * @param[in] bank_no      bank to test
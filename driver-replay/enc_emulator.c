@@ -0,0 +1,543 @@
+/*
+ * enc_emulator.c
+ *
+ *  Emulated ENC28J60 for the host replay harness
+ */
+
+#include "enc_emulator.h"
+#include "registerlib.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define SRAM_SIZE      0x2000
+#define PHY_REGS       0x20
+
+/* SPI opcodes */
+#define OP_RCR         0x00
+#define OP_RBM         0x3a
+#define OP_WCR         0x40
+#define OP_WBM         0x7a
+#define OP_BFS         0x80
+#define OP_BFC         0xa0
+#define OP_SRC         0xff
+
+#define ECON1_BSEL     0x03
+
+/* Receive status vector bits 16-31 */
+#define RSV_OK         0x80      /* bit 23, received OK */
+#define RSV_MULTICAST  0x01      /* bit 24 */
+#define RSV_BROADCAST  0x02      /* bit 25 */
+
+#define CRC_LENGTH     4
+#define TSV_LENGTH     7
+
+typedef enum {
+    EMU_IDLE = 0,       /* waiting for an opcode */
+    EMU_READ,           /* RCR, next byte returns the register */
+    EMU_READ_DUMMY,     /* RCR of a MAC/MII register, dummy byte first */
+    EMU_WRITE,          /* WCR/BFS/BFC, next byte is the data */
+    EMU_RBM,
+    EMU_WBM,
+    EMU_DONE            /* command complete, more bytes are ignored */
+} emuState_t;
+
+/* Register classes from the driver register table, indexed by name */
+#define EMU_CLASS(name, cls, access)  [name] = (cls),
+static const uint8_t emuRegClass[0x80] = {
+    ENC_REGISTERS(EMU_CLASS)
+};
+
+static uint8_t emuSram[SRAM_SIZE];
+/* Banks 0-3, the common registers 0x1b-0x1f live in bank 0 */
+static uint8_t emuRegs[4][0x20];
+static uint16_t emuPhy[PHY_REGS];
+static emuState_t emuState;
+static uint8_t emuOpcode;
+static uint8_t emuReg;          /* register name of the command, bank included */
+static uint64_t emuNowNs;
+static uint32_t emuBitRate = 8000000;
+static uint32_t emuOverheadNs = 0;
+static encEmu_arrivalFxn emuArrival;
+static void *emuArrivalArg;
+static encEmuStats_t emuStats;
+
+
+/*! @brief Storage of a register name, bank included
+ *  @param[in] reg         register name
+ *  @return             register byte
+ */
+static uint8_t *encEmu_reg(uint8_t reg){
+    if ((reg & 0x1f) >= EIE)
+        return &emuRegs[0][reg & 0x1f];
+    return &emuRegs[(reg & 0x60) >> 5][reg & 0x1f];
+}
+
+
+static uint16_t encEmu_get16(uint8_t regL){
+    return *encEmu_reg(regL + 1) << 8 | *encEmu_reg(regL);
+}
+
+
+static void encEmu_set16(uint8_t regL, uint16_t value){
+    *encEmu_reg(regL) = value & 0xff;
+    *encEmu_reg(regL + 1) = value >> 8;
+}
+
+
+/*! @brief Register name addressed by an opcode in the current bank
+ *  @param[in] address     5 bit address of the opcode
+ *  @return             register name
+ */
+static uint8_t encEmu_name(uint8_t address){
+    if (address >= EIE)
+        return address;
+    return (emuRegs[0][ECON1] & ECON1_BSEL) << 5 | address;
+}
+
+
+/*! @brief Bytes held in the receive ring, from the byte after ERXRDPT to ERXWRPT
+ *  @return             used bytes
+ */
+static uint16_t encEmu_ringUsed(void){
+    uint16_t st = encEmu_get16(ERXSTL);
+    uint16_t nd = encEmu_get16(ERXNDL);
+    uint16_t size = nd - st + 1;
+    uint16_t wr = encEmu_get16(ERXWRPTL);
+    uint16_t rd = encEmu_get16(ERXRDPTL);
+
+    return (uint16_t) ((wr + size - rd - 1) % size);
+}
+
+
+/*! @brief Power on reset values */
+static void encEmu_resetRegs(void){
+    memset(emuRegs, 0, sizeof(emuRegs));
+    memset(emuPhy, 0, sizeof(emuPhy));
+    encEmu_set16(ERXSTL, 0x05fa);
+    encEmu_set16(ERXNDL, 0x1fff);
+    encEmu_set16(ERDPTL, 0x05fa);
+    encEmu_set16(ERXRDPTL, 0x05fa);
+    encEmu_set16(ERXWRPTL, 0x0000);
+    encEmu_set16(ETXNDL, 0x0000);
+    *encEmu_reg(ECON2) = ECON2_AUTOINC;
+    *encEmu_reg(ESTAT) = ESTAT_CLKRDY;
+    *encEmu_reg(ERXFCON) = ERXFCON_UCEN | ERXFCON_CRCEN | ERXFCON_BCEN;
+    *encEmu_reg(MACLCON1) = 0x0f;
+    *encEmu_reg(MACLCON2) = 0x37;
+    encEmu_set16(MAMXFLL, 0x0600);
+    *encEmu_reg(ECOCON) = 0x04;
+    encEmu_set16(EPAUSL, 0x1000);
+    *encEmu_reg(EREVID) = 0x06;
+    emuPhy[PHID1] = 0x0083;
+    emuPhy[PHID2] = 0x1400;
+    /* Link up */
+    emuPhy[PHSTAT1] = 0x1804;
+    emuPhy[PHSTAT2] = PHSTAT2_LSTAT;
+    emuPhy[PHLCON] = 0x3422;
+    emuState = EMU_IDLE;
+}
+
+
+/*! @brief Power on reset of the emulated chip, virtual time back to 0
+ */
+void encEmu_reset(void){
+    memset(emuSram, 0, sizeof(emuSram));
+    encEmu_resetRegs();
+    emuNowNs = 0;
+    memset(&emuStats, 0, sizeof(emuStats));
+}
+
+
+/*! @brief Cost of the SPI traffic in virtual time
+ *  @param[in] bitRate     SPI clock in Hz
+ *  @param[in] overheadNs  fixed cost of every SPI transfer (driver call, DMA setup)
+ */
+void encEmu_setSpiTiming(uint32_t bitRate, uint32_t overheadNs){
+    if (bitRate != 0)
+        emuBitRate = bitRate;
+    emuOverheadNs = overheadNs;
+}
+
+
+/*! @brief Install the arrival hook
+ *  @param[in] fxn         hook, NULL to remove it
+ *  @param[in] arg         hook argument
+ */
+void encEmu_setArrivalHook(encEmu_arrivalFxn fxn, void *arg){
+    emuArrival = fxn;
+    emuArrivalArg = arg;
+}
+
+
+/*! @brief Virtual time
+ *  @return             nanoseconds since encEmu_reset or encEmu_setTime
+ */
+uint64_t encEmu_now(void){
+    return emuNowNs;
+}
+
+
+/*! @brief Set the virtual time, without running the arrival hook
+ *  @param[in] nowNs       new virtual time
+ */
+void encEmu_setTime(uint64_t nowNs){
+    emuNowNs = nowNs;
+}
+
+
+/*! @brief Let virtual time pass, then run the arrival hook
+ *  @param[in] ns          nanoseconds
+ */
+void encEmu_advance(uint64_t ns){
+    emuNowNs += ns;
+    if (emuArrival != NULL)
+        emuArrival(emuArrivalArg, emuNowNs);
+}
+
+
+/*! @brief Receive filter of ERXFCON. Pattern match, Magic Packet and hash
+ * table filters are not emulated, they never match.
+ *  @param[in] frame       frame from the destination address
+ *  @return             true if the frame is accepted
+ */
+static bool encEmu_filter(const uint8_t *frame){
+    static const uint8_t broadcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    uint8_t erxfcon = *encEmu_reg(ERXFCON);
+    uint8_t mac[6];
+    bool isBroadcast = memcmp(frame, broadcast, 6) == 0;
+
+    mac[0] = *encEmu_reg(MAADR1);
+    mac[1] = *encEmu_reg(MAADR2);
+    mac[2] = *encEmu_reg(MAADR3);
+    mac[3] = *encEmu_reg(MAADR4);
+    mac[4] = *encEmu_reg(MAADR5);
+    mac[5] = *encEmu_reg(MAADR6);
+
+    /* Promiscuous */
+    if ((erxfcon & ~(ERXFCON_CRCEN | ERXFCON_ANDOR)) == 0)
+        return true;
+    if ((erxfcon & ERXFCON_UCEN) && memcmp(frame, mac, 6) == 0)
+        return true;
+    if ((erxfcon & ERXFCON_BCEN) && isBroadcast)
+        return true;
+    if ((erxfcon & ERXFCON_MCEN) && (frame[0] & 0x01) && !isBroadcast)
+        return true;
+    return false;
+}
+
+
+/*! @brief Write bytes into the receive ring, wrapping at ERXND
+ *  @param[in] addr        ring address
+ *  @param[in] data        bytes, NULL for zeros
+ *  @param[in] len         number of bytes
+ *  @return             address after the bytes
+ */
+static uint16_t encEmu_ringWrite(uint16_t addr, const uint8_t *data, uint16_t len){
+    uint16_t st = encEmu_get16(ERXSTL);
+    uint16_t nd = encEmu_get16(ERXNDL);
+    uint16_t i;
+
+    for (i = 0; i < len; i++){
+        emuSram[addr] = data ? data[i] : 0;
+        addr = (addr == nd) ? st : (addr + 1) & (SRAM_SIZE - 1);
+    }
+    return addr;
+}
+
+
+/*! @brief A frame arrives on the wire now: filtered, then written to the
+ * receive ring with its next packet pointer and status vector
+ *  @param[in] frame       frame from the destination address, without CRC
+ *  @param[in] len         frame length
+ *  @return             true if it was written to the ring
+ */
+bool encEmu_receive(const uint8_t *frame, uint16_t len){
+    uint8_t header[6];
+    uint16_t st = encEmu_get16(ERXSTL);
+    uint16_t nd = encEmu_get16(ERXNDL);
+    uint16_t size = nd - st + 1;
+    uint16_t wr = encEmu_get16(ERXWRPTL);
+    uint16_t rd = encEmu_get16(ERXRDPTL);
+    uint16_t byteCount = len + CRC_LENGTH;
+    uint16_t need = sizeof(header) + byteCount;
+    uint16_t freeBytes, next, used;
+    uint8_t *pktcnt = encEmu_reg(EPKTCNT);
+
+    emuStats.framesIn++;
+    if (len < 14){
+        emuStats.framesFiltered++;
+        return false;
+    }
+    if (!(*encEmu_reg(ECON1) & ECON1_RXEN)){
+        emuStats.framesRxOff++;
+        return false;
+    }
+    if (!encEmu_filter(frame)){
+        emuStats.framesFiltered++;
+        return false;
+    }
+
+    /* Frames start on even addresses */
+    need += need & 1;
+    if (wr > rd)
+        freeBytes = (nd - st) - (wr - rd);
+    else if (wr == rd)
+        freeBytes = nd - st;
+    else
+        freeBytes = rd - wr - 1;
+    if (need > freeBytes || *pktcnt == 255){
+        *encEmu_reg(EIR) |= EIR_RXERIF;
+        emuStats.framesDropped++;
+        return false;
+    }
+
+    next = wr + need;
+    if (next > nd)
+        next -= size;
+    header[0] = next & 0xff;
+    header[1] = next >> 8;
+    header[2] = byteCount & 0xff;
+    header[3] = byteCount >> 8;
+    header[4] = RSV_OK;
+    header[5] = 0;
+    if (memcmp(frame, "\xff\xff\xff\xff\xff\xff", 6) == 0)
+        header[5] |= RSV_BROADCAST;
+    else if (frame[0] & 0x01)
+        header[5] |= RSV_MULTICAST;
+
+    wr = encEmu_ringWrite(wr, header, sizeof(header));
+    wr = encEmu_ringWrite(wr, frame, len);
+    encEmu_ringWrite(wr, NULL, CRC_LENGTH);
+    encEmu_set16(ERXWRPTL, next);
+    (*pktcnt)++;
+    *encEmu_reg(EIR) |= EIR_PKTIF;
+
+    emuStats.framesAccepted++;
+    used = encEmu_ringUsed();
+    if (used > emuStats.highWaterBytes)
+        emuStats.highWaterBytes = used;
+    if (*pktcnt > emuStats.highWaterFrames)
+        emuStats.highWaterFrames = *pktcnt;
+    return true;
+}
+
+
+/*! @brief Frames waiting in the ring, EPKTCNT without SPI traffic
+ *  @return             EPKTCNT
+ */
+uint8_t encEmu_pending(void){
+    return *encEmu_reg(EPKTCNT);
+}
+
+
+/*! @brief INT line: EIE.INTIE set and an enabled EIR flag raised
+ *  @return             true while INT is asserted (low on the pin)
+ */
+bool encEmu_interrupt(void){
+    uint8_t eie = *encEmu_reg(EIE);
+
+    return (eie & EIE_INTIE) && (*encEmu_reg(EIR) & eie & ~EIE_INTIE);
+}
+
+
+/*! @brief Send the frame between ETXST and ETXND: it leaves at once, the
+ * transmit status vector is written behind it and TXIF set
+ */
+static void encEmu_transmit(void){
+    uint16_t st = encEmu_get16(ETXSTL);
+    uint16_t nd = encEmu_get16(ETXNDL);
+    uint16_t len = nd - st;
+    uint8_t tsv[TSV_LENGTH] = { 0 };
+    uint16_t i;
+
+    tsv[0] = len & 0xff;
+    tsv[1] = len >> 8;
+    tsv[2] = 0x80;              /* transmit done */
+    for (i = 0; i < TSV_LENGTH; i++)
+        emuSram[(nd + 1 + i) & (SRAM_SIZE - 1)] = tsv[i];
+
+    emuStats.framesTx++;
+    *encEmu_reg(ECON1) &= ~ECON1_TXRTS;
+    *encEmu_reg(EIR) |= EIR_TXIF;
+}
+
+
+/*! @brief Side effects of a register write
+ *  @param[in] reg         register name
+ *  @param[in] old         value before the write
+ */
+static void encEmu_written(uint8_t reg, uint8_t old){
+    uint8_t value = *encEmu_reg(reg);
+    uint8_t *pktcnt = encEmu_reg(EPKTCNT);
+
+    switch (reg){
+    case ECON1:
+        if ((value & ECON1_TXRTS) && !(old & ECON1_TXRTS))
+            encEmu_transmit();
+        if (value & ECON1_TXRST)
+            *encEmu_reg(ECON1) &= ~ECON1_TXRTS;
+        break;
+    case ECON2:
+        if (value & ECON2_PKTDEC){
+            if (*pktcnt > 0)
+                (*pktcnt)--;
+            if (*pktcnt == 0)
+                *encEmu_reg(EIR) &= ~EIR_PKTIF;
+            *encEmu_reg(ECON2) &= ~ECON2_PKTDEC;
+        }
+        if (value & ECON2_PWRSV)
+            *encEmu_reg(ESTAT) &= ~ESTAT_CLKRDY;
+        else
+            *encEmu_reg(ESTAT) |= ESTAT_CLKRDY;
+        break;
+    case ERXSTL:
+    case ERXSTH:
+        /* The hardware write pointer follows the start of the ring */
+        encEmu_set16(ERXWRPTL, encEmu_get16(ERXSTL));
+        break;
+    case MICMD:
+        if (value & MICMD_MIIRD){
+            uint16_t phy = emuPhy[*encEmu_reg(MIREGADR) & (PHY_REGS - 1)];
+            *encEmu_reg(MIRDL) = phy & 0xff;
+            *encEmu_reg(MIRDH) = phy >> 8;
+        }
+        break;
+    case MIWRH:
+        emuPhy[*encEmu_reg(MIREGADR) & (PHY_REGS - 1)] = value << 8 | *encEmu_reg(MIWRL);
+        break;
+    case EPKTCNT:
+    case ERXWRPTL:
+    case ERXWRPTH:
+    case ESTAT:
+    case EREVID:
+    case MISTAT:
+        /* Read only */
+        *encEmu_reg(reg) = old;
+        break;
+    default:
+        break;
+    }
+}
+
+
+/*! @brief Chip select of the ENC28J60
+ *  @param[in] asserted    true when CS goes low
+ */
+void encEmu_select(bool asserted){
+    (void) asserted;
+    /* Every chip select frame starts with an opcode */
+    emuState = EMU_IDLE;
+}
+
+
+/*! @brief One byte clocked while selected
+ *  @param[in] in          byte from the host
+ *  @return             byte to the host
+ */
+static uint8_t encEmu_byte(uint8_t in){
+    uint8_t out = 0;
+    uint8_t *reg;
+    uint8_t old;
+    uint16_t ptr;
+
+    switch (emuState){
+    case EMU_IDLE:
+        emuOpcode = in;
+        if (in == OP_SRC){
+            encEmu_resetRegs();
+            emuState = EMU_DONE;
+        }
+        else if (in == OP_RBM){
+            emuState = EMU_RBM;
+        }
+        else if (in == OP_WBM){
+            emuState = EMU_WBM;
+        }
+        else{
+            emuReg = encEmu_name(in & 0x1f);
+            if ((in & 0xe0) == OP_RCR)
+                emuState = (emuRegClass[emuReg] & ENC_REG_MAC) ? EMU_READ_DUMMY : EMU_READ;
+            else
+                emuState = EMU_WRITE;
+        }
+        break;
+    case EMU_READ_DUMMY:
+        emuState = EMU_READ;
+        break;
+    case EMU_READ:
+        out = *encEmu_reg(emuReg);
+        emuState = EMU_DONE;
+        break;
+    case EMU_WRITE:
+        reg = encEmu_reg(emuReg);
+        old = *reg;
+        if ((emuOpcode & 0xe0) == OP_WCR)
+            *reg = in;
+        else if ((emuOpcode & 0xe0) == OP_BFS)
+            *reg |= in;
+        else if ((emuOpcode & 0xe0) == OP_BFC)
+            *reg &= ~in;
+        encEmu_written(emuReg, old);
+        emuState = EMU_DONE;
+        break;
+    case EMU_RBM:
+        ptr = encEmu_get16(ERDPTL);
+        out = emuSram[ptr];
+        if (*encEmu_reg(ECON2) & ECON2_AUTOINC){
+            /* The read pointer wraps from ERXND to ERXST */
+            if (ptr == encEmu_get16(ERXNDL))
+                ptr = encEmu_get16(ERXSTL);
+            else
+                ptr = (ptr + 1) & (SRAM_SIZE - 1);
+            encEmu_set16(ERDPTL, ptr);
+        }
+        break;
+    case EMU_WBM:
+        ptr = encEmu_get16(EWRPTL);
+        emuSram[ptr] = in;
+        if (*encEmu_reg(ECON2) & ECON2_AUTOINC)
+            encEmu_set16(EWRPTL, (ptr + 1) & (SRAM_SIZE - 1));
+        break;
+    case EMU_DONE:
+    default:
+        break;
+    }
+    return out;
+}
+
+
+/*! @brief Bytes clocked while selected
+ *  @param[in] tx          bytes from the host, NULL for the default value
+ *  @param[out] rx         bytes to the host, may be NULL
+ *  @param[in] count       number of bytes
+ */
+void encEmu_transfer(const uint8_t *tx, uint8_t *rx, size_t count){
+    size_t i;
+    uint8_t out;
+
+    for (i = 0; i < count; i++){
+        out = encEmu_byte(tx ? tx[i] : 0xff);
+        if (rx != NULL)
+            rx[i] = out;
+    }
+    encEmu_advance((uint64_t) count * 8 * 1000000000ULL / emuBitRate + emuOverheadNs);
+}
+
+
+/*! @brief Emulator counters
+ *  @param[out] stats      copy of the counters
+ */
+void encEmu_getStats(encEmuStats_t *stats){
+    if (stats != NULL)
+        *stats = emuStats;
+}
+
+
+/*! @brief Clear the emulator counters, the high-water marks restart from the ring state
+ */
+void encEmu_resetStats(void){
+    memset(&emuStats, 0, sizeof(emuStats));
+    emuStats.highWaterBytes = encEmu_ringUsed();
+    emuStats.highWaterFrames = *encEmu_reg(EPKTCNT);
+}
@@ -0,0 +1,120 @@
+/*
+ * enc_emulator.h
+ *
+ *  Emulated ENC28J60 for the host replay harness: SPI opcodes, banked
+ *  control registers, MII access to the PHY, the 8 KB buffer memory with
+ *  the receive ring, and frames appearing on the wire. Time is virtual,
+ *  it advances with the SPI traffic at the configured bit rate.
+ */
+
+#ifndef ENC_EMULATOR_H_
+#define ENC_EMULATOR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*! @brief Emulator counters */
+typedef struct {
+    uint32_t framesIn;          /* frames offered by the wire */
+    uint32_t framesAccepted;    /* written to the receive ring */
+    uint32_t framesFiltered;    /* rejected by ERXFCON */
+    uint32_t framesDropped;     /* no room in the ring, or EPKTCNT at 255 */
+    uint32_t framesRxOff;       /* arrived with ECON1.RXEN clear */
+    uint32_t framesTx;          /* frames sent with ECON1.TXRTS */
+    uint16_t highWaterBytes;    /* most bytes held in the receive ring */
+    uint8_t  highWaterFrames;   /* highest EPKTCNT */
+} encEmuStats_t;
+
+/*! @brief Called whenever virtual time moves, to put the frames that are
+ * due on the wire with encEmu_receive
+ *  @param[in] arg         hook argument
+ *  @param[in] nowNs       virtual time
+ */
+typedef void (*encEmu_arrivalFxn)(void *arg, uint64_t nowNs);
+
+
+/*! @brief Power on reset of the emulated chip, virtual time back to 0
+ */
+void encEmu_reset(void);
+
+
+/*! @brief Cost of the SPI traffic in virtual time
+ *  @param[in] bitRate     SPI clock in Hz
+ *  @param[in] overheadNs  fixed cost of every SPI transfer (driver call, DMA setup)
+ */
+void encEmu_setSpiTiming(uint32_t bitRate, uint32_t overheadNs);
+
+
+/*! @brief Install the arrival hook
+ *  @param[in] fxn         hook, NULL to remove it
+ *  @param[in] arg         hook argument
+ */
+void encEmu_setArrivalHook(encEmu_arrivalFxn fxn, void *arg);
+
+
+/*! @brief Virtual time
+ *  @return             nanoseconds since encEmu_reset or encEmu_setTime
+ */
+uint64_t encEmu_now(void);
+
+
+/*! @brief Set the virtual time, without running the arrival hook
+ *  @param[in] nowNs       new virtual time
+ */
+void encEmu_setTime(uint64_t nowNs);
+
+
+/*! @brief Let virtual time pass, then run the arrival hook
+ *  @param[in] ns          nanoseconds
+ */
+void encEmu_advance(uint64_t ns);
+
+
+/*! @brief A frame arrives on the wire now: filtered, then written to the
+ * receive ring with its next packet pointer and status vector
+ *  @param[in] frame       frame from the destination address, without CRC
+ *  @param[in] len         frame length
+ *  @return             true if it was written to the ring
+ */
+bool encEmu_receive(const uint8_t *frame, uint16_t len);
+
+
+/*! @brief Frames waiting in the ring, EPKTCNT without SPI traffic. The
+ * harness uses it as the INT line.
+ *  @return             EPKTCNT
+ */
+uint8_t encEmu_pending(void);
+
+
+/*! @brief INT line: EIE.INTIE set and an enabled EIR flag raised
+ *  @return             true while INT is asserted (low on the pin)
+ */
+bool encEmu_interrupt(void);
+
+
+/*! @brief Chip select of the ENC28J60
+ *  @param[in] asserted    true when CS goes low
+ */
+void encEmu_select(bool asserted);
+
+
+/*! @brief Bytes clocked while selected
+ *  @param[in] tx          bytes from the host, NULL for the default value
+ *  @param[out] rx         bytes to the host, may be NULL
+ *  @param[in] count       number of bytes
+ */
+void encEmu_transfer(const uint8_t *tx, uint8_t *rx, size_t count);
+
+
+/*! @brief Emulator counters
+ *  @param[out] stats      copy of the counters
+ */
+void encEmu_getStats(encEmuStats_t *stats);
+
+
+/*! @brief Clear the emulator counters, the high-water marks restart from the ring state
+ */
+void encEmu_resetStats(void);
+
+#endif /* ENC_EMULATOR_H_ */
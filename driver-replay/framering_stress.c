@@ -0,0 +1,211 @@
+/*
+ * framering_stress.c
+ *
+ *  Two-thread stress test of the frame ring of enc_framering.c on a Linux
+ *  host. A producer thread takes buffers, fills them with a sequence
+ *  number and a pattern derived from it and enqueues them in batches of
+ *  varying size; a consumer thread dequeues, checks that every frame
+ *  arrives once, in order and intact, and frees the buffers. The pool is
+ *  small so that both the empty and the full ring are hit often. Runs once
+ *  with a polling and once with a blocking consumer.
+ *
+ *  Usage:
+ *      framering_stress [-n frames] [-c buffers]
+ *
+ *      -n  frames per mode (default 1000000)
+ *      -c  ring buffers, a power of two up to FRAMERING_MAX_BUFFERS (default 4)
+ *
+ *  Exits 0 when both modes pass.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <ti/drivers/dpl/HwiP.h>
+#include "enc_framering.h"
+
+#define STRESS_BUF_SIZE     64
+/* Most frames per frameRing_enqueue and frameRing_dequeue */
+#define STRESS_BATCH        8
+/* A blocking consumer that misses a wakeup hangs, the test fails instead */
+#define STRESS_TIMEOUT_S    120
+
+typedef struct {
+    frameRing_t *ring;
+    uint32_t     frames;
+    bool         wait;          /* consumer blocks in frameRing_dequeue */
+    uint32_t     errors;
+    uint32_t     received;
+} stress_t;
+
+static frameRing_t ring;
+static uint8_t pool[FRAMERING_MAX_BUFFERS * STRESS_BUF_SIZE];
+
+/* The ring's latency histograms take interrupts off around their update */
+static pthread_mutex_t hwiLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+uintptr_t HwiP_disable(void){
+    pthread_mutex_lock(&hwiLock);
+    return 0;
+}
+
+
+void HwiP_restore(uintptr_t key){
+    pthread_mutex_unlock(&hwiLock);
+}
+
+
+/*! @brief Length of a frame, from its sequence number
+ *  @param[in] seq         sequence number
+ *  @return     4 to STRESS_BUF_SIZE bytes
+ */
+static uint16_t stress_length(uint32_t seq){
+    return 4 + (seq * 7) % (STRESS_BUF_SIZE - 3);
+}
+
+
+/*! @brief Pattern byte of a frame
+ *  @param[in] seq         sequence number
+ *  @param[in] i           byte offset, past the sequence number
+ *  @return     byte
+ */
+static uint8_t stress_byte(uint32_t seq, uint16_t i){
+    return (uint8_t) (seq * 31 + i);
+}
+
+
+/*! @brief Producer thread: fill and enqueue frames 0 to frames - 1
+ *  @param[in] arg         stress_t
+ */
+static void *stress_producer(void *arg){
+    stress_t *st = arg;
+    frameDesc_t batch[STRESS_BATCH];
+    uint32_t seq = 0;
+    uint16_t used, want, i;
+
+    while (seq < st->frames){
+        want = 1 + seq % STRESS_BATCH;
+        used = 0;
+        while (used < want && seq < st->frames){
+            if (!frameRing_alloc(st->ring, &batch[used])){
+                /* Pool empty: hand over what is filled, then let the consumer run */
+                if (used != 0)
+                    break;
+                sched_yield();
+                continue;
+            }
+            batch[used].length = stress_length(seq);
+            memcpy(batch[used].data, &seq, sizeof(seq));
+            for (i = sizeof(seq); i < batch[used].length; i++)
+                batch[used].data[i] = stress_byte(seq, i);
+            batch[used].rsv = seq;
+            used++;
+            seq++;
+        }
+        frameRing_enqueue(st->ring, batch, used);
+    }
+    return NULL;
+}
+
+
+/*! @brief Consumer thread: take frames 0 to frames - 1 in order and check them
+ *  @param[in] arg         stress_t
+ */
+static void *stress_consumer(void *arg){
+    stress_t *st = arg;
+    frameDesc_t desc[STRESS_BATCH];
+    uint32_t seq;
+    uint16_t n, k, i;
+
+    while (st->received < st->frames){
+        n = frameRing_dequeue(st->ring, desc, 1 + st->received % STRESS_BATCH, st->wait);
+        if (n == 0){
+            sched_yield();
+            continue;
+        }
+        for (k = 0; k < n; k++){
+            memcpy(&seq, desc[k].data, sizeof(seq));
+            if (seq != st->received || desc[k].rsv != st->received
+                    || desc[k].length != stress_length(st->received)){
+                if (st->errors++ < 10)
+                    fprintf(stderr, "frame %u: got sequence %u, rsv %u, length %u\n",
+                            st->received, seq, desc[k].rsv, desc[k].length);
+            }
+            else{
+                for (i = sizeof(seq); i < desc[k].length && desc[k].data[i] == stress_byte(seq, i); i++)
+                    ;
+                if (i != desc[k].length && st->errors++ < 10)
+                    fprintf(stderr, "frame %u: corrupt at byte %u\n", seq, i);
+            }
+            st->received++;
+        }
+        frameRing_free(st->ring, desc, n);
+    }
+    return NULL;
+}
+
+
+/*! @brief Run the producer and the consumer over one ring
+ *  @param[in] count       ring buffers
+ *  @param[in] frames      frames to pass
+ *  @param[in] wait        blocking consumer
+ *  @return     true if every frame arrived once, in order and intact
+ */
+static bool stress_run(uint16_t count, uint32_t frames, bool wait){
+    pthread_t producer, consumer;
+    frameRingStats_t stats;
+    stress_t st;
+    bool ok;
+
+    if (frameRing_init(&ring, pool, STRESS_BUF_SIZE, count) != 0){
+        fprintf(stderr, "frameRing_init failed\n");
+        return false;
+    }
+    memset(&st, 0, sizeof(st));
+    st.ring = &ring;
+    st.frames = frames;
+    st.wait = wait;
+
+    pthread_create(&consumer, NULL, stress_consumer, &st);
+    pthread_create(&producer, NULL, stress_producer, &st);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    frameRing_getStats(&ring, &stats);
+    ok = st.errors == 0 && st.received == frames && stats.enqueued == frames
+            && stats.dequeued == frames && frameRing_used(&ring) == 0;
+    printf("%-8s %u frames, %u errors, %u enqueued, %u dequeued, %u overflows, high water %u: %s\n",
+           wait ? "blocking" : "polling", st.received, st.errors, stats.enqueued, stats.dequeued,
+           stats.overflows, stats.highWater, ok ? "pass" : "FAIL");
+    sem_destroy(&ring.ready);
+    return ok;
+}
+
+
+int main(int argc, char **argv){
+    uint32_t frames = 1000000;
+    uint16_t count = 4;
+    bool ok;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:")) != -1){
+        switch (opt){
+        case 'n': frames = strtoul(optarg, NULL, 0); break;
+        case 'c': count = (uint16_t) strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-n frames] [-c buffers]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    alarm(STRESS_TIMEOUT_S);
+    ok = stress_run(count, frames, false);
+    ok = stress_run(count, frames, true) && ok;
+    return ok ? 0 : 1;
+}
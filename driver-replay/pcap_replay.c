@@ -0,0 +1,644 @@
+/*
+ * pcap_replay.c
+ *
+ *  Replays a pcap capture through the ENC28J60 driver on a Linux host.
+ *  The driver sources are built unchanged against ti_host.c, which sends
+ *  the SPI traffic to the emulated chip of enc_emulator.c. Frames appear
+ *  on the emulated wire at their recorded times, scaled by the speed, and
+ *  never faster than 10 Mb/s; virtual time moves with the SPI bytes, so
+ *  the report shows whether the receive path keeps up with the traffic
+ *  and what every frame costs on the bus.
+ *
+ *  Usage:
+ *      pcap_replay [-s speed] [-m peek|ring|zerocopy|dispatch|engine] [-b bitrate]
+ *                  [-o overheadNs] [-B budget] [-a address] [-p] [-v] capture.pcap
+ *
+ *      -s  speed factor on the recorded gaps, 2 replays twice as fast,
+ *          0 sends back to back at wire speed (default 1)
+ *      -m  receive path: peek reads with enc_rx_peek/enc_rx_read and
+ *          releases each frame, ring moves frames with ethernet_rxToRing
+ *          into a frame ring, zerocopy reads each frame with
+ *          ethernet_rxZeroCopy into a lent header and payload buffer,
+ *          dispatch routes frames by EtherType with enc_rx_service to a
+ *          full copy catch-all handler, engine runs the event-driven core of
+ *          enc_engine.c on the SPI queue, with INT edges and 1 ms timer
+ *          ticks in virtual time (default peek)
+ *      -b  SPI clock in Hz (default 8000000)
+ *      -o  fixed cost of every SPI transfer in ns (default 0)
+ *      -B  frames moved per ethernet_rxToRing, ethernet_rxZeroCopy or
+ *          enc_rx_service call, 0 for all (default 0)
+ *      -a  dispatch mode: bring up the UDP/IPv4/ARP layer of enc_net.c on
+ *          this address, its handlers take the ARP and IPv4 frames ahead
+ *          of the catch-all
+ *      -p  promiscuous, no receive filter
+ *      -v  print the driver messages
+ *
+ *  ethernet_packetReceive is not driven: its length comes from the frame
+ *  contents rather than the receive status vector.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "enc_emulator.h"
+#include "enc_ethernet.h"
+#include "enc_framering.h"
+#include "enc_engine.h"
+#include "enc_rxdispatch.h"
+#include "enc_net.h"
+#include "enc_rxtime.h"
+#include "spimaster.h"
+#include "registerlib.h"
+#include "Board.h"
+
+#define PCAP_MAGIC_US      0xa1b2c3d4
+#define PCAP_MAGIC_NS      0xa1b23c4d
+#define PCAP_LINKTYPE_ETH  1
+
+/* 10BASE-T: 100 ns per bit, preamble, CRC and interframe gap on the wire */
+#define WIRE_NS_PER_BYTE   800
+#define WIRE_OVERHEAD      (4 + 8 + 12)
+
+#define RING_BUFFERS       16
+
+/* Timer tick of the engine mode */
+#define ENGINE_TICK_NS     1000000
+
+/* RXSTART_INIT to RXSTOP_INIT of enc_ethernet.c */
+#define RX_RING_BYTES      0x0c00
+
+typedef struct {
+    uint64_t tsNs;      /* recorded time */
+    uint16_t len;       /* bytes kept, at most MAX_MAC_LENGTH */
+    uint8_t *data;
+} replayFrame_t;
+
+typedef struct {
+    replayFrame_t *frames;
+    uint32_t count;
+    uint32_t next;          /* next frame to put on the wire */
+    double speed;
+    uint64_t base;          /* recorded time of the first frame */
+    uint64_t nextArrival;   /* virtual time of frames[next] */
+    uint64_t lastEnd;       /* end of the previous frame on the wire */
+    uint32_t truncated;     /* frames cut to MAX_MAC_LENGTH */
+    bool markInt;           /* latch INT edges for the polled service loop */
+} replay_t;
+
+extern bool hostVerbose;
+extern SPI_Handle masterSpi;
+
+static uint8_t ringPool[RING_BUFFERS * MAX_MAC_LENGTH];
+static frameRing_t ring;
+
+/* Frames and bytes taken by the catch-all handler of the dispatch mode */
+static uint32_t dispatchFrames;
+static uint64_t dispatchBytes;
+
+
+static uint32_t pcap_get32(const uint8_t *p, bool swap){
+    if (swap)
+        return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+    return (uint32_t) p[3] << 24 | (uint32_t) p[2] << 16 | (uint32_t) p[1] << 8 | p[0];
+}
+
+
+/*! @brief Load the frames of a pcap file, microsecond or nanosecond
+ * timestamps in either byte order, Ethernet link type only
+ *  @param[in] path        pcap file
+ *  @param[out] replay     frames
+ *  @return             0 on success, -1 on failure
+ */
+static int replay_load(const char *path, replay_t *replay){
+    uint8_t global[24];
+    uint8_t record[16];
+    uint32_t magic, inclLen, origLen, capacity = 0;
+    uint64_t tsNs;
+    bool swap, nanos;
+    replayFrame_t *frame;
+    FILE *f = fopen(path, "rb");
+
+    if (f == NULL){
+        perror(path);
+        return -1;
+    }
+    if (fread(global, 1, sizeof(global), f) != sizeof(global)){
+        fprintf(stderr, "%s: not a pcap file\n", path);
+        fclose(f);
+        return -1;
+    }
+    magic = pcap_get32(global, false);
+    swap = (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1);
+    magic = pcap_get32(global, swap);
+    nanos = (magic == PCAP_MAGIC_NS);
+    if ((magic != PCAP_MAGIC_US && !nanos) || pcap_get32(global + 20, swap) != PCAP_LINKTYPE_ETH){
+        fprintf(stderr, "%s: not an Ethernet pcap file\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    memset(replay, 0, sizeof(*replay));
+    while (fread(record, 1, sizeof(record), f) == sizeof(record)){
+        tsNs = (uint64_t) pcap_get32(record, swap) * 1000000000ULL
+             + (uint64_t) pcap_get32(record + 4, swap) * (nanos ? 1 : 1000);
+        inclLen = pcap_get32(record + 8, swap);
+        origLen = pcap_get32(record + 12, swap);
+        if (inclLen > 0x40000){
+            fprintf(stderr, "%s: bad record %u\n", path, replay->count);
+            break;
+        }
+        if (replay->count == capacity){
+            capacity = capacity ? 2 * capacity : 1024;
+            replay->frames = realloc(replay->frames, capacity * sizeof(replayFrame_t));
+            if (replay->frames == NULL){
+                fclose(f);
+                return -1;
+            }
+        }
+        frame = &replay->frames[replay->count];
+        frame->tsNs = tsNs;
+        frame->len = (inclLen > MAX_MAC_LENGTH) ? MAX_MAC_LENGTH : inclLen;
+        frame->data = malloc(inclLen ? inclLen : 1);
+        if (frame->data == NULL || fread(frame->data, 1, inclLen, f) != inclLen){
+            free(frame->data);
+            break;
+        }
+        if (inclLen > MAX_MAC_LENGTH || origLen > inclLen)
+            replay->truncated++;
+        replay->count++;
+    }
+    fclose(f);
+    return 0;
+}
+
+
+/*! @brief Virtual arrival time of the next frame: its recorded offset
+ * scaled by the speed, but not before the previous frame left the wire
+ *  @param[in,out] replay  frames
+ */
+static void replay_schedule(replay_t *replay){
+    const replayFrame_t *frame = &replay->frames[replay->next];
+    uint64_t at = 0;
+
+    if (replay->speed > 0)
+        at = (uint64_t) ((double) (frame->tsNs - replay->base) / replay->speed);
+    if (at < replay->lastEnd)
+        at = replay->lastEnd;
+    replay->nextArrival = at;
+}
+
+
+/*! @brief Clock of the receive timestamps, ENC_CLOCK_SOURCE of the build
+ *  @return             virtual time in ns, wrapping
+ */
+uint32_t replay_clockNs(void){
+    return (uint32_t) encEmu_now();
+}
+
+
+/*! @brief Print a receive latency histogram, buckets without samples left out
+ *  @param[in] name        label
+ *  @param[in] which       ENC_RXLAT_* histogram
+ */
+static void replay_printLatency(const char *name, encRxLatency_t which){
+    encRxHistogram_t hist;
+    uint8_t i;
+
+    encRxTime_getHistogram(which, &hist);
+    printf("  %-17s %u frames, avg %.1f us, min %.1f us, max %.1f us\n", name, hist.samples,
+           hist.samples ? hist.sumNs / 1e3 / hist.samples : 0.0, hist.minNs / 1e3, hist.maxNs / 1e3);
+    for (i = 0; i <= hist.buckets; i++){
+        if (hist.count[i] == 0)
+            continue;
+        if (i < hist.buckets)
+            printf("    <= %-10.0f us %u\n", hist.boundNs[i] / 1e3, hist.count[i]);
+        else
+            printf("    >  %-10.0f us %u\n", hist.boundNs[i - 1] / 1e3, hist.count[i]);
+    }
+}
+
+
+/*! @brief Arrival hook, puts every frame that is due on the wire. With
+ * markInt, a frame landing in an empty receive ring raises EIR.PKTIF and
+ * the INT falling edge is latched for the next service pass, as the INT
+ * line interrupt does on target.
+ *  @param[in] arg         replay_t
+ *  @param[in] nowNs       virtual time
+ */
+static void replay_arrive(void *arg, uint64_t nowNs){
+    replay_t *replay = arg;
+    const replayFrame_t *frame;
+    bool empty;
+
+    while (replay->next < replay->count && replay->nextArrival <= nowNs){
+        frame = &replay->frames[replay->next++];
+        /* The chip sees the frame once its last byte is in */
+        replay->lastEnd = replay->nextArrival + (uint64_t) (frame->len + WIRE_OVERHEAD) * WIRE_NS_PER_BYTE;
+        empty = encEmu_pending() == 0;
+        encEmu_receive(frame->data, frame->len);
+        if (replay->markInt && empty && encEmu_pending() != 0)
+            encRxTime_intMark();
+        if (replay->next < replay->count)
+            replay_schedule(replay);
+    }
+}
+
+
+/*! @brief Take one frame out of the receive ring with the peek path
+ *  @return             bytes delivered, -1 on failure
+ */
+static int32_t replay_servicePeek(void){
+    static uint8_t frame[MAX_MAC_LENGTH];
+    enc_rx_handle_t rx;
+    uint16_t rest;
+
+    if (enc_rx_peek(&rx, frame, ENC_RX_PEEK_MAX) != ERR_SUCCESS)
+        return -1;
+    rest = rx.length - rx.headerLen;
+    if (rest != 0 && enc_rx_read(&rx, rx.headerLen, rest, frame + rx.headerLen) != rest)
+        return -1;
+    if (enc_rx_release(&rx) != ERR_SUCCESS)
+        return -1;
+    return rx.length;
+}
+
+
+/*! @brief Move frames with ethernet_rxToRing, then consume them
+ *  @param[in] budget      frames per call, 0 for all
+ *  @param[out] frames     frames delivered
+ *  @return             bytes delivered, -1 on failure
+ */
+static int32_t replay_serviceRing(uint8_t budget, uint32_t *frames){
+    frameDesc_t desc[RING_BUFFERS];
+    uint16_t n, i;
+    int32_t bytes = 0;
+
+    if (ethernet_rxToRing(&ring, budget) < 0)
+        return -1;
+    n = frameRing_dequeue(&ring, desc, RING_BUFFERS, false);
+    for (i = 0; i < n; i++){
+        if (desc[i].length != 0)
+            (*frames)++;
+        bytes += desc[i].length;
+    }
+    frameRing_free(&ring, desc, n);
+    return bytes;
+}
+
+
+/*! @brief Lend the destination of a frame: the Ethernet header into its
+ * own small buffer, the rest into a payload buffer
+ *  @param[in] arg         unused
+ *  @param[in] rx          frame handle
+ *  @param[out] dest       destination
+ *  @return             true, every frame is taken
+ */
+static bool replay_zeroCopyDest(void *arg, const enc_rx_handle_t *rx, enc_rx_dest_t *dest){
+    static uint8_t header[14];
+    static uint8_t payload[MAX_MAC_LENGTH - sizeof(header)];
+
+    dest->header = header;
+    dest->headerLen = sizeof(header);
+    dest->payload = payload;
+    dest->payloadLen = sizeof(payload);
+    return true;
+}
+
+
+/*! @brief Take a lent destination back
+ *  @param[in] arg         bytes delivered
+ *  @param[in] rx          frame handle
+ *  @param[in] dest        destination
+ *  @param[in] delivered   frame in dest
+ */
+static void replay_zeroCopyDeliver(void *arg, const enc_rx_handle_t *rx, const enc_rx_dest_t *dest, bool delivered){
+    if (delivered)
+        *(int32_t *) arg += rx->length;
+}
+
+
+/*! @brief Receive frames with ethernet_rxZeroCopy
+ *  @param[in] budget      frames per call, 0 for all
+ *  @param[out] frames     frames delivered
+ *  @return             bytes delivered, -1 on failure
+ */
+static int32_t replay_serviceZeroCopy(uint8_t budget, uint32_t *frames){
+    int32_t bytes = 0;
+    int16_t n = ethernet_rxZeroCopy(replay_zeroCopyDest, replay_zeroCopyDeliver, &bytes, budget);
+
+    if (n < 0)
+        return -1;
+    *frames += n;
+    return bytes;
+}
+
+
+/*! @brief Catch-all handler of the dispatch mode
+ *  @param[in] frame       full copy of the frame
+ */
+static void replay_dispatchHandler(const enc_rx_frame_t *frame){
+    dispatchFrames++;
+    dispatchBytes += frame->length;
+}
+
+
+/*! @brief Route frames with enc_rx_service
+ *  @param[in] budget      frames per call, 0 for all
+ *  @param[out] frames     frames delivered
+ *  @return             bytes delivered, -1 on failure
+ */
+static int32_t replay_serviceDispatch(uint8_t budget, uint32_t *frames){
+    uint32_t before = dispatchFrames;
+    uint64_t bytes = dispatchBytes;
+
+    /* Called with a frame pending, dispatching none means the peek failed */
+    if (enc_rx_service(budget) <= 0)
+        return -1;
+    *frames += dispatchFrames - before;
+    return (int32_t) (dispatchBytes - bytes);
+}
+
+
+/*! @brief Post an INT edge to the engine when the line falls
+ *  @param[in,out] intLine  level seen last
+ *  @return             true while INT is asserted
+ */
+static bool replay_intLine(bool *intLine){
+    bool asserted = encEmu_interrupt();
+
+    if (asserted && !*intLine)
+        encEngine_intIsr(Board_GPIO_INT);
+    *intLine = asserted;
+    return asserted;
+}
+
+
+/*! @brief Run the event-driven core until the capture is replayed: INT
+ * edges and timer ticks are posted as they happen in virtual time, INT
+ * is sampled after every encEngine_run call since each can start a chain
+ * changing EIE.INTIE, frames are taken from the ring
+ *  @param[in,out] replay  frames
+ *  @param[out] bytes      bytes delivered
+ *  @param[out] busyNs     virtual time spent in encEngine_run
+ *  @return             frames delivered, -1 if the engine did not start
+ */
+static int32_t replay_engine(replay_t *replay, uint64_t *bytes, uint64_t *busyNs){
+    encEngineConfig_t config;
+    frameDesc_t desc[RING_BUFFERS];
+    uint64_t nextTick = ENGINE_TICK_NS, start, now, wake;
+    bool intLine = false, asserted;
+    int32_t frames = 0;
+    uint16_t n, i;
+
+    memset(&config, 0, sizeof(config));
+    config.rxRing = &ring;
+    config.tickMs = ENGINE_TICK_NS / 1000000;
+    config.txTimeoutMs = 10;
+    if (encEngine_start(&config) != ERR_SUCCESS)
+        return -1;
+
+    for (;;){
+        start = encEmu_now();
+        while (encEngine_run())
+            replay_intLine(&intLine);
+        *busyNs += encEmu_now() - start;
+
+        n = frameRing_dequeue(&ring, desc, RING_BUFFERS, false);
+        for (i = 0; i < n; i++){
+            if (desc[i].length != 0)
+                frames++;
+            *bytes += desc[i].length;
+        }
+        frameRing_free(&ring, desc, n);
+
+        asserted = replay_intLine(&intLine);
+        now = encEmu_now();
+        if (now >= nextTick){
+            nextTick = now - now % ENGINE_TICK_NS + ENGINE_TICK_NS;
+            encEngine_timer();
+        }
+        if (encEngine_pending())
+            continue;
+
+        if (replay->next >= replay->count && !asserted && encEmu_pending() == 0
+            && encEngine_getState() == ENC_ENGINE_IDLE)
+            break;
+        /* Idle until the next frame or tick */
+        wake = nextTick;
+        if (replay->next < replay->count && replay->nextArrival < wake)
+            wake = replay->nextArrival;
+        if (wake > now)
+            encEmu_advance(wake - now);
+    }
+    encEngine_stop();
+    while (encEngine_run())
+        ;
+    return frames;
+}
+
+
+static void usage(void){
+    fprintf(stderr, "usage: pcap_replay [-s speed] [-m peek|ring|zerocopy|dispatch|engine] [-b bitrate]\n"
+                    "                   [-o overheadNs] [-B budget] [-a address] [-p] [-v] capture.pcap\n");
+    exit(2);
+}
+
+
+int main(int argc, char *argv[]){
+    replay_t replay;
+    encEmuStats_t emu;
+    spiStats_t spi;
+    frameRingStats_t ringStats;
+    uint64_t busyNs = 0, start, endNs;
+    uint32_t bitRate = 8000000, overheadNs = 0, frames = 0, failures = 0;
+    uint64_t bytes = 0;
+    uint8_t budget = 0;
+    bool ringMode = false, zeroCopyMode = false, dispatchMode = false, engineMode = false, promiscuous = false;
+    unsigned int ip[4];
+    uint32_t netIp = 0;
+    enc_rx_dispatchStats_t dispatch;
+    netStats_t net;
+    SPI_Params spiParams;
+    encEngineStats_t engine;
+    spiArbStats_t arb;
+    double speed = 1.0, perFrame;
+    int32_t got;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:m:b:o:B:a:pv")) != -1){
+        switch (opt){
+        case 's': speed = atof(optarg); break;
+        case 'm':
+            if (strcmp(optarg, "ring") == 0)
+                ringMode = true;
+            else if (strcmp(optarg, "zerocopy") == 0)
+                zeroCopyMode = true;
+            else if (strcmp(optarg, "dispatch") == 0)
+                dispatchMode = true;
+            else if (strcmp(optarg, "engine") == 0)
+                engineMode = true;
+            else if (strcmp(optarg, "peek") != 0)
+                usage();
+            break;
+        case 'b': bitRate = strtoul(optarg, NULL, 0); break;
+        case 'o': overheadNs = strtoul(optarg, NULL, 0); break;
+        case 'B': budget = (uint8_t) strtoul(optarg, NULL, 0); break;
+        case 'a':
+            if (sscanf(optarg, "%u.%u.%u.%u", &ip[0], &ip[1], &ip[2], &ip[3]) != 4
+                || ip[0] > 255 || ip[1] > 255 || ip[2] > 255 || ip[3] > 255)
+                usage();
+            netIp = ip[0] << 24 | ip[1] << 16 | ip[2] << 8 | ip[3];
+            break;
+        case 'p': promiscuous = true; break;
+        case 'v': hostVerbose = true; break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1 || speed < 0 || bitRate == 0 || (netIp != 0 && !dispatchMode))
+        usage();
+    if (replay_load(argv[optind], &replay) != 0)
+        return 1;
+    if (replay.count == 0){
+        fprintf(stderr, "%s: no frames\n", argv[optind]);
+        return 1;
+    }
+
+    encEmu_reset();
+    encEmu_setSpiTiming(bitRate, overheadNs);
+    if (engineMode){
+        /* The engine needs the queue, the SPI in callback mode */
+        SPI_Params_init(&spiParams);
+        spiParams.transferMode = SPI_MODE_CALLBACK;
+        spiParams.transferCallbackFxn = spiQueue_transferCallback;
+        if (spiQueue_init() != ERR_SUCCESS
+            || (masterSpi = SPI_open(Board_SPI_MASTER, &spiParams)) == NULL){
+            fprintf(stderr, "spiQueue_init failed\n");
+            return 1;
+        }
+    }
+    if (ethernet_Init() != ERR_SUCCESS){
+        fprintf(stderr, "ethernet_Init failed\n");
+        return 1;
+    }
+    if (promiscuous && ethernet_setRxFilter(0) != ERR_SUCCESS){
+        fprintf(stderr, "ethernet_setRxFilter failed\n");
+        return 1;
+    }
+    if (dispatchMode && ((netIp != 0 && net_init(netIp, 0xffffff00, 0) != ERR_SUCCESS)
+        || enc_rx_register(ENC_RX_ANY_TYPE, replay_dispatchHandler, ENC_RX_FULL_COPY | ENC_RX_ACCEPT_ERRORS) != ERR_SUCCESS)){
+        fprintf(stderr, "receive dispatch setup failed\n");
+        return 1;
+    }
+    if ((ringMode || engineMode) && frameRing_init(&ring, ringPool, MAX_MAC_LENGTH, RING_BUFFERS) != 0){
+        fprintf(stderr, "frameRing_init failed\n");
+        return 1;
+    }
+
+    /* Only the replay is measured, not the bring-up */
+    encEmu_setTime(0);
+    encEmu_resetStats();
+    spi_resetStats();
+    encRxTime_init();
+    replay.speed = speed;
+    replay.base = replay.frames[0].tsNs;
+    /* The engine takes its INT edges through replay_intLine */
+    replay.markInt = !engineMode;
+    replay_schedule(&replay);
+    encEmu_setArrivalHook(replay_arrive, &replay);
+
+    if (engineMode){
+        got = replay_engine(&replay, &bytes, &busyNs);
+        if (got < 0){
+            fprintf(stderr, "encEngine_start failed\n");
+            return 1;
+        }
+        frames = got;
+    }
+
+    while (!engineMode){
+        if (encEmu_pending() == 0){
+            if (replay.next >= replay.count)
+                break;
+            /* Idle until the next frame, INT stays high */
+            encEmu_advance(replay.nextArrival - encEmu_now());
+            continue;
+        }
+        start = encEmu_now();
+        if (ringMode){
+            got = replay_serviceRing(budget, &frames);
+        }
+        else if (zeroCopyMode){
+            got = replay_serviceZeroCopy(budget, &frames);
+        }
+        else if (dispatchMode){
+            got = replay_serviceDispatch(budget, &frames);
+        }
+        else{
+            got = replay_servicePeek();
+            if (got >= 0)
+                frames++;
+        }
+        busyNs += encEmu_now() - start;
+        if (got < 0){
+            /* Drop what is left with a register program, as after an overflow */
+            failures++;
+            if (ethernet_rxOverflowRecover() != ERR_SUCCESS){
+                fprintf(stderr, "receive path stuck\n");
+                break;
+            }
+            continue;
+        }
+        bytes += got;
+    }
+    endNs = encEmu_now();
+
+    encEmu_getStats(&emu);
+    spi_getStats(&spi);
+    perFrame = frames ? 1.0 / frames : 0;
+
+    printf("frames offered      %u (%u truncated to %u bytes)\n", emu.framesIn, replay.truncated, MAX_MAC_LENGTH);
+    printf("  accepted          %u\n", emu.framesAccepted);
+    printf("  filtered          %u\n", emu.framesFiltered);
+    printf("  dropped, ring     %u\n", emu.framesDropped);
+    printf("  receive off       %u\n", emu.framesRxOff);
+    printf("frames delivered    %u, %llu bytes, %u service failures\n", frames, (unsigned long long) bytes, failures);
+    if (engineMode){
+        encEngine_getStats(&engine);
+        printf("  engine            %u interrupts, %u chains, %u dropped, %u recoveries, %u SPI failures\n",
+               engine.interrupts, engine.chains, engine.rxDropped, engine.recoveries, engine.spiFailures);
+        printf("  receive ring      %u overflows, %u frames discarded by resynchronization\n",
+               engine.rxOverflows, engine.rxDiscarded);
+        spiQueue_getArbStats(&arb);
+        printf("  bus arbiter       %u chunks, %u resumes, %u pointer restores\n",
+               arb.chunks, arb.resumes, arb.pointerRestores);
+    }
+    if (dispatchMode){
+        enc_rx_getDispatchStats(&dispatch);
+        printf("  dispatch          %u frames, %u handled, %u dropped, %u errors\n",
+               dispatch.frames, dispatch.handled, dispatch.dropped, dispatch.errors);
+        if (netIp != 0){
+            net_getStats(&net);
+            printf("  network layer     %u ARP requests in, %u replies, %u IPv4 dropped, %u UDP in, %u no socket\n",
+                   net.arpRequestsIn, net.arpRepliesOut, net.ipDropped, net.udpIn, net.udpNoSocket);
+        }
+        replay_printLatency("INT -> delivery", ENC_RXLAT_ARRIVAL_TO_DELIVERY);
+        replay_printLatency("delivery -> free", ENC_RXLAT_DELIVERY_TO_RELEASE);
+    }
+    if (ringMode || engineMode){
+        frameRing_getStats(&ring, &ringStats);
+        printf("  frame ring        %u overflows, %u frames high water\n", ringStats.overflows, ringStats.highWater);
+        replay_printLatency("INT -> delivery", ENC_RXLAT_ARRIVAL_TO_DELIVERY);
+        replay_printLatency("delivery -> free", ENC_RXLAT_DELIVERY_TO_RELEASE);
+    }
+    printf("ring high water     %u of %u bytes, %u frames\n", emu.highWaterBytes, RX_RING_BYTES, emu.highWaterFrames);
+    printf("SPI                 %u bytes, %u transactions, %u bank switches\n", spi.bytes, spi.transactions, spi.bankSwitches);
+    printf("  register shadow   %u reads without a transfer\n", spi.shadowHits);
+    printf("  per frame         %.1f bytes, %.1f transactions, %.2f bank switches\n",
+           spi.bytes * perFrame, spi.transactions * perFrame, spi.bankSwitches * perFrame);
+    printf("  efficiency        %.1f%% payload of the bytes clocked\n", spi.bytes ? 100.0 * bytes / spi.bytes : 0.0);
+    printf("virtual time        %.3f ms, receive path busy %.1f%%\n", endNs / 1e6, endNs ? 100.0 * busyNs / endNs : 0.0);
+    return emu.framesDropped != 0;
+}
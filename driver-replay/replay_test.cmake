@@ -0,0 +1,21 @@
+# Runs pcap_replay on a capture for ctest: fails unless it exits 0 (no
+# frame lost in the receive ring) and prints every line of EXPECT.
+#
+#   cmake -DREPLAY=<pcap_replay> -DARGS=<options;capture> -DEXPECT=<regex;...> -P replay_test.cmake
+
+execute_process(
+	COMMAND ${REPLAY} ${ARGS}
+	RESULT_VARIABLE status
+	OUTPUT_VARIABLE output
+	ERROR_VARIABLE output
+)
+message("${output}")
+
+if(NOT status EQUAL 0)
+	message(FATAL_ERROR "pcap_replay ${ARGS} exited with ${status}")
+endif()
+foreach(line IN LISTS EXPECT)
+	if(NOT output MATCHES "${line}")
+		message(FATAL_ERROR "pcap_replay ${ARGS}: no match for \"${line}\"")
+	endif()
+endforeach()
@@ -0,0 +1,13 @@
+#ifndef STUB_BOARD_H
+#define STUB_BOARD_H
+#define Board_GPIO_LED0 0
+#define Board_GPIO_LED1 1
+#define Board_GPIO_LED_ON 1
+#define Board_GPIO_LED_OFF 0
+#define Board_GPIO_CSN0 12
+#define Board_GPIO_INT 13
+#define Board_SPI_MASTER 0
+#define Board_SPI_FLASH_CS 7
+#define Board_GPIO_SPI_FLASH_CS 7
+void Board_init(void);
+#endif
@@ -0,0 +1,8 @@
+#ifndef STUB_DISPLAY_H
+#define STUB_DISPLAY_H
+typedef struct Display_Config_ *Display_Handle;
+#define Display_Type_UART 0
+void Display_printf(Display_Handle h, int line, int col, const char *fmt, ...);
+Display_Handle Display_open(int type, void *params);
+void Display_init(void);
+#endif
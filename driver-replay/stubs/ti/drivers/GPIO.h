@@ -0,0 +1,18 @@
+#ifndef STUB_GPIO_H
+#define STUB_GPIO_H
+#include <stdint.h>
+typedef uint32_t GPIO_PinConfig;
+typedef void (*GPIO_CallbackFxn)(uint_least8_t index);
+#define GPIO_CFG_OUT_STD 0
+#define GPIO_CFG_OUT_LOW 0
+#define GPIO_CFG_IN_PU 0
+#define GPIO_CFG_IN_INT_FALLING 0
+void GPIO_write(uint_least8_t index, unsigned int value);
+unsigned int GPIO_read(uint_least8_t index);
+void GPIO_setCallback(uint_least8_t index, GPIO_CallbackFxn callback);
+void GPIO_enableInt(uint_least8_t index);
+void GPIO_disableInt(uint_least8_t index);
+void GPIO_clearInt(uint_least8_t index);
+void GPIO_init(void);
+void GPIO_setConfig(uint_least8_t index, GPIO_PinConfig pinConfig);
+#endif
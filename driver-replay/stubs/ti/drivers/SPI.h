@@ -0,0 +1,19 @@
+#ifndef STUB_SPI_H
+#define STUB_SPI_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+typedef struct SPI_Config_ *SPI_Handle;
+typedef enum { SPI_TRANSFER_COMPLETED = 0, SPI_TRANSFER_STARTED, SPI_TRANSFER_QUEUED, SPI_TRANSFER_FAILED, SPI_TRANSFER_CANCELED } SPI_Status;
+typedef struct { size_t count; void *txBuf; void *rxBuf; void *arg; SPI_Status status; void *nextPtr; } SPI_Transaction;
+typedef void (*SPI_CallbackFxn)(SPI_Handle handle, SPI_Transaction *transaction);
+typedef enum { SPI_MODE_BLOCKING, SPI_MODE_CALLBACK } SPI_TransferMode;
+typedef enum { SPI_MASTER, SPI_SLAVE } SPI_Mode;
+typedef enum { SPI_POL0_PHA0 = 0 } SPI_FrameFormat;
+typedef struct { SPI_TransferMode transferMode; uint32_t transferTimeout; SPI_CallbackFxn transferCallbackFxn; SPI_Mode mode; uint32_t bitRate; uint32_t dataSize; SPI_FrameFormat frameFormat; void *custom; } SPI_Params;
+bool SPI_transfer(SPI_Handle handle, SPI_Transaction *transaction);
+void SPI_Params_init(SPI_Params *params);
+SPI_Handle SPI_open(uint_least8_t index, SPI_Params *params);
+void SPI_close(SPI_Handle handle);
+void SPI_init(void);
+#endif
@@ -0,0 +1,6 @@
+#ifndef STUB_HWIP_H
+#define STUB_HWIP_H
+#include <stdint.h>
+uintptr_t HwiP_disable(void);
+void HwiP_restore(uintptr_t key);
+#endif
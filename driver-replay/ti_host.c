@@ -0,0 +1,123 @@
+/*
+ * ti_host.c
+ *
+ *  TI driver calls of the ENC28J60 driver on a Linux host: the SPI
+ *  transfers and the chip select go to the emulated chip, the display
+ *  goes to stderr when verbose, interrupts are a no-op since the harness
+ *  is single threaded. In SPI_MODE_CALLBACK the callback runs before
+ *  SPI_transfer returns, the transfer takes no real time.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <ti/drivers/GPIO.h>
+#include <ti/drivers/SPI.h>
+#include <ti/drivers/dpl/HwiP.h>
+#include <ti/display/Display.h>
+#include "Board.h"
+#include "enc_emulator.h"
+
+/* Set by the harness to see the driver messages */
+bool hostVerbose = false;
+
+static SPI_CallbackFxn spiCallback;
+
+
+void GPIO_write(uint_least8_t index, unsigned int value){
+    if (index == Board_GPIO_CSN0)
+        encEmu_select(value == 0);
+}
+
+
+unsigned int GPIO_read(uint_least8_t index){
+    /* INT is active low, asserted while frames are pending */
+    if (index == Board_GPIO_INT)
+        return encEmu_pending() == 0;
+    return 1;
+}
+
+
+void GPIO_setCallback(uint_least8_t index, GPIO_CallbackFxn callback){
+}
+
+
+void GPIO_enableInt(uint_least8_t index){
+}
+
+
+void GPIO_disableInt(uint_least8_t index){
+}
+
+
+void GPIO_clearInt(uint_least8_t index){
+}
+
+
+void GPIO_init(void){
+}
+
+
+void GPIO_setConfig(uint_least8_t index, GPIO_PinConfig pinConfig){
+}
+
+
+bool SPI_transfer(SPI_Handle handle, SPI_Transaction *transaction){
+    encEmu_transfer(transaction->txBuf, transaction->rxBuf, transaction->count);
+    transaction->status = SPI_TRANSFER_COMPLETED;
+    if (spiCallback != NULL)
+        spiCallback(handle, transaction);
+    return true;
+}
+
+
+void SPI_Params_init(SPI_Params *params){
+    memset(params, 0, sizeof(*params));
+}
+
+
+SPI_Handle SPI_open(uint_least8_t index, SPI_Params *params){
+    if (params != NULL && params->transferMode == SPI_MODE_CALLBACK)
+        spiCallback = params->transferCallbackFxn;
+    return (SPI_Handle) 1;
+}
+
+
+void SPI_close(SPI_Handle handle){
+    spiCallback = NULL;
+}
+
+
+void SPI_init(void){
+}
+
+
+uintptr_t HwiP_disable(void){
+    return 0;
+}
+
+
+void HwiP_restore(uintptr_t key){
+}
+
+
+void Display_printf(Display_Handle h, int line, int col, const char *fmt, ...){
+    va_list args;
+
+    if (!hostVerbose)
+        return;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+
+Display_Handle Display_open(int type, void *params){
+    return (Display_Handle) 1;
+}
+
+
+void Display_init(void){
+}
@@ -109,6 +109,7 @@ extern "C" {
 #define Board_GPIO_TMP116_EN    CC1352P1_LAUNCHXL_GPIO_TMP116_EN
 
 #define Board_GPIO_CSN0         CC1352P1_LAUNCHXL_GPIO_SPI0_CS
+#define Board_GPIO_SPI_FLASH_CS CC1352P1_LAUNCHXL_GPIO_SPI_FLASH_CS
 #define Board_GPIO_INT          CC1352P1_LAUNCHXL_GPIO_INT
 
 
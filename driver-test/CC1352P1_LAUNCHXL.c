@@ -576,7 +576,7 @@ GPIO_PinConfig gpioPinConfigs[] = {
     GPIOCC26XX_DIO_22 | GPIO_DO_NOT_CONFIG, /* LCD power control */
     GPIOCC26XX_DIO_23 | GPIO_DO_NOT_CONFIG, /*LCD enable */
     GPIOCC26XX_DIO_16 | GPIO_CFG_OUT_STD | GPIO_CFG_OUT_STR_HIGH | GPIO_CFG_OUT_LOW, /* SPI0 CS enable */
-    GPIOCC26XX_DIO_19 | GPIO_CFG_OUT_STD | GPIO_CFG_OUT_STR_HIGH | GPIO_CFG_OUT_LOW, /* SPI0 CS enable */	
+    GPIOCC26XX_DIO_19 | GPIO_CFG_IN_PU | GPIO_CFG_IN_INT_FALLING, /* ENC28J60 INT, active low */
 };
 
 /*
@@ -591,6 +591,16 @@ GPIO_CallbackFxn gpioCallbackFunctions[] = {
     NULL,  /* Button 1 */
     NULL,  /* CC1352P1_LAUNCHXL_SPI_MASTER_READY */
     NULL,  /* CC1352P1_LAUNCHXL_SPI_SLAVE_READY */
+    NULL,  /* Green LED */
+    NULL,  /* Red LED */
+    NULL,  /* TMP116_EN */
+    NULL,  /* SPI Flash CSN */
+    NULL,  /* SD CS */
+    NULL,  /* LCD SPI chip select */
+    NULL,  /* LCD power control */
+    NULL,  /* LCD enable */
+    NULL,  /* SPI0 CS enable */
+    NULL,  /* ENC28J60 INT */
 };
 
 const GPIOCC26XX_Config GPIOCC26XX_config = {
@@ -38,6 +38,7 @@
 
 /* POSIX Header files */
 #include <pthread.h>
+#include <unistd.h>
 
 /* RTOS header files */
 #include <ti/sysbios/BIOS.h>
@@ -54,6 +55,9 @@
 #include "registerlib.h"
 #include "spimaster.h"
 #include "enc_ethernet.h"
+#include "enc_probe.h"
+#include "enc_engine.h"
+#include "enc_rxtime.h"
 #include "Board.h"
 
 
@@ -75,6 +79,44 @@ extern SPI_Params      spiParams;
 extern SPI_Transaction controlReg;
 Display_Handle display;
 
+/* Frames used to exercise the latency probes */
+#define PROBE_TX_FRAMES    8
+#define PROBE_RX_WINDOW_MS 2000
+static uint8_t probeFrame[60] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff,     /* broadcast */
+    0x74, 0x69, 0x69, 0x2D, 0x30, 0x31,     /* our address */
+    0x88, 0xb5,                             /* local experimental ethertype */
+};
+static uint8_t probeRxBuffer[MAX_MAC_LENGTH];
+
+/* Receive ring of the event-driven engine, driven from masterThread alone */
+#define ENGINE_RX_BUFFERS  4
+static uint8_t enginePool[ENGINE_RX_BUFFERS * MAX_MAC_LENGTH];
+static frameRing_t engineRing;
+
+/* JEDEC ID read of the SPI flash sharing the bus, time critical class */
+#define FLASH_OP_RDID      0x9f
+#define FLASH_POLL_MS      20
+static uint8_t flashIdCmd[4] = {FLASH_OP_RDID, 0, 0, 0};
+static uint8_t flashId[4];
+static spiQueueItem_t flashItem;
+static volatile bool flashBusy;
+
+static void flashIdDone(spiQueueItem_t *item, bool transferOK)
+{
+    flashBusy = false;
+}
+
+
+/*
+ *  ======== encIntCallback ========
+ *  ENC28J60 INT line, only timestamps the interrupt entry
+ */
+static void encIntCallback(uint_least8_t index)
+{
+    ENC_PROBE(ENC_PROBE_ISR_ENTRY);
+}
+
 
 /*
  *  ======== masterThread ========
@@ -83,12 +125,19 @@ Display_Handle display;
  */
 void *masterThread(void *arg0)
 {
+    /* Register accesses go through the driver's transaction queue */
+    if (spiQueue_init() != ERR_SUCCESS) {
+        Display_printf(display, 0, 0, "Error initializing SPI queue\n");
+        while (1);
+    }
+
     /* Open SPI as master (default) */
     SPI_Params_init(&spiParams);
     spiParams.dataSize = 8;
     spiParams.frameFormat = SPI_POL0_PHA0;
     spiParams.bitRate = 800000;
-    spiParams.transferMode = SPI_MODE_BLOCKING;
+    spiParams.transferMode = SPI_MODE_CALLBACK;
+    spiParams.transferCallbackFxn = spiQueue_transferCallback;
     masterSpi = SPI_open(Board_SPI_MASTER, &spiParams);
     if (masterSpi == NULL) {
         Display_printf(display, 0, 0, "Error initializing master SPI\n");
@@ -161,6 +210,124 @@ void *masterThread(void *arg0)
 
 	Display_printf(display, 0, 0, "Preliminary Tests Done\n");
 
+	Display_printf(display, 0, 0, "Ethernet bring-up\n");
+	if(ethernet_Init()!=ERR_SUCCESS)
+		Display_printf(display, 0, 0, "Ethernet init failed\n");
+	else{
+		uint32_t initUs, linkUpUs;
+		if(ethernet_waitLinkUp(3000)!=ERR_SUCCESS)
+			Display_printf(display, 0, 0, "Link down\n");
+		ethernet_getBringupTime(&initUs, &linkUpUs);
+		Display_printf(display, 0, 0, "Init took %d us, link up after %d us\n", initUs, linkUpUs);
+
+		ethernet_stats_t stats;
+		ethernet_getStats(&stats);
+		Display_printf(display, 0, 0, "SPI: %d transactions, %d bytes, %d bank switches, %d failures\n",
+				stats.spi.transactions, stats.spi.bytes, stats.spi.bankSwitches, stats.spi.failures);
+
+		/* Send a few frames and receive whatever arrives, then dump the stage latencies */
+		Display_printf(display, 0, 0, "Latency probes\n");
+		encProbe_init();
+		GPIO_setCallback(Board_GPIO_INT, encIntCallback);
+		GPIO_enableInt(Board_GPIO_INT);
+		for (i = 0; i < PROBE_TX_FRAMES; i++){
+			if(ethernet_transmitPackets(probeFrame, sizeof(probeFrame))!=ERR_SUCCESS)
+				Display_printf(display, 0, 0, "Transmit failed\n");
+		}
+		ethernet_txPoll();
+		for (i = 0; i < PROBE_RX_WINDOW_MS; i++){
+			uint8_t pkthdr[24];
+			uint16_t len;
+			if (ENC_READ(EPKTCNT) == 0){
+				usleep(1000);
+				continue;
+			}
+			len = ethernet_getRecvLength(pkthdr);
+			if (len == (uint16_t) ERR_DRIVER_FAIL || len > sizeof(probeRxBuffer))
+				break;
+			ethernet_packetReceive(probeRxBuffer, len);
+		}
+		GPIO_disableInt(Board_GPIO_INT);
+		encProbe_dump();
+
+		/* One power-save cycle, the wake latency is what a sleeping node pays per transmit */
+		ethernet_pwrStats_t pwr;
+		if(ethernet_powerSaveEnter()!=ERR_SUCCESS)
+			Display_printf(display, 0, 0, "Power-save entry failed\n");
+		sleep(1);
+		if(ethernet_powerSaveExit()!=ERR_SUCCESS)
+			Display_printf(display, 0, 0, "Power-save exit failed\n");
+		ethernet_getPowerStats(&pwr);
+		Display_printf(display, 0, 0, "Power-save: asleep %d ms, wake took %d us\n", pwr.asleepMs, pwr.lastWakeUs);
+
+		/* Same frames through the event-driven engine, this thread is its superloop */
+		encEngineConfig_t engCfg = {0};
+		encEngineStats_t engStats;
+		frameDesc_t desc[ENGINE_RX_BUFFERS];
+		uint16_t n;
+		engCfg.rxRing = &engineRing;
+		engCfg.tickMs = 1;
+		engCfg.txTimeoutMs = 10;
+		engCfg.linkPollMs = 1000;
+		/* Flash on its own chip select, polled while the engine moves frames */
+		spiArbStats_t arb;
+		uint8_t flashDev;
+		GPIO_setConfig(Board_GPIO_SPI_FLASH_CS, GPIO_CFG_OUT_STD | GPIO_CFG_OUT_HIGH);
+		flashDev = spiQueue_addDevice(Board_GPIO_SPI_FLASH_CS);
+		flashItem.txBuf = flashIdCmd;
+		flashItem.rxBuf = flashId;
+		flashItem.count = sizeof(flashIdCmd);
+		flashItem.flags = SPIQ_CS_FRAME;
+		flashItem.bank = SPIQ_BANK_ANY;
+		flashItem.callback = flashIdDone;
+		spiQueue_resetArbStats();
+		encRxTime_init();
+		if(frameRing_init(&engineRing, enginePool, MAX_MAC_LENGTH, ENGINE_RX_BUFFERS)!=0
+		   || encEngine_start(&engCfg)!=ERR_SUCCESS)
+			Display_printf(display, 0, 0, "Engine start failed\n");
+		else{
+			GPIO_setCallback(Board_GPIO_INT, encEngine_intIsr);
+			GPIO_enableInt(Board_GPIO_INT);
+			for (i = 0; i < PROBE_TX_FRAMES; i++)
+				encEngine_send(probeFrame, sizeof(probeFrame));
+			for (i = 0; i < PROBE_RX_WINDOW_MS; i++){
+				while (encEngine_run())
+					;
+				n = frameRing_dequeue(&engineRing, desc, ENGINE_RX_BUFFERS, false);
+				frameRing_free(&engineRing, desc, n);
+				if (flashDev != SPIQ_DEV_NONE && !flashBusy && i % FLASH_POLL_MS == 0){
+					flashBusy = true;
+					if (spiQueue_submitTo(&flashItem, flashDev, SPIQ_PRIO_HIGH) != ERR_SUCCESS)
+						flashBusy = false;
+				}
+				usleep(1000);
+				encEngine_timer();
+			}
+			while (flashBusy)
+				usleep(1000);
+			encEngine_stop();
+			while (encEngine_run() || encEngine_getState() != ENC_ENGINE_STOPPED)
+				usleep(1000);
+			GPIO_disableInt(Board_GPIO_INT);
+			encEngine_getStats(&engStats);
+			Display_printf(display, 0, 0, "Engine: %d rx, %d dropped, %d tx, %d tx failed, %d chains, link %s\n",
+					engStats.rxFrames, engStats.rxDropped, engStats.txFrames, engStats.txFailed,
+					engStats.chains, encEngine_linkUp() ? "up" : "down");
+			spiQueue_getArbStats(&arb);
+			Display_printf(display, 0, 0, "Flash ID %02x %02x %02x, worst wait high %d us, normal %d us, bulk %d us, %d chunks, %d resumes\n",
+					flashId[1], flashId[2], flashId[3], arb.cls[SPIQ_PRIO_HIGH].maxWaitUs,
+					arb.cls[SPIQ_PRIO_NORMAL].maxWaitUs, arb.cls[SPIQ_PRIO_BULK].maxWaitUs,
+					arb.chunks, arb.resumes);
+			encRxHistogram_t arrival, release;
+			encRxTime_getHistogram(ENC_RXLAT_ARRIVAL_TO_DELIVERY, &arrival);
+			encRxTime_getHistogram(ENC_RXLAT_DELIVERY_TO_RELEASE, &release);
+			Display_printf(display, 0, 0, "Rx latency of %d frames: INT -> delivery avg %d us max %d us, delivery -> release avg %d us max %d us\n",
+					arrival.samples,
+					arrival.samples ? (uint32_t) (arrival.sumNs / arrival.samples / 1000) : 0, arrival.maxNs / 1000,
+					release.samples ? (uint32_t) (release.sumNs / release.samples / 1000) : 0, release.maxNs / 1000);
+		}
+	}
+
     /* Close the SPI module */
     SPI_close(masterSpi);
 
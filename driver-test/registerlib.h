@@ -27,6 +27,14 @@
 #define ERXRDPTH 0x0d
 #define ERXWRPTL 0x0e
 #define ERXWRPTH 0x0f
+#define EDMASTL  0x10
+#define EDMASTH  0x11
+#define EDMANDL  0x12
+#define EDMANDH  0x13
+#define EDMADSTL 0x14
+#define EDMADSTH 0x15
+#define EDMACSL  0x16
+#define EDMACSH  0x17
 
 #define EIE   0x1b
 #define EIR   0x1c
@@ -36,14 +44,30 @@
 
 #define ESTAT_CLKRDY 0x01
 #define ESTAT_TXABRT 0x02
+#define ESTAT_RXBUSY 0x04
+#define ESTAT_LATECOL 0x10
 
 #define ECON1_RXEN   0x04
 #define ECON1_TXRTS  0x08
+#define ECON1_TXRST  0x80
 
 #define ECON2_AUTOINC 0x80
 #define ECON2_PKTDEC  0x40
+#define ECON2_PWRSV   0x20
+#define ECON2_VRPS    0x08
 
+#define EIE_INTIE     0x80
+#define EIE_PKTIE     0x40
+#define EIE_LINKIE    0x10
+#define EIE_TXIE      0x08
+#define EIE_TXERIE    0x02
+#define EIE_RXERIE    0x01
+
+#define EIR_PKTIF     0x40
+#define EIR_LINKIF    0x10
 #define EIR_TXIF      0x08
+#define EIR_TXERIF    0x02
+#define EIR_RXERIF    0x01
 
 
 
@@ -55,6 +79,26 @@
 /* Bank 1 */
 #define EPKTCNT_BANK 0x01
 
+#define EHT0    0x20   // 0x00 in bank 1
+#define EHT1    0x21
+#define EHT2    0x22
+#define EHT3    0x23
+#define EHT4    0x24
+#define EHT5    0x25
+#define EHT6    0x26
+#define EHT7    0x27
+#define EPMM0   0x28
+#define EPMM1   0x29
+#define EPMM2   0x2a
+#define EPMM3   0x2b
+#define EPMM4   0x2c
+#define EPMM5   0x2d
+#define EPMM6   0x2e
+#define EPMM7   0x2f
+#define EPMCSL  0x30
+#define EPMCSH  0x31
+#define EPMOL   0x34
+#define EPMOH   0x35
 #define ERXFCON 0x38   // 0x18 in bank 1
 #define EPKTCNT 0x39   // 0x19
 
@@ -69,6 +113,8 @@
 #define MABBIPG 0x44    // 0x04
 #define MAIPGL  0x46    // 0x06
 #define MAIPGH  0x47    // 0x07
+#define MACLCON1 0x48   // 0x08
+#define MACLCON2 0x49   // 0x09
 #define MAMXFLL 0x4a    // 0x0a
 #define MAMXFLH 0x4b    // 0x0b
 
@@ -79,6 +125,8 @@
 #define MIRDL    0x58
 #define MIRDH    0x59
 
+#define MICMD_MIIRD   0x01
+
 #define MACON1_TXPAUS 0x08
 #define MACON1_RXPAUS 0x04
 #define MACON1_MARXEN 0x01
@@ -96,20 +144,38 @@
 
 #define MAADR1 0x64 /* MAADR<47:40> */
 #define MAADR2 0x65 /* MAADR<39:32> */
+#define EBSTSD  0x66
+#define EBSTCON 0x67
+#define EBSTCSL 0x68
+#define EBSTCSH 0x69
 #define MAADR3 0x62 /* MAADR<31:24> */
 #define MAADR4 0x63 /* MAADR<23:16> */
 #define MAADR5 0x60 /* MAADR<15:8> */
 #define MAADR6 0x61 /* MAADR<7:0> */
 #define MISTAT 0x6a
 #define EREVID 0x72
+
+#define MISTAT_BUSY   0x01
 #define ECOCON 0x75
+#define EFLOCON 0x77  // 0x17 in bank 3
+#define EPAUSL  0x78
+#define EPAUSH  0x79
 
 #define ERXFCON_UCEN  0x80
 #define ERXFCON_ANDOR 0x40
 #define ERXFCON_CRCEN 0x20
+#define ERXFCON_PMEN  0x10
+#define ERXFCON_MPEN  0x08
+#define ERXFCON_HTEN  0x04
 #define ERXFCON_MCEN  0x02
 #define ERXFCON_BCEN  0x01
 
+#define EFLOCON_FCEN_MASK  0x03
+#define EFLOCON_FC_OFF      0x00
+#define EFLOCON_FC_ONCE     0x01  /* full-duplex: one pause frame, then off. half-duplex: backpressure */
+#define EFLOCON_FC_PERIODIC 0x02  /* full-duplex: pause frames periodically */
+#define EFLOCON_FC_RELEASE  0x03  /* full-duplex: one pause frame with a zero timer, then off */
+
 /* Physical register mappings */
 #define PHCON1  0x00
 #define PHSTAT1 0x01
@@ -121,5 +187,109 @@
 #define PHIR    0x13
 #define PHLCON  0x14
 
+#define PHSTAT2_LSTAT 0x0400
+
+#define PHIE_PLNKIE   0x0010
+#define PHIE_PGEIE    0x0002
+
+
+/* ======== Register descriptors ========
+ * Every control register with its class and access, the bank is the one
+ * encoded in the register name. ENC_READ/ENC_WRITE/ENC_BFS/ENC_BFC in
+ * spimaster.h look the register up here at compile time.
+ */
+#define ENC_REG_ETH   0x00   /* ETH register - 2 byte read, BFS/BFC allowed */
+#define ENC_REG_MAC   0x01   /* MAC/MII register - 3 byte read with dummy byte, no BFS/BFC */
+#define ENC_REG_RW    0x00
+#define ENC_REG_RO    0x02   /* read only */
+#define ENC_REG_CMD   0x04   /* writing starts an operation, left out of register tests */
+#define ENC_REG_LIVE  0x08   /* changed by the chip, never served from the register shadow */
+
+/* X(name, class, access) */
+#define ENC_REGISTERS(X) \
+    X(ERDPTL,   ENC_REG_ETH, ENC_REG_RW | ENC_REG_LIVE) \
+    X(ERDPTH,   ENC_REG_ETH, ENC_REG_RW | ENC_REG_LIVE) \
+    X(EWRPTL,   ENC_REG_ETH, ENC_REG_RW | ENC_REG_LIVE) \
+    X(EWRPTH,   ENC_REG_ETH, ENC_REG_RW | ENC_REG_LIVE) \
+    X(ETXSTL,   ENC_REG_ETH, ENC_REG_RW) \
+    X(ETXSTH,   ENC_REG_ETH, ENC_REG_RW) \
+    X(ETXNDL,   ENC_REG_ETH, ENC_REG_RW) \
+    X(ETXNDH,   ENC_REG_ETH, ENC_REG_RW) \
+    X(ERXSTL,   ENC_REG_ETH, ENC_REG_RW) \
+    X(ERXSTH,   ENC_REG_ETH, ENC_REG_RW) \
+    X(ERXNDL,   ENC_REG_ETH, ENC_REG_RW) \
+    X(ERXNDH,   ENC_REG_ETH, ENC_REG_RW) \
+    X(ERXRDPTL, ENC_REG_ETH, ENC_REG_RW) \
+    X(ERXRDPTH, ENC_REG_ETH, ENC_REG_RW) \
+    X(ERXWRPTL, ENC_REG_ETH, ENC_REG_RO) \
+    X(ERXWRPTH, ENC_REG_ETH, ENC_REG_RO) \
+    X(EDMASTL,  ENC_REG_ETH, ENC_REG_RW) \
+    X(EDMASTH,  ENC_REG_ETH, ENC_REG_RW) \
+    X(EDMANDL,  ENC_REG_ETH, ENC_REG_RW) \
+    X(EDMANDH,  ENC_REG_ETH, ENC_REG_RW) \
+    X(EDMADSTL, ENC_REG_ETH, ENC_REG_RW) \
+    X(EDMADSTH, ENC_REG_ETH, ENC_REG_RW) \
+    X(EDMACSL,  ENC_REG_ETH, ENC_REG_RO) \
+    X(EDMACSH,  ENC_REG_ETH, ENC_REG_RO) \
+    X(EIE,      ENC_REG_ETH, ENC_REG_RW) \
+    X(EIR,      ENC_REG_ETH, ENC_REG_RW | ENC_REG_LIVE) \
+    X(ESTAT,    ENC_REG_ETH, ENC_REG_RW | ENC_REG_LIVE) \
+    X(ECON2,    ENC_REG_ETH, ENC_REG_RW | ENC_REG_LIVE) \
+    X(ECON1,    ENC_REG_ETH, ENC_REG_RW | ENC_REG_LIVE) \
+    X(EHT0,     ENC_REG_ETH, ENC_REG_RW) \
+    X(EHT1,     ENC_REG_ETH, ENC_REG_RW) \
+    X(EHT2,     ENC_REG_ETH, ENC_REG_RW) \
+    X(EHT3,     ENC_REG_ETH, ENC_REG_RW) \
+    X(EHT4,     ENC_REG_ETH, ENC_REG_RW) \
+    X(EHT5,     ENC_REG_ETH, ENC_REG_RW) \
+    X(EHT6,     ENC_REG_ETH, ENC_REG_RW) \
+    X(EHT7,     ENC_REG_ETH, ENC_REG_RW) \
+    X(EPMM0,    ENC_REG_ETH, ENC_REG_RW) \
+    X(EPMM1,    ENC_REG_ETH, ENC_REG_RW) \
+    X(EPMM2,    ENC_REG_ETH, ENC_REG_RW) \
+    X(EPMM3,    ENC_REG_ETH, ENC_REG_RW) \
+    X(EPMM4,    ENC_REG_ETH, ENC_REG_RW) \
+    X(EPMM5,    ENC_REG_ETH, ENC_REG_RW) \
+    X(EPMM6,    ENC_REG_ETH, ENC_REG_RW) \
+    X(EPMM7,    ENC_REG_ETH, ENC_REG_RW) \
+    X(EPMCSL,   ENC_REG_ETH, ENC_REG_RW) \
+    X(EPMCSH,   ENC_REG_ETH, ENC_REG_RW) \
+    X(EPMOL,    ENC_REG_ETH, ENC_REG_RW) \
+    X(EPMOH,    ENC_REG_ETH, ENC_REG_RW) \
+    X(ERXFCON,  ENC_REG_ETH, ENC_REG_RW) \
+    X(EPKTCNT,  ENC_REG_ETH, ENC_REG_RO) \
+    X(MACON1,   ENC_REG_MAC, ENC_REG_RW) \
+    X(MACON3,   ENC_REG_MAC, ENC_REG_RW) \
+    X(MACON4,   ENC_REG_MAC, ENC_REG_RW) \
+    X(MABBIPG,  ENC_REG_MAC, ENC_REG_RW) \
+    X(MAIPGL,   ENC_REG_MAC, ENC_REG_RW) \
+    X(MAIPGH,   ENC_REG_MAC, ENC_REG_RW) \
+    X(MACLCON1, ENC_REG_MAC, ENC_REG_RW) \
+    X(MACLCON2, ENC_REG_MAC, ENC_REG_RW) \
+    X(MAMXFLL,  ENC_REG_MAC, ENC_REG_RW) \
+    X(MAMXFLH,  ENC_REG_MAC, ENC_REG_RW) \
+    X(MICMD,    ENC_REG_MAC, ENC_REG_CMD) \
+    X(MIREGADR, ENC_REG_MAC, ENC_REG_RW) \
+    X(MIWRL,    ENC_REG_MAC, ENC_REG_RW) \
+    X(MIWRH,    ENC_REG_MAC, ENC_REG_CMD) \
+    X(MIRDL,    ENC_REG_MAC, ENC_REG_RO) \
+    X(MIRDH,    ENC_REG_MAC, ENC_REG_RO) \
+    X(MAADR5,   ENC_REG_MAC, ENC_REG_RW) \
+    X(MAADR6,   ENC_REG_MAC, ENC_REG_RW) \
+    X(MAADR3,   ENC_REG_MAC, ENC_REG_RW) \
+    X(MAADR4,   ENC_REG_MAC, ENC_REG_RW) \
+    X(MAADR1,   ENC_REG_MAC, ENC_REG_RW) \
+    X(MAADR2,   ENC_REG_MAC, ENC_REG_RW) \
+    X(EBSTSD,   ENC_REG_ETH, ENC_REG_RW) \
+    X(EBSTCON,  ENC_REG_ETH, ENC_REG_CMD | ENC_REG_LIVE) \
+    X(EBSTCSL,  ENC_REG_ETH, ENC_REG_RO) \
+    X(EBSTCSH,  ENC_REG_ETH, ENC_REG_RO) \
+    X(MISTAT,   ENC_REG_MAC, ENC_REG_RO) \
+    X(EREVID,   ENC_REG_ETH, ENC_REG_RO) \
+    X(ECOCON,   ENC_REG_ETH, ENC_REG_RW) \
+    X(EFLOCON,  ENC_REG_ETH, ENC_REG_RW | ENC_REG_LIVE) \
+    X(EPAUSL,   ENC_REG_ETH, ENC_REG_RW) \
+    X(EPAUSH,   ENC_REG_ETH, ENC_REG_RW)
+
 
 #endif /* REGISTERLIB_H_ */